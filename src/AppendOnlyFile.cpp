@@ -0,0 +1,526 @@
+#include "AppendOnlyFile.hpp"
+#include "Server.hpp"
+#include "Connection.hpp"
+#include "ListObject.hpp"
+#include "HashObject.hpp"
+#include "SortedSet.hpp"
+#include "Stream.hpp"
+#include "Utils.hpp"
+#include "RESPHandler.hpp"
+#include "Log.hpp"
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// Collections are rewritten in commands of at most this many elements, so replaying a
+// huge list does not need one huge request
+const size_t AOF_REWRITE_ITEMS_PER_COMMAND = 64;
+
+AppendFsync parse_append_fsync(const std::string &value, bool &ok)
+{
+    ok = true;
+    if (value == "always")
+        return AppendFsync::ALWAYS;
+    if (value == "everysec")
+        return AppendFsync::EVERYSEC;
+    if (value == "no")
+        return AppendFsync::NO;
+    ok = false;
+    return AppendFsync::EVERYSEC;
+}
+
+void aof_append_command(std::string &out, const std::vector<std::string_view> &args)
+{
+    out += "*" + std::to_string(args.size()) + "\r\n";
+    for (std::string_view arg : args)
+    {
+        out += "$" + std::to_string(arg.size()) + "\r\n";
+        out.append(arg.data(), arg.size());
+        out += "\r\n";
+    }
+}
+
+AppendOnlyFile::AppendOnlyFile(const ServerConfig &config)
+{
+    is_enabled = config.appendonly;
+    path = config.dir + "/" + config.appendfilename;
+    bool ok;
+    fsync_policy = parse_append_fsync(config.appendfsync, ok);
+    last_fsync = std::chrono::steady_clock::now();
+
+    if (is_enabled && fsync_policy == AppendFsync::EVERYSEC)
+        fsync_thread = std::thread(&AppendOnlyFile::fsync_loop, this);
+}
+
+AppendOnlyFile::~AppendOnlyFile()
+{
+    if (fsync_thread.joinable())
+    {
+        {
+            std::lock_guard<std::mutex> lock(fsync_mutex);
+            stopping = true;
+        }
+        fsync_wakeup.notify_one();
+        fsync_thread.join();
+    }
+    if (fd != -1)
+        close(fd);
+}
+
+bool AppendOnlyFile::exists() const
+{
+    return access(path.c_str(), F_OK) == 0;
+}
+
+void AppendOnlyFile::fsync_loop()
+{
+    std::unique_lock<std::mutex> lock(fsync_mutex);
+    while (true)
+    {
+        fsync_wakeup.wait(lock, [this]()
+                          { return fsync_requested || stopping; });
+        if (stopping)
+            return;
+        fsync_requested = false;
+        fsync_running = true;
+        int target = fd;
+
+        // The disk can take its time, the event loop is not waiting on us
+        lock.unlock();
+        fdatasync(target);
+        lock.lock();
+        fsync_running = false;
+        fsync_wakeup.notify_all();
+    }
+}
+
+bool AppendOnlyFile::write_all(int target, const char *data, size_t length)
+{
+    while (length > 0)
+    {
+        ssize_t n = write(target, data, length);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        length -= n;
+    }
+    return true;
+}
+
+//======================  LOADING  ======================
+
+void AppendOnlyFile::load(Server &server)
+{
+    int input = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (input < 0)
+        return;
+
+    // Replay through a connection without a socket: the exact code path clients use,
+    // with the replies thrown away
+    auto started = std::chrono::steady_clock::now();
+    Connection replayer(-1, server);
+    loading = true;
+
+    const size_t READ_SIZE = 64 * 1024;
+    unsigned char chunk[READ_SIZE];
+    size_t total = 0;
+    while (true)
+    {
+        ssize_t n = read(input, chunk, READ_SIZE);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            break;
+        total += n;
+        replayer.incoming_message.insert(replayer.incoming_message.end(), chunk, chunk + n);
+        replayer.replay_requests();
+        if (replayer.want_close)
+        {
+            server_log(LogLevel::WARNING, "Bad file format reading the append only file " + path + " near byte " + std::to_string(total));
+            exit(1);
+        }
+    }
+    close(input);
+    loading = false;
+
+    // A crash in the middle of a write leaves a partial last command, which is dropped
+    if (!replayer.incoming_message.empty())
+    {
+        server_log(LogLevel::WARNING, "Append only file " + path + " ends with a truncated command (" + std::to_string(replayer.incoming_message.size()) + " bytes), ignoring it");
+        if (truncate(path.c_str(), total - replayer.incoming_message.size()) != 0)
+        {
+            server_log(LogLevel::WARNING, "Could not truncate " + path + ": " + std::string(strerror(errno)));
+            exit(1);
+        }
+        replayer.incoming_message.clear();
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+    server_log(LogLevel::NOTICE, "DB loaded from append only file: " + std::to_string(server.kv_store.size()) + " keys in " + std::to_string(elapsed.count()) + " ms");
+}
+
+void AppendOnlyFile::open(KeyValueStore &store)
+{
+    if (!is_enabled)
+        return;
+
+    bool fresh = !exists();
+    fd = ::open(path.c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        server_log(LogLevel::WARNING, "Can't open the append-only file " + path + ": " + std::string(strerror(errno)));
+        exit(1);
+    }
+
+    if (fresh && store.size() > 0)
+    {
+        if (!aof_write_keyspace(store, fd) || fdatasync(fd) != 0)
+        {
+            server_log(LogLevel::WARNING, "Can't write the initial append-only file " + path + ": " + std::string(strerror(errno)));
+            exit(1);
+        }
+    }
+
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) == 0)
+        current_size = base_size = file_stat.st_size;
+}
+
+//======================  APPENDING  ======================
+
+void AppendOnlyFile::feed(std::string_view command)
+{
+    if (!is_enabled || loading)
+        return;
+    buffer.append(command.data(), command.size());
+    commands_buffered++;
+}
+
+void AppendOnlyFile::flush()
+{
+    if (!is_enabled || buffer.empty())
+        return;
+
+    // One write (and for always, one fdatasync) for everything this iteration produced
+    last_write_ok = write_all(fd, buffer.data(), buffer.size());
+    if (!last_write_ok)
+    {
+        // Refusing to acknowledge writes that are not logged is the only safe option
+        server_log(LogLevel::WARNING, "Error writing to the AOF file: " + std::string(strerror(errno)) + ". Exiting.");
+        exit(1);
+    }
+
+    if (fsync_policy == AppendFsync::ALWAYS && fdatasync(fd) != 0)
+    {
+        server_log(LogLevel::WARNING, "Can't persist AOF for fsync error when the AOF fsync policy is 'always': " + std::string(strerror(errno)) + ". Exiting.");
+        exit(1);
+    }
+
+    current_size += buffer.size();
+    group_commits++;
+    commands_written += commands_buffered;
+    commands_buffered = 0;
+
+    if (rewrite_in_progress())
+        rewrite_buffer += buffer;
+    buffer.clear();
+}
+
+void AppendOnlyFile::cron()
+{
+    if (rewrite_in_progress())
+    {
+        int status;
+        if (waitpid(rewrite_pid, &status, WNOHANG) == rewrite_pid)
+            finish_rewrite(status);
+    }
+    if (!is_enabled)
+        return;
+
+    auto now = std::chrono::steady_clock::now();
+    if (fsync_policy == AppendFsync::EVERYSEC && now - last_fsync >= std::chrono::seconds(1))
+    {
+        {
+            std::lock_guard<std::mutex> lock(fsync_mutex);
+            fsync_requested = true;
+        }
+        fsync_wakeup.notify_one();
+        last_fsync = now;
+    }
+}
+
+int AppendOnlyFile::cron_interval_ms() const
+{
+    if (rewrite_in_progress())
+        return 100;
+    if (!is_enabled)
+        return -1;
+    if (fsync_policy == AppendFsync::EVERYSEC)
+        return 1000;
+    return -1;
+}
+
+//======================  REWRITE  ======================
+
+// Buffered writer for the rewrite child
+class CommandWriter
+{
+public:
+    explicit CommandWriter(int fd) : fd(fd) {}
+    bool failed = false;
+
+    void command(const std::vector<std::string_view> &args)
+    {
+        aof_append_command(buffer, args);
+        if (buffer.size() >= 1024 * 1024)
+            flush();
+    }
+
+    void flush()
+    {
+        const char *data = buffer.data();
+        size_t length = buffer.size();
+        while (!failed && length > 0)
+        {
+            ssize_t n = write(fd, data, length);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                failed = true;
+                break;
+            }
+            data += n;
+            length -= n;
+        }
+        buffer.clear();
+    }
+
+private:
+    int fd;
+    std::string buffer;
+};
+
+// Emits 'command key item item ...' in batches of AOF_REWRITE_ITEMS_PER_COMMAND items,
+// where each item is 'per_item' arguments. Items are copied: hash listpacks and sorted
+// sets hand out temporaries that are gone by the time the batch is written.
+class BatchedCommand
+{
+public:
+    BatchedCommand(CommandWriter &writer, std::string_view command, std::string_view key, size_t per_item)
+        : writer(writer), command(command), key(key), per_item(per_item)
+    {
+        items.reserve(AOF_REWRITE_ITEMS_PER_COMMAND * per_item);
+    }
+
+    void add(std::initializer_list<std::string_view> item)
+    {
+        items.insert(items.end(), item.begin(), item.end());
+        if (items.size() == AOF_REWRITE_ITEMS_PER_COMMAND * per_item)
+            emit();
+    }
+
+    void emit()
+    {
+        if (items.empty())
+            return;
+        std::vector<std::string_view> args = {command, key};
+        args.insert(args.end(), items.begin(), items.end());
+        writer.command(args);
+        items.clear();
+    }
+
+private:
+    CommandWriter &writer;
+    std::string_view command;
+    std::string_view key;
+    size_t per_item;
+    std::vector<std::string> items;
+};
+
+bool aof_write_keyspace(KeyValueStore &store, int fd)
+{
+    CommandWriter writer(fd);
+    auto steady_now = std::chrono::steady_clock::now();
+    long long unix_now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                std::chrono::system_clock::now().time_since_epoch())
+                                .count();
+
+    store.for_each([&](const std::string &key, KeyValueStore::ValueEntry &entry)
+                   {
+                       if (KeyValueStore::is_expired(entry))
+                           return;
+
+                       switch (entry.type)
+                       {
+                       case ValueType::STRING:
+                       {
+                           if (entry.expires_at.has_value())
+                           {
+                               long long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(*entry.expires_at - steady_now).count();
+                               std::string at = std::to_string(unix_now_ms + remaining);
+                               writer.command({"SET", key, entry.value, "PXAT", at});
+                           }
+                           else
+                           {
+                               writer.command({"SET", key, entry.value});
+                           }
+                           break;
+                       }
+                       case ValueType::LIST:
+                       {
+                           BatchedCommand push(writer, "RPUSH", key, 1);
+                           for (const std::string &item : static_cast<ListObject &>(*entry.object).items)
+                               push.add({item});
+                           push.emit();
+                           break;
+                       }
+                       case ValueType::HASH:
+                       {
+                           BatchedCommand hset(writer, "HSET", key, 2);
+                           static_cast<HashObject &>(*entry.object).for_each([&](const std::string &field, const std::string &value)
+                                                                             { hset.add({field, value}); });
+                           hset.emit();
+                           break;
+                       }
+                       case ValueType::ZSET:
+                       {
+                           SortedSet &zset = static_cast<SortedSet &>(*entry.object);
+                           if (zset.size() == 0)
+                               break;
+                           BatchedCommand zadd(writer, "ZADD", key, 2);
+                           zset.range_by_rank(0, zset.size() - 1, false, [&](std::string_view member, double score)
+                                              { zadd.add({format_double(score), member}); });
+                           zadd.emit();
+                           break;
+                       }
+                       case ValueType::STREAM:
+                       {
+                           Stream &stream = static_cast<Stream &>(*entry.object);
+                           stream.range(StreamID{0, 0}, StreamID{UINT64_MAX, UINT64_MAX}, -1, false,
+                                        [&](const StreamID &id, const std::vector<std::string_view> &fields)
+                                        {
+                                            std::string id_text = id.to_string();
+                                            std::vector<std::string_view> args = {"XADD", key, id_text};
+                                            args.insert(args.end(), fields.begin(), fields.end());
+                                            writer.command(args);
+                                        });
+                           break;
+                       }
+                       }
+                   });
+
+    writer.flush();
+    return !writer.failed;
+}
+
+std::string AppendOnlyFile::background_rewrite(KeyValueStore &store)
+{
+    if (rewrite_in_progress())
+        return RESPHandler::serialize_error("ERR Background append only file rewriting already in progress");
+
+    // Anything still buffered belongs in the old file before the fork splits the history
+    flush();
+
+    rewrite_temp_path = path + ".temp-rewrite";
+    rewrite_started = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int output = ::open(rewrite_temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        bool ok = output >= 0 && aof_write_keyspace(store, output) && fsync(output) == 0;
+        _exit(ok ? 0 : 1);
+    }
+    if (pid < 0)
+    {
+        last_rewrite_ok = false;
+        return RESPHandler::serialize_error(std::string("ERR Can't rewrite append only file in background: fork: ") + strerror(errno));
+    }
+
+    rewrite_pid = pid;
+    rewrite_buffer.clear();
+    server_log(LogLevel::NOTICE, "Background append only file rewriting started by pid " + std::to_string(pid));
+    return RESPHandler::serialize_simple_string("Background append only file rewriting started");
+}
+
+void AppendOnlyFile::finish_rewrite(int status)
+{
+    rewrite_pid = -1;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+    {
+        last_rewrite_ok = false;
+        unlink(rewrite_temp_path.c_str());
+        rewrite_buffer.clear();
+        server_log(LogLevel::WARNING, "Background AOF rewrite failed");
+        return;
+    }
+
+    // Append what was written while the child worked, then swap the files. Commands
+    // fed but not flushed yet are still in 'buffer' and will go to the new file.
+    int output = ::open(rewrite_temp_path.c_str(), O_WRONLY | O_APPEND | O_CLOEXEC);
+    if (output < 0 || !write_all(output, rewrite_buffer.data(), rewrite_buffer.size()) || fdatasync(output) != 0 ||
+        rename(rewrite_temp_path.c_str(), path.c_str()) != 0)
+    {
+        server_log(LogLevel::WARNING, "Failed installing the rewritten AOF: " + std::string(strerror(errno)));
+        if (output >= 0)
+            close(output);
+        unlink(rewrite_temp_path.c_str());
+        rewrite_buffer.clear();
+        last_rewrite_ok = false;
+        return;
+    }
+
+    if (!is_enabled)
+    {
+        // BGREWRITEAOF with appendonly off only produces the file
+        close(output);
+    }
+    else
+    {
+        // The fsync thread must not be in the middle of syncing the descriptor we close
+        std::unique_lock<std::mutex> lock(fsync_mutex);
+        fsync_wakeup.wait(lock, [this]()
+                          { return !fsync_running; });
+        close(fd);
+        fd = output;
+    }
+
+    struct stat file_stat;
+    if (is_enabled && fstat(fd, &file_stat) == 0)
+        current_size = base_size = file_stat.st_size;
+    rewrite_buffer.clear();
+    rewrite_buffer.shrink_to_fit();
+    rewrites_completed++;
+    last_rewrite_ok = true;
+    last_rewrite_usec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - rewrite_started).count();
+    server_log(LogLevel::NOTICE, "Background AOF rewrite finished successfully (" + std::to_string(current_size) + " bytes, " + std::to_string(last_rewrite_usec / 1000) + " ms)");
+}
+
+std::string AppendOnlyFile::info() const
+{
+    std::string text;
+    text += "aof_enabled:" + std::to_string(is_enabled ? 1 : 0) + "\r\n";
+    text += "aof_rewrite_in_progress:" + std::to_string(rewrite_in_progress() ? 1 : 0) + "\r\n";
+    text += "aof_last_rewrite_time_sec:" + std::to_string(last_rewrite_usec / 1000000) + "\r\n";
+    text += "aof_last_bgrewrite_status:" + std::string(last_rewrite_ok ? "ok" : "err") + "\r\n";
+    text += "aof_last_write_status:" + std::string(last_write_ok ? "ok" : "err") + "\r\n";
+    if (is_enabled)
+    {
+        double per_commit = group_commits > 0 ? (double)commands_written / group_commits : 0;
+        text += "aof_current_size:" + std::to_string(current_size) + "\r\n";
+        text += "aof_base_size:" + std::to_string(base_size) + "\r\n";
+        text += "aof_buffer_length:" + std::to_string(buffer.size()) + "\r\n";
+        text += "aof_rewrite_buffer_length:" + std::to_string(rewrite_buffer.size()) + "\r\n";
+        text += "aof_rewrites:" + std::to_string(rewrites_completed) + "\r\n";
+        text += "aof_group_commits:" + std::to_string(group_commits) + "\r\n";
+        text += "aof_commands_per_group_commit:" + std::to_string(per_commit) + "\r\n";
+    }
+    return text;
+}
@@ -0,0 +1,120 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <sys/types.h>
+#include "Config.hpp"
+#include "Memory.hpp"
+#include "KeyValueStore.hpp"
+
+class Server;
+
+enum class AppendFsync
+{
+    ALWAYS,   // fdatasync before any reply to a write is released
+    EVERYSEC, // fdatasync once a second on a background thread
+    NO,       // Leave flushing to the kernel
+};
+
+// The append only file: every executed write command, in RESP, in execution order.
+//
+// Commands are not written one by one. They collect in a buffer during an event loop
+// iteration and go out with a single write() before the loop sleeps again. With
+// appendfsync always that write is followed by one fdatasync, and replies stay queued
+// until it returns (group commit): many clients' writes share one disk flush, and no
+// client hears OK for a write that is not yet durable.
+class AppendOnlyFile
+{
+public:
+    explicit AppendOnlyFile(const ServerConfig &config);
+    ~AppendOnlyFile();
+
+    bool enabled() const { return is_enabled; }
+    bool exists() const;
+
+    // Set while replaying the log at startup, so replayed commands are not logged again
+    bool loading = false;
+
+    // Replays the log into the server's keyspace. Exits on a corrupt file.
+    void load(Server &server);
+
+    // Opens the log for appending. If there is no log yet it is created from the current
+    // keyspace, so data loaded from a snapshot is not lost on the next restart.
+    void open(KeyValueStore &store);
+
+    // Queues one command (already RESP encoded) executed in this iteration
+    void feed(std::string_view command);
+
+    // True while replies must not be sent: appendfsync always and the commands they
+    // acknowledge are not on disk yet
+    bool holding_replies() const { return is_enabled && fsync_policy == AppendFsync::ALWAYS && !buffer.empty(); }
+
+    // Called before the event loop sleeps: writes the iteration's commands (and syncs them
+    // for appendfsync always)
+    void flush();
+
+    // Called every event loop iteration: schedules the everysec fsync and reaps a
+    // finished rewrite
+    void cron();
+    int cron_interval_ms() const;
+
+    // BGREWRITEAOF: a forked child writes the smallest command sequence that recreates
+    // the keyspace, and the writes made meanwhile are appended to it when it finishes
+    std::string background_rewrite(KeyValueStore &store);
+    bool rewrite_in_progress() const { return rewrite_pid != -1; }
+
+    // aof_* lines for the "# Persistence" section of INFO
+    std::string info() const;
+
+    // Bytes held by the write and rewrite buffers
+    size_t buffer_memory() const { return string_heap_size(buffer) + string_heap_size(rewrite_buffer); }
+
+private:
+    bool is_enabled;
+    std::string path;
+    AppendFsync fsync_policy;
+    int fd = -1;
+    std::string buffer;
+    off_t current_size = 0;
+
+    // everysec: a background thread does the fdatasync so the event loop never waits on the disk
+    std::thread fsync_thread;
+    std::mutex fsync_mutex;
+    std::condition_variable fsync_wakeup;
+    bool fsync_requested = false;
+    bool fsync_running = false;
+    bool stopping = false;
+    std::chrono::steady_clock::time_point last_fsync;
+
+    // Rewrite in progress: commands flushed since the fork, appended to the new file at the end
+    pid_t rewrite_pid = -1;
+    std::string rewrite_temp_path;
+    std::string rewrite_buffer;
+    std::chrono::steady_clock::time_point rewrite_started;
+
+    // Stats
+    long long group_commits = 0;
+    long long commands_written = 0;
+    long long commands_buffered = 0; // In the current iteration
+    long long rewrites_completed = 0;
+    long long last_rewrite_usec = 0;
+    off_t base_size = 0; // Size right after the last rewrite
+    bool last_write_ok = true;
+    bool last_rewrite_ok = true;
+
+    void fsync_loop();
+    bool write_all(int target, const char *data, size_t length);
+    void finish_rewrite(int status);
+};
+
+// Writes commands that recreate every key in store to fd. Returns false on a write error.
+bool aof_write_keyspace(KeyValueStore &store, int fd);
+
+// Appends the RESP encoding of a command to out
+void aof_append_command(std::string &out, const std::vector<std::string_view> &args);
+
+AppendFsync parse_append_fsync(const std::string &value, bool &ok);
@@ -0,0 +1,194 @@
+#include "Bitops.hpp"
+#include <cstdint>
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+//======================  SCALAR FALLBACK  ======================
+
+static size_t popcount_scalar(const unsigned char *data, size_t length)
+{
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        count += __builtin_popcountll(word);
+    }
+    for (; i < length; i++)
+    {
+        count += __builtin_popcount(data[i]);
+    }
+    return count;
+}
+
+static void apply_scalar(BitOperation operation, unsigned char *dest, const unsigned char *source, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+    {
+        switch (operation)
+        {
+        case BitOperation::AND:
+            dest[i] &= source[i];
+            break;
+        case BitOperation::OR:
+            dest[i] |= source[i];
+            break;
+        case BitOperation::XOR:
+            dest[i] ^= source[i];
+            break;
+        case BitOperation::NOT:
+            dest[i] = ~source[i];
+            break;
+        }
+    }
+}
+
+size_t bitops_skip_bytes(const unsigned char *data, size_t length, unsigned char skip)
+{
+    // Compare a word at a time, then find the differing byte
+    uint64_t pattern = 0x0101010101010101ULL * skip;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        if (word != pattern)
+            break;
+    }
+    while (i < length && data[i] == skip)
+        i++;
+    return i;
+}
+
+#if defined(__x86_64__)
+
+//======================  X86-64 KERNELS  ======================
+
+// Same loop as the scalar version, but here __builtin_popcountll is a single instruction
+__attribute__((target("popcnt"))) static size_t popcount_popcnt(const unsigned char *data, size_t length)
+{
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, data + i, sizeof(word));
+        count += __builtin_popcountll(word);
+    }
+    for (; i < length; i++)
+    {
+        count += __builtin_popcount(data[i]);
+    }
+    return count;
+}
+
+// Per-nibble lookup popcount (Mula et al.): split every byte into two nibbles, look up
+// their bit counts with a byte shuffle and accumulate byte-wise counters, which are
+// folded into 64-bit lanes with SAD before they can overflow.
+__attribute__((target("avx2,popcnt"))) static size_t popcount_avx2(const unsigned char *data, size_t length)
+{
+    const __m256i lookup = _mm256_setr_epi8(
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0F);
+    const __m256i zero = _mm256_setzero_si256();
+
+    __m256i total = zero;
+    size_t i = 0;
+    while (i + 32 <= length)
+    {
+        // Each round adds at most 8 per byte, so 31 rounds fit in a byte
+        __m256i counters = zero;
+        for (int round = 0; round < 31 && i + 32 <= length; round++, i += 32)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(data + i));
+            __m256i low = _mm256_and_si256(v, low_mask);
+            __m256i high = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+            counters = _mm256_add_epi8(counters, _mm256_shuffle_epi8(lookup, low));
+            counters = _mm256_add_epi8(counters, _mm256_shuffle_epi8(lookup, high));
+        }
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(counters, zero));
+    }
+
+    size_t count = (size_t)_mm256_extract_epi64(total, 0) + (size_t)_mm256_extract_epi64(total, 1) +
+                   (size_t)_mm256_extract_epi64(total, 2) + (size_t)_mm256_extract_epi64(total, 3);
+    return count + popcount_popcnt(data + i, length - i);
+}
+
+__attribute__((target("avx2"))) static void apply_avx2(BitOperation operation, unsigned char *dest, const unsigned char *source, size_t length)
+{
+    const __m256i ones = _mm256_set1_epi8((char)0xFF);
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(dest + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(source + i));
+        __m256i result;
+        switch (operation)
+        {
+        case BitOperation::AND:
+            result = _mm256_and_si256(a, b);
+            break;
+        case BitOperation::OR:
+            result = _mm256_or_si256(a, b);
+            break;
+        case BitOperation::XOR:
+            result = _mm256_xor_si256(a, b);
+            break;
+        default:
+            result = _mm256_xor_si256(b, ones);
+            break;
+        }
+        _mm256_storeu_si256((__m256i *)(dest + i), result);
+    }
+    apply_scalar(operation, dest + i, source + i, length - i);
+}
+
+typedef size_t (*PopcountKernel)(const unsigned char *, size_t);
+typedef void (*ApplyKernel)(BitOperation, unsigned char *, const unsigned char *, size_t);
+
+static PopcountKernel select_popcount()
+{
+    if (__builtin_cpu_supports("avx2"))
+        return popcount_avx2;
+    if (__builtin_cpu_supports("popcnt"))
+        return popcount_popcnt;
+    return popcount_scalar;
+}
+
+static ApplyKernel select_apply()
+{
+    if (__builtin_cpu_supports("avx2"))
+        return apply_avx2;
+    return apply_scalar;
+}
+
+size_t bitops_popcount(const unsigned char *data, size_t length)
+{
+    static const PopcountKernel kernel = select_popcount();
+    return kernel(data, length);
+}
+
+void bitops_apply(BitOperation operation, unsigned char *dest, const unsigned char *source, size_t length)
+{
+    static const ApplyKernel kernel = select_apply();
+    kernel(operation, dest, source, length);
+}
+
+#else
+
+size_t bitops_popcount(const unsigned char *data, size_t length)
+{
+    return popcount_scalar(data, length);
+}
+
+void bitops_apply(BitOperation operation, unsigned char *dest, const unsigned char *source, size_t length)
+{
+    apply_scalar(operation, dest, source, length);
+}
+
+#endif
@@ -0,0 +1,24 @@
+#pragma once
+#include <cstddef>
+
+// Bit-level kernels behind BITCOUNT, BITOP and BITPOS. On x86-64 the AVX2 (or POPCNT)
+// versions are picked at runtime based on what the CPU supports, with a portable
+// scalar fallback everywhere else.
+
+enum class BitOperation
+{
+    AND,
+    OR,
+    XOR,
+    NOT,
+};
+
+// Number of set bits in data[0, length)
+size_t bitops_popcount(const unsigned char *data, size_t length);
+
+// dest[i] = dest[i] op source[i] for i < length (NOT ignores dest: dest[i] = ~source[i])
+void bitops_apply(BitOperation operation, unsigned char *dest, const unsigned char *source, size_t length);
+
+// Index of the first byte in data[0, length) that is not equal to skip, or length if
+// there is none. BITPOS uses it to jump over all-zero or all-one runs.
+size_t bitops_skip_bytes(const unsigned char *data, size_t length, unsigned char skip);
@@ -0,0 +1,126 @@
+#include "BlockingManager.hpp"
+#include "Connection.hpp"
+#include "ListObject.hpp"
+#include "RESPHandler.hpp"
+#include "Server.hpp"
+#include <algorithm>
+
+void BlockingManager::block(Connection *client, const std::vector<std::string> &keys, bool pop_left, std::optional<TimePoint> deadline)
+{
+    BlockedState &state = client->blocked_state;
+    state.pop_left = pop_left;
+
+    for (const std::string &key : keys)
+    {
+        // BLPOP a a b only waits once on a
+        bool duplicate = std::any_of(state.keys.begin(), state.keys.end(),
+                                     [&key](const auto &entry)
+                                     { return entry.first == key; });
+        if (duplicate)
+            continue;
+
+        WaiterQueue &queue = waiters[key];
+        queue.push_back(client);
+        state.keys.emplace_back(key, std::prev(queue.end()));
+    }
+
+    if (deadline.has_value())
+    {
+        state.timer = timeouts.emplace(*deadline, client);
+    }
+
+    // Park the connection: it is not polled for reads until it is served or times out
+    client->blocked = true;
+    client->want_read = false;
+}
+
+void BlockingManager::unblock(Connection *client)
+{
+    BlockedState &state = client->blocked_state;
+
+    for (auto &[key, position] : state.keys)
+    {
+        auto it = waiters.find(key);
+        it->second.erase(position);
+        if (it->second.empty())
+            waiters.erase(it);
+    }
+
+    if (state.timer.has_value())
+        timeouts.erase(*state.timer);
+
+    state = BlockedState{};
+    client->blocked = false;
+}
+
+void BlockingManager::signal_key_ready(const std::string &key)
+{
+    if (waiters.count(key) > 0)
+        ready_keys.push_back(key);
+}
+
+void BlockingManager::serve_ready_keys(KeyValueStore &store)
+{
+    while (!ready_keys.empty())
+    {
+        std::vector<std::string> keys;
+        keys.swap(ready_keys);
+
+        for (const std::string &key : keys)
+        {
+            while (true)
+            {
+                // Look the queue up again every round, unblock() drops it once it is empty
+                auto it = waiters.find(key);
+                if (it == waiters.end())
+                    break;
+
+                KeyValueStore::ValueEntry *entry = store.find(key);
+                if (entry == nullptr || entry->type != ValueType::LIST)
+                    break;
+                ListObject *list = static_cast<ListObject *>(entry->object.get());
+
+                Connection *client = it->second.front();
+                bool pop_left = client->blocked_state.pop_left;
+                std::string value;
+                if (pop_left)
+                {
+                    value = std::move(list->items.front());
+                    list->items.pop_front();
+                }
+                else
+                {
+                    value = std::move(list->items.back());
+                    list->items.pop_back();
+                }
+
+                // Empty lists are not kept around
+                if (list->items.empty())
+                    store.erase(key);
+
+                unblock(client);
+                client->send_reply(RESPHandler::serialize_array({key, value}));
+
+                // The AOF gets the pop that actually happened, not the BLPOP that waited
+                client->server.propagate({pop_left ? "LPOP" : "RPOP", key});
+            }
+        }
+    }
+}
+
+void BlockingManager::expire_timeouts(TimePoint now)
+{
+    while (!timeouts.empty() && timeouts.begin()->first <= now)
+    {
+        Connection *client = timeouts.begin()->second;
+        unblock(client);
+        client->send_reply(RESPHandler::serialize_null_array());
+    }
+}
+
+std::optional<BlockingManager::TimePoint> BlockingManager::next_deadline() const
+{
+    if (timeouts.empty())
+        return std::nullopt;
+    return timeouts.begin()->first;
+}
@@ -0,0 +1,51 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include <optional>
+#include <chrono>
+#include <unordered_map>
+#include "KeyValueStore.hpp"
+
+class Connection;
+
+// Tracks clients parked in BLPOP/BRPOP. Each key has a FIFO queue of waiting clients,
+// and clients with a timeout are also kept in a deadline ordered timer map that the
+// event loop uses to size its poll timeout.
+class BlockingManager
+{
+public:
+    typedef std::chrono::steady_clock::time_point TimePoint;
+    typedef std::list<Connection *> WaiterQueue;
+
+    // Per-connection bookkeeping, stored inside the Connection while it is blocked
+    struct BlockedState
+    {
+        bool pop_left = true;
+        std::vector<std::pair<std::string, WaiterQueue::iterator>> keys;
+        std::optional<std::multimap<TimePoint, Connection *>::iterator> timer;
+    };
+
+    // Parks client on keys until one of them receives an element or the deadline passes
+    void block(Connection *client, const std::vector<std::string> &keys, bool pop_left, std::optional<TimePoint> deadline);
+
+    // Removes client from every waiter queue and the timer map (no reply is sent)
+    void unblock(Connection *client);
+
+    // Called by list pushes. Cheap when nobody is waiting on key.
+    void signal_key_ready(const std::string &key);
+
+    // Hands elements of the keys signalled since the last call to their waiters, in FIFO order
+    void serve_ready_keys(KeyValueStore &store);
+
+    // Replies with a null array to every client whose deadline is at or before now
+    void expire_timeouts(TimePoint now);
+
+    std::optional<TimePoint> next_deadline() const;
+
+private:
+    std::unordered_map<std::string, WaiterQueue> waiters;
+    std::multimap<TimePoint, Connection *> timeouts;
+    std::vector<std::string> ready_keys;
+};
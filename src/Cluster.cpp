@@ -0,0 +1,806 @@
+#include "Cluster.hpp"
+#include "Server.hpp"
+#include "Connection.hpp"
+#include "CommandDispatcher.hpp"
+#include "RESPHandler.hpp"
+#include "Utils.hpp"
+#include "Log.hpp"
+#include <fstream>
+#include <sstream>
+#include <array>
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+//======================  HASH SLOTS  ======================
+
+static constexpr std::array<uint16_t, 256> make_crc16_table()
+{
+    std::array<uint16_t, 256> table{};
+    for (int i = 0; i < 256; i++)
+    {
+        uint16_t crc = (uint16_t)(i << 8);
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+        table[i] = crc;
+    }
+    return table;
+}
+
+static constexpr std::array<uint16_t, 256> CRC16_TABLE = make_crc16_table();
+
+uint16_t crc16(const char *data, size_t length)
+{
+    uint16_t crc = 0;
+    for (size_t i = 0; i < length; i++)
+        crc = (uint16_t)((crc << 8) ^ CRC16_TABLE[((crc >> 8) ^ (uint8_t)data[i]) & 0xFF]);
+    return crc;
+}
+
+int key_hash_slot(std::string_view key)
+{
+    size_t open = key.find('{');
+    if (open != std::string_view::npos)
+    {
+        size_t close = key.find('}', open + 1);
+        if (close != std::string_view::npos && close != open + 1)
+            key = key.substr(open + 1, close - open - 1);
+    }
+    return crc16(key.data(), key.size()) & (CLUSTER_SLOTS - 1);
+}
+
+std::vector<std::string> keys_in_slot(KeyValueStore &store, int slot, long long limit)
+{
+    // A walk over the keyspace with SCAN cursors, so it can stop as soon as it has enough
+    std::vector<std::string> keys;
+    unsigned long cursor = 0;
+    do
+    {
+        cursor = store.scan(cursor, [&](const std::string &key, KeyValueStore::ValueEntry &entry)
+                            {
+                                if (limit >= 0 && (long long)keys.size() >= limit)
+                                    return;
+                                if (!KeyValueStore::is_expired(entry) && key_hash_slot(key) == slot)
+                                    keys.push_back(key);
+                            });
+    } while (cursor != 0 && (limit < 0 || (long long)keys.size() < limit));
+    return keys;
+}
+
+static bool parse_slot(const std::string &text, int &slot)
+{
+    long long value = 0;
+    if (!parse_integer(text, value) || value < 0 || value >= CLUSTER_SLOTS)
+        return false;
+    slot = (int)value;
+    return true;
+}
+
+// Parses "0-5460,5462" (or "-" for none) into slot numbers
+static bool parse_slot_ranges(const std::string &text, std::vector<int> &out)
+{
+    if (text == "-")
+        return true;
+    std::istringstream ranges(text);
+    std::string range;
+    while (std::getline(ranges, range, ','))
+    {
+        size_t dash = range.find('-');
+        int first = 0, last = 0;
+        if (dash == std::string::npos)
+        {
+            if (!parse_slot(range, first))
+                return false;
+            last = first;
+        }
+        else if (!parse_slot(range.substr(0, dash), first) || !parse_slot(range.substr(dash + 1), last) || first > last)
+        {
+            return false;
+        }
+        for (int slot = first; slot <= last; slot++)
+            out.push_back(slot);
+    }
+    return true;
+}
+
+//======================  CLUSTER STATE  ======================
+
+Cluster::Cluster(const ServerConfig &config)
+{
+    is_enabled = config.cluster_enabled;
+    announce_ip = config.cluster_announce_ip;
+    node_timeout = std::chrono::milliseconds(config.cluster_node_timeout);
+    slots.assign(CLUSTER_SLOTS, nullptr);
+    if (!is_enabled)
+        return;
+
+    config_path = config.dir + "/" + config.cluster_config_file;
+    if (load_config())
+    {
+        server_log(LogLevel::NOTICE, "Node configuration loaded, I'm " + myself->id);
+    }
+    else
+    {
+        nodes.push_back(std::make_unique<Node>());
+        myself = nodes.back().get();
+        myself->id = random_hex_id();
+        config_dirty = true;
+        server_log(LogLevel::NOTICE, "No cluster configuration found, I'm " + myself->id);
+    }
+
+    // The address may have changed since the configuration was written
+    myself->ip = announce_ip;
+    myself->port = config.port;
+}
+
+Cluster::Node *Cluster::find_node(const std::string &id) const
+{
+    for (const auto &node : nodes)
+    {
+        if (!node->id.empty() && node->id == id)
+            return node.get();
+    }
+    return nullptr;
+}
+
+bool Cluster::node_failing(const Node *node) const
+{
+    if (node == myself)
+        return false;
+    return node->last_seen == std::chrono::steady_clock::time_point{} ||
+           std::chrono::steady_clock::now() - node->last_seen > node_timeout;
+}
+
+bool Cluster::all_slots_served() const
+{
+    return std::none_of(slots.begin(), slots.end(), [](Node *owner)
+                        { return owner == nullptr; });
+}
+
+std::string Cluster::redirect(const std::vector<std::string> &args, Connection &client, KeyValueStore &store)
+{
+    std::vector<size_t> keys = CommandDispatcher::command_keys(args);
+    if (keys.empty())
+        return "";
+
+    int slot = -1;
+    for (size_t index : keys)
+    {
+        int key_slot = key_hash_slot(args[index]);
+        if (slot != -1 && key_slot != slot)
+            return RESPHandler::serialize_error("CROSSSLOT Keys in request don't hash to the same slot");
+        slot = key_slot;
+    }
+
+    // A client sent here with -ASK may use a slot we are still importing
+    bool asking = client.asking || args[0] == "RESTORE-ASKING";
+    if (asking && importing.count(slot))
+        return "";
+
+    Node *owner = slots[slot];
+    if (owner == nullptr)
+        return RESPHandler::serialize_error("CLUSTERDOWN Hash slot not served");
+    if (owner != myself)
+        return RESPHandler::serialize_error("MOVED " + std::to_string(slot) + " " + owner->ip + ":" + std::to_string(owner->port));
+
+    // While the slot moves out, keys that are still here are served here and the rest
+    // are already (or about to be) on the target
+    auto moving = migrating.find(slot);
+    if (moving != migrating.end())
+    {
+        size_t missing = std::count_if(keys.begin(), keys.end(), [&](size_t index)
+                                       { return store.find(args[index]) == nullptr; });
+        if (missing == keys.size())
+            return RESPHandler::serialize_error("ASK " + std::to_string(slot) + " " + moving->second->ip + ":" + std::to_string(moving->second->port));
+        if (missing > 0)
+            return RESPHandler::serialize_error("TRYAGAIN Multiple keys request during rehashing of slot");
+    }
+    return "";
+}
+
+void Cluster::remove_client(Connection *client)
+{
+    for (const auto &node : nodes)
+    {
+        if (node->link == client)
+            node->link = nullptr;
+    }
+}
+
+std::string Cluster::slot_ranges(const Node *node, char separator) const
+{
+    std::string text;
+    int slot = 0;
+    while (slot < CLUSTER_SLOTS)
+    {
+        if (slots[slot] != node)
+        {
+            slot++;
+            continue;
+        }
+        int first = slot;
+        while (slot < CLUSTER_SLOTS && slots[slot] == node)
+            slot++;
+        if (!text.empty())
+            text += separator;
+        text += std::to_string(first);
+        if (slot - 1 > first)
+            text += "-" + std::to_string(slot - 1);
+    }
+    return text;
+}
+
+//======================  GOSSIP  ======================
+
+std::string Cluster::gossip_message() const
+{
+    std::string ranges = slot_ranges(myself, ',');
+    std::vector<std::string> message = {"CLUSTER", "GOSSIP", myself->id, std::to_string(myself->port),
+                                        std::to_string(myself->config_epoch), ranges.empty() ? "-" : ranges};
+    for (const auto &node : nodes)
+    {
+        if (node.get() == myself || node->id.empty())
+            continue;
+        message.push_back(node->id);
+        message.push_back(node->ip);
+        message.push_back(std::to_string(node->port));
+    }
+    return RESPHandler::serialize_array(message);
+}
+
+std::string Cluster::handle_gossip(const std::vector<std::string> &args, Connection &client)
+{
+    // CLUSTER GOSSIP <id> <port> <epoch> <slots> [<id> <ip> <port> ...]. Never answered:
+    // the sender does not read its gossip links.
+    long long port = 0, epoch = 0;
+    std::vector<int> claimed;
+    if (args.size() < 6 || (args.size() - 6) % 3 != 0 || args[2].size() != 40 || !parse_integer(args[3], port) ||
+        !parse_integer(args[4], epoch) || epoch < 0 || !parse_slot_ranges(args[5], claimed))
+        return "";
+    if (args[2] == myself->id)
+        return "";
+
+    // The sender's address is the one its connection comes from
+    struct sockaddr_in address = {};
+    socklen_t length = sizeof(address);
+    if (getpeername(client.fd, (struct sockaddr *)&address, &length) != 0)
+        return "";
+    std::string ip = inet_ntoa(address.sin_addr);
+
+    Node *sender = find_node(args[2]);
+    if (sender == nullptr)
+    {
+        // Either a node we sent MEET to, answering for the first time, or a new one
+        for (const auto &node : nodes)
+        {
+            if (node->id.empty() && node->ip == ip && node->port == port)
+                sender = node.get();
+        }
+        if (sender == nullptr)
+        {
+            nodes.push_back(std::make_unique<Node>());
+            sender = nodes.back().get();
+        }
+        sender->id = args[2];
+        server_log(LogLevel::NOTICE, "Cluster node " + sender->id + " at " + ip + ":" + std::to_string(port) + " joined");
+        config_dirty = true;
+    }
+    if (sender->ip != ip || sender->port != port)
+    {
+        sender->ip = ip;
+        sender->port = (int)port;
+        config_dirty = true;
+    }
+    sender->last_seen = std::chrono::steady_clock::now();
+    if ((uint64_t)epoch != sender->config_epoch)
+    {
+        sender->config_epoch = epoch;
+        config_dirty = true;
+    }
+    current_epoch = std::max(current_epoch, (uint64_t)epoch);
+
+    // Slot claims: the higher config epoch wins, ties go to the smaller node ID
+    for (int slot : claimed)
+    {
+        Node *owner = slots[slot];
+        if (owner == sender || importing.count(slot))
+            continue;
+        bool wins = owner == nullptr || (uint64_t)epoch > owner->config_epoch ||
+                    ((uint64_t)epoch == owner->config_epoch && sender->id < owner->id);
+        if (!wins)
+            continue;
+        if (owner == myself)
+        {
+            server_log(LogLevel::VERBOSE, "Slot " + std::to_string(slot) + " is now served by " + sender->id);
+            migrating.erase(slot);
+        }
+        slots[slot] = sender;
+        config_dirty = true;
+    }
+
+    // Nodes the sender knows about and we don't
+    for (size_t i = 6; i + 2 < args.size(); i += 3)
+    {
+        long long node_port = 0;
+        if (args[i].size() != 40 || args[i] == myself->id || find_node(args[i]) || !parse_integer(args[i + 2], node_port))
+            continue;
+        nodes.push_back(std::make_unique<Node>());
+        nodes.back()->id = args[i];
+        nodes.back()->ip = args[i + 1];
+        nodes.back()->port = (int)node_port;
+        config_dirty = true;
+    }
+    return "";
+}
+
+void Cluster::connect_link(Server &server, Node &node)
+{
+    node.last_link_attempt = std::chrono::steady_clock::now();
+
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(node.port);
+    if (inet_pton(AF_INET, node.ip.c_str(), &address.sin_addr) != 1)
+        return;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+        return;
+    if (set_fd_nonblocking(fd) != 0 ||
+        (connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0 && errno != EINPROGRESS))
+    {
+        close(fd);
+        return;
+    }
+
+    // The link is an ordinary connection: gossip is queued on it like a reply, and a
+    // failed connect shows up as an error in the event loop, which closes it
+    node.link = server.add_connection(fd);
+}
+
+void Cluster::cron(Server &server)
+{
+    if (!is_enabled)
+        return;
+    auto now = std::chrono::steady_clock::now();
+
+    // MEET targets that never answered are given up on
+    for (auto it = nodes.begin(); it != nodes.end();)
+    {
+        Node *node = it->get();
+        if (node->id.empty() && now - node->last_seen > node_timeout)
+        {
+            server_log(LogLevel::NOTICE, "Cluster MEET " + node->ip + ":" + std::to_string(node->port) + " got no answer, giving up");
+            if (node->link)
+                node->link->schedule_close();
+            it = nodes.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    if (now - last_gossip >= std::chrono::seconds(1))
+    {
+        last_gossip = now;
+        auto message = std::make_shared<const std::string>(gossip_message());
+        for (const auto &node : nodes)
+        {
+            if (node.get() == myself)
+                continue;
+            if (node->link == nullptr && now - node->last_link_attempt >= std::chrono::seconds(1))
+                connect_link(server, *node);
+            // A link that has not even flushed the last message gets no new one
+            if (node->link != nullptr && !node->link->want_write)
+                node->link->enqueue_shared(message);
+        }
+    }
+
+    if (config_dirty)
+        save_config();
+}
+
+int Cluster::cron_interval_ms() const
+{
+    return is_enabled ? 100 : -1;
+}
+
+//======================  CONFIGURATION FILE  ======================
+
+std::string Cluster::nodes_text() const
+{
+    auto steady_now = std::chrono::steady_clock::now();
+    long long unix_now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+
+    std::string text;
+    for (const auto &node : nodes)
+    {
+        if (node->id.empty())
+            continue;
+        std::string flags = node.get() == myself ? "myself,master" : "master";
+        if (node_failing(node.get()))
+            flags += ",fail?";
+        long long pong = 0;
+        if (node.get() != myself && node->last_seen != std::chrono::steady_clock::time_point{})
+            pong = unix_now - std::chrono::duration_cast<std::chrono::milliseconds>(steady_now - node->last_seen).count();
+        bool connected = node.get() == myself || (node->link != nullptr && !node_failing(node.get()));
+
+        // The gossip runs over the client port, so that is the bus port too
+        text += node->id + " " + node->ip + ":" + std::to_string(node->port) + "@" + std::to_string(node->port) + " " + flags +
+                " - 0 " + std::to_string(pong) + " " + std::to_string(node->config_epoch) + " " + (connected ? "connected" : "disconnected");
+        std::string ranges = slot_ranges(node.get(), ' ');
+        if (!ranges.empty())
+            text += " " + ranges;
+        if (node.get() == myself)
+        {
+            for (const auto &[slot, target] : migrating)
+                text += " [" + std::to_string(slot) + "->-" + target->id + "]";
+            for (const auto &[slot, source] : importing)
+                text += " [" + std::to_string(slot) + "-<-" + source->id + "]";
+        }
+        text += "\n";
+    }
+    return text;
+}
+
+bool Cluster::load_config()
+{
+    std::ifstream file(config_path);
+    if (!file)
+        return false;
+
+    auto corrupt = [&](const std::string &line)
+    {
+        server_log(LogLevel::WARNING, "Unrecoverable error: corrupted cluster config file \"" + line + "\"");
+        exit(1);
+    };
+
+    // Migration markers name other nodes, so they are resolved after every node is read
+    std::vector<std::string> markers;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        std::istringstream words(line);
+        std::vector<std::string> fields;
+        std::string word;
+        while (words >> word)
+            fields.push_back(word);
+        if (fields.empty())
+            continue;
+
+        if (fields[0] == "vars")
+        {
+            for (size_t i = 1; i + 1 < fields.size(); i += 2)
+            {
+                long long value = 0;
+                if (fields[i] == "currentEpoch" && parse_integer(fields[i + 1], value))
+                    current_epoch = value;
+            }
+            continue;
+        }
+
+        // <id> <ip:port@cport> <flags> <master> <ping-sent> <pong-recv> <config-epoch> <link-state> <slot> ...
+        size_t colon = fields.size() >= 8 ? fields[1].rfind(':') : std::string::npos;
+        long long port = 0, epoch = 0;
+        if (colon == std::string::npos || fields[0].size() != 40 ||
+            !parse_integer(fields[1].substr(colon + 1, fields[1].find('@') - colon - 1), port) || !parse_integer(fields[6], epoch))
+            corrupt(line);
+
+        nodes.push_back(std::make_unique<Node>());
+        Node *node = nodes.back().get();
+        node->id = fields[0];
+        node->ip = fields[1].substr(0, colon);
+        node->port = (int)port;
+        node->config_epoch = epoch;
+        if (fields[2].find("myself") != std::string::npos)
+            myself = node;
+
+        for (size_t i = 8; i < fields.size(); i++)
+        {
+            if (fields[i][0] == '[')
+            {
+                markers.push_back(fields[i]);
+                continue;
+            }
+            std::vector<int> owned;
+            if (!parse_slot_ranges(fields[i], owned))
+                corrupt(line);
+            for (int slot : owned)
+                slots[slot] = node;
+        }
+    }
+    if (myself == nullptr)
+        corrupt("no myself node");
+
+    // [slot->-id] migrating to id, [slot-<-id] importing from id
+    for (const std::string &marker : markers)
+    {
+        size_t arrow = marker.find("->-");
+        bool out = arrow != std::string::npos;
+        if (!out)
+            arrow = marker.find("-<-");
+        int slot = 0;
+        Node *peer = arrow == std::string::npos ? nullptr : find_node(marker.substr(arrow + 3, marker.size() - arrow - 4));
+        if (peer == nullptr || !parse_slot(marker.substr(1, arrow - 1), slot))
+            corrupt(marker);
+        (out ? migrating : importing)[slot] = peer;
+    }
+    return true;
+}
+
+void Cluster::save_config()
+{
+    // Same as the snapshots: a complete temporary file renamed over the old one
+    std::string text = nodes_text() + "vars currentEpoch " + std::to_string(current_epoch) + " lastVoteEpoch 0\n";
+    std::string temp_path = config_path + ".temp-" + std::to_string(getpid());
+    int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    bool ok = fd >= 0 && write(fd, text.data(), text.size()) == (ssize_t)text.size() && fsync(fd) == 0;
+    if (fd >= 0)
+        close(fd);
+    if (!ok || rename(temp_path.c_str(), config_path.c_str()) != 0)
+    {
+        server_log(LogLevel::WARNING, "Could not save the cluster configuration to " + config_path + ": " + std::string(strerror(errno)));
+        unlink(temp_path.c_str());
+        return;
+    }
+    config_dirty = false;
+}
+
+//======================  CLUSTER COMMAND  ======================
+
+std::string Cluster::handle_command(const std::vector<std::string> &args, Connection &client, KeyValueStore &store)
+{
+    if (!is_enabled)
+        return RESPHandler::serialize_error("ERR This instance has cluster support disabled");
+    if (args.size() < 2)
+        return RESPHandler::serialize_error("ERR wrong number of arguments for 'cluster' command");
+
+    std::string sub = args[1];
+    std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    auto wrong_arguments = [&]()
+    {
+        std::string name = sub;
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        return RESPHandler::serialize_error("ERR wrong number of arguments for 'cluster|" + name + "' command");
+    };
+    const std::string INVALID_SLOT = "ERR Invalid or out of range slot";
+
+    if (sub == "GOSSIP")
+        return handle_gossip(args, client);
+
+    if (sub == "MYID")
+        return RESPHandler::serialize_bulk_string(myself->id);
+
+    if (sub == "MEET")
+    {
+        long long port = 0;
+        struct in_addr parsed;
+        if (args.size() != 4)
+            return wrong_arguments();
+        if (inet_pton(AF_INET, args[2].c_str(), &parsed) != 1 || !parse_integer(args[3], port) || port <= 0 || port > 65535)
+            return RESPHandler::serialize_error("ERR Invalid node address specified: " + args[2] + ":" + args[3]);
+        bool known = std::any_of(nodes.begin(), nodes.end(), [&](const auto &node)
+                                 { return node->ip == args[2] && node->port == port; });
+        if (!known)
+        {
+            nodes.push_back(std::make_unique<Node>());
+            nodes.back()->ip = args[2];
+            nodes.back()->port = (int)port;
+            nodes.back()->last_seen = std::chrono::steady_clock::now(); // When the MEET started
+        }
+        return RESPHandler::serialize_simple_string("OK");
+    }
+
+    if (sub == "ADDSLOTS" || sub == "DELSLOTS" || sub == "ADDSLOTSRANGE" || sub == "DELSLOTSRANGE")
+    {
+        bool ranges = sub.ends_with("RANGE");
+        bool adding = sub.starts_with("ADD");
+        if (args.size() < 3 || (ranges && args.size() % 2 != 0))
+            return wrong_arguments();
+
+        // Everything is validated before anything changes
+        std::vector<int> requested;
+        for (size_t i = 2; i < args.size(); i += ranges ? 2 : 1)
+        {
+            int first = 0, last = 0;
+            if (!parse_slot(args[i], first) || (ranges && !parse_slot(args[i + 1], last)))
+                return RESPHandler::serialize_error(INVALID_SLOT);
+            if (!ranges)
+                last = first;
+            if (first > last)
+                return RESPHandler::serialize_error("ERR start slot number " + std::to_string(first) + " is greater than end slot number " + std::to_string(last));
+            for (int slot = first; slot <= last; slot++)
+                requested.push_back(slot);
+        }
+        std::vector<bool> seen(CLUSTER_SLOTS, false);
+        for (int slot : requested)
+        {
+            if (seen[slot])
+                return RESPHandler::serialize_error("ERR Slot " + std::to_string(slot) + " specified multiple times");
+            seen[slot] = true;
+            if (adding && slots[slot] != nullptr)
+                return RESPHandler::serialize_error("ERR Slot " + std::to_string(slot) + " is already busy");
+            if (!adding && slots[slot] == nullptr)
+                return RESPHandler::serialize_error("ERR Slot " + std::to_string(slot) + " is already unassigned");
+        }
+        for (int slot : requested)
+        {
+            slots[slot] = adding ? myself : nullptr;
+            migrating.erase(slot);
+            importing.erase(slot);
+        }
+        config_dirty = true;
+        return RESPHandler::serialize_simple_string("OK");
+    }
+
+    if (sub == "SETSLOT")
+        return handle_setslot(args, store);
+
+    if (sub == "BUMPEPOCH")
+    {
+        myself->config_epoch = ++current_epoch;
+        config_dirty = true;
+        return RESPHandler::serialize_simple_string("BUMPED " + std::to_string(current_epoch));
+    }
+
+    if (sub == "NODES")
+        return RESPHandler::serialize_bulk_string(nodes_text());
+
+    if (sub == "SLOTS")
+        return handle_slots();
+
+    if (sub == "INFO")
+    {
+        size_t assigned = 0, pfail = 0, size = 0;
+        for (Node *owner : slots)
+        {
+            if (owner == nullptr)
+                continue;
+            assigned++;
+            if (node_failing(owner))
+                pfail++;
+        }
+        size_t known = 0;
+        for (const auto &node : nodes)
+        {
+            if (node->id.empty())
+                continue;
+            known++;
+            if (std::find(slots.begin(), slots.end(), node.get()) != slots.end())
+                size++;
+        }
+        std::string text = std::string("cluster_state:") + (all_slots_served() ? "ok" : "fail") + "\r\n";
+        text += "cluster_slots_assigned:" + std::to_string(assigned) + "\r\n";
+        text += "cluster_slots_ok:" + std::to_string(assigned - pfail) + "\r\n";
+        text += "cluster_slots_pfail:" + std::to_string(pfail) + "\r\n";
+        text += "cluster_slots_fail:0\r\n";
+        text += "cluster_known_nodes:" + std::to_string(known) + "\r\n";
+        text += "cluster_size:" + std::to_string(size) + "\r\n";
+        text += "cluster_current_epoch:" + std::to_string(current_epoch) + "\r\n";
+        text += "cluster_my_epoch:" + std::to_string(myself->config_epoch) + "\r\n";
+        return RESPHandler::serialize_bulk_string(text);
+    }
+
+    if (sub == "KEYSLOT")
+    {
+        if (args.size() != 3)
+            return wrong_arguments();
+        return RESPHandler::serialize_integer(key_hash_slot(args[2]));
+    }
+
+    if (sub == "COUNTKEYSINSLOT" || sub == "GETKEYSINSLOT")
+    {
+        bool get = sub == "GETKEYSINSLOT";
+        int slot = 0;
+        long long count = -1;
+        if (args.size() != (get ? 4u : 3u))
+            return wrong_arguments();
+        if (!parse_slot(args[2], slot))
+            return RESPHandler::serialize_error(INVALID_SLOT);
+        if (get && (!parse_integer(args[3], count) || count < 0))
+            return RESPHandler::serialize_error("ERR Invalid number of keys");
+        std::vector<std::string> keys = keys_in_slot(store, slot, count);
+        if (!get)
+            return RESPHandler::serialize_integer(keys.size());
+        return RESPHandler::serialize_array(keys);
+    }
+
+    return RESPHandler::serialize_error("ERR unknown subcommand '" + args[1] + "'. Try CLUSTER HELP.");
+}
+
+std::string Cluster::handle_setslot(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    // CLUSTER SETSLOT <slot> IMPORTING <id> | MIGRATING <id> | NODE <id> | STABLE
+    int slot = 0;
+    if (args.size() < 4)
+        return RESPHandler::serialize_error("ERR wrong number of arguments for 'cluster|setslot' command");
+    if (!parse_slot(args[2], slot))
+        return RESPHandler::serialize_error("ERR Invalid or out of range slot");
+
+    std::string action = args[3];
+    std::transform(action.begin(), action.end(), action.begin(), ::toupper);
+    if (action == "STABLE")
+    {
+        migrating.erase(slot);
+        importing.erase(slot);
+        config_dirty = true;
+        return RESPHandler::serialize_simple_string("OK");
+    }
+    if (args.size() != 5 || (action != "MIGRATING" && action != "IMPORTING" && action != "NODE"))
+        return RESPHandler::serialize_error("ERR Invalid CLUSTER SETSLOT action or number of arguments. Try CLUSTER HELP");
+
+    Node *node = find_node(args[4]);
+    if (node == nullptr)
+        return RESPHandler::serialize_error("ERR I don't know about node " + args[4]);
+
+    if (action == "MIGRATING")
+    {
+        if (slots[slot] != myself)
+            return RESPHandler::serialize_error("ERR I'm not the owner of hash slot " + std::to_string(slot));
+        if (node == myself)
+            return RESPHandler::serialize_error("ERR I can't migrate to myself");
+        migrating[slot] = node;
+    }
+    else if (action == "IMPORTING")
+    {
+        if (slots[slot] == myself)
+            return RESPHandler::serialize_error("ERR I'm already the owner of hash slot " + std::to_string(slot));
+        if (node == myself)
+            return RESPHandler::serialize_error("ERR I can't import from myself");
+        importing[slot] = node;
+    }
+    else
+    {
+        if (slots[slot] == myself && node != myself && !keys_in_slot(store, slot, 1).empty())
+            return RESPHandler::serialize_error("ERR Can't assign hashslot " + std::to_string(slot) + " to a different node while I still hold keys for this hash slot.");
+
+        // Taking over an imported slot: a new config epoch makes our claim beat the old
+        // owner's everywhere the gossip reaches
+        if (node == myself && importing.erase(slot))
+        {
+            myself->config_epoch = ++current_epoch;
+            server_log(LogLevel::VERBOSE, "Took over slot " + std::to_string(slot) + ", config epoch is now " + std::to_string(current_epoch));
+        }
+        if (node != myself)
+            migrating.erase(slot);
+        slots[slot] = node;
+    }
+    config_dirty = true;
+    return RESPHandler::serialize_simple_string("OK");
+}
+
+std::string Cluster::handle_slots() const
+{
+    // One entry per run of consecutive slots served by the same node
+    std::string body;
+    size_t entries = 0;
+    int slot = 0;
+    while (slot < CLUSTER_SLOTS)
+    {
+        Node *owner = slots[slot];
+        int first = slot;
+        while (slot < CLUSTER_SLOTS && slots[slot] == owner)
+            slot++;
+        if (owner == nullptr)
+            continue;
+
+        entries++;
+        body += RESPHandler::serialize_array_header(3);
+        body += RESPHandler::serialize_integer(first);
+        body += RESPHandler::serialize_integer(slot - 1);
+        body += RESPHandler::serialize_array_header(3);
+        body += RESPHandler::serialize_bulk_string(owner->ip);
+        body += RESPHandler::serialize_integer(owner->port);
+        body += RESPHandler::serialize_bulk_string(owner->id);
+    }
+    return RESPHandler::serialize_array_header(entries) + body;
+}
+
+std::string Cluster::info() const
+{
+    return std::string("# Cluster\r\ncluster_enabled:") + (is_enabled ? "1" : "0") + "\r\n";
+}
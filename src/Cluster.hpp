@@ -0,0 +1,107 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <map>
+#include <memory>
+#include <chrono>
+#include <cstdint>
+#include "Config.hpp"
+#include "KeyValueStore.hpp"
+
+class Server;
+class Connection;
+
+const int CLUSTER_SLOTS = 16384;
+
+// CRC16/XMODEM, the hash Redis Cluster uses for slots
+uint16_t crc16(const char *data, size_t length);
+
+// Slot of a key: CRC16 of the key modulo 16384. If the key has a non-empty {hash tag}
+// only the tag is hashed, so related keys can be kept in one slot on purpose.
+int key_hash_slot(std::string_view key);
+
+// Cluster mode: the keyspace is split into 16384 hash slots, each served by one node.
+//
+// Nodes talk to each other over their regular client port. Once a second every node
+// sends each peer it knows a CLUSTER GOSSIP command: its ID, port, config epoch, the
+// slots it serves and the nodes it knows. That is how nodes introduced with CLUSTER MEET
+// find each other and how slot ownership spreads. Conflicting claims on a slot are won by
+// the higher config epoch, which a node bumps when it takes over a slot it was importing.
+//
+// A command whose keys live elsewhere is answered with -MOVED, and during a migration
+// (CLUSTER SETSLOT ... MIGRATING / IMPORTING plus MIGRATE) keys already moved are
+// answered with -ASK. The configuration survives restarts in cluster-config-file.
+class Cluster
+{
+public:
+    struct Node
+    {
+        std::string id; // Empty until a node introduced by MEET tells us its ID
+        std::string ip;
+        int port = 0;
+        uint64_t config_epoch = 0;
+        std::chrono::steady_clock::time_point last_seen; // Last gossip received from it
+
+        // Outgoing link the gossip is sent on
+        Connection *link = nullptr;
+        std::chrono::steady_clock::time_point last_link_attempt;
+    };
+
+    explicit Cluster(const ServerConfig &config);
+
+    bool enabled() const { return is_enabled; }
+
+    // Checks where the keys of a command are served. Returns "" if it runs here, otherwise
+    // the -MOVED / -ASK / -CROSSSLOT / -TRYAGAIN / -CLUSTERDOWN error to reply with.
+    std::string redirect(const std::vector<std::string> &args, Connection &client, KeyValueStore &store);
+
+    // CLUSTER <subcommand> ...
+    std::string handle_command(const std::vector<std::string> &args, Connection &client, KeyValueStore &store);
+
+    // Forgets a closing connection that was a gossip link
+    void remove_client(Connection *client);
+
+    // Sends the gossip, reconnects links and saves a changed configuration
+    void cron(Server &server);
+    int cron_interval_ms() const;
+
+    // The "# Cluster" section of INFO
+    std::string info() const;
+
+private:
+    bool is_enabled;
+    std::string config_path;
+    std::string announce_ip;
+    std::chrono::milliseconds node_timeout;
+    uint64_t current_epoch = 0;
+
+    std::vector<std::unique_ptr<Node>> nodes; // myself included
+    Node *myself = nullptr;
+    std::vector<Node *> slots;
+    std::map<int, Node *> migrating; // Slots we own and are moving out
+    std::map<int, Node *> importing; // Slots we are receiving
+
+    bool config_dirty = false;
+    std::chrono::steady_clock::time_point last_gossip;
+
+    Node *find_node(const std::string &id) const;
+    bool node_failing(const Node *node) const;
+    bool all_slots_served() const;
+
+    std::string handle_gossip(const std::vector<std::string> &args, Connection &client);
+    std::string handle_setslot(const std::vector<std::string> &args, KeyValueStore &store);
+    std::string handle_slots() const;
+    std::string nodes_text() const;
+    std::string gossip_message() const;
+
+    // "0-5460,5462" for the slots owned by node, "-" for none
+    std::string slot_ranges(const Node *node, char separator) const;
+
+    void connect_link(Server &server, Node &node);
+    bool load_config();
+    void save_config();
+};
+
+// Keys of the store that hash to slot, at most 'limit' of them (-1 for all)
+std::vector<std::string> keys_in_slot(KeyValueStore &store, int slot, long long limit);
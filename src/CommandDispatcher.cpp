@@ -1,30 +1,2732 @@
 #include "CommandDispatcher.hpp"
+#include "HashObject.hpp"
+#include "SortedSet.hpp"
+#include "Stream.hpp"
+#include "ListObject.hpp"
+#include "Connection.hpp"
+#include "Server.hpp"
+#include "Bitops.hpp"
+#include "HyperLogLog.hpp"
+#include "Rdb.hpp"
+#include "Utils.hpp"
+#include "Memory.hpp"
+#include "Log.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_set>
+#include <unordered_map>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
 
-std::string CommandDispatcher::dispatch(const std::vector<std::string> &args, KeyValueStore &store)
+static const char *WRONGTYPE_ERROR = "WRONGTYPE Operation against a key holding the wrong kind of value";
+
+static std::string wrong_number_of_arguments(const std::string &command)
+{
+    return RESPHandler::serialize_error("ERR wrong number of arguments for '" + command + "' command");
+}
+
+// Looks up key as an object of the given type. Returns nullptr if the key is missing or
+// holds another type (wrong_type tells the two apart).
+template <typename T>
+static T *lookup_object(KeyValueStore &store, const std::string &key, ValueType type, bool &wrong_type)
+{
+    wrong_type = false;
+    KeyValueStore::ValueEntry *entry = store.find(key);
+    if (entry == nullptr)
+        return nullptr;
+    if (entry->type != type)
+    {
+        wrong_type = true;
+        return nullptr;
+    }
+    return static_cast<T *>(entry->object.get());
+}
+
+// Strings live inline in the entry, so this hands out the entry itself
+static KeyValueStore::ValueEntry *lookup_string(KeyValueStore &store, const std::string &key, bool &wrong_type)
+{
+    wrong_type = false;
+    KeyValueStore::ValueEntry *entry = store.find(key);
+    if (entry != nullptr && entry->type != ValueType::STRING)
+    {
+        wrong_type = true;
+        return nullptr;
+    }
+    return entry;
+}
+
+static const char *INVALID_HLL_ERROR = "WRONGTYPE Key is not a valid HyperLogLog string value.";
+
+// A HyperLogLog is a string with a HYLL header. Anything else is reported as invalid.
+static KeyValueStore::ValueEntry *lookup_hll(KeyValueStore &store, const std::string &key, bool &invalid)
+{
+    KeyValueStore::ValueEntry *entry = lookup_string(store, key, invalid);
+    if (entry != nullptr && !hll_is_valid(entry->value))
+    {
+        invalid = true;
+        return nullptr;
+    }
+    return entry;
+}
+
+static ListObject *lookup_list(KeyValueStore &store, const std::string &key, bool &wrong_type)
+{
+    return lookup_object<ListObject>(store, key, ValueType::LIST, wrong_type);
+}
+
+static HashObject *lookup_hash(KeyValueStore &store, const std::string &key, bool &wrong_type)
+{
+    return lookup_object<HashObject>(store, key, ValueType::HASH, wrong_type);
+}
+
+static SortedSet *lookup_zset(KeyValueStore &store, const std::string &key, bool &wrong_type)
+{
+    return lookup_object<SortedSet>(store, key, ValueType::ZSET, wrong_type);
+}
+
+static Stream *lookup_stream(KeyValueStore &store, const std::string &key, bool &wrong_type)
+{
+    return lookup_object<Stream>(store, key, ValueType::STREAM, wrong_type);
+}
+
+std::string CommandDispatcher::dispatch(const std::vector<std::string> &args, KeyValueStore &store, Connection &client)
 {
     if (args.empty())
         return "";
-    std::string command = args[0];
+    const std::string &command = args[0];
+
+    if (command == "SETBIT")
+        return handle_setbit(args, store);
+    if (command == "GETBIT")
+        return handle_getbit(args, store);
+    if (command == "BITCOUNT")
+        return handle_bitcount(args, store);
+    if (command == "BITPOS")
+        return handle_bitpos(args, store);
+    if (command == "BITOP")
+        return handle_bitop(args, store);
+    if (command == "PFADD")
+        return handle_pfadd(args, store, client);
+    if (command == "PFCOUNT")
+        return handle_pfcount(args, store);
+    if (command == "PFMERGE")
+        return handle_pfmerge(args, store);
+    if (command == "SCAN")
+        return handle_scan(args, store);
+    if (command == "KEYS")
+        return handle_keys(args, store);
+    if (command == "DEL")
+        return handle_del(args, store);
+    if (command == "LPUSH")
+        return handle_push(args, store, client, true);
+    if (command == "RPUSH")
+        return handle_push(args, store, client, false);
+    if (command == "LPOP")
+        return handle_pop(args, store, true);
+    if (command == "RPOP")
+        return handle_pop(args, store, false);
+    if (command == "BLPOP")
+        return handle_blocking_pop(args, store, client, true);
+    if (command == "BRPOP")
+        return handle_blocking_pop(args, store, client, false);
+    if (command == "LLEN")
+        return handle_llen(args, store);
+    if (command == "LRANGE")
+        return handle_lrange(args, store);
+
+    if (command == "SUBSCRIBE")
+        return handle_subscribe(args, client, false);
+    if (command == "PSUBSCRIBE")
+        return handle_subscribe(args, client, true);
+    if (command == "UNSUBSCRIBE")
+        return handle_unsubscribe(args, client, false);
+    if (command == "PUNSUBSCRIBE")
+        return handle_unsubscribe(args, client, true);
+    if (command == "PUBLISH")
+        return handle_publish(args, client);
+    if (command == "HSET")
+        return handle_hset(args, store);
+    if (command == "HGET")
+        return handle_hget(args, store);
+    if (command == "HMGET")
+        return handle_hmget(args, store);
+    if (command == "HDEL")
+        return handle_hdel(args, store);
+    if (command == "HGETALL")
+        return handle_hgetall(args, store);
+    if (command == "HINCRBY")
+        return handle_hincrby(args, store);
+    if (command == "HLEN")
+        return handle_hlen(args, store);
+    if (command == "ZADD")
+        return handle_zadd(args, store);
+    if (command == "ZREM")
+        return handle_zrem(args, store);
+    if (command == "ZSCORE")
+        return handle_zscore(args, store);
+    if (command == "ZINCRBY")
+        return handle_zincrby(args, store);
+    if (command == "ZRANK")
+        return handle_zrank(args, store);
+    if (command == "ZRANGE")
+        return handle_zrange(args, store);
+    if (command == "ZRANGEBYSCORE")
+        return handle_zrangebyscore(args, store);
+    if (command == "ZCARD")
+        return handle_zcard(args, store);
+    if (command == "XADD")
+        return handle_xadd(args, store, client);
+    if (command == "XRANGE")
+        return handle_xrange(args, store, false);
+    if (command == "XREVRANGE")
+        return handle_xrange(args, store, true);
+    if (command == "XLEN")
+        return handle_xlen(args, store);
+    if (command == "XTRIM")
+        return handle_xtrim(args, store);
 
-    if (command == "PING")
-        return handle_ping(args);
-    if (command == "GET")
-        return handle_get(args, store);
-    if (command == "SET")
-        return handle_set(args, store);
+    if (command == "SAVE")
+        return handle_save(args, store, client, false);
+    if (command == "BGSAVE")
+        return handle_save(args, store, client, true);
+    if (command == "BGREWRITEAOF")
+        return handle_bgrewriteaof(args, store, client);
+    if (command == "LASTSAVE")
+        return handle_lastsave(args, client);
+    if (command == "INFO")
+        return handle_info(args, store, client);
+    if (command == "CONFIG")
+        return handle_config(args, client);
+    if (command == "SLOWLOG")
+        return handle_slowlog(args, client);
+    if (command == "LATENCY")
+        return handle_latency(args, client);
+    if (command == "CLIENT")
+        return handle_client(args, client);
+    if (command == "MEMORY")
+        return handle_memory(args, store);
+    if (command == "HOTKEYS")
+        return handle_hotkeys(args, client);
 
-    return RESPHandler::serialize_error("unknown command");
+    if (command == "REPLICAOF" || command == "SLAVEOF")
+        return handle_replicaof(args, client);
+    if (command == "PSYNC" || command == "SYNC")
+        return handle_psync(args, client);
+    if (command == "REPLCONF")
+        return handle_replconf(args, client);
+
+    if (command == "CLUSTER")
+        return client.server.cluster.handle_command(args, client, store);
+    if (command == "ASKING")
+        return handle_asking(args, client);
+    if (command == "DUMP")
+        return handle_dump(args, store);
+    if (command == "RESTORE" || command == "RESTORE-ASKING")
+        return handle_restore(args, store, client);
+    if (command == "MIGRATE")
+        return handle_migrate(args, store, client);
+
+    static LogRateLimit unknown_commands;
+    if (log_enabled(LogLevel::VERBOSE))
+        unknown_commands.log(LogLevel::VERBOSE, "Unknown command '" + command + "'");
+    return RESPHandler::serialize_error("ERR unknown command '" + command + "'");
+}
+
+bool CommandDispatcher::is_write_command(const std::string &command)
+{
+    static const std::unordered_set<std::string> write_commands = {
+        "SET", "SETBIT", "BITOP", "PFADD", "PFMERGE",
+        "LPUSH", "RPUSH", "LPOP", "RPOP", "BLPOP", "BRPOP",
+        "HSET", "HDEL", "HINCRBY",
+        "ZADD", "ZREM", "ZINCRBY",
+        "XADD", "XTRIM",
+        "DEL", "RESTORE", "RESTORE-ASKING"};
+    return write_commands.count(command) > 0;
+}
+
+bool CommandDispatcher::is_known_command(const std::string &command)
+{
+    // Keep in step with dispatch() and the commands Connection handles itself
+    static const std::unordered_set<std::string> known_commands = {
+        "PING", "ECHO", "SET", "GET", "DEL", "KEYS", "SCAN",
+        "SETBIT", "GETBIT", "BITCOUNT", "BITPOS", "BITOP",
+        "PFADD", "PFCOUNT", "PFMERGE",
+        "LPUSH", "RPUSH", "LPOP", "RPOP", "LLEN", "LRANGE", "BLPOP", "BRPOP",
+        "HSET", "HGET", "HMGET", "HDEL", "HLEN", "HGETALL", "HINCRBY",
+        "ZADD", "ZREM", "ZSCORE", "ZRANK", "ZCARD", "ZINCRBY", "ZRANGE", "ZRANGEBYSCORE",
+        "XADD", "XLEN", "XRANGE", "XREVRANGE", "XTRIM",
+        "SUBSCRIBE", "UNSUBSCRIBE", "PSUBSCRIBE", "PUNSUBSCRIBE", "PUBLISH",
+        "DUMP", "RESTORE", "RESTORE-ASKING", "MIGRATE", "ASKING", "CLUSTER",
+        "REPLICAOF", "SLAVEOF", "REPLCONF", "PSYNC", "SYNC",
+        "SAVE", "BGSAVE", "BGREWRITEAOF", "LASTSAVE",
+        "INFO", "CONFIG", "CLIENT", "MEMORY", "SLOWLOG", "LATENCY", "HOTKEYS"};
+    return known_commands.count(command) > 0;
 }
 
-std::string CommandDispatcher::handle_ping(const std::vector<std::string> &args)
+std::vector<size_t> CommandDispatcher::command_keys(const std::vector<std::string> &args)
 {
-    std::string response = "PONG";
+    // Where the keys are: from 'first' to 'last' (negative counts from the end, -1 being
+    // the last argument), every 'step' arguments
+    struct KeySpec
+    {
+        int first;
+        int last;
+        int step;
+    };
+    static const std::unordered_map<std::string, KeySpec> key_specs = {
+        {"GET", {1, 1, 1}}, {"SET", {1, 1, 1}}, {"DEL", {1, -1, 1}},
+        {"MEMORY", {2, 2, 1}}, {"DUMP", {1, 1, 1}}, {"RESTORE", {1, 1, 1}}, {"RESTORE-ASKING", {1, 1, 1}},
+        {"SETBIT", {1, 1, 1}}, {"GETBIT", {1, 1, 1}}, {"BITCOUNT", {1, 1, 1}}, {"BITPOS", {1, 1, 1}}, {"BITOP", {2, -1, 1}},
+        {"PFADD", {1, 1, 1}}, {"PFCOUNT", {1, -1, 1}}, {"PFMERGE", {1, -1, 1}},
+        {"LPUSH", {1, 1, 1}}, {"RPUSH", {1, 1, 1}}, {"LPOP", {1, 1, 1}}, {"RPOP", {1, 1, 1}},
+        {"BLPOP", {1, -2, 1}}, {"BRPOP", {1, -2, 1}}, {"LLEN", {1, 1, 1}}, {"LRANGE", {1, 1, 1}},
+        {"HSET", {1, 1, 1}}, {"HGET", {1, 1, 1}}, {"HMGET", {1, 1, 1}}, {"HDEL", {1, 1, 1}},
+        {"HGETALL", {1, 1, 1}}, {"HINCRBY", {1, 1, 1}}, {"HLEN", {1, 1, 1}},
+        {"ZADD", {1, 1, 1}}, {"ZREM", {1, 1, 1}}, {"ZSCORE", {1, 1, 1}}, {"ZINCRBY", {1, 1, 1}},
+        {"ZRANK", {1, 1, 1}}, {"ZRANGE", {1, 1, 1}}, {"ZRANGEBYSCORE", {1, 1, 1}}, {"ZCARD", {1, 1, 1}},
+        {"XADD", {1, 1, 1}}, {"XRANGE", {1, 1, 1}}, {"XREVRANGE", {1, 1, 1}}, {"XLEN", {1, 1, 1}}, {"XTRIM", {1, 1, 1}}};
+
+    std::vector<size_t> keys;
+    if (args.empty())
+        return keys;
+
+    // MIGRATE takes a single key, or "" followed by KEYS key [key ...]
+    if (args[0] == "MIGRATE")
+    {
+        if (args.size() >= 6 && !args[3].empty())
+            keys.push_back(3);
+        for (size_t i = 6; i < args.size(); i++)
+        {
+            if (args[i] == "KEYS")
+            {
+                for (size_t key = i + 1; key < args.size(); key++)
+                    keys.push_back(key);
+                break;
+            }
+        }
+        return keys;
+    }
+
+    auto spec = key_specs.find(args[0]);
+    if (spec == key_specs.end())
+        return keys;
+    int count = (int)args.size();
+    int last = spec->second.last < 0 ? count + spec->second.last : spec->second.last;
+    for (int i = spec->second.first; i <= last && i < count; i += spec->second.step)
+        keys.push_back(i);
+    return keys;
+}
+
+// Bitmaps address bits from the most significant bit of the first byte
+static int get_bit(const std::string &value, size_t offset)
+{
+    size_t byte = offset >> 3;
+    if (byte >= value.size())
+        return 0;
+    return ((unsigned char)value[byte] >> (7 - (offset & 7))) & 1;
+}
+
+// Clamps a [start, end] range with negative indexes counting from the end, the way
+// BITCOUNT and BITPOS do. Returns false if the range is empty.
+static bool clamp_bit_range(long long &start, long long &end, long long length)
+{
+    if (start < 0)
+        start += length;
+    if (end < 0)
+        end += length;
+    if (start < 0)
+        start = 0;
+    if (end < 0)
+        end = 0;
+    if (end >= length)
+        end = length - 1;
+    return length > 0 && start <= end;
+}
+
+std::string CommandDispatcher::handle_setbit(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    if (args.size() != 4)
+        return wrong_number_of_arguments("setbit");
+
+    // Offsets are limited to 512MB worth of bits
+    long long offset;
+    if (!parse_integer(args[2], offset) || offset < 0 || offset >= (4LL * 1024 * 1024 * 1024))
+        return RESPHandler::serialize_error("ERR bit offset is not an integer or out of range");
+    if (args[3] != "0" && args[3] != "1")
+        return RESPHandler::serialize_error("ERR bit is not an integer or out of range");
+    int bit = args[3][0] - '0';
+
+    bool wrong_type;
+    KeyValueStore::ValueEntry *entry = lookup_string(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (entry == nullptr)
+    {
+        store.set(args[1], KeyValueStore::ValueEntry{});
+        entry = store.find(args[1]);
+    }
+
+    std::string &value = entry->value;
+    size_t byte = offset >> 3;
+    if (byte >= value.size())
+    {
+        // Grow geometrically so a run of SETBITs at increasing offsets does not
+        // reallocate and copy the whole bitmap on every write
+        if (byte + 1 > value.capacity())
+            value.reserve(std::max(byte + 1, value.capacity() * 2));
+        value.resize(byte + 1, '\0');
+    }
+
+    int old_bit = get_bit(value, offset);
+    unsigned char mask = 1 << (7 - (offset & 7));
+    if (bit)
+        value[byte] = (char)((unsigned char)value[byte] | mask);
+    else
+        value[byte] = (char)((unsigned char)value[byte] & ~mask);
+
+    return RESPHandler::serialize_integer(old_bit);
+}
+
+std::string CommandDispatcher::handle_getbit(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    if (args.size() != 3)
+        return wrong_number_of_arguments("getbit");
+
+    long long offset;
+    if (!parse_integer(args[2], offset) || offset < 0)
+        return RESPHandler::serialize_error("ERR bit offset is not an integer or out of range");
+
+    bool wrong_type;
+    KeyValueStore::ValueEntry *entry = lookup_string(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (entry == nullptr)
+        return RESPHandler::serialize_integer(0);
+    return RESPHandler::serialize_integer(get_bit(entry->value, offset));
+}
+
+std::string CommandDispatcher::handle_bitcount(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    // BITCOUNT key [start end [BYTE|BIT]]
+    if (args.size() != 2 && args.size() != 4 && args.size() != 5)
+        return args.size() == 3 ? RESPHandler::serialize_error("ERR syntax error") : wrong_number_of_arguments("bitcount");
+
+    long long start = 0, end = -1;
+    bool bit_mode = false;
+    if (args.size() >= 4)
+    {
+        if (!parse_integer(args[2], start) || !parse_integer(args[3], end))
+            return RESPHandler::serialize_error("ERR value is not an integer or out of range");
+        if (args.size() == 5)
+        {
+            if (args[4] == "BIT")
+                bit_mode = true;
+            else if (args[4] != "BYTE")
+                return RESPHandler::serialize_error("ERR syntax error");
+        }
+    }
+
+    bool wrong_type;
+    KeyValueStore::ValueEntry *entry = lookup_string(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (entry == nullptr)
+        return RESPHandler::serialize_integer(0);
+
+    const unsigned char *data = (const unsigned char *)entry->value.data();
+    long long length = entry->value.size();
+
+    if (!bit_mode)
+    {
+        if (!clamp_bit_range(start, end, length))
+            return RESPHandler::serialize_integer(0);
+        return RESPHandler::serialize_integer(bitops_popcount(data + start, end - start + 1));
+    }
+
+    if (!clamp_bit_range(start, end, length * 8))
+        return RESPHandler::serialize_integer(0);
+
+    // Count the whole bytes covering the range, then take off the bits outside it
+    long long first_byte = start >> 3;
+    long long last_byte = end >> 3;
+    long long count = bitops_popcount(data + first_byte, last_byte - first_byte + 1);
+    unsigned char before = (unsigned char)(0xFF << (8 - (start & 7)));
+    unsigned char after = (unsigned char)((1 << (7 - (end & 7))) - 1);
+    if (start & 7)
+        count -= __builtin_popcount(data[first_byte] & before);
+    count -= __builtin_popcount(data[last_byte] & after);
+    return RESPHandler::serialize_integer(count);
+}
+
+// Position of the first bit equal to 'bit' in the bit range [from, to], or -1
+static long long find_bit(const unsigned char *data, long long from, long long to, int bit)
+{
+    long long position = from;
+
+    // Leading bits up to a byte boundary
+    while (position <= to && (position & 7) != 0)
+    {
+        if (((data[position >> 3] >> (7 - (position & 7))) & 1) == bit)
+            return position;
+        position++;
+    }
+
+    // Whole bytes: skip over runs that cannot contain the bit we are looking for
+    long long full_bytes_end = (to + 1) >> 3;
+    long long byte = position >> 3;
+    if (byte < full_bytes_end)
+    {
+        byte += bitops_skip_bytes(data + byte, full_bytes_end - byte, bit ? 0x00 : 0xFF);
+        position = byte << 3;
+        if (byte < full_bytes_end)
+        {
+            unsigned char value = bit ? data[byte] : (unsigned char)~data[byte];
+            return position + __builtin_clz((unsigned int)value) - 24;
+        }
+    }
+
+    // Trailing bits of a partial last byte
+    while (position <= to)
+    {
+        if (((data[position >> 3] >> (7 - (position & 7))) & 1) == bit)
+            return position;
+        position++;
+    }
+    return -1;
+}
+
+std::string CommandDispatcher::handle_bitpos(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    // BITPOS key bit [start [end [BYTE|BIT]]]
+    if (args.size() < 3 || args.size() > 6)
+        return wrong_number_of_arguments("bitpos");
+    if (args[2] != "0" && args[2] != "1")
+        return RESPHandler::serialize_error("ERR The bit argument must be 1 or 0.");
+    int bit = args[2][0] - '0';
+
+    long long start = 0, end = -1;
+    bool end_given = args.size() >= 5;
+    bool bit_mode = false;
+    if (args.size() >= 4 && !parse_integer(args[3], start))
+        return RESPHandler::serialize_error("ERR value is not an integer or out of range");
+    if (end_given && !parse_integer(args[4], end))
+        return RESPHandler::serialize_error("ERR value is not an integer or out of range");
+    if (args.size() == 6)
+    {
+        if (args[5] == "BIT")
+            bit_mode = true;
+        else if (args[5] != "BYTE")
+            return RESPHandler::serialize_error("ERR syntax error");
+    }
+
+    bool wrong_type;
+    KeyValueStore::ValueEntry *entry = lookup_string(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+
+    // A missing key is an empty string: no set bits, and clear bits from position 0
+    if (entry == nullptr || entry->value.empty())
+        return RESPHandler::serialize_integer(bit ? -1 : 0);
+
+    const unsigned char *data = (const unsigned char *)entry->value.data();
+    long long length = entry->value.size();
+
+    long long from, to;
+    if (bit_mode)
+    {
+        if (!clamp_bit_range(start, end, length * 8))
+            return RESPHandler::serialize_integer(-1);
+        from = start;
+        to = end;
+    }
+    else
+    {
+        if (!clamp_bit_range(start, end, length))
+            return RESPHandler::serialize_integer(-1);
+        from = start * 8;
+        to = end * 8 + 7;
+    }
+
+    long long position = find_bit(data, from, to, bit);
+
+    // Looking for a clear bit in an open ended range: the string is conceptually
+    // padded with zeros, so the first clear bit is right after it
+    if (position == -1 && bit == 0 && !end_given)
+        position = length * 8;
+
+    return RESPHandler::serialize_integer(position);
+}
+
+std::string CommandDispatcher::handle_bitop(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    // BITOP AND|OR|XOR|NOT destkey key [key ...]
+    if (args.size() < 4)
+        return wrong_number_of_arguments("bitop");
+
+    BitOperation operation;
+    if (args[1] == "AND")
+        operation = BitOperation::AND;
+    else if (args[1] == "OR")
+        operation = BitOperation::OR;
+    else if (args[1] == "XOR")
+        operation = BitOperation::XOR;
+    else if (args[1] == "NOT")
+        operation = BitOperation::NOT;
+    else
+        return RESPHandler::serialize_error("ERR syntax error");
+
+    if (operation == BitOperation::NOT && args.size() != 4)
+        return RESPHandler::serialize_error("ERR BITOP NOT must be called with a single source key.");
+
+    // Missing keys count as empty strings, shorter strings as zero padded
+    std::vector<const std::string *> sources;
+    size_t max_length = 0;
+    static const std::string empty;
+    for (size_t i = 3; i < args.size(); i++)
+    {
+        bool wrong_type;
+        KeyValueStore::ValueEntry *entry = lookup_string(store, args[i], wrong_type);
+        if (wrong_type)
+            return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+        sources.push_back(entry ? &entry->value : &empty);
+        max_length = std::max(max_length, sources.back()->size());
+    }
+
+    std::string result(max_length, '\0');
+    unsigned char *dest = (unsigned char *)result.data();
+    const unsigned char *first = (const unsigned char *)sources[0]->data();
+
+    if (operation == BitOperation::NOT)
+    {
+        bitops_apply(BitOperation::NOT, dest, first, sources[0]->size());
+    }
+    else
+    {
+        memcpy(dest, first, sources[0]->size());
+        for (size_t i = 1; i < sources.size(); i++)
+        {
+            const std::string &source = *sources[i];
+            bitops_apply(operation, dest, (const unsigned char *)source.data(), source.size());
+
+            // Past the end of a shorter source: x AND 0 = 0, while OR/XOR keep x
+            if (operation == BitOperation::AND && source.size() < max_length)
+                memset(dest + source.size(), 0, max_length - source.size());
+        }
+    }
+
+    if (max_length == 0)
+    {
+        store.erase(args[2]);
+    }
+    else
+    {
+        KeyValueStore::ValueEntry value_entry;
+        value_entry.value = std::move(result);
+        store.set(args[2], std::move(value_entry));
+    }
+    return RESPHandler::serialize_integer(max_length);
+}
+
+std::string CommandDispatcher::handle_pfadd(const std::vector<std::string> &args, KeyValueStore &store, Connection &client)
+{
+    if (args.size() < 2)
+        return wrong_number_of_arguments("pfadd");
+
+    bool invalid;
+    KeyValueStore::ValueEntry *entry = lookup_hll(store, args[1], invalid);
+    if (invalid)
+        return RESPHandler::serialize_error(INVALID_HLL_ERROR);
+
+    // Creating the key counts as a change even without elements
+    bool changed = false;
+    if (entry == nullptr)
+    {
+        KeyValueStore::ValueEntry value_entry;
+        value_entry.value = hll_create();
+        store.set(args[1], std::move(value_entry));
+        entry = store.find(args[1]);
+        changed = true;
+    }
+
+    for (size_t i = 2; i < args.size(); i++)
+    {
+        if (hll_add(entry->value, args[i]))
+            changed = true;
+    }
+
+    // Elements that were already counted change nothing: nothing to log or replicate
+    if (!changed)
+        client.write_unchanged = true;
+    return RESPHandler::serialize_integer(changed ? 1 : 0);
+}
+
+std::string CommandDispatcher::handle_pfcount(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    if (args.size() < 2)
+        return wrong_number_of_arguments("pfcount");
+
+    bool invalid;
+    if (args.size() == 2)
+    {
+        // Single key: answered from the cached cardinality in the header when possible
+        KeyValueStore::ValueEntry *entry = lookup_hll(store, args[1], invalid);
+        if (invalid)
+            return RESPHandler::serialize_error(INVALID_HLL_ERROR);
+        if (entry == nullptr)
+            return RESPHandler::serialize_integer(0);
+        return RESPHandler::serialize_integer(hll_count(entry->value));
+    }
+
+    // Several keys: the cardinality of their union, from max-merged registers
+    std::vector<uint8_t> registers(HLL_REGISTERS, 0);
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        KeyValueStore::ValueEntry *entry = lookup_hll(store, args[i], invalid);
+        if (invalid)
+            return RESPHandler::serialize_error(INVALID_HLL_ERROR);
+        if (entry != nullptr)
+            hll_merge_into(registers.data(), entry->value);
+    }
+    return RESPHandler::serialize_integer(hll_count_registers(registers.data()));
+}
+
+std::string CommandDispatcher::handle_pfmerge(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    // PFMERGE destkey [sourcekey ...]
+    if (args.size() < 2)
+        return wrong_number_of_arguments("pfmerge");
+
+    // The destination is one of the inputs
+    bool invalid;
+    std::vector<uint8_t> registers(HLL_REGISTERS, 0);
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        KeyValueStore::ValueEntry *entry = lookup_hll(store, args[i], invalid);
+        if (invalid)
+            return RESPHandler::serialize_error(INVALID_HLL_ERROR);
+        if (entry != nullptr)
+            hll_merge_into(registers.data(), entry->value);
+    }
+
+    // The result is always dense. Overwriting the value in place keeps any TTL.
+    KeyValueStore::ValueEntry *destination = store.find(args[1]);
+    if (destination != nullptr)
+    {
+        destination->value = hll_from_registers(registers.data());
+    }
+    else
+    {
+        KeyValueStore::ValueEntry value_entry;
+        value_entry.value = hll_from_registers(registers.data());
+        store.set(args[1], std::move(value_entry));
+    }
+    return RESPHandler::serialize_simple_string("OK");
+}
+
+std::string CommandDispatcher::handle_save(const std::vector<std::string> &args, KeyValueStore &store, Connection &client, bool background)
+{
+    if (args.size() != 1)
+        return wrong_number_of_arguments(background ? "bgsave" : "save");
+    if (background)
+    {
+        // One fork at a time: two children would double the copy-on-write cost
+        if (client.server.aof.rewrite_in_progress())
+            return RESPHandler::serialize_error("ERR An AOF log rewriting in progress: can't BGSAVE right now");
+        return client.server.persistence.background_save(store);
+    }
+    return client.server.persistence.save(store);
+}
+
+std::string CommandDispatcher::handle_bgrewriteaof(const std::vector<std::string> &args, KeyValueStore &store, Connection &client)
+{
+    if (args.size() != 1)
+        return wrong_number_of_arguments("bgrewriteaof");
+    if (client.server.persistence.child_active())
+        return RESPHandler::serialize_error("ERR Background save in progress, can't rewrite the AOF right now");
+    return client.server.aof.background_rewrite(store);
+}
+
+std::string CommandDispatcher::handle_lastsave(const std::vector<std::string> &args, Connection &client)
+{
+    if (args.size() != 1)
+        return wrong_number_of_arguments("lastsave");
+    return RESPHandler::serialize_integer(client.server.persistence.last_save_time());
+}
+
+// Parameters that CONFIG GET / CONFIG SET know about. set returns false on a bad value.
+struct ConfigParameter
+{
+    const char *name;
+    std::string (*get)(Server &server);
+    bool (*set)(Server &server, const std::string &value);
+};
+
+static const ConfigParameter CONFIG_PARAMETERS[] = {
+    {"slowlog-log-slower-than",
+     [](Server &server)
+     { return std::to_string(server.config.slowlog_log_slower_than); },
+     [](Server &server, const std::string &value)
+     {
+         long long threshold = 0;
+         if (!parse_integer(value, threshold))
+             return false;
+         server.config.slowlog_log_slower_than = threshold;
+         server.slowlog.configure(threshold, server.config.slowlog_max_len);
+         return true;
+     }},
+    {"latency-monitor-threshold",
+     [](Server &server)
+     { return std::to_string(server.config.latency_monitor_threshold); },
+     [](Server &server, const std::string &value)
+     {
+         long long threshold = 0;
+         if (!parse_integer(value, threshold) || threshold < 0)
+             return false;
+         server.config.latency_monitor_threshold = threshold;
+         server.latency.set_threshold(threshold);
+         return true;
+     }},
+    {"timeout",
+     [](Server &server)
+     { return std::to_string(server.config.timeout); },
+     [](Server &server, const std::string &value)
+     {
+         long long seconds = 0;
+         if (!parse_integer(value, seconds) || seconds < 0)
+             return false;
+         server.set_idle_timeout(seconds);
+         return true;
+     }},
+    {"tcp-keepalive",
+     [](Server &server)
+     { return std::to_string(server.config.tcp_keepalive); },
+     [](Server &server, const std::string &value)
+     {
+         // Applies to connections accepted from now on
+         long long seconds = 0;
+         if (!parse_integer(value, seconds) || seconds < 0)
+             return false;
+         server.config.tcp_keepalive = seconds;
+         return true;
+     }},
+    {"maxclients",
+     [](Server &server)
+     { return std::to_string(server.config.maxclients); },
+     [](Server &server, const std::string &value)
+     {
+         // Clients already connected over a lowered limit stay, new ones are refused
+         long long clients = 0;
+         if (!parse_integer(value, clients) || clients < 1)
+             return false;
+         server.config.maxclients = clients;
+         return true;
+     }},
+    {"loglevel",
+     [](Server &server)
+     { return server.config.loglevel; },
+     [](Server &server, const std::string &value)
+     {
+         std::string lowered = value;
+         std::transform(lowered.begin(), lowered.end(), lowered.begin(), ::tolower);
+         if (!parse_log_level(lowered, log_level))
+             return false;
+         server.config.loglevel = lowered;
+         return true;
+     }},
+    {"hotkeys",
+     [](Server &server)
+     { return std::string(server.config.hotkeys ? "yes" : "no"); },
+     [](Server &server, const std::string &value)
+     {
+         std::string lowered = value;
+         std::transform(lowered.begin(), lowered.end(), lowered.begin(), ::tolower);
+         if (lowered != "yes" && lowered != "no")
+             return false;
+         server.config.hotkeys = lowered == "yes";
+         server.hotkeys.set_enabled(server.config.hotkeys);
+         server.kv_store.set_access_tracker(server.config.hotkeys ? &server.hotkeys : nullptr);
+         return true;
+     }},
+    {"slowlog-max-len",
+     [](Server &server)
+     { return std::to_string(server.config.slowlog_max_len); },
+     [](Server &server, const std::string &value)
+     {
+         long long length = 0;
+         if (!parse_integer(value, length) || length < 0)
+             return false;
+         server.config.slowlog_max_len = length;
+         server.slowlog.configure(server.config.slowlog_log_slower_than, length);
+         return true;
+     }},
+};
+
+std::string CommandDispatcher::handle_config(const std::vector<std::string> &args, Connection &client)
+{
+    // CONFIG GET pattern [pattern ...] | CONFIG SET parameter value [parameter value ...] | CONFIG RESETSTAT
+    if (args.size() < 2)
+        return wrong_number_of_arguments("config");
+
+    std::string sub = args[1];
+    std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    if (sub == "RESETSTAT" && args.size() == 2)
+    {
+        client.server.stats.reset();
+        return RESPHandler::serialize_simple_string("OK");
+    }
+    if (sub == "GET" && args.size() >= 3)
+    {
+        std::vector<std::string> pairs;
+        for (const ConfigParameter &parameter : CONFIG_PARAMETERS)
+        {
+            bool matches = std::any_of(args.begin() + 2, args.end(), [&](const std::string &pattern)
+                                       {
+                                           std::string lowered = pattern;
+                                           std::transform(lowered.begin(), lowered.end(), lowered.begin(), ::tolower);
+                                           return glob_match(lowered, parameter.name); });
+            if (!matches)
+                continue;
+            pairs.push_back(parameter.name);
+            pairs.push_back(parameter.get(client.server));
+        }
+        return RESPHandler::serialize_array(pairs);
+    }
+    if (sub == "SET" && args.size() >= 4 && args.size() % 2 == 0)
+    {
+        for (size_t i = 2; i < args.size(); i += 2)
+        {
+            std::string name = args[i];
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            const ConfigParameter *parameter = nullptr;
+            for (const ConfigParameter &candidate : CONFIG_PARAMETERS)
+            {
+                if (name == candidate.name)
+                    parameter = &candidate;
+            }
+            if (parameter == nullptr)
+                return RESPHandler::serialize_error("ERR Unknown option or number of arguments for CONFIG SET - '" + args[i] + "'");
+            if (!parameter->set(client.server, args[i + 1]))
+                return RESPHandler::serialize_error("ERR CONFIG SET failed (possibly related to argument '" + args[i] + "') - argument couldn't be parsed into an integer");
+        }
+        return RESPHandler::serialize_simple_string("OK");
+    }
+    return RESPHandler::serialize_error("ERR unknown subcommand or wrong number of arguments for '" + args[1] + "'. Try CONFIG HELP.");
+}
+
+std::string CommandDispatcher::handle_slowlog(const std::vector<std::string> &args, Connection &client)
+{
+    // SLOWLOG GET [count] | SLOWLOG LEN | SLOWLOG RESET
+    if (args.size() < 2)
+        return wrong_number_of_arguments("slowlog");
+
+    SlowLog &slowlog = client.server.slowlog;
+    std::string sub = args[1];
+    std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    if (sub == "GET" && args.size() <= 3)
+    {
+        long long count = 10;
+        if (args.size() == 3 && (!parse_integer(args[2], count) || count < -1))
+            return RESPHandler::serialize_error("ERR count should be greater than or equal to -1");
+        return slowlog.get(count);
+    }
+    if (sub == "LEN" && args.size() == 2)
+        return RESPHandler::serialize_integer(slowlog.length());
+    if (sub == "RESET" && args.size() == 2)
+    {
+        slowlog.reset();
+        return RESPHandler::serialize_simple_string("OK");
+    }
+    return RESPHandler::serialize_error("ERR unknown subcommand or wrong number of arguments for '" + args[1] + "'. Try SLOWLOG HELP.");
+}
+
+std::string CommandDispatcher::handle_latency(const std::vector<std::string> &args, Connection &client)
+{
+    // LATENCY LATEST | LATENCY HISTORY event | LATENCY RESET [event ...] | LATENCY DOCTOR
+    if (args.size() < 2)
+        return wrong_number_of_arguments("latency");
+
+    LatencyMonitor &latency = client.server.latency;
+    std::string sub = args[1];
+    std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    if (sub == "LATEST" && args.size() == 2)
+        return latency.latest();
+    if (sub == "HISTORY" && args.size() == 3)
+        return latency.history(args[2]);
+    if (sub == "RESET")
+        return RESPHandler::serialize_integer(latency.reset(std::vector<std::string>(args.begin() + 2, args.end())));
+    if (sub == "DOCTOR" && args.size() == 2)
+        return RESPHandler::serialize_bulk_string(latency.doctor());
+    return RESPHandler::serialize_error("ERR unknown subcommand or wrong number of arguments for '" + args[1] + "'. Try LATENCY HELP.");
+}
+
+// CLIENT LIST / KILL TYPE: primary links are "master", connections of our replicas
+// "replica", subscribed clients "pubsub", everything else "normal"
+static bool client_has_type(const Connection &connection, const std::string &type)
+{
+    bool replica = connection.replica_state.stage != Replication::ReplicaState::NONE;
+    bool pubsub = connection.subscription_count() > 0;
+    if (type == "MASTER")
+        return connection.is_master;
+    if (type == "REPLICA" || type == "SLAVE")
+        return replica;
+    if (type == "PUBSUB")
+        return pubsub;
+    return !connection.is_master && !replica && !pubsub;
+}
+
+static bool valid_client_type(const std::string &type)
+{
+    return type == "NORMAL" || type == "MASTER" || type == "REPLICA" || type == "SLAVE" || type == "PUBSUB";
+}
+
+std::string CommandDispatcher::handle_client(const std::vector<std::string> &args, Connection &client)
+{
+    // CLIENT ID | INFO | LIST [TYPE type] [ID id ...] | SETNAME name | GETNAME | KILL ...
+    if (args.size() < 2)
+        return wrong_number_of_arguments("client");
+
+    Server &server = client.server;
+    std::string sub = args[1];
+    std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+
+    if (sub == "ID" && args.size() == 2)
+        return RESPHandler::serialize_integer(client.id);
+    if (sub == "INFO" && args.size() == 2)
+        return RESPHandler::serialize_bulk_string(client.describe() + "\n");
+    if (sub == "GETNAME" && args.size() == 2)
+        return client.name.empty() ? "$-1\r\n" : RESPHandler::serialize_bulk_string(client.name);
+    if (sub == "SETNAME" && args.size() == 3)
+    {
+        // The name goes into the space separated CLIENT LIST line as is
+        for (unsigned char c : args[2])
+        {
+            if (c <= ' ' || c > '~')
+                return RESPHandler::serialize_error("ERR Client names cannot contain spaces, newlines or special characters.");
+        }
+        client.name = args[2];
+        return RESPHandler::serialize_simple_string("OK");
+    }
+
+    if (sub == "LIST")
+    {
+        std::string type;
+        std::unordered_set<uint64_t> ids;
+        for (size_t i = 2; i < args.size(); i++)
+        {
+            std::string option = args[i];
+            std::transform(option.begin(), option.end(), option.begin(), ::toupper);
+            if (option == "TYPE" && i + 1 < args.size())
+            {
+                type = args[++i];
+                std::transform(type.begin(), type.end(), type.begin(), ::toupper);
+                if (!valid_client_type(type))
+                    return RESPHandler::serialize_error("ERR Unknown client type '" + args[i] + "'");
+            }
+            else if (option == "ID" && i + 1 < args.size())
+            {
+                while (i + 1 < args.size())
+                {
+                    long long id;
+                    if (!parse_integer(args[++i], id) || id <= 0)
+                        return RESPHandler::serialize_error("ERR Invalid client ID");
+                    ids.insert(id);
+                }
+            }
+            else
+            {
+                return RESPHandler::serialize_error("ERR syntax error");
+            }
+        }
+
+        std::string text;
+        for (Connection *connection : server.clients())
+        {
+            if (!type.empty() && !client_has_type(*connection, type))
+                continue;
+            if (!ids.empty() && ids.count(connection->id) == 0)
+                continue;
+            text += connection->describe() + "\n";
+        }
+        return RESPHandler::serialize_bulk_string(text);
+    }
+
+    if (sub == "KILL" && args.size() == 3)
+    {
+        // Old form: CLIENT KILL ip:port
+        for (Connection *connection : server.clients())
+        {
+            if (connection->address != args[2])
+                continue;
+            if (connection == &client)
+                client.close_after_reply = true;
+            else
+                connection->schedule_close();
+            return RESPHandler::serialize_simple_string("OK");
+        }
+        return RESPHandler::serialize_error("ERR No such client");
+    }
+    if (sub == "KILL" && args.size() >= 4 && args.size() % 2 == 0)
+    {
+        // CLIENT KILL <filter> <value> ...: every filter has to match; replies with the count
+        long long id = 0;
+        long long max_age = 0;
+        std::string address, type;
+        bool skip_me = true;
+        for (size_t i = 2; i < args.size(); i += 2)
+        {
+            std::string filter = args[i];
+            std::transform(filter.begin(), filter.end(), filter.begin(), ::toupper);
+            std::string value = args[i + 1];
+            if (filter == "ID")
+            {
+                if (!parse_integer(value, id) || id <= 0)
+                    return RESPHandler::serialize_error("ERR client-id should be greater than 0");
+            }
+            else if (filter == "ADDR")
+                address = value;
+            else if (filter == "TYPE")
+            {
+                type = value;
+                std::transform(type.begin(), type.end(), type.begin(), ::toupper);
+                if (!valid_client_type(type))
+                    return RESPHandler::serialize_error("ERR Unknown client type '" + value + "'");
+            }
+            else if (filter == "SKIPME")
+            {
+                std::transform(value.begin(), value.end(), value.begin(), ::toupper);
+                if (value != "YES" && value != "NO")
+                    return RESPHandler::serialize_error("ERR syntax error");
+                skip_me = value == "YES";
+            }
+            else if (filter == "MAXAGE")
+            {
+                if (!parse_integer(value, max_age) || max_age <= 0)
+                    return RESPHandler::serialize_error("ERR syntax error");
+            }
+            else
+                return RESPHandler::serialize_error("ERR syntax error");
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        long long killed = 0;
+        for (Connection *connection : server.clients())
+        {
+            if ((id != 0 && connection->id != (uint64_t)id) ||
+                (!address.empty() && connection->address != address) ||
+                (!type.empty() && !client_has_type(*connection, type)) ||
+                (skip_me && connection == &client) ||
+                (max_age != 0 && now - connection->created < std::chrono::seconds(max_age)) ||
+                connection->want_close)
+                continue;
+            if (connection == &client)
+                client.close_after_reply = true;
+            else
+                connection->schedule_close();
+            killed++;
+        }
+        return RESPHandler::serialize_integer(killed);
+    }
+    return RESPHandler::serialize_error("ERR unknown subcommand or wrong number of arguments for '" + args[1] + "'. Try CLIENT HELP.");
+}
+
+// The "# Memory" section of INFO. Overhead is what the server spends around the data:
+// what it took at startup (the replication backlog included), client buffers, the AOF
+// buffers, the keyspace table and the connection pool; the dataset is the rest.
+static std::string memory_info(Server &server, KeyValueStore &store)
+{
+    size_t used = used_memory();
+    size_t peak = std::max(peak_memory(), used);
+    size_t rss = resident_set_bytes();
+
+    size_t clients_normal = 0, clients_replicas = 0;
+    for (Connection *connection : server.clients())
+    {
+        if (connection->replica_state.stage != Replication::ReplicaState::NONE)
+            clients_replicas += connection->memory_usage();
+        else
+            clients_normal += connection->memory_usage();
+    }
+    size_t aof_buffer = server.aof.buffer_memory();
+    size_t keyspace = store.overhead_bytes();
+    size_t pooled = server.connection_pool.memory_usage();
+    size_t overhead = server.startup_memory + clients_normal + clients_replicas + aof_buffer + keyspace + pooled;
+    size_t dataset = used > overhead ? used - overhead : 0;
+    size_t net = used > server.startup_memory ? used - server.startup_memory : 0;
+
+    char ratio[32];
+    std::string section = "# Memory\r\n";
+    section += "used_memory:" + std::to_string(used) + "\r\n";
+    section += "used_memory_human:" + bytes_to_human(used) + "\r\n";
+    section += "used_memory_rss:" + std::to_string(rss) + "\r\n";
+    section += "used_memory_rss_human:" + bytes_to_human(rss) + "\r\n";
+    section += "used_memory_peak:" + std::to_string(peak) + "\r\n";
+    section += "used_memory_peak_human:" + bytes_to_human(peak) + "\r\n";
+    snprintf(ratio, sizeof(ratio), "%.2f%%", peak ? 100.0 * used / peak : 0);
+    section += "used_memory_peak_perc:" + std::string(ratio) + "\r\n";
+    section += "used_memory_overhead:" + std::to_string(overhead) + "\r\n";
+    section += "used_memory_startup:" + std::to_string(server.startup_memory) + "\r\n";
+    section += "used_memory_dataset:" + std::to_string(dataset) + "\r\n";
+    snprintf(ratio, sizeof(ratio), "%.2f%%", net ? 100.0 * dataset / net : 0);
+    section += "used_memory_dataset_perc:" + std::string(ratio) + "\r\n";
+    section += "mem_clients_normal:" + std::to_string(clients_normal) + "\r\n";
+    section += "mem_clients_slaves:" + std::to_string(clients_replicas) + "\r\n";
+    section += "mem_replication_backlog:" + std::to_string(server.replication.backlog_memory()) + "\r\n";
+    section += "mem_aof_buffer:" + std::to_string(aof_buffer) + "\r\n";
+    section += "mem_keyspace_overhead:" + std::to_string(keyspace) + "\r\n";
+    section += "mem_connection_pool:" + std::to_string(pooled) + "\r\n";
+    snprintf(ratio, sizeof(ratio), "%.2f", used ? (double)rss / used : 0);
+    section += "mem_fragmentation_ratio:" + std::string(ratio) + "\r\n";
+    section += "mem_fragmentation_bytes:" + std::to_string((long long)rss - (long long)used) + "\r\n";
+    section += "mem_allocator:libc\r\n";
+    return section;
+}
+
+std::string CommandDispatcher::handle_memory(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    // MEMORY USAGE key [SAMPLES count]
+    if (args.size() < 2)
+        return wrong_number_of_arguments("memory");
+
+    std::string sub = args[1];
+    std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    if (sub == "USAGE" && (args.size() == 3 || args.size() == 5))
+    {
+        long long samples = 5;
+        if (args.size() == 5)
+        {
+            std::string option = args[3];
+            std::transform(option.begin(), option.end(), option.begin(), ::toupper);
+            if (option != "SAMPLES")
+                return RESPHandler::serialize_error("ERR syntax error");
+            if (!parse_integer(args[4], samples) || samples < 0)
+                return RESPHandler::serialize_error("ERR value is out of range, must be positive");
+        }
+        KeyValueStore::ValueEntry *entry = store.find(args[2]);
+        if (entry == nullptr)
+            return "$-1\r\n";
+        return RESPHandler::serialize_integer(KeyValueStore::memory_usage(args[2], *entry, samples));
+    }
+    return RESPHandler::serialize_error("ERR unknown subcommand or wrong number of arguments for '" + args[1] + "'. Try MEMORY HELP.");
+}
+
+std::string CommandDispatcher::handle_hotkeys(const std::vector<std::string> &args, Connection &client)
+{
+    // HOTKEYS [COUNT count] | HOTKEYS RESET
+    HotKeys &hotkeys = client.server.hotkeys;
+    if (!hotkeys.enabled())
+        return RESPHandler::serialize_error("ERR hot key tracking is off, turn it on with CONFIG SET hotkeys yes");
+
+    std::string option = args.size() > 1 ? args[1] : "";
+    std::transform(option.begin(), option.end(), option.begin(), ::toupper);
+    if (args.size() == 2 && option == "RESET")
+    {
+        hotkeys.reset();
+        return RESPHandler::serialize_simple_string("OK");
+    }
+    long long count = 10;
+    if (args.size() == 3 && option == "COUNT")
+    {
+        if (!parse_integer(args[2], count) || count <= 0)
+            return RESPHandler::serialize_error("ERR value is out of range, must be positive");
+    }
+    else if (args.size() != 1)
+    {
+        return RESPHandler::serialize_error("ERR syntax error");
+    }
+    return hotkeys.top(count);
+}
+
+std::string CommandDispatcher::handle_info(const std::vector<std::string> &args, KeyValueStore &store, Connection &client)
+{
+    // INFO [section ...]. Without arguments (or with all/everything/default) every section is returned.
+    std::unordered_set<std::string> wanted;
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        std::string section = args[i];
+        std::transform(section.begin(), section.end(), section.begin(), ::tolower);
+        wanted.insert(section);
+    }
+    bool everything = wanted.empty() || wanted.count("all") || wanted.count("everything") || wanted.count("default");
+    auto include = [&](const char *section)
+    { return everything || wanted.count(section) > 0; };
+    // The per-command sections are long, so like in Redis they are not part of the default
+    auto include_extra = [&](const char *section)
+    { return wanted.count("all") || wanted.count("everything") || wanted.count(section) > 0; };
+
+    Server &server = client.server;
+    std::string text;
+    auto add_section = [&](const std::string &section)
+    {
+        if (!text.empty())
+            text += "\r\n";
+        text += section;
+    };
+
+    if (include("server"))
+    {
+        auto uptime = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - server.start_time);
+        std::string section = "# Server\r\n";
+        section += "redis_version:7.0.0\r\n";
+        section += "process_id:" + std::to_string(getpid()) + "\r\n";
+        section += "tcp_port:" + std::to_string(server.config.port) + "\r\n";
+        section += "uptime_in_seconds:" + std::to_string(uptime.count()) + "\r\n";
+        add_section(section);
+    }
+    if (include("clients"))
+    {
+        // The biggest buffers right now point at the clients to look at with CLIENT LIST
+        size_t max_input = 0, max_output = 0, blocked = 0, pubsub = 0;
+        for (Connection *connection : server.clients())
+        {
+            max_input = std::max(max_input, connection->incoming_message.size());
+            max_output = std::max(max_output, connection->output_buffer_size());
+            blocked += connection->blocked ? 1 : 0;
+            pubsub += connection->subscription_count() > 0 ? 1 : 0;
+        }
+        std::string section = "# Clients\r\n";
+        section += "connected_clients:" + std::to_string(server.connected_clients()) + "\r\n";
+        section += "client_recent_max_input_buffer:" + std::to_string(max_input) + "\r\n";
+        section += "client_recent_max_output_buffer:" + std::to_string(max_output) + "\r\n";
+        section += "blocked_clients:" + std::to_string(blocked) + "\r\n";
+        section += "pubsub_clients:" + std::to_string(pubsub) + "\r\n";
+        add_section(section);
+    }
+    if (include("memory"))
+    {
+        add_section(memory_info(server, store));
+    }
+    if (include("stats"))
+    {
+        add_section(server.stats.info_stats(store.expired_count()) + server.connection_pool.info());
+    }
+    if (include("persistence"))
+    {
+        add_section(server.persistence.info() + server.aof.info());
+    }
+    if (include("replication"))
+    {
+        add_section(server.replication.info());
+    }
+    if (include("cluster"))
+    {
+        add_section(server.cluster.info());
+    }
+    if (include_extra("commandstats"))
+    {
+        add_section(server.stats.info_commandstats());
+    }
+    if (include_extra("latencystats"))
+    {
+        add_section(server.stats.info_latencystats());
+    }
+    if (include("keyspace"))
+    {
+        std::string section = "# Keyspace\r\n";
+        size_t keys = store.size();
+        if (keys > 0)
+            section += "db0:keys=" + std::to_string(keys) + "\r\n";
+        add_section(section);
+    }
+
+    return RESPHandler::serialize_bulk_string(text);
+}
+
+std::string CommandDispatcher::handle_scan(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    // SCAN cursor [MATCH pattern] [COUNT count] [TYPE type]
+    if (args.size() < 2)
+        return wrong_number_of_arguments("scan");
+
+    unsigned long cursor;
+    auto [end, ec] = std::from_chars(args[1].data(), args[1].data() + args[1].size(), cursor);
+    if (ec != std::errc() || end != args[1].data() + args[1].size())
+        return RESPHandler::serialize_error("ERR invalid cursor");
+
+    const std::string *pattern = nullptr;
+    const std::string *type = nullptr;
+    long long count = 10;
+    for (size_t i = 2; i < args.size(); i += 2)
+    {
+        if (i + 1 >= args.size())
+            return RESPHandler::serialize_error("ERR syntax error");
+
+        if (args[i] == "MATCH")
+        {
+            pattern = &args[i + 1];
+        }
+        else if (args[i] == "COUNT")
+        {
+            if (!parse_integer(args[i + 1], count))
+                return RESPHandler::serialize_error("ERR value is not an integer or out of range");
+            if (count < 1)
+                return RESPHandler::serialize_error("ERR syntax error");
+        }
+        else if (args[i] == "TYPE")
+        {
+            type = &args[i + 1];
+        }
+        else
+        {
+            return RESPHandler::serialize_error("ERR syntax error");
+        }
+    }
+
+    // COUNT is a hint for the amount of work: walk buckets until we have that many keys,
+    // but give up after a bounded number of (possibly empty) buckets
+    std::vector<std::string> keys;
+    std::vector<std::string> expired;
+    long long max_buckets = count * 10;
+    do
+    {
+        cursor = store.scan(cursor, [&](const std::string &key, KeyValueStore::ValueEntry &entry)
+                            {
+                                if (KeyValueStore::is_expired(entry))
+                                {
+                                    expired.push_back(key);
+                                    return;
+                                }
+                                if (pattern && !glob_match(*pattern, key))
+                                    return;
+                                if (type && *type != type_name(entry.type))
+                                    return;
+                                keys.push_back(key); });
+    } while (cursor != 0 && --max_buckets > 0 && (long long)keys.size() < count);
+
+    // Expired keys can only be removed once the bucket walk is over
+    for (const std::string &key : expired)
+    {
+        store.find(key);
+    }
+
+    std::string response = RESPHandler::serialize_array_header(2);
+    response += RESPHandler::serialize_bulk_string(std::to_string(cursor));
+    response += RESPHandler::serialize_array(keys);
     return response;
 }
-std::string CommandDispatcher::handle_get(const std::vector<std::string> &args, KeyValueStore &store)
+
+std::string CommandDispatcher::handle_keys(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    if (args.size() != 2)
+        return wrong_number_of_arguments("keys");
+
+    const std::string &pattern = args[1];
+    bool match_all = pattern == "*";
+
+    std::vector<std::string> keys;
+    store.for_each([&](const std::string &key, KeyValueStore::ValueEntry &entry)
+                   {
+                       if (KeyValueStore::is_expired(entry))
+                           return;
+                       if (match_all || glob_match(pattern, key))
+                           keys.push_back(key); });
+    return RESPHandler::serialize_array(keys);
+}
+
+std::string CommandDispatcher::handle_del(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    if (args.size() < 2)
+        return wrong_number_of_arguments("del");
+
+    // find first, so a key that expired but is still stored is not counted
+    long long deleted = 0;
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        if (store.find(args[i]) != nullptr && store.erase(args[i]))
+            deleted++;
+    }
+    return RESPHandler::serialize_integer(deleted);
+}
+
+std::string CommandDispatcher::handle_push(const std::vector<std::string> &args, KeyValueStore &store, Connection &client, bool left)
+{
+    // LPUSH/RPUSH key element [element ...]
+    if (args.size() < 3)
+        return wrong_number_of_arguments(left ? "lpush" : "rpush");
+
+    bool wrong_type;
+    ListObject *list = lookup_list(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (list == nullptr)
+        list = &store.create<ListObject>(args[1], ValueType::LIST);
+
+    for (size_t i = 2; i < args.size(); i++)
+    {
+        if (left)
+            list->items.push_front(args[i]);
+        else
+            list->items.push_back(args[i]);
+    }
+    long long length = list->items.size();
+
+    // Wake up clients parked on this key
+    client.server.blocking.signal_key_ready(args[1]);
+
+    return RESPHandler::serialize_integer(length);
+}
+
+std::string CommandDispatcher::handle_pop(const std::vector<std::string> &args, KeyValueStore &store, bool left)
 {
-    
+    // LPOP/RPOP key [count]
+    if (args.size() != 2 && args.size() != 3)
+        return wrong_number_of_arguments(left ? "lpop" : "rpop");
+
+    long long count = 1;
+    if (args.size() == 3 && (!parse_integer(args[2], count) || count < 0))
+        return RESPHandler::serialize_error("ERR value is out of range, must be positive");
+
+    bool wrong_type;
+    ListObject *list = lookup_list(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (list == nullptr)
+        return args.size() == 3 ? RESPHandler::serialize_null_array() : RESPHandler::serialize_null_bulk();
+
+    std::vector<std::string> popped;
+    while ((long long)popped.size() < count && !list->items.empty())
+    {
+        if (left)
+        {
+            popped.push_back(std::move(list->items.front()));
+            list->items.pop_front();
+        }
+        else
+        {
+            popped.push_back(std::move(list->items.back()));
+            list->items.pop_back();
+        }
+    }
+
+    // Empty lists are not kept around
+    if (list->items.empty())
+        store.erase(args[1]);
+
+    if (args.size() == 3)
+        return RESPHandler::serialize_array(popped);
+    return RESPHandler::serialize_bulk_string(popped[0]);
 }
-std::string CommandDispatcher::handle_set(const std::vector<std::string> &args, KeyValueStore &store)
+
+std::string CommandDispatcher::handle_blocking_pop(const std::vector<std::string> &args, KeyValueStore &store, Connection &client, bool left)
 {
+    // BLPOP/BRPOP key [key ...] timeout
+    if (args.size() < 3)
+        return wrong_number_of_arguments(left ? "blpop" : "brpop");
+
+    double timeout;
+    if (!parse_double(args.back(), timeout) || std::isinf(timeout))
+        return RESPHandler::serialize_error("ERR timeout is not a float or out of range");
+    if (timeout < 0)
+        return RESPHandler::serialize_error("ERR timeout is negative");
+
+    std::vector<std::string> keys(args.begin() + 1, args.end() - 1);
+
+    // Serve straight away if any of the lists has an element
+    for (const std::string &key : keys)
+    {
+        bool wrong_type;
+        ListObject *list = lookup_list(store, key, wrong_type);
+        if (wrong_type)
+            return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+        if (list == nullptr)
+            continue;
+
+        std::string value;
+        if (left)
+        {
+            value = std::move(list->items.front());
+            list->items.pop_front();
+        }
+        else
+        {
+            value = std::move(list->items.back());
+            list->items.pop_back();
+        }
+        if (list->items.empty())
+            store.erase(key);
+        client.rewritten_command = {left ? "LPOP" : "RPOP", key};
+        return RESPHandler::serialize_array({key, value});
+    }
+
+    // Otherwise park the connection. The reply is sent when it is served or times out.
+    std::optional<BlockingManager::TimePoint> deadline;
+    if (timeout > 0)
+    {
+        auto wait = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+        deadline = std::chrono::steady_clock::now() + wait;
+    }
+    client.server.blocking.block(&client, keys, left, deadline);
+    return "";
+}
+
+std::string CommandDispatcher::handle_llen(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    if (args.size() != 2)
+        return wrong_number_of_arguments("llen");
+
+    bool wrong_type;
+    ListObject *list = lookup_list(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (list == nullptr)
+        return RESPHandler::serialize_integer(0);
+    return RESPHandler::serialize_integer(list->items.size());
+}
+
+std::string CommandDispatcher::handle_lrange(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    if (args.size() != 4)
+        return wrong_number_of_arguments("lrange");
+
+    long long start, stop;
+    if (!parse_integer(args[2], start) || !parse_integer(args[3], stop))
+        return RESPHandler::serialize_error("ERR value is not an integer or out of range");
+
+    bool wrong_type;
+    ListObject *list = lookup_list(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (list == nullptr)
+        return RESPHandler::serialize_array_header(0);
+
+    // Negative indexes count from the end
+    long long length = (long long)list->items.size();
+    if (start < 0)
+        start = std::max(length + start, 0LL);
+    if (stop < 0)
+        stop = length + stop;
+    if (stop >= length)
+        stop = length - 1;
+    if (start > stop || start >= length)
+        return RESPHandler::serialize_array_header(0);
+
+    std::string response = RESPHandler::serialize_array_header(stop - start + 1);
+    for (long long i = start; i <= stop; i++)
+    {
+        response += RESPHandler::serialize_bulk_string(list->items[i]);
+    }
+    return response;
+}
+
+// One confirmation per (un)subscribed channel: [kind, channel, subscriptions left]
+static std::string subscription_reply(const std::string &kind, const std::string *channel, size_t count)
+{
+    std::string reply = RESPHandler::serialize_array_header(3);
+    reply += RESPHandler::serialize_bulk_string(kind);
+    reply += channel ? RESPHandler::serialize_bulk_string(*channel) : RESPHandler::serialize_null_bulk();
+    reply += RESPHandler::serialize_integer(count);
+    return reply;
+}
+
+std::string CommandDispatcher::handle_subscribe(const std::vector<std::string> &args, Connection &client, bool pattern)
+{
+    if (args.size() < 2)
+        return wrong_number_of_arguments(pattern ? "psubscribe" : "subscribe");
+
+    std::string response;
+    for (size_t i = 1; i < args.size(); i++)
+    {
+        if (pattern)
+            client.server.pubsub.psubscribe(&client, args[i]);
+        else
+            client.server.pubsub.subscribe(&client, args[i]);
+        response += subscription_reply(pattern ? "psubscribe" : "subscribe", &args[i], client.subscription_count());
+    }
+    return response;
+}
+
+std::string CommandDispatcher::handle_unsubscribe(const std::vector<std::string> &args, Connection &client, bool pattern)
+{
+    const char *kind = pattern ? "punsubscribe" : "unsubscribe";
+
+    // Without arguments, drop every subscription of this kind
+    std::vector<std::string> targets(args.begin() + 1, args.end());
+    if (targets.empty())
+    {
+        const auto &current = pattern ? client.subscribed_patterns : client.subscribed_channels;
+        targets.assign(current.begin(), current.end());
+        if (targets.empty())
+            return subscription_reply(kind, nullptr, client.subscription_count());
+    }
+
+    std::string response;
+    for (const std::string &target : targets)
+    {
+        if (pattern)
+            client.server.pubsub.punsubscribe(&client, target);
+        else
+            client.server.pubsub.unsubscribe(&client, target);
+        response += subscription_reply(kind, &target, client.subscription_count());
+    }
+    return response;
+}
+
+std::string CommandDispatcher::handle_publish(const std::vector<std::string> &args, Connection &client)
+{
+    if (args.size() != 3)
+        return wrong_number_of_arguments("publish");
+
+    return RESPHandler::serialize_integer(client.server.pubsub.publish(args[1], args[2]));
+}
+
+std::string CommandDispatcher::handle_hset(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    // HSET key field value [field value ...]
+    if (args.size() < 4 || args.size() % 2 != 0)
+        return wrong_number_of_arguments("hset");
+
+    bool wrong_type;
+    HashObject *hash = lookup_hash(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (hash == nullptr)
+        hash = &store.create<HashObject>(args[1], ValueType::HASH);
+
+    long long added = 0;
+    for (size_t i = 2; i < args.size(); i += 2)
+    {
+        if (hash->set(args[i], args[i + 1]))
+            added++;
+    }
+    return RESPHandler::serialize_integer(added);
+}
+
+std::string CommandDispatcher::handle_hget(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    if (args.size() != 3)
+        return wrong_number_of_arguments("hget");
+
+    bool wrong_type;
+    HashObject *hash = lookup_hash(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (hash == nullptr)
+        return RESPHandler::serialize_null_bulk();
+
+    std::optional<std::string> value = hash->get(args[2]);
+    if (!value.has_value())
+        return RESPHandler::serialize_null_bulk();
+    return RESPHandler::serialize_bulk_string(*value);
+}
+
+std::string CommandDispatcher::handle_hmget(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    if (args.size() < 3)
+        return wrong_number_of_arguments("hmget");
+
+    bool wrong_type;
+    HashObject *hash = lookup_hash(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+
+    std::string response = RESPHandler::serialize_array_header(args.size() - 2);
+    for (size_t i = 2; i < args.size(); i++)
+    {
+        std::optional<std::string> value = hash ? hash->get(args[i]) : std::nullopt;
+        if (value.has_value())
+            response += RESPHandler::serialize_bulk_string(*value);
+        else
+            response += RESPHandler::serialize_null_bulk();
+    }
+    return response;
+}
+
+std::string CommandDispatcher::handle_hdel(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    if (args.size() < 3)
+        return wrong_number_of_arguments("hdel");
+
+    bool wrong_type;
+    HashObject *hash = lookup_hash(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (hash == nullptr)
+        return RESPHandler::serialize_integer(0);
+
+    long long removed = 0;
+    for (size_t i = 2; i < args.size(); i++)
+    {
+        if (hash->remove(args[i]))
+            removed++;
+    }
+
+    // Empty hashes are not kept around
+    if (hash->size() == 0)
+        store.erase(args[1]);
+
+    return RESPHandler::serialize_integer(removed);
+}
+
+std::string CommandDispatcher::handle_hgetall(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    if (args.size() != 2)
+        return wrong_number_of_arguments("hgetall");
+
+    bool wrong_type;
+    HashObject *hash = lookup_hash(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (hash == nullptr)
+        return RESPHandler::serialize_array_header(0);
+
+    std::string response = RESPHandler::serialize_array_header(hash->size() * 2);
+    hash->for_each([&response](const std::string &field, const std::string &value)
+                   {
+                       response += RESPHandler::serialize_bulk_string(field);
+                       response += RESPHandler::serialize_bulk_string(value); });
+    return response;
+}
+
+std::string CommandDispatcher::handle_hincrby(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    if (args.size() != 4)
+        return wrong_number_of_arguments("hincrby");
+
+    long long increment;
+    if (!parse_integer(args[3], increment))
+        return RESPHandler::serialize_error("ERR value is not an integer or out of range");
+
+    bool wrong_type;
+    HashObject *hash = lookup_hash(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (hash == nullptr)
+        hash = &store.create<HashObject>(args[1], ValueType::HASH);
+
+    long long current = 0;
+    std::optional<std::string> existing = hash->get(args[2]);
+    if (existing.has_value() && !parse_integer(*existing, current))
+        return RESPHandler::serialize_error("ERR hash value is not an integer");
+
+    long long result;
+    if (__builtin_add_overflow(current, increment, &result))
+        return RESPHandler::serialize_error("ERR increment or decrement would overflow");
+
+    hash->set(args[2], std::to_string(result));
+    return RESPHandler::serialize_integer(result);
+}
+
+std::string CommandDispatcher::handle_hlen(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    if (args.size() != 2)
+        return wrong_number_of_arguments("hlen");
+
+    bool wrong_type;
+    HashObject *hash = lookup_hash(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (hash == nullptr)
+        return RESPHandler::serialize_integer(0);
+    return RESPHandler::serialize_integer(hash->size());
+}
+
+// Parses a ZRANGEBYSCORE bound: a number, "-inf"/"+inf", or "(number" for an exclusive bound
+static bool parse_score_bound(const std::string &s, double &value, bool &exclusive)
+{
+    exclusive = !s.empty() && s[0] == '(';
+    return parse_double(exclusive ? s.substr(1) : s, value);
+}
+
+// Appends one member (and optionally its score) of a range reply
+static void append_zset_element(std::string &response, std::string_view member, double score, bool with_scores)
+{
+    response += '$';
+    response += std::to_string(member.size());
+    response += "\r\n";
+    response += member;
+    response += "\r\n";
+    if (with_scores)
+        response += RESPHandler::serialize_bulk_string(format_double(score));
+}
+
+std::string CommandDispatcher::handle_zadd(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    // ZADD key [NX|XX] [GT|LT] [CH] [INCR] score member [score member ...]
+    if (args.size() < 4)
+        return wrong_number_of_arguments("zadd");
+
+    bool nx = false, xx = false, gt = false, lt = false, ch = false, incr = false;
+    size_t i = 2;
+    for (; i < args.size(); i++)
+    {
+        const std::string &flag = args[i];
+        if (flag == "NX")
+            nx = true;
+        else if (flag == "XX")
+            xx = true;
+        else if (flag == "GT")
+            gt = true;
+        else if (flag == "LT")
+            lt = true;
+        else if (flag == "CH")
+            ch = true;
+        else if (flag == "INCR")
+            incr = true;
+        else
+            break;
+    }
+
+    size_t pairs_count = args.size() - i;
+    if (pairs_count == 0 || pairs_count % 2 != 0)
+        return RESPHandler::serialize_error("ERR syntax error");
+    if (nx && xx)
+        return RESPHandler::serialize_error("ERR XX and NX options at the same time are not compatible");
+    if ((gt && lt) || (gt && nx) || (lt && nx))
+        return RESPHandler::serialize_error("ERR GT, LT, and/or NX options at the same time are not compatible");
+    if (incr && pairs_count > 2)
+        return RESPHandler::serialize_error("ERR INCR option supports a single increment-element pair");
+
+    // Validate every score before touching the set
+    std::vector<double> scores;
+    scores.reserve(pairs_count / 2);
+    for (size_t j = i; j < args.size(); j += 2)
+    {
+        double score;
+        if (!parse_double(args[j], score))
+            return RESPHandler::serialize_error("ERR value is not a valid float");
+        scores.push_back(score);
+    }
+
+    bool wrong_type;
+    SortedSet *zset = lookup_zset(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (zset == nullptr)
+    {
+        if (xx)
+            return incr ? RESPHandler::serialize_null_bulk() : RESPHandler::serialize_integer(0);
+        zset = &store.create<SortedSet>(args[1], ValueType::ZSET);
+    }
+
+    long long added = 0;
+    long long updated = 0;
+    std::optional<double> incr_result;
+    for (size_t j = 0; j < scores.size(); j++)
+    {
+        const std::string &member = args[i + j * 2 + 1];
+        double score = scores[j];
+        std::optional<double> current = zset->score(member);
+
+        if (current.has_value())
+        {
+            if (nx)
+                continue;
+            if (incr)
+            {
+                score += *current;
+                if (std::isnan(score))
+                    return RESPHandler::serialize_error("ERR resulting score is not a number (NaN)");
+            }
+            if ((gt && score <= *current) || (lt && score >= *current))
+                continue;
+            incr_result = score;
+            if (score != *current)
+            {
+                zset->insert(member, score);
+                updated++;
+            }
+        }
+        else
+        {
+            if (xx)
+                continue;
+            zset->insert(member, score);
+            incr_result = score;
+            added++;
+        }
+    }
+
+    if (zset->size() == 0)
+        store.erase(args[1]);
+
+    if (incr)
+    {
+        if (!incr_result.has_value())
+            return RESPHandler::serialize_null_bulk();
+        return RESPHandler::serialize_bulk_string(format_double(*incr_result));
+    }
+    return RESPHandler::serialize_integer(ch ? added + updated : added);
+}
+
+std::string CommandDispatcher::handle_zrem(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    if (args.size() < 3)
+        return wrong_number_of_arguments("zrem");
+
+    bool wrong_type;
+    SortedSet *zset = lookup_zset(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (zset == nullptr)
+        return RESPHandler::serialize_integer(0);
+
+    long long removed = 0;
+    for (size_t i = 2; i < args.size(); i++)
+    {
+        if (zset->remove(args[i]))
+            removed++;
+    }
+
+    // Empty sorted sets are not kept around
+    if (zset->size() == 0)
+        store.erase(args[1]);
+
+    return RESPHandler::serialize_integer(removed);
+}
+
+std::string CommandDispatcher::handle_zscore(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    if (args.size() != 3)
+        return wrong_number_of_arguments("zscore");
+
+    bool wrong_type;
+    SortedSet *zset = lookup_zset(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+
+    std::optional<double> score = zset ? zset->score(args[2]) : std::nullopt;
+    if (!score.has_value())
+        return RESPHandler::serialize_null_bulk();
+    return RESPHandler::serialize_bulk_string(format_double(*score));
+}
+
+std::string CommandDispatcher::handle_zincrby(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    if (args.size() != 4)
+        return wrong_number_of_arguments("zincrby");
+
+    double increment;
+    if (!parse_double(args[2], increment))
+        return RESPHandler::serialize_error("ERR value is not a valid float");
+
+    bool wrong_type;
+    SortedSet *zset = lookup_zset(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (zset == nullptr)
+        zset = &store.create<SortedSet>(args[1], ValueType::ZSET);
+
+    double score = zset->score(args[3]).value_or(0) + increment;
+    if (std::isnan(score))
+        return RESPHandler::serialize_error("ERR resulting score is not a number (NaN)");
+
+    zset->insert(args[3], score);
+    return RESPHandler::serialize_bulk_string(format_double(score));
+}
+
+std::string CommandDispatcher::handle_zrank(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    if (args.size() != 3)
+        return wrong_number_of_arguments("zrank");
+
+    bool wrong_type;
+    SortedSet *zset = lookup_zset(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+
+    std::optional<size_t> rank = zset ? zset->rank(args[2], false) : std::nullopt;
+    if (!rank.has_value())
+        return RESPHandler::serialize_null_bulk();
+    return RESPHandler::serialize_integer(*rank);
+}
+
+std::string CommandDispatcher::handle_zrange(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    // ZRANGE key start stop [REV] [WITHSCORES]
+    if (args.size() < 4)
+        return wrong_number_of_arguments("zrange");
+
+    long long start, stop;
+    if (!parse_integer(args[2], start) || !parse_integer(args[3], stop))
+        return RESPHandler::serialize_error("ERR value is not an integer or out of range");
+
+    bool reverse = false, with_scores = false;
+    for (size_t i = 4; i < args.size(); i++)
+    {
+        if (args[i] == "REV")
+            reverse = true;
+        else if (args[i] == "WITHSCORES")
+            with_scores = true;
+        else
+            return RESPHandler::serialize_error("ERR syntax error");
+    }
+
+    bool wrong_type;
+    SortedSet *zset = lookup_zset(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (zset == nullptr)
+        return RESPHandler::serialize_array_header(0);
+
+    // Negative indexes count from the end
+    long long length = (long long)zset->size();
+    if (start < 0)
+        start = std::max(length + start, 0LL);
+    if (stop < 0)
+        stop = length + stop;
+    if (stop >= length)
+        stop = length - 1;
+    if (start > stop || start >= length)
+        return RESPHandler::serialize_array_header(0);
+
+    size_t count = stop - start + 1;
+    std::string response = RESPHandler::serialize_array_header(with_scores ? count * 2 : count);
+    zset->range_by_rank(start, stop, reverse, [&](std::string_view member, double score)
+                        { append_zset_element(response, member, score, with_scores); });
+    return response;
+}
+
+std::string CommandDispatcher::handle_zrangebyscore(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    // ZRANGEBYSCORE key min max [WITHSCORES] [LIMIT offset count]
+    if (args.size() < 4)
+        return wrong_number_of_arguments("zrangebyscore");
+
+    ScoreRange range;
+    if (!parse_score_bound(args[2], range.min, range.min_exclusive) ||
+        !parse_score_bound(args[3], range.max, range.max_exclusive))
+        return RESPHandler::serialize_error("ERR min or max is not a float");
+
+    bool with_scores = false;
+    long long offset = 0, count = -1;
+    for (size_t i = 4; i < args.size(); i++)
+    {
+        if (args[i] == "WITHSCORES")
+        {
+            with_scores = true;
+        }
+        else if (args[i] == "LIMIT" && i + 2 < args.size())
+        {
+            if (!parse_integer(args[i + 1], offset) || !parse_integer(args[i + 2], count))
+                return RESPHandler::serialize_error("ERR value is not an integer or out of range");
+            i += 2;
+        }
+        else
+        {
+            return RESPHandler::serialize_error("ERR syntax error");
+        }
+    }
+
+    bool wrong_type;
+    SortedSet *zset = lookup_zset(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (zset == nullptr || offset < 0)
+        return RESPHandler::serialize_array_header(0);
+
+    // The element count is only known after the walk, so the header is prepended at the end
+    std::string elements;
+    size_t matched = 0;
+    zset->range_by_score(range, offset, count, [&](std::string_view member, double score)
+                         {
+                             append_zset_element(elements, member, score, with_scores);
+                             matched++; });
+
+    return RESPHandler::serialize_array_header(with_scores ? matched * 2 : matched) + elements;
+}
+
+std::string CommandDispatcher::handle_zcard(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    if (args.size() != 2)
+        return wrong_number_of_arguments("zcard");
+
+    bool wrong_type;
+    SortedSet *zset = lookup_zset(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (zset == nullptr)
+        return RESPHandler::serialize_integer(0);
+    return RESPHandler::serialize_integer(zset->size());
+}
+
+// Parses "ms-seq", or just "ms" in which case the sequence number is default_seq
+static bool parse_stream_id(const std::string &s, StreamID &id, uint64_t default_seq)
+{
+    const char *begin = s.data();
+    const char *end = s.data() + s.size();
+    auto [ms_end, ms_ec] = std::from_chars(begin, end, id.ms);
+    if (ms_ec != std::errc() || ms_end == begin)
+        return false;
+    if (ms_end == end)
+    {
+        id.seq = default_seq;
+        return true;
+    }
+    if (*ms_end != '-')
+        return false;
+    auto [seq_end, seq_ec] = std::from_chars(ms_end + 1, end, id.seq);
+    return seq_ec == std::errc() && seq_end == end && seq_end != ms_end + 1;
+}
+
+struct StreamTrimOptions
+{
+    bool present = false;
+    bool by_length = true;
+    bool approximate = false;
+    long long max_length = 0;
+    StreamID min_id;
+};
+
+// Parses "MAXLEN|MINID [=|~] threshold" starting at args[i]. On success i is left on the
+// last consumed argument. Returns an error reply, or an empty string on success.
+static std::string parse_stream_trim(const std::vector<std::string> &args, size_t &i, StreamTrimOptions &options)
+{
+    options.present = true;
+    options.by_length = args[i] == "MAXLEN";
+    if (i + 1 < args.size() && (args[i + 1] == "~" || args[i + 1] == "="))
+    {
+        options.approximate = args[i + 1] == "~";
+        i++;
+    }
+    if (i + 1 >= args.size())
+        return RESPHandler::serialize_error("ERR syntax error");
+    i++;
+
+    if (options.by_length)
+    {
+        if (!parse_integer(args[i], options.max_length) || options.max_length < 0)
+            return RESPHandler::serialize_error("ERR The MAXLEN argument must be >= 0.");
+    }
+    else if (!parse_stream_id(args[i], options.min_id, 0))
+    {
+        return RESPHandler::serialize_error("ERR Invalid stream ID specified as stream command argument");
+    }
+    return "";
+}
+
+static size_t apply_stream_trim(Stream &stream, const StreamTrimOptions &options)
+{
+    if (options.by_length)
+        return stream.trim_by_length(options.max_length, options.approximate);
+    return stream.trim_by_min_id(options.min_id, options.approximate);
+}
+
+std::string CommandDispatcher::handle_xadd(const std::vector<std::string> &args, KeyValueStore &store, Connection &client)
+{
+    // XADD key [NOMKSTREAM] [MAXLEN|MINID [=|~] threshold] <* | ms-* | ms-seq> field value [field value ...]
+    if (args.size() < 5)
+        return wrong_number_of_arguments("xadd");
+
+    bool no_make_stream = false;
+    StreamTrimOptions trim;
+    size_t i = 2;
+    for (; i < args.size(); i++)
+    {
+        if (args[i] == "NOMKSTREAM")
+        {
+            no_make_stream = true;
+        }
+        else if (args[i] == "MAXLEN" || args[i] == "MINID")
+        {
+            std::string error = parse_stream_trim(args, i, trim);
+            if (!error.empty())
+                return error;
+        }
+        else
+        {
+            break;
+        }
+    }
+
+    size_t fields_count = args.size() > i ? args.size() - i - 1 : 0;
+    if (fields_count == 0 || fields_count % 2 != 0)
+        return wrong_number_of_arguments("xadd");
+
+    bool wrong_type;
+    Stream *stream = lookup_stream(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (stream == nullptr && no_make_stream)
+        return RESPHandler::serialize_null_bulk();
+
+    StreamID last = stream ? stream->last_id : StreamID{};
+    StreamID id;
+    const std::string &id_arg = args[i];
+
+    if (id_arg == "*")
+    {
+        // Fully auto-generated: current time, bumping the sequence if the clock has not moved on
+        uint64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                              std::chrono::system_clock::now().time_since_epoch())
+                              .count();
+        if (now_ms > last.ms)
+            id = {now_ms, 0};
+        else
+            id = {last.ms, last.seq + 1};
+    }
+    else if (id_arg.size() > 2 && id_arg.ends_with("-*"))
+    {
+        // Partially auto-generated: caller picks the millisecond, we pick the sequence
+        if (!parse_stream_id(id_arg.substr(0, id_arg.size() - 2), id, 0))
+            return RESPHandler::serialize_error("ERR Invalid stream ID specified as stream command argument");
+        if (stream && id.ms == last.ms)
+            id.seq = last.seq + 1;
+        else
+            id.seq = (id.ms == 0) ? 1 : 0;
+    }
+    else if (!parse_stream_id(id_arg, id, 0))
+    {
+        return RESPHandler::serialize_error("ERR Invalid stream ID specified as stream command argument");
+    }
+
+    if (id == StreamID{})
+        return RESPHandler::serialize_error("ERR The ID specified in XADD must be greater than 0-0");
+    if (stream && id <= last)
+        return RESPHandler::serialize_error("ERR The ID specified in XADD is equal or smaller than the target stream top item");
+
+    if (stream == nullptr)
+        stream = &store.create<Stream>(args[1], ValueType::STREAM);
+
+    stream->append(id, std::span<const std::string>(args).subspan(i + 1));
+    if (trim.present)
+        apply_stream_trim(*stream, trim);
+
+    // Log the ID that was picked, so replaying gives the same entry
+    if (id_arg != id.to_string())
+    {
+        client.rewritten_command = args;
+        client.rewritten_command[i] = id.to_string();
+    }
+
+    return RESPHandler::serialize_bulk_string(id.to_string());
+}
+
+// Parses an XRANGE bound: "-", "+", an ID, or "(ID" for an exclusive bound.
+// A bare millisecond means its first (for start) or last (for end) sequence number.
+static bool parse_range_bound(const std::string &s, bool is_start, StreamID &id, bool &empty_range)
+{
+    if (s == "-")
+    {
+        id = {0, 0};
+        return true;
+    }
+    if (s == "+")
+    {
+        id = {UINT64_MAX, UINT64_MAX};
+        return true;
+    }
+
+    bool exclusive = !s.empty() && s[0] == '(';
+    if (!parse_stream_id(exclusive ? s.substr(1) : s, id, is_start ? 0 : UINT64_MAX))
+        return false;
+    if (!exclusive)
+        return true;
+
+    // Exclusive bounds become the next/previous ID, and an overflow means nothing can match
+    if (is_start)
+    {
+        if (id.seq < UINT64_MAX)
+            id.seq++;
+        else if (id.ms < UINT64_MAX)
+            id = {id.ms + 1, 0};
+        else
+            empty_range = true;
+    }
+    else
+    {
+        if (id.seq > 0)
+            id.seq--;
+        else if (id.ms > 0)
+            id = {id.ms - 1, UINT64_MAX};
+        else
+            empty_range = true;
+    }
+    return true;
+}
+
+std::string CommandDispatcher::handle_xrange(const std::vector<std::string> &args, KeyValueStore &store, bool reverse)
+{
+    // XRANGE key start end [COUNT count]
+    // XREVRANGE key end start [COUNT count]
+    if (args.size() != 4 && args.size() != 6)
+        return wrong_number_of_arguments(reverse ? "xrevrange" : "xrange");
+
+    StreamID start, end;
+    bool empty_range = false;
+    const std::string &start_arg = reverse ? args[3] : args[2];
+    const std::string &end_arg = reverse ? args[2] : args[3];
+    if (!parse_range_bound(start_arg, true, start, empty_range) || !parse_range_bound(end_arg, false, end, empty_range))
+        return RESPHandler::serialize_error("ERR Invalid stream ID specified as stream command argument");
+
+    long long count = -1;
+    if (args.size() == 6)
+    {
+        if (args[4] != "COUNT")
+            return RESPHandler::serialize_error("ERR syntax error");
+        if (!parse_integer(args[5], count))
+            return RESPHandler::serialize_error("ERR value is not an integer or out of range");
+        if (count < 0)
+            count = 0;
+    }
+
+    bool wrong_type;
+    Stream *stream = lookup_stream(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (stream == nullptr || empty_range || start > end || count == 0)
+        return RESPHandler::serialize_array_header(0);
+
+    std::string elements;
+    size_t matched = 0;
+    stream->range(start, end, count, reverse, [&](const StreamID &id, const std::vector<std::string_view> &fields)
+                  {
+                      elements += "*2\r\n";
+                      elements += RESPHandler::serialize_bulk_string(id.to_string());
+                      elements += RESPHandler::serialize_array_header(fields.size());
+                      for (std::string_view field : fields)
+                      {
+                          elements += '$';
+                          elements += std::to_string(field.size());
+                          elements += "\r\n";
+                          elements += field;
+                          elements += "\r\n";
+                      }
+                      matched++; });
+
+    return RESPHandler::serialize_array_header(matched) + elements;
+}
+
+std::string CommandDispatcher::handle_xlen(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    if (args.size() != 2)
+        return wrong_number_of_arguments("xlen");
+
+    bool wrong_type;
+    Stream *stream = lookup_stream(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (stream == nullptr)
+        return RESPHandler::serialize_integer(0);
+    return RESPHandler::serialize_integer(stream->size());
+}
+
+std::string CommandDispatcher::handle_xtrim(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    // XTRIM key MAXLEN|MINID [=|~] threshold
+    if (args.size() < 4)
+        return wrong_number_of_arguments("xtrim");
+    if (args[2] != "MAXLEN" && args[2] != "MINID")
+        return RESPHandler::serialize_error("ERR syntax error");
+
+    StreamTrimOptions trim;
+    size_t i = 2;
+    std::string error = parse_stream_trim(args, i, trim);
+    if (!error.empty())
+        return error;
+    if (i + 1 != args.size())
+        return RESPHandler::serialize_error("ERR syntax error");
+
+    bool wrong_type;
+    Stream *stream = lookup_stream(store, args[1], wrong_type);
+    if (wrong_type)
+        return RESPHandler::serialize_error(WRONGTYPE_ERROR);
+    if (stream == nullptr)
+        return RESPHandler::serialize_integer(0);
+
+    return RESPHandler::serialize_integer(apply_stream_trim(*stream, trim));
+}
+
+std::string CommandDispatcher::handle_replicaof(const std::vector<std::string> &args, Connection &client)
+{
+    if (args.size() != 3)
+        return wrong_number_of_arguments(args[0] == "SLAVEOF" ? "slaveof" : "replicaof");
+
+    Replication &replication = client.server.replication;
+    std::string host = args[1], port_text = args[2];
+    std::transform(host.begin(), host.end(), host.begin(), ::tolower);
+    std::transform(port_text.begin(), port_text.end(), port_text.begin(), ::tolower);
+    if (host == "no" && port_text == "one")
+    {
+        replication.promote();
+        return RESPHandler::serialize_simple_string("OK");
+    }
+
+    long long port = 0;
+    if (client.server.cluster.enabled())
+        return RESPHandler::serialize_error("ERR REPLICAOF not allowed in cluster mode.");
+    if (!parse_integer(args[2], port) || port <= 0 || port > 65535)
+        return RESPHandler::serialize_error("ERR Invalid master port");
+    if (client.is_master)
+        return RESPHandler::serialize_error("ERR Command is not valid when client is a replica.");
+
+    replication.follow(args[1], (int)port);
+    return RESPHandler::serialize_simple_string("OK");
+}
+
+std::string CommandDispatcher::handle_psync(const std::vector<std::string> &args, Connection &client)
+{
+    // SYNC is the old form that always gets a full sync
+    if (args[0] == "SYNC")
+        return client.server.replication.handle_psync(client.server, client, "?", -1);
+
+    long long offset = 0;
+    if (args.size() != 3)
+        return wrong_number_of_arguments("psync");
+    if (!parse_integer(args[2], offset))
+        return RESPHandler::serialize_error("ERR value is not an integer or out of range");
+    return client.server.replication.handle_psync(client.server, client, args[1], offset);
+}
+
+std::string CommandDispatcher::handle_replconf(const std::vector<std::string> &args, Connection &client)
+{
+    if (args.size() < 3 || args.size() % 2 == 0)
+        return RESPHandler::serialize_error("ERR syntax error");
+    return client.server.replication.handle_replconf(client, args);
+}
+
+std::string CommandDispatcher::handle_asking(const std::vector<std::string> &args, Connection &client)
+{
+    if (args.size() != 1)
+        return wrong_number_of_arguments("asking");
+    if (!client.server.cluster.enabled())
+        return RESPHandler::serialize_error("ERR This instance has cluster support disabled");
+    client.asking = true;
+    return RESPHandler::serialize_simple_string("OK");
+}
+
+std::string CommandDispatcher::handle_dump(const std::vector<std::string> &args, KeyValueStore &store)
+{
+    if (args.size() != 2)
+        return wrong_number_of_arguments("dump");
+    KeyValueStore::ValueEntry *entry = store.find(args[1]);
+    if (entry == nullptr)
+        return RESPHandler::serialize_null_bulk();
+    return RESPHandler::serialize_bulk_string(rdb_dump_value(*entry));
+}
+
+std::string CommandDispatcher::handle_restore(const std::vector<std::string> &args, KeyValueStore &store, Connection &client)
+{
+    // RESTORE key ttl serialized-value [REPLACE] [ABSTTL]. RESTORE-ASKING is the same
+    // command, sent by MIGRATE to a node that is importing the slot.
+    if (args.size() < 4)
+        return wrong_number_of_arguments(args[0] == "RESTORE" ? "restore" : "restore-asking");
+
+    long long ttl = 0;
+    if (!parse_integer(args[2], ttl))
+        return RESPHandler::serialize_error("ERR value is not an integer or out of range");
+    if (ttl < 0)
+        return RESPHandler::serialize_error("ERR Invalid TTL value, must be >= 0");
+
+    bool replace = false, absolute_ttl = false;
+    for (size_t i = 4; i < args.size(); i++)
+    {
+        std::string option = args[i];
+        std::transform(option.begin(), option.end(), option.begin(), ::toupper);
+        if (option == "REPLACE")
+            replace = true;
+        else if (option == "ABSTTL")
+            absolute_ttl = true;
+        else
+            return RESPHandler::serialize_error("ERR syntax error");
+    }
+
+    const std::string &key = args[1];
+    if (!replace && store.find(key) != nullptr)
+        return RESPHandler::serialize_error("BUSYKEY Target key name already exists.");
+
+    KeyValueStore::ValueEntry entry;
+    std::string error;
+    if (!rdb_restore_value(args[3], entry, error))
+        return RESPHandler::serialize_error("ERR " + error);
+
+    if (ttl == 0)
+    {
+        store.set(key, entry);
+        return RESPHandler::serialize_simple_string("OK");
+    }
+
+    // The AOF and replicas get an absolute expiry, so replaying it later does not extend it
+    long long unix_now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+    long long at_ms = absolute_ttl ? ttl : unix_now + ttl;
+    if (at_ms <= unix_now)
+    {
+        // Already expired: the only effect is that a replaced key is gone
+        store.erase(key);
+        client.rewritten_command = {"DEL", key};
+        return RESPHandler::serialize_simple_string("OK");
+    }
+    entry.expires_at = std::chrono::steady_clock::now() + std::chrono::milliseconds(at_ms - unix_now);
+    store.set(key, entry);
+    client.rewritten_command = {"RESTORE", key, std::to_string(at_ms), args[3], "REPLACE", "ABSTTL"};
+    return RESPHandler::serialize_simple_string("OK");
+}
+
+// Connects to host:port, waiting at most timeout_ms. Returns a blocking socket whose reads
+// and writes time out after timeout_ms, or -1.
+static int connect_with_timeout(const std::string &host, const std::string &port, long long timeout_ms)
+{
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *addresses = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0 || addresses == nullptr)
+        return -1;
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    bool connected = false;
+    if (fd >= 0 && set_fd_nonblocking(fd) == 0)
+    {
+        if (connect(fd, addresses->ai_addr, addresses->ai_addrlen) == 0)
+        {
+            connected = true;
+        }
+        else if (errno == EINPROGRESS)
+        {
+            struct pollfd pending = {fd, POLLOUT, 0};
+            int error = 0;
+            socklen_t length = sizeof(error);
+            connected = poll(&pending, 1, (int)timeout_ms) == 1 &&
+                        getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &length) == 0 && error == 0;
+        }
+    }
+    freeaddrinfo(addresses);
+    if (!connected)
+    {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) & ~O_NONBLOCK);
+    struct timeval timeout = {(time_t)(timeout_ms / 1000), (suseconds_t)(timeout_ms % 1000) * 1000};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+std::string CommandDispatcher::handle_migrate(const std::vector<std::string> &args, KeyValueStore &store, Connection &client)
+{
+    // MIGRATE host port key|"" destination-db timeout [COPY] [REPLACE] [KEYS key [key ...]]
+    if (args.size() < 6)
+        return wrong_number_of_arguments("migrate");
+
+    long long db = 0, timeout_ms = 0;
+    if (!parse_integer(args[4], db) || !parse_integer(args[5], timeout_ms))
+        return RESPHandler::serialize_error("ERR value is not an integer or out of range");
+    if (db != 0)
+        return RESPHandler::serialize_error("ERR DB index is out of range");
+    if (timeout_ms <= 0)
+        timeout_ms = 1000;
+
+    bool copy = false, replace = false, keys_option = false;
+    for (size_t i = 6; i < args.size() && !keys_option; i++)
+    {
+        std::string option = args[i];
+        std::transform(option.begin(), option.end(), option.begin(), ::toupper);
+        if (option == "COPY")
+            copy = true;
+        else if (option == "REPLACE")
+            replace = true;
+        else if (option == "KEYS")
+            keys_option = true;
+        else
+            return RESPHandler::serialize_error("ERR syntax error");
+    }
+    if (keys_option && !args[3].empty())
+        return RESPHandler::serialize_error("ERR When using MIGRATE KEYS option, the key argument must be set to empty string");
+
+    // Serialize what is there, missing keys are simply skipped
+    struct Outgoing
+    {
+        std::string key;
+        std::string command;
+    };
+    std::vector<Outgoing> outgoing;
+    auto steady_now = std::chrono::steady_clock::now();
+    for (size_t index : command_keys(args))
+    {
+        KeyValueStore::ValueEntry *entry = store.find(args[index]);
+        if (entry == nullptr)
+            continue;
+        long long ttl = 0;
+        if (entry->expires_at.has_value())
+            ttl = std::max<long long>(1, std::chrono::duration_cast<std::chrono::milliseconds>(*entry->expires_at - steady_now).count());
+        std::vector<std::string> restore = {"RESTORE-ASKING", args[index], std::to_string(ttl), rdb_dump_value(*entry)};
+        if (replace)
+            restore.push_back("REPLACE");
+        outgoing.push_back({args[index], RESPHandler::serialize_array(restore)});
+    }
+    if (outgoing.empty())
+        return RESPHandler::serialize_simple_string("NOKEY");
+
+    int fd = connect_with_timeout(args[1], args[2], timeout_ms);
+    if (fd < 0)
+        return RESPHandler::serialize_error("IOERR error or timeout connecting to the client");
+
+    // The RESTOREs are pipelined in batches: one write and one round trip per batch
+    // instead of per key, with a bounded amount of buffered payload
+    const size_t MIGRATE_BATCH_KEYS = 100;
+    const size_t MIGRATE_BATCH_BYTES = 1024 * 1024;
+    std::vector<std::string> moved;
+    std::string target_error;
+    bool io_error = false;
+    size_t next = 0;
+    while (next < outgoing.size() && !io_error && target_error.empty())
+    {
+        std::string batch;
+        size_t first = next;
+        while (next < outgoing.size() && next - first < MIGRATE_BATCH_KEYS && batch.size() < MIGRATE_BATCH_BYTES)
+            batch += outgoing[next++].command;
+
+        size_t sent = 0;
+        while (sent < batch.size())
+        {
+            ssize_t n = send(fd, batch.data() + sent, batch.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0)
+            {
+                io_error = true;
+                break;
+            }
+            sent += n;
+        }
+
+        // Every RESTORE is answered with a single +OK or -ERR line
+        std::string replies;
+        size_t answered = first;
+        size_t line_start = 0;
+        char chunk[4096];
+        while (!io_error && answered < next)
+        {
+            size_t line_end = replies.find("\r\n", line_start);
+            if (line_end == std::string::npos)
+            {
+                ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+                if (n <= 0)
+                    io_error = true;
+                else
+                    replies.append(chunk, n);
+                continue;
+            }
+            if (replies[line_start] == '-')
+            {
+                if (target_error.empty())
+                    target_error = replies.substr(line_start + 1, line_end - line_start - 1);
+            }
+            else
+            {
+                moved.push_back(outgoing[answered].key);
+            }
+            answered++;
+            line_start = line_end + 2;
+        }
+    }
+    close(fd);
+
+    // Keys that made it are deleted here (unless COPY), even if a later one failed
+    if (!copy && !moved.empty())
+    {
+        for (const std::string &key : moved)
+            store.erase(key);
+        client.rewritten_command = {"DEL"};
+        client.rewritten_command.insert(client.rewritten_command.end(), moved.begin(), moved.end());
+    }
+
+    if (io_error)
+        return RESPHandler::serialize_error("IOERR error or timeout reading to target instance");
+    if (!target_error.empty())
+        return RESPHandler::serialize_error("ERR Target instance replied with error: " + target_error);
+    return RESPHandler::serialize_simple_string("OK");
 }
@@ -4,22 +4,100 @@
 #include<string>
 #include<vector>
 
+class Connection;
 
 class CommandDispatcher {
 public:
-    std::string dispatch(const std::vector<std::string>& args, KeyValueStore& store) {
-        if (args.empty()) return "";
-        std::string command = args[0];
-        
-        if (command == "PING") return handle_ping(args);
-        if (command == "GET")  return handle_get(args, store);
-        if (command == "SET")  return handle_set(args, store);
-        
-        return RESPHandler::serialize_error("unknown command");
-    }
+    // client is the connection the command arrived on, for commands that need more than the store
+    std::string dispatch(const std::vector<std::string>& args, KeyValueStore& store, Connection& client);
+
+    // True for commands that may modify the keyspace
+    static bool is_write_command(const std::string& command);
+
+    // True for the commands this server implements, here or in Connection. Only these
+    // names are kept in stats and shown back to clients, anything else a client sends
+    // could carry CR/LF into INFO.
+    static bool is_known_command(const std::string& command);
+
+    // Positions of the key arguments of a command (for cluster slot routing). Empty for
+    // commands without keys.
+    static std::vector<size_t> command_keys(const std::vector<std::string>& args);
 
 private:
-    std::string handle_ping(const std::vector<std::string>& args);
-    std::string handle_get(const std::vector<std::string>& args, KeyValueStore& store);
-    std::string handle_set(const std::vector<std::string>& args, KeyValueStore& store);
-};
\ No newline at end of file
+    // Bitmap commands
+    std::string handle_setbit(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_getbit(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_bitcount(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_bitpos(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_bitop(const std::vector<std::string>& args, KeyValueStore& store);
+
+    // HyperLogLog commands
+    std::string handle_pfadd(const std::vector<std::string>& args, KeyValueStore& store, Connection& client);
+    std::string handle_pfcount(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_pfmerge(const std::vector<std::string>& args, KeyValueStore& store);
+
+    // Server commands
+    std::string handle_save(const std::vector<std::string>& args, KeyValueStore& store, Connection& client, bool background);
+    std::string handle_bgrewriteaof(const std::vector<std::string>& args, KeyValueStore& store, Connection& client);
+    std::string handle_lastsave(const std::vector<std::string>& args, Connection& client);
+    std::string handle_info(const std::vector<std::string>& args, KeyValueStore& store, Connection& client);
+    std::string handle_config(const std::vector<std::string>& args, Connection& client);
+    std::string handle_slowlog(const std::vector<std::string>& args, Connection& client);
+    std::string handle_latency(const std::vector<std::string>& args, Connection& client);
+    std::string handle_client(const std::vector<std::string>& args, Connection& client);
+    std::string handle_memory(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_hotkeys(const std::vector<std::string>& args, Connection& client);
+
+    // Replication commands
+    std::string handle_replicaof(const std::vector<std::string>& args, Connection& client);
+    std::string handle_psync(const std::vector<std::string>& args, Connection& client);
+    std::string handle_replconf(const std::vector<std::string>& args, Connection& client);
+
+    // Cluster commands
+    std::string handle_asking(const std::vector<std::string>& args, Connection& client);
+    std::string handle_dump(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_restore(const std::vector<std::string>& args, KeyValueStore& store, Connection& client);
+    std::string handle_migrate(const std::vector<std::string>& args, KeyValueStore& store, Connection& client);
+
+    // Keyspace commands
+    std::string handle_del(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_scan(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_keys(const std::vector<std::string>& args, KeyValueStore& store);
+
+    // List commands
+    std::string handle_push(const std::vector<std::string>& args, KeyValueStore& store, Connection& client, bool left);
+    std::string handle_pop(const std::vector<std::string>& args, KeyValueStore& store, bool left);
+    std::string handle_blocking_pop(const std::vector<std::string>& args, KeyValueStore& store, Connection& client, bool left);
+    std::string handle_llen(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_lrange(const std::vector<std::string>& args, KeyValueStore& store);
+
+    // Pub/Sub commands
+    std::string handle_subscribe(const std::vector<std::string>& args, Connection& client, bool pattern);
+    std::string handle_unsubscribe(const std::vector<std::string>& args, Connection& client, bool pattern);
+    std::string handle_publish(const std::vector<std::string>& args, Connection& client);
+
+    // Hash commands
+    std::string handle_hset(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_hget(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_hmget(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_hdel(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_hgetall(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_hincrby(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_hlen(const std::vector<std::string>& args, KeyValueStore& store);
+
+    // Sorted set commands
+    std::string handle_zadd(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_zrem(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_zscore(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_zincrby(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_zrank(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_zrange(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_zrangebyscore(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_zcard(const std::vector<std::string>& args, KeyValueStore& store);
+
+    // Stream commands
+    std::string handle_xadd(const std::vector<std::string>& args, KeyValueStore& store, Connection& client);
+    std::string handle_xrange(const std::vector<std::string>& args, KeyValueStore& store, bool reverse);
+    std::string handle_xlen(const std::vector<std::string>& args, KeyValueStore& store);
+    std::string handle_xtrim(const std::vector<std::string>& args, KeyValueStore& store);
+};
@@ -0,0 +1,235 @@
+#include "Config.hpp"
+#include "Utils.hpp"
+#include "Log.hpp"
+#include <sstream>
+#include <algorithm>
+
+bool parse_save_rules(const std::string &text, std::vector<SaveRule> &rules)
+{
+    std::vector<SaveRule> parsed;
+    std::istringstream words(text);
+    std::string seconds, changes;
+    while (words >> seconds)
+    {
+        SaveRule rule;
+        if (!(words >> changes) || !parse_integer(seconds, rule.seconds) || !parse_integer(changes, rule.changes) ||
+            rule.seconds <= 0 || rule.changes <= 0)
+            return false;
+        parsed.push_back(rule);
+    }
+    rules = std::move(parsed);
+    return true;
+}
+
+bool parse_config_arguments(int argc, char **argv, ServerConfig &config, std::string &error)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        std::string name = argv[i];
+        if (name.rfind("--", 0) != 0 || i + 1 >= argc)
+        {
+            error = "Bad argument '" + name + "', expected --name value";
+            return false;
+        }
+        std::string value = argv[++i];
+
+        long long number = 0;
+
+        if (name == "--port")
+        {
+            if (!parse_integer(value, number) || number <= 0 || number > 65535)
+            {
+                error = "Invalid port '" + value + "'";
+                return false;
+            }
+            config.port = (int)number;
+        }
+        else if (name == "--timeout")
+        {
+            if (!parse_integer(value, number) || number < 0)
+            {
+                error = "timeout must be a number of seconds";
+                return false;
+            }
+            config.timeout = number;
+        }
+        else if (name == "--tcp-keepalive")
+        {
+            if (!parse_integer(value, number) || number < 0)
+            {
+                error = "tcp-keepalive must be a number of seconds";
+                return false;
+            }
+            config.tcp_keepalive = number;
+        }
+        else if (name == "--maxclients")
+        {
+            if (!parse_integer(value, number) || number < 1)
+            {
+                error = "maxclients must be at least 1";
+                return false;
+            }
+            config.maxclients = number;
+        }
+        else if (name == "--loglevel")
+        {
+            if (!parse_log_level(value, log_level))
+            {
+                error = "loglevel must be debug, verbose, notice or warning";
+                return false;
+            }
+            config.loglevel = value;
+        }
+        else if (name == "--dir")
+        {
+            config.dir = value;
+        }
+        else if (name == "--dbfilename")
+        {
+            config.dbfilename = value;
+        }
+        else if (name == "--save")
+        {
+            if (!parse_save_rules(value, config.save_rules))
+            {
+                error = "Invalid save rules '" + value + "'";
+                return false;
+            }
+        }
+        else if (name == "--appendonly")
+        {
+            if (value != "yes" && value != "no")
+            {
+                error = "appendonly must be yes or no";
+                return false;
+            }
+            config.appendonly = value == "yes";
+        }
+        else if (name == "--appendfilename")
+        {
+            config.appendfilename = value;
+        }
+        else if (name == "--appendfsync")
+        {
+            if (value != "always" && value != "everysec" && value != "no")
+            {
+                error = "appendfsync must be always, everysec or no";
+                return false;
+            }
+            config.appendfsync = value;
+        }
+        else if (name == "--replicaof")
+        {
+            // "host port", or "no one" to start as a primary
+            std::istringstream words(value);
+            std::string host, port;
+            words >> host >> port;
+            std::string lowered = value;
+            std::transform(lowered.begin(), lowered.end(), lowered.begin(), ::tolower);
+            if (lowered == "no one")
+            {
+                config.replicaof_host.clear();
+            }
+            else if (host.empty() || !parse_integer(port, number) || number <= 0 || number > 65535)
+            {
+                error = "replicaof expects \"host port\"";
+                return false;
+            }
+            else
+            {
+                config.replicaof_host = host;
+                config.replicaof_port = (int)number;
+            }
+        }
+        else if (name == "--repl-backlog-size")
+        {
+            if (!parse_integer(value, number) || number < 16 * 1024)
+            {
+                error = "repl-backlog-size must be at least 16384 bytes";
+                return false;
+            }
+            config.repl_backlog_size = number;
+        }
+        else if (name == "--cluster-enabled")
+        {
+            if (value != "yes" && value != "no")
+            {
+                error = "cluster-enabled must be yes or no";
+                return false;
+            }
+            config.cluster_enabled = value == "yes";
+        }
+        else if (name == "--cluster-config-file")
+        {
+            config.cluster_config_file = value;
+        }
+        else if (name == "--cluster-node-timeout")
+        {
+            if (!parse_integer(value, number) || number <= 0)
+            {
+                error = "cluster-node-timeout must be a positive number of milliseconds";
+                return false;
+            }
+            config.cluster_node_timeout = number;
+        }
+        else if (name == "--cluster-announce-ip")
+        {
+            config.cluster_announce_ip = value;
+        }
+        else if (name == "--slowlog-log-slower-than")
+        {
+            if (!parse_integer(value, number))
+            {
+                error = "slowlog-log-slower-than must be a number of microseconds";
+                return false;
+            }
+            config.slowlog_log_slower_than = number;
+        }
+        else if (name == "--slowlog-max-len")
+        {
+            if (!parse_integer(value, number) || number < 0)
+            {
+                error = "slowlog-max-len must be a positive number";
+                return false;
+            }
+            config.slowlog_max_len = number;
+        }
+        else if (name == "--latency-monitor-threshold")
+        {
+            if (!parse_integer(value, number) || number < 0)
+            {
+                error = "latency-monitor-threshold must be a number of milliseconds";
+                return false;
+            }
+            config.latency_monitor_threshold = number;
+        }
+        else if (name == "--hotkeys")
+        {
+            if (value != "yes" && value != "no")
+            {
+                error = "hotkeys must be yes or no";
+                return false;
+            }
+            config.hotkeys = value == "yes";
+        }
+        else if (name == "--metrics-port")
+        {
+            if (!parse_integer(value, number) || number < 0 || number > 65535)
+            {
+                error = "Invalid metrics-port '" + value + "'";
+                return false;
+            }
+            config.metrics_port = (int)number;
+        }
+        else if (name == "--metrics-bind")
+        {
+            config.metrics_bind = value;
+        }
+        else
+        {
+            error = "Unknown option '" + name + "'";
+            return false;
+        }
+    }
+    return true;
+}
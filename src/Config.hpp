@@ -0,0 +1,68 @@
+#pragma once
+#include <string>
+#include <vector>
+
+// A save rule: snapshot in the background once 'changes' writes happened within 'seconds'
+struct SaveRule
+{
+    long long seconds;
+    long long changes;
+};
+
+// Settings given on the command line, redis-server style: --port 6380 --save "60 1000"
+struct ServerConfig
+{
+    int port = 6379;
+
+    // Clients idle for this many seconds are disconnected (0 never). Keepalive probes
+    // start after tcp_keepalive seconds of silence on accepted sockets (0 leaves them off).
+    long long timeout = 0;
+    long long tcp_keepalive = 300;
+
+    // Connections beyond this many are refused with an error
+    long long maxclients = 10000;
+
+    // debug, verbose, notice or warning
+    std::string loglevel = "notice";
+
+    // Snapshots are written to dir/dbfilename
+    std::string dir = ".";
+    std::string dbfilename = "dump.rdb";
+    std::vector<SaveRule> save_rules = {{3600, 1}, {300, 100}, {60, 10000}};
+
+    // Append only file, also in dir
+    bool appendonly = false;
+    std::string appendfilename = "appendonly.aof";
+    std::string appendfsync = "everysec"; // always, everysec or no
+
+    // Replication. An empty replicaof_host means we start as a primary.
+    std::string replicaof_host;
+    int replicaof_port = 0;
+    size_t repl_backlog_size = 1024 * 1024;
+
+    // Cluster mode. The node configuration is kept in dir/cluster_config_file.
+    bool cluster_enabled = false;
+    std::string cluster_config_file = "nodes.conf";
+    long long cluster_node_timeout = 15000; // ms without gossip before a node is flagged fail?
+    std::string cluster_announce_ip = "127.0.0.1";
+
+    // Commands slower than this many microseconds go to the slow log (negative disables it)
+    long long slowlog_log_slower_than = 10000;
+    size_t slowlog_max_len = 128;
+
+    // Event loop iterations busy for this many milliseconds are reported by LATENCY (0 is off)
+    long long latency_monitor_threshold = 0;
+
+    // Count key accesses to find the hottest keys (HOTKEYS)
+    bool hotkeys = false;
+
+    // Prometheus metrics over HTTP on this port (0 disables it), local only by default
+    int metrics_port = 0;
+    std::string metrics_bind = "127.0.0.1";
+};
+
+// Fills config from argv. On bad input returns false and describes the problem in error.
+bool parse_config_arguments(int argc, char **argv, ServerConfig &config, std::string &error);
+
+// Parses a "seconds changes [seconds changes ...]" list. An empty string disables saving.
+bool parse_save_rules(const std::string &text, std::vector<SaveRule> &rules);
@@ -2,22 +2,41 @@
 #include "Connection.hpp"
 #include "RESPHandler.hpp"
 #include "Utils.hpp"
-#include <iostream>
+#include "Server.hpp"
+#include "Log.hpp"
 #include <unistd.h>
 #include <cstring>
 #include <algorithm>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
 
 // Constructor Definition
-Connection::Connection(int fd, KeyValueStore &store) : kv_store(store)
+Connection::Connection(int fd, Server &server) : server(server), kv_store(server.kv_store)
 {
     this->fd = fd;
     this->want_read = true;
+    this->incoming_message = server.connection_pool.acquire_buffer();
+    this->outgoing_message = server.connection_pool.acquire_buffer();
+    this->id = server.next_client_id++;
+    this->created = std::chrono::steady_clock::now();
+    this->last_interaction = this->created;
 }
 
 // Destructor Definiton
 Connection::~Connection()
 {
+    // Make sure no waiter queue keeps pointing at us
+    if (blocked)
+    {
+        server.blocking.unblock(this);
+    }
+    server.pubsub.remove_client(this);
+    server.replication.remove_client(this);
+    server.cluster.remove_client(this);
+    server.connection_pool.release_buffer(this->incoming_message);
+    server.connection_pool.release_buffer(this->outgoing_message);
+
     if (fd != -1)
     {
         close(fd);
@@ -26,13 +45,22 @@ Connection::~Connection()
 
 void Connection::handle_read()
 {
-    unsigned char buffer[1024 * 64] = {0};
-
-    // Read data from the socket into the temporary buffer
-    int bytes_read = read(
-        this->fd,
-        buffer,
-        sizeof(buffer));
+    // Read straight into the end of incoming_message, making room for read_size bytes
+    // (IOBuffer grows without initializing them). Reads that fill that room double it
+    // (bulk uploads), reads that use less than a quarter of it halve it (small
+    // commands), so the room stays near what the client actually sends.
+    size_t used = this->incoming_message.size();
+    this->incoming_message.resize(used + this->read_size);
+
+    ssize_t bytes_read;
+    {
+        LatencyMonitor::Timer timer(this->server.latency, LatencyMonitor::READ);
+        bytes_read = read(
+            this->fd,
+            this->incoming_message.data() + used,
+            this->read_size);
+    }
+    this->incoming_message.resize(used + std::max<ssize_t>(bytes_read, 0));
 
     if (bytes_read < 0)
     {
@@ -50,38 +78,196 @@ void Connection::handle_read()
     // Check for EOF (Client closed connection)
     if (bytes_read == 0)
     {
-        if (this->incoming_message.size() == 0)
+        if (log_enabled(LogLevel::VERBOSE))
         {
-            std::cout << "Client Closed\n";
-        }
-        else
-        {
-            std::cout << "Unexpected End Of File\n";
+            server_log(LogLevel::VERBOSE, (this->incoming_message.empty() ? "Client closed " : "Unexpected end of file from ") + this->address);
         }
         this->want_close = true;
         return;
     }
 
-    if (bytes_read + this->incoming_message.size() > MAX_REQUEST_SIZE)
+    if (this->incoming_message.size() > MAX_REQUEST_SIZE)
     {
         this->want_read = false;
         this->want_close = true;
         return;
     }
 
+    if ((size_t)bytes_read == this->read_size && this->read_size < MAX_READ_SIZE)
+    {
+        this->read_size *= 2;
+    }
+    else if ((size_t)bytes_read < this->read_size / 4 && this->read_size > MIN_READ_SIZE)
+    {
+        this->read_size /= 2;
+    }
+
+    this->server.stats.net_input_bytes += bytes_read;
+    this->net_input_bytes += bytes_read;
+    this->last_interaction = std::chrono::steady_clock::now();
+    this->query_buffer_peak = std::max(this->query_buffer_peak, this->incoming_message.size());
+    this->query_buffer_recent_peak = std::max(this->query_buffer_recent_peak, this->incoming_message.size());
+
+    process_requests();
+}
+
+void Connection::receive(const unsigned char *data, size_t length)
+{
     // Append the data read from temporary buffer to Connection object's incoming message
     buffer_append(
         this->incoming_message,
-        buffer,
-        bytes_read);
+        data,
+        length);
+    this->query_buffer_peak = std::max(this->query_buffer_peak, this->incoming_message.size());
+    this->query_buffer_recent_peak = std::max(this->query_buffer_recent_peak, this->incoming_message.size());
 
-    // Keep on processing request until you exhaust them or encounter a partial request
-    while (try_one_request() == true)
+    process_requests();
+}
+
+std::string Connection::peer_address() const
+{
+    struct sockaddr_in address = {};
+    socklen_t length = sizeof(address);
+    if (getpeername(this->fd, (struct sockaddr *)&address, &length) != 0)
+    {
+        return "";
+    }
+    char ip[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &address.sin_addr, ip, sizeof(ip));
+    return std::string(ip) + ":" + std::to_string(ntohs(address.sin_port));
+}
+
+// Moves the contents of buffer into a smaller allocation when at least half of its
+// capacity is not needed. Buffers of the initial size are left alone.
+static void shrink_buffer(IOBuffer &buffer, size_t needed, size_t minimum)
+{
+    size_t target = std::max({buffer.size(), needed, minimum});
+    if (buffer.capacity() <= minimum || buffer.capacity() < 2 * target)
+    {
+        return;
+    }
+    IOBuffer smaller;
+    smaller.reserve(target);
+    smaller.assign(buffer.begin(), buffer.end());
+    buffer.swap(smaller);
+}
+
+void Connection::reclaim_buffers(std::chrono::steady_clock::time_point now)
+{
+    // An idle client gets back to the initial sizes; an active one keeps room for what it
+    // needed since the last look, and for the read_size room the next handle_read asks
+    // for (the peak only sees what reads filled, shrinking to it would be undone by the
+    // next read)
+    bool idle = now - this->last_interaction >= std::chrono::seconds(2);
+    size_t query_needed = std::max(this->query_buffer_recent_peak, this->incoming_message.size() + this->read_size);
+    shrink_buffer(this->incoming_message, idle ? 0 : query_needed, INITIAL_READ_SIZE);
+    shrink_buffer(this->outgoing_message, idle ? 0 : this->output_buffer_recent_peak, INITIAL_READ_SIZE);
+    if (idle)
+    {
+        this->read_size = INITIAL_READ_SIZE;
+    }
+    this->query_buffer_recent_peak = this->incoming_message.size();
+    this->output_buffer_recent_peak = this->outgoing_message.size();
+}
+
+size_t Connection::output_buffer_size() const
+{
+    size_t size = this->outgoing_message.size();
+    for (const SharedChunk &chunk : this->output_queue)
+    {
+        size += chunk.data->size() - chunk.sent;
+    }
+    return size;
+}
+
+size_t Connection::memory_usage() const
+{
+    size_t bytes = this->incoming_message.capacity() + this->outgoing_message.capacity();
+    for (const SharedChunk &chunk : this->output_queue)
+    {
+        bytes += chunk.data->size();
+    }
+    return bytes;
+}
+
+std::string Connection::flags() const
+{
+    std::string flags;
+    if (this->is_master)
+        flags += 'M';
+    if (this->replica_state.stage != Replication::ReplicaState::NONE)
+        flags += 'S';
+    if (this->subscription_count() > 0)
+        flags += 'P';
+    if (this->blocked)
+        flags += 'b';
+    if (this->want_close || this->close_after_reply)
+        flags += 'A';
+    return flags.empty() ? "N" : flags;
+}
+
+std::string Connection::describe() const
+{
+    auto now = std::chrono::steady_clock::now();
+    auto age = std::chrono::duration_cast<std::chrono::seconds>(now - this->created).count();
+    auto idle = std::chrono::duration_cast<std::chrono::seconds>(now - this->last_interaction).count();
+    std::string command = this->last_command.empty() ? "NULL" : this->last_command;
+    std::transform(command.begin(), command.end(), command.begin(), ::tolower);
+
+    size_t total_memory = memory_usage();
+    size_t output_memory = total_memory - this->incoming_message.capacity();
+
+    std::string events;
+    if (this->want_read)
+        events += 'r';
+    if (this->want_write)
+        events += 'w';
+
+    return "id=" + std::to_string(this->id) +
+           " addr=" + this->address +
+           " fd=" + std::to_string(this->fd) +
+           " name=" + this->name +
+           " age=" + std::to_string(age) +
+           " idle=" + std::to_string(idle) +
+           " flags=" + flags() +
+           " db=0" +
+           " sub=" + std::to_string(this->subscribed_channels.size()) +
+           " psub=" + std::to_string(this->subscribed_patterns.size()) +
+           " qbuf=" + std::to_string(this->incoming_message.size() - this->parse_offset) +
+           " qbuf-peak=" + std::to_string(this->query_buffer_peak) +
+           " qbuf-free=" + std::to_string(this->incoming_message.capacity() - this->incoming_message.size()) +
+           " obl=" + std::to_string(this->outgoing_message.size()) +
+           " oll=" + std::to_string(this->output_queue.size()) +
+           " omem=" + std::to_string(output_memory) +
+           " omem-peak=" + std::to_string(this->output_buffer_peak) +
+           " tot-mem=" + std::to_string(total_memory) +
+           " tot-net-in=" + std::to_string(this->net_input_bytes) +
+           " tot-net-out=" + std::to_string(this->net_output_bytes) +
+           " tot-cmds=" + std::to_string(this->commands_processed) +
+           " events=" + events +
+           " cmd=" + command;
+}
+
+void Connection::schedule_close()
+{
+    // Polling for writability makes the server loop visit us right away, and it closes
+    // connections that want_close instead of writing to them
+    this->want_close = true;
+    this->want_read = false;
+    this->want_write = true;
+}
+
+void Connection::process_requests()
+{
+    // Keep on processing request until you exhaust them, encounter a partial request,
+    // or a command parks this connection
+    while (this->blocked == false && this->close_after_reply == false && try_one_request() == true)
     {
     }
+    compact_incoming();
 
     // Set write to true and read to false if there is any outgoing message
-    if (this->outgoing_message.size() > 0)
+    if (has_pending_output())
     {
         this->want_read = false;
         this->want_write = true;
@@ -93,12 +279,55 @@ void Connection::handle_read()
 
 void Connection::handle_write()
 {
-    // Send the data from the outgoing buffer to the client
-    int sent_bytes = send(
-        this->fd,
-        this->outgoing_message.data(),
-        this->outgoing_message.size(),
-        0);
+    // appendfsync always: nothing goes out until the writes it acknowledges are on disk
+    if (this->server.aof.holding_replies())
+    {
+        return;
+    }
+
+    // Shared chunks go out first, followed by our own buffer, in a single call
+    const size_t MAX_WRITE_CHUNKS = 64;
+    struct iovec chunks[MAX_WRITE_CHUNKS];
+    size_t chunk_count = 0;
+
+    for (const SharedChunk &chunk : this->output_queue)
+    {
+        if (chunk_count == MAX_WRITE_CHUNKS - 1)
+            break;
+        chunks[chunk_count].iov_base = (void *)(chunk.data->data() + chunk.sent);
+        chunks[chunk_count].iov_len = chunk.data->size() - chunk.sent;
+        chunk_count++;
+    }
+    if (chunk_count == this->output_queue.size() && this->outgoing_message.size() > 0)
+    {
+        chunks[chunk_count].iov_base = this->outgoing_message.data();
+        chunks[chunk_count].iov_len = this->outgoing_message.size();
+        chunk_count++;
+    }
+
+    // The peak is taken here, where every kind of output passes on its way out
+    size_t pending_bytes = 0;
+    for (size_t i = 0; i < chunk_count; i++)
+    {
+        pending_bytes += chunks[i].iov_len;
+    }
+    this->output_buffer_peak = std::max(this->output_buffer_peak, pending_bytes);
+    this->output_buffer_recent_peak = std::max(this->output_buffer_recent_peak, pending_bytes);
+
+    struct msghdr message = {};
+    message.msg_iov = chunks;
+    message.msg_iovlen = chunk_count;
+
+    // Send the data from the outgoing buffers to the client. MSG_NOSIGNAL: a peer that
+    // went away must give us EPIPE, not a SIGPIPE that kills the server.
+    ssize_t sent_bytes;
+    {
+        LatencyMonitor::Timer timer(this->server.latency, LatencyMonitor::WRITE);
+        sent_bytes = sendmsg(
+            this->fd,
+            &message,
+            MSG_NOSIGNAL);
+    }
 
     if (sent_bytes < 0)
     {
@@ -113,24 +342,92 @@ void Connection::handle_write()
         }
     }
 
+    this->server.stats.net_output_bytes += sent_bytes;
+    this->net_output_bytes += sent_bytes;
+    this->last_interaction = std::chrono::steady_clock::now();
+
+    // Drop the shared chunks that went out completely, then what was sent of our own buffer
+    size_t remaining = sent_bytes;
+    while (remaining > 0 && !this->output_queue.empty())
+    {
+        SharedChunk &chunk = this->output_queue.front();
+        size_t left = chunk.data->size() - chunk.sent;
+        if (remaining < left)
+        {
+            chunk.sent += remaining;
+            remaining = 0;
+            break;
+        }
+        remaining -= left;
+        this->output_queue.pop_front();
+    }
+
     // Remove the bytes that were successfully sent from the outgoing message buffer
     buffer_consume(
         this->outgoing_message,
-        sent_bytes);
+        remaining);
 
-    // If outgoing message is empty, switch back to reading mode
-    if (this->outgoing_message.size() == 0)
+    // If outgoing message is empty, switch back to reading mode (unless we are parked)
+    if (!has_pending_output())
     {
-        this->want_read = true;
+        if (this->close_after_reply)
+        {
+            this->want_close = true;
+            return;
+        }
+        this->want_read = !this->blocked;
         this->want_write = false;
+
+        // Requests pipelined behind a blocking command are still waiting in the buffer
+        if (!this->blocked && this->incoming_message.size() > 0)
+        {
+            process_requests();
+        }
     }
 
     return;
 }
 
+void Connection::replay_requests()
+{
+    while (try_one_request() == true)
+    {
+    }
+    compact_incoming();
+    this->outgoing_message.clear();
+    this->output_queue.clear();
+}
+
+void Connection::send_reply(const std::string &reply)
+{
+    buffer_append(this->outgoing_message, (const unsigned char *)reply.c_str(), reply.length());
+    this->want_read = false;
+    this->want_write = true;
+}
+
+void Connection::enqueue_shared(const std::shared_ptr<const std::string> &payload)
+{
+    // Anything already in our private buffer is older than this payload, so it has to
+    // move into the queue ahead of it
+    if (this->outgoing_message.size() > 0)
+    {
+        auto pending = std::make_shared<const std::string>(this->outgoing_message.begin(), this->outgoing_message.end());
+        this->output_queue.push_back({pending, 0});
+        this->outgoing_message.clear();
+    }
+
+    this->output_queue.push_back({payload, 0});
+    this->want_read = false;
+    this->want_write = true;
+}
+
 bool Connection::try_one_request()
 {
-    RESPRequest request = RESPHandler::parse_request(this->incoming_message);
+    RESPRequest request;
+    {
+        LatencyMonitor::Timer timer(this->server.latency, LatencyMonitor::PARSE);
+        request = RESPHandler::parse_request(this->incoming_message, this->parse_offset);
+    }
 
     if(request.status == ParseStatus::ERROR){
         this->want_read = false;
@@ -141,13 +438,45 @@ bool Connection::try_one_request()
         return false;
     }
 
+    // Replies to the primary are dropped, everything from here on is cut off again
+    size_t reply_start = this->outgoing_message.size();
+    auto started = std::chrono::steady_clock::now();
+    bool rejected = false;
+
     if (request.args.size() > 0)
     {
         std::string command = request.args[0];
+        std::string redirect_error;
 
-        if (command == "PING")
+        if (this->subscription_count() > 0 && command != "SUBSCRIBE" && command != "UNSUBSCRIBE" &&
+            command != "PSUBSCRIBE" && command != "PUNSUBSCRIBE" && command != "PING" && command != "QUIT")
         {
-            const char *response = "+PONG\r\n";
+            // In subscribed mode the connection only takes Pub/Sub commands
+            std::string name = command;
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            std::string err = "-ERR Can't execute '" + name + "': only (P)SUBSCRIBE / (P)UNSUBSCRIBE / PING / QUIT are allowed in this context\r\n";
+            buffer_append(this->outgoing_message, (const unsigned char *)err.c_str(), err.length());
+            rejected = true;
+        }
+        else if (!this->is_master && !this->server.aof.loading && this->server.replication.is_replica() &&
+                 CommandDispatcher::is_write_command(command))
+        {
+            // Replicas only change through their primary's stream (and their own AOF at
+            // startup, which is replayed before the link to the primary exists)
+            const char *err = "-READONLY You can't write against a read only replica.\r\n";
+            buffer_append(this->outgoing_message, (const unsigned char *)err, strlen(err));
+            rejected = true;
+        }
+        else if (this->server.cluster.enabled() && !this->is_master && !this->server.aof.loading &&
+                 !(redirect_error = this->server.cluster.redirect(request.args, *this, this->kv_store)).empty())
+        {
+            // In cluster mode keys of slots served elsewhere are not touched here
+            buffer_append(this->outgoing_message, (const unsigned char *)redirect_error.c_str(), redirect_error.length());
+            rejected = true;
+        }
+        else if (command == "PING")
+        {
+            const char *response = this->subscription_count() > 0 ? "*2\r\n$4\r\npong\r\n$0\r\n\r\n" : "+PONG\r\n";
             buffer_append(
                 this->outgoing_message,
                 (const unsigned char *)response,
@@ -178,19 +507,17 @@ bool Connection::try_one_request()
             if (request.args.size() > 1)
             {
                 std::string &key = request.args[1];
-                std::optional<KeyValueStore::ValueEntry> result = this->kv_store.get(key);
-                if (result.has_value() == true)
+                KeyValueStore::ValueEntry *result = this->kv_store.find(key);
+                if (result != nullptr)
                 {
-                    std::string value = result->value;
-                    std::optional<std::chrono::steady_clock::time_point> expires_at = result->expires_at;
                     std::string response;
-                    if (expires_at <= std::chrono::steady_clock::now())
+                    if (result->type != ValueType::STRING)
                     {
-                        response = "$-1\r\n";
+                        response = "-WRONGTYPE Operation against a key holding the wrong kind of value\r\n";
                     }
                     else
                     {
-                        response = "$" + std::to_string(value.length()) + "\r\n" + value + "\r\n";
+                        response = RESPHandler::serialize_bulk_string(result->value);
                     }
 
                     buffer_append(
@@ -257,7 +584,7 @@ bool Connection::try_one_request()
                             goto syntax_error;
                         keep_ttl = true;
                     }
-                    else if (argument == "PX" || argument == "EX")
+                    else if (argument == "PX" || argument == "EX" || argument == "PXAT" || argument == "EXAT")
                     {
                         if (keep_ttl || expiry != std::nullopt)
                             goto syntax_error;
@@ -271,14 +598,21 @@ bool Connection::try_one_request()
                             {
                                 std::string err = "-ERR value is not an integer or out of range\r\n";
                                 buffer_append(this->outgoing_message, (const unsigned char *)err.c_str(), err.length());
-                                return true;
+                                goto request_done;
                             }
 
                             auto time_now = std::chrono::steady_clock::now();
                             if (argument == "PX")
                                 expiry = time_now + std::chrono::milliseconds(time_val);
-                            else
+                            else if (argument == "EX")
                                 expiry = time_now + std::chrono::seconds(time_val);
+                            else
+                            {
+                                // Absolute unix time, converted to the monotonic clock the store uses
+                                long long at_ms = argument == "PXAT" ? time_val : time_val * 1000;
+                                long long unix_now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+                                expiry = time_now + std::chrono::milliseconds(at_ms - unix_now);
+                            }
                         }
                         else
                         {
@@ -291,40 +625,144 @@ bool Connection::try_one_request()
                         goto syntax_error;
                     }
                 }
+
+                {
+                    // After the loop, execute the KVStore logic...
+                    KeyValueStore::ValueEntry value_entry;
+                    value_entry.value = value;
+                    value_entry.expires_at = expiry;
+                    this->kv_store.set(key, value_entry);
+
+                    // Log an absolute expiry: replaying the AOF or applying the command on a
+                    // replica later must not extend the TTL. Otherwise the request goes out as sent.
+                    if (expiry.has_value())
+                    {
+                        long long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(*expiry - std::chrono::steady_clock::now()).count();
+                        long long unix_now = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+                        this->server.propagate({"SET", key, value, "PXAT", std::to_string(unix_now + remaining)});
+                    }
+                    else
+                    {
+                        this->server.propagate_raw(std::string_view((const char *)this->incoming_message.data() + this->parse_offset, request.parsed_bytes));
+                    }
+
+                    const char *ok = "+OK\r\n";
+                    buffer_append(this->outgoing_message, (const unsigned char *)ok, strlen(ok));
+                    goto request_done;
+                }
+
             syntax_error:
             {
                 const char *err = "-ERR syntax error\r\n";
                 buffer_append(this->outgoing_message, (const unsigned char *)err, strlen(err));
-                return true;
             }
-
-                KeyValueStore::ValueEntry value_entry = {value, expiry};
-                this->kv_store.set(key, value_entry);
-
-                // After the loop, execute the KVStore logic...
-                return true;
             }
         }
         else
         {
-            std::cerr << "Unknown Command\n";
-            std::string err = "-ERR unknown command '" + command + "'\r\n";
-            buffer_append(this->outgoing_message, (const unsigned char *)err.c_str(), err.length());
+            // Everything else goes through the command dispatcher
+            std::string response = this->dispatcher.dispatch(request.args, this->kv_store, *this);
+            // Writes are logged as the client sent them, straight from the request bytes,
+            // unless the command asked for something else to be logged
+            bool failed = response.empty() || response[0] == '-';
+            if (this->write_unchanged)
+            {
+                this->write_unchanged = false;
+                this->rewritten_command.clear();
+            }
+            else if (!this->rewritten_command.empty())
+            {
+                this->server.propagate(this->rewritten_command);
+                this->rewritten_command.clear();
+            }
+            else if (!failed && CommandDispatcher::is_write_command(command))
+            {
+                this->server.propagate_raw(std::string_view((const char *)this->incoming_message.data() + this->parse_offset, request.parsed_bytes));
+            }
+            buffer_append(this->outgoing_message, (const unsigned char *)response.c_str(), response.length());
+
+            // A push may have made keys ready for clients parked in BLPOP/BRPOP
+            this->server.blocking.serve_ready_keys(this->kv_store);
         }
     }
 
-    buffer_consume(this->incoming_message, request.parsed_bytes);
+request_done:
+    // Every command is counted, and its reply tells how it went
+    if (!request.args.empty() && !this->server.aof.loading)
+    {
+        static const std::string UNKNOWN_COMMAND = "-ERR unknown command";
+        const unsigned char *reply = this->outgoing_message.data() + reply_start;
+        size_t reply_length = this->outgoing_message.size() > reply_start ? this->outgoing_message.size() - reply_start : 0;
+        // A name we do not implement is unknown even when it was refused before reaching
+        // the dispatcher (subscribed mode, cluster redirects, READONLY). Its name is not
+        // repeated anywhere: it is whatever the client sent, CR/LF and spaces included.
+        static const std::string UNKNOWN_NAME = "unknown";
+        bool known = CommandDispatcher::is_known_command(request.args[0]);
+        const std::string &command_name = known ? request.args[0] : UNKNOWN_NAME;
+        Stats::Outcome outcome = Stats::Outcome::OK;
+        if (!known)
+            outcome = Stats::Outcome::UNKNOWN;
+        else if (rejected)
+            outcome = Stats::Outcome::REJECTED;
+        else if (reply_length >= UNKNOWN_COMMAND.size() && memcmp(reply, UNKNOWN_COMMAND.data(), UNKNOWN_COMMAND.size()) == 0)
+            outcome = Stats::Outcome::UNKNOWN;
+        else if (reply_length > 0 && reply[0] == '-')
+            outcome = Stats::Outcome::FAILED;
+        // One clock read at each end of the command serves both the stats and the slow log
+        auto finished = std::chrono::steady_clock::now();
+        uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(finished - started).count();
+        this->server.stats.record_command(command_name, elapsed, outcome, finished);
+        this->commands_processed++;
+        this->last_command = command_name;
+        if (this->server.latency.enabled())
+        {
+            this->server.latency.add_command(command_name, elapsed);
+        }
+        if (!rejected && this->server.slowlog.is_slow(elapsed / 1000))
+        {
+            this->server.slowlog.record(request.args, elapsed / 1000, this->address, this->name);
+        }
+    }
+
+    // ASKING only covers the command right after it
+    if (request.args.empty() || request.args[0] != "ASKING")
+    {
+        this->asking = false;
+    }
+    if (this->is_master)
+    {
+        // The primary only reads the ACK it asked for with REPLCONF GETACK
+        bool getack = request.args.size() > 1 && request.args[0] == "REPLCONF" && request.args[1] == "GETACK";
+        if (!getack)
+        {
+            this->outgoing_message.resize(reply_start);
+        }
+        this->server.replication.applied_from_master(std::string_view((const char *)this->incoming_message.data() + this->parse_offset, request.parsed_bytes));
+    }
+    this->parse_offset += request.parsed_bytes;
 
     // Return true so the server loops again to check for pipelined requests
     return true;
 }
 
-void Connection::buffer_append(std::vector<unsigned char> &buffer, const unsigned char *data, unsigned long length)
+void Connection::buffer_append(IOBuffer &buffer, const unsigned char *data, unsigned long length)
 {
     buffer.insert(buffer.end(), data, data + length);
 }
 
-void Connection::buffer_consume(std::vector<unsigned char> &buffer, unsigned long length)
+void Connection::compact_incoming()
+{
+    // Requests are parsed in place, moving parse_offset forward; what they used is
+    // dropped here, once per batch. Erasing each request as it is parsed moves the rest
+    // of the buffer every time, which is quadratic in a deep pipeline.
+    if (this->parse_offset > 0)
+    {
+        buffer_consume(this->incoming_message, this->parse_offset);
+        this->parse_offset = 0;
+    }
+}
+
+void Connection::buffer_consume(IOBuffer &buffer, unsigned long length)
 {
     buffer.erase(buffer.begin(), buffer.begin() + length);
 }
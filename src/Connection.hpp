@@ -1,7 +1,16 @@
 #pragma once
 #include <vector>
 #include <string>
+#include <deque>
+#include <memory>
+#include <unordered_set>
 #include "KeyValueStore.hpp"
+#include "CommandDispatcher.hpp"
+#include "BlockingManager.hpp"
+#include "Replication.hpp"
+#include "IOBuffer.hpp"
+
+class Server;
 
 class Connection
 {
@@ -10,21 +19,130 @@ public:
     bool want_read = false;
     bool want_write = false;
     bool want_close = false;
+    Server &server;
     KeyValueStore &kv_store;
+    CommandDispatcher dispatcher;
+
+    // Set while the client is parked in a blocking command (BLPOP/BRPOP)
+    bool blocked = false;
+    BlockingManager::BlockedState blocked_state;
+
+    // Pub/Sub subscriptions. While any exist the connection is in subscribed mode.
+    std::unordered_set<std::string> subscribed_channels;
+    std::unordered_set<std::string> subscribed_patterns;
 
     // We use your existing buffer types
-    std::vector<unsigned char> incoming_message;
-    std::vector<unsigned char> outgoing_message;
+    IOBuffer incoming_message;
+    IOBuffer outgoing_message;
+
+    // Reference counted buffers shared with other connections (published messages).
+    // They are written before outgoing_message, which always holds the newest bytes.
+    struct SharedChunk
+    {
+        std::shared_ptr<const std::string> data;
+        size_t sent = 0;
+    };
+    std::deque<SharedChunk> output_queue;
+
+    // Replication. is_master marks a replica's link to its primary: commands on it are
+    // applied without replies. replica_state is used on the primary, on connections of
+    // replicas attached to it.
+    bool is_master = false;
+    Replication::ReplicaState replica_state;
+
+    // Set by ASKING: the next command may use a slot this node is still importing
+    bool asking = false;
 
-    Connection(int fd, KeyValueStore &store); // Constructor
-    ~Connection();                            // Destructor
+    // A command can set this to have something other than its own arguments written to the
+    // AOF, e.g. the ID XADD generated instead of '*', or LPOP for a BLPOP that was served
+    std::vector<std::string> rewritten_command;
+
+    // Set by a write command that turned out to change nothing (PFADD of elements
+    // already counted): it is then not propagated, nor counted as a change
+    bool write_unchanged = false;
+
+    // Client bookkeeping for CLIENT LIST / INFO / KILL. Peaks are high water marks of
+    // the buffers over the connection's life, the other counters are totals.
+    uint64_t id;
+    std::string address; // "ip:port" of the peer, "" if the socket has none
+    std::string name;    // CLIENT SETNAME
+    std::chrono::steady_clock::time_point created;
+    std::chrono::steady_clock::time_point last_interaction;
+    std::string last_command;
+    size_t query_buffer_peak = 0;
+    size_t output_buffer_peak = 0;
+    size_t query_buffer_recent_peak = 0; // Since the last reclaim_buffers
+    size_t output_buffer_recent_peak = 0;
+    uint64_t commands_processed = 0;
+    uint64_t net_input_bytes = 0;
+    uint64_t net_output_bytes = 0;
+
+    // Set by CLIENT KILL on the client itself: the reply goes out, then the connection closes
+    bool close_after_reply = false;
+
+    Connection(int fd, Server &server); // Constructor
+    ~Connection();                      // Destructor
 
     void handle_read();
     void handle_write();
 
+    // Takes bytes received for this connection and executes the complete requests
+    void receive(const unsigned char *data, size_t length);
+
+    // Closes the connection on the next event loop iteration. For connections that are
+    // closed from outside their own request processing.
+    void schedule_close();
+
+    // Queues a reply produced outside of this connection's own request processing
+    // (e.g. when a blocked client is served) and schedules it for writing
+    void send_reply(const std::string &reply);
+
+    // Queues a buffer that is shared with other connections, without copying it
+    void enqueue_shared(const std::shared_ptr<const std::string> &payload);
+
+    // Executes the complete requests in incoming_message and discards the replies.
+    // Used to replay the append only file.
+    void replay_requests();
+
+    size_t subscription_count() const { return subscribed_channels.size() + subscribed_patterns.size(); }
+
+    // "ip:port" of the other end, "" if the socket has none
+    std::string peer_address() const;
+
+    // Bytes waiting to be written, shared chunks included
+    size_t output_buffer_size() const;
+
+    // Called about once a second by the server: releases buffer capacity the connection
+    // has not been using since the last call, all of it beyond the initial size once the
+    // client has been idle for two seconds
+    void reclaim_buffers(std::chrono::steady_clock::time_point now);
+
+    // Bytes held by the buffers of the connection: both at their capacity plus the queued chunks
+    size_t memory_usage() const;
+
+    // Flags as CLIENT LIST shows them: N normal, M primary link, S replica, P pubsub,
+    // b blocked, A closing
+    std::string flags() const;
+
+    // The CLIENT LIST / CLIENT INFO line for this connection, without the line break
+    std::string describe() const;
+
 private:
+    // Bytes handle_read makes room for, adapted to the client (see handle_read)
+    static constexpr size_t INITIAL_READ_SIZE = 4096;
+    static constexpr size_t MIN_READ_SIZE = 512;
+    static constexpr size_t MAX_READ_SIZE = 256 * 1024;
+    size_t read_size = INITIAL_READ_SIZE;
+
+    // Where the next request starts in incoming_message while a batch is processed.
+    // Zero outside of process_requests / replay_requests.
+    size_t parse_offset = 0;
+
     // Helper functions specific to a single connection
+    void process_requests();
     bool try_one_request();
-    void buffer_append(std::vector<unsigned char> &buffer, const unsigned char *data, unsigned long length);
-    void buffer_consume(std::vector<unsigned char> &buffer, unsigned long length);
-};
\ No newline at end of file
+    void compact_incoming();
+    bool has_pending_output() const { return !output_queue.empty() || outgoing_message.size() > 0; }
+    void buffer_append(IOBuffer &buffer, const unsigned char *data, unsigned long length);
+    void buffer_consume(IOBuffer &buffer, unsigned long length);
+};
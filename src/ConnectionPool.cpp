@@ -0,0 +1,98 @@
+#include "ConnectionPool.hpp"
+#include "Connection.hpp"
+#include <new>
+
+ConnectionPool::~ConnectionPool()
+{
+    for (void *block : free_connections)
+        ::operator delete(block);
+}
+
+Connection *ConnectionPool::acquire(int fd, Server &server)
+{
+    void *block;
+    if (!free_connections.empty())
+    {
+        block = free_connections.back();
+        free_connections.pop_back();
+        connection_hits++;
+    }
+    else
+    {
+        block = ::operator new(sizeof(Connection));
+        connection_misses++;
+    }
+    return new (block) Connection(fd, server);
+}
+
+void ConnectionPool::release(Connection *connection)
+{
+    connection->~Connection();
+    if (free_connections.size() < MAX_FREE_CONNECTIONS)
+        free_connections.push_back(connection);
+    else
+        ::operator delete(connection);
+}
+
+ConnectionPool::Buffer ConnectionPool::acquire_buffer()
+{
+    buffers_outstanding++;
+    for (std::vector<Buffer> &free : free_buffers)
+    {
+        if (free.empty())
+            continue;
+        Buffer buffer = std::move(free.back());
+        free.pop_back();
+        free_buffer_bytes -= buffer.capacity();
+        buffer_hits++;
+        return buffer;
+    }
+    buffer_misses++;
+    Buffer buffer;
+    buffer.reserve(SMALLEST_BUFFER);
+    return buffer;
+}
+
+void ConnectionPool::release_buffer(Buffer &buffer)
+{
+    buffers_outstanding--;
+
+    // Class i holds capacities from class_size(i) up to the next class
+    size_t capacity = buffer.capacity();
+    size_t index = 0;
+    while (index + 1 < BUFFER_CLASSES && capacity >= class_size(index + 1))
+        index++;
+    bool fits = capacity >= SMALLEST_BUFFER && capacity < 2 * class_size(BUFFER_CLASSES - 1);
+    if (!fits || (free_buffers[index].size() + 1) * class_size(index) > CLASS_BYTES)
+    {
+        Buffer().swap(buffer);
+        return;
+    }
+    buffer.clear();
+    free_buffer_bytes += capacity;
+    free_buffers[index].push_back(std::move(buffer));
+    buffer = Buffer();
+}
+
+size_t ConnectionPool::memory_usage() const
+{
+    return free_buffer_bytes + free_connections.size() * sizeof(Connection);
+}
+
+std::string ConnectionPool::info() const
+{
+    size_t free_buffer_count = 0;
+    for (const std::vector<Buffer> &free : free_buffers)
+        free_buffer_count += free.size();
+
+    std::string text;
+    text += "connection_pool_hits:" + std::to_string(connection_hits) + "\r\n";
+    text += "connection_pool_misses:" + std::to_string(connection_misses) + "\r\n";
+    text += "connection_pool_free:" + std::to_string(free_connections.size()) + "\r\n";
+    text += "buffer_pool_hits:" + std::to_string(buffer_hits) + "\r\n";
+    text += "buffer_pool_misses:" + std::to_string(buffer_misses) + "\r\n";
+    text += "buffer_pool_free:" + std::to_string(free_buffer_count) + "\r\n";
+    text += "buffer_pool_free_bytes:" + std::to_string(free_buffer_bytes) + "\r\n";
+    text += "buffers_outstanding:" + std::to_string(buffers_outstanding) + "\r\n";
+    return text;
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "IOBuffer.hpp"
+
+class Connection;
+class Server;
+
+// Recycles what connections are made of, for servers with a lot of connection churn
+// (short lived clients that connect, run a command or two and leave).
+//
+// Connection objects: closed connections are destroyed in place and their memory is
+// kept on a free list, so the next accept constructs into it instead of calling the
+// allocator.
+//
+// I/O buffers: the incoming and outgoing buffers of a closed connection are emptied
+// and kept in size classes (4K, 16K, 64K, 256K, 1M), each class capped at about 1MB,
+// and new connections start with the smallest warm buffer available. A buffer that
+// grew to 2MB or more is freed instead, so one huge request does not stay pinned in
+// the pool.
+class ConnectionPool
+{
+public:
+    typedef IOBuffer Buffer;
+
+    ConnectionPool() = default;
+    ~ConnectionPool();
+    ConnectionPool(const ConnectionPool &) = delete;
+    ConnectionPool &operator=(const ConnectionPool &) = delete;
+
+    // Builds a connection for fd in a recycled block when there is one
+    Connection *acquire(int fd, Server &server);
+
+    // Destroys the connection and keeps its memory (replaces delete)
+    void release(Connection *connection);
+
+    // An empty buffer with some capacity, warm from the pool when possible
+    Buffer acquire_buffer();
+    void release_buffer(Buffer &buffer);
+
+    // Bytes kept on the free lists
+    size_t memory_usage() const;
+
+    // connection_pool_* / buffer_pool_* lines for the "# Stats" section of INFO
+    std::string info() const;
+
+private:
+    static constexpr size_t BUFFER_CLASSES = 5;
+    static constexpr size_t SMALLEST_BUFFER = 4096;
+    static constexpr size_t CLASS_BYTES = 1024 * 1024; // Pooled bytes per class, at most
+    static constexpr size_t MAX_FREE_CONNECTIONS = 1024;
+
+    std::vector<void *> free_connections;
+    std::vector<Buffer> free_buffers[BUFFER_CLASSES];
+
+    uint64_t connection_hits = 0;
+    uint64_t connection_misses = 0;
+    uint64_t buffer_hits = 0;
+    uint64_t buffer_misses = 0;
+    uint64_t buffers_outstanding = 0;
+    size_t free_buffer_bytes = 0;
+
+    static size_t class_size(size_t index) { return SMALLEST_BUFFER << (2 * index); }
+};
@@ -0,0 +1,342 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <functional>
+#include <utility>
+
+// Chained hash table used for the keyspace. Unlike std::unordered_map it exposes its
+// buckets, which is what makes a stateless SCAN cursor possible, and it resizes
+// incrementally: while a resize is in progress entries live in two tables and every
+// operation moves a few buckets from the old table to the new one.
+//
+// Table sizes are powers of two, so a bucket index is just the low bits of the hash.
+// Entries are individually allocated and never copied, so pointers to values stay
+// valid until the key is erased.
+template <typename V>
+class Dict
+{
+public:
+    Dict() = default;
+    ~Dict() { clear(); }
+    Dict(const Dict &) = delete;
+    Dict &operator=(const Dict &) = delete;
+
+    size_t size() const { return tables[0].used + tables[1].used; }
+    size_t bucket_count() const { return tables[0].buckets.size() + tables[1].buckets.size(); }
+    bool is_rehashing() const { return rehash_index >= 0; }
+
+    // Bytes of one entry allocation (key and value objects included, not what they point to)
+    static constexpr size_t entry_size() { return sizeof(Entry); }
+
+    // Bytes of the bucket arrays
+    size_t table_bytes() const { return (tables[0].buckets.capacity() + tables[1].buckets.capacity()) * sizeof(Entry *); }
+
+    V *find(std::string_view key)
+    {
+        if (size() == 0)
+            return nullptr;
+        rehash_step();
+
+        size_t hash = hash_key(key);
+        for (int t = 0; t <= 1; t++)
+        {
+            Table &table = tables[t];
+            if (table.buckets.empty())
+                continue;
+            for (Entry *entry = table.buckets[hash & table.mask()]; entry; entry = entry->next)
+            {
+                if (entry->key == key)
+                    return &entry->value;
+            }
+            if (!is_rehashing())
+                break;
+        }
+        return nullptr;
+    }
+
+    // Returns the value stored under key, inserting a default constructed one if needed
+    V &operator[](std::string_view key)
+    {
+        if (V *existing = find(key))
+            return *existing;
+
+        expand_if_needed();
+
+        // New entries always go to the newest table
+        Table &table = is_rehashing() ? tables[1] : tables[0];
+        size_t index = hash_key(key) & table.mask();
+        Entry *entry = new Entry{std::string(key), V(), table.buckets[index]};
+        table.buckets[index] = entry;
+        table.used++;
+        return entry->value;
+    }
+
+    // Inserts a key the caller knows is absent, skipping the lookup. Used by bulk loads,
+    // where keys are unique by construction.
+    void insert_unique(std::string &&key, V &&value)
+    {
+        expand_if_needed();
+        Table &table = is_rehashing() ? tables[1] : tables[0];
+        size_t index = hash_key(key) & table.mask();
+        Entry *entry = new Entry{std::move(key), std::move(value), table.buckets[index]};
+        table.buckets[index] = entry;
+        table.used++;
+    }
+
+    bool erase(std::string_view key)
+    {
+        if (size() == 0)
+            return false;
+        rehash_step();
+
+        size_t hash = hash_key(key);
+        for (int t = 0; t <= 1; t++)
+        {
+            Table &table = tables[t];
+            if (table.buckets.empty())
+                continue;
+            Entry **link = &table.buckets[hash & table.mask()];
+            while (*link)
+            {
+                Entry *entry = *link;
+                if (entry->key == key)
+                {
+                    *link = entry->next;
+                    delete entry;
+                    table.used--;
+                    shrink_if_needed();
+                    return true;
+                }
+                link = &entry->next;
+            }
+            if (!is_rehashing())
+                break;
+        }
+        return false;
+    }
+
+    // Pre-sizes the table for 'count' entries, e.g. before a bulk load
+    void reserve(size_t count)
+    {
+        if (is_rehashing() || count <= tables[0].buckets.size())
+            return;
+        resize(count);
+    }
+
+    void clear()
+    {
+        for (Table &table : tables)
+        {
+            for (Entry *head : table.buckets)
+            {
+                while (head)
+                {
+                    Entry *next = head->next;
+                    delete head;
+                    head = next;
+                }
+            }
+            table = Table{};
+        }
+        rehash_index = -1;
+    }
+
+    void for_each(const std::function<void(const std::string &, V &)> &fn)
+    {
+        for (Table &table : tables)
+        {
+            for (Entry *entry : table.buckets)
+            {
+                for (; entry; entry = entry->next)
+                    fn(entry->key, entry->value);
+            }
+        }
+    }
+
+    // Visits one bucket (or, mid-resize, one small-table bucket and every large-table
+    // bucket it expands to) and returns the next cursor, 0 when the scan is complete.
+    //
+    // The cursor is incremented on its reversed bits, i.e. from the high bits of the
+    // bucket index down. Doubling or halving the table only adds or removes a high bit,
+    // so buckets visited before a resize map to buckets that are still "behind" the
+    // cursor afterwards: every key present for the whole scan is returned at least once.
+    // fn must not add or remove keys.
+    unsigned long scan(unsigned long cursor, const std::function<void(const std::string &, V &)> &fn)
+    {
+        if (size() == 0)
+            return 0;
+
+        unsigned long v = cursor;
+        if (!is_rehashing())
+        {
+            Table &table = tables[0];
+            emit_bucket(table.buckets[v & table.mask()], fn);
+
+            // Set the bits above the mask so the increment carries into the masked bits
+            v |= ~(unsigned long)table.mask();
+            v = reverse_bits(v);
+            v++;
+            v = reverse_bits(v);
+            return v;
+        }
+
+        Table *small = &tables[0];
+        Table *large = &tables[1];
+        if (small->buckets.size() > large->buckets.size())
+            std::swap(small, large);
+        unsigned long small_mask = small->mask();
+        unsigned long large_mask = large->mask();
+
+        emit_bucket(small->buckets[v & small_mask], fn);
+
+        // Visit every bucket of the larger table that the small bucket expands into
+        do
+        {
+            emit_bucket(large->buckets[v & large_mask], fn);
+            v |= ~large_mask;
+            v = reverse_bits(v);
+            v++;
+            v = reverse_bits(v);
+        } while (v & (small_mask ^ large_mask));
+
+        return v;
+    }
+
+    // Moves up to 'buckets' buckets to the new table. Returns true while work remains.
+    bool rehash(size_t buckets)
+    {
+        if (!is_rehashing())
+            return false;
+
+        // Cap the number of empty buckets looked at, so one call stays cheap
+        size_t empty_visits = buckets * 10;
+        Table &from = tables[0];
+        Table &to = tables[1];
+
+        while (buckets-- > 0 && from.used > 0)
+        {
+            while (from.buckets[rehash_index] == nullptr)
+            {
+                rehash_index++;
+                if (--empty_visits == 0)
+                    return true;
+            }
+
+            Entry *entry = from.buckets[rehash_index];
+            while (entry)
+            {
+                Entry *next = entry->next;
+                size_t index = hash_key(entry->key) & to.mask();
+                entry->next = to.buckets[index];
+                to.buckets[index] = entry;
+                from.used--;
+                to.used++;
+                entry = next;
+            }
+            from.buckets[rehash_index] = nullptr;
+            rehash_index++;
+        }
+
+        if (from.used == 0)
+        {
+            // Done: the new table becomes the main one
+            tables[0] = std::move(tables[1]);
+            tables[1] = Table{};
+            rehash_index = -1;
+            return false;
+        }
+        return true;
+    }
+
+private:
+    struct Entry
+    {
+        std::string key;
+        V value;
+        Entry *next;
+    };
+
+    struct Table
+    {
+        std::vector<Entry *> buckets;
+        size_t used = 0;
+
+        size_t mask() const { return buckets.size() - 1; }
+    };
+
+    static const size_t INITIAL_SIZE = 4;
+
+    Table tables[2];
+    long long rehash_index = -1; // Next bucket of tables[0] to move, -1 when not resizing
+
+    static size_t hash_key(std::string_view key) { return std::hash<std::string_view>()(key); }
+
+    static void emit_bucket(Entry *entry, const std::function<void(const std::string &, V &)> &fn)
+    {
+        for (; entry; entry = entry->next)
+            fn(entry->key, entry->value);
+    }
+
+    static unsigned long reverse_bits(unsigned long v)
+    {
+        unsigned long s = 8 * sizeof(v);
+        unsigned long mask = ~0UL;
+        while ((s >>= 1) > 0)
+        {
+            mask ^= (mask << s);
+            v = ((v >> s) & mask) | ((v << s) & ~mask);
+        }
+        return v;
+    }
+
+    static size_t next_power(size_t size)
+    {
+        size_t power = INITIAL_SIZE;
+        while (power < size)
+            power *= 2;
+        return power;
+    }
+
+    void rehash_step()
+    {
+        if (is_rehashing())
+            rehash(1);
+    }
+
+    void resize(size_t size)
+    {
+        size_t buckets = next_power(size);
+        if (tables[0].buckets.empty())
+        {
+            // First allocation, nothing to move
+            tables[0].buckets.assign(buckets, nullptr);
+            return;
+        }
+        if (buckets == tables[0].buckets.size())
+            return;
+
+        tables[1].buckets.assign(buckets, nullptr);
+        tables[1].used = 0;
+        rehash_index = 0;
+    }
+
+    void expand_if_needed()
+    {
+        if (is_rehashing())
+            return;
+        if (tables[0].buckets.empty())
+            resize(INITIAL_SIZE);
+        else if (tables[0].used >= tables[0].buckets.size())
+            resize(tables[0].used * 2);
+    }
+
+    void shrink_if_needed()
+    {
+        // Shrink once less than 1/8 of the buckets would be in use
+        if (is_rehashing() || tables[0].buckets.size() <= INITIAL_SIZE)
+            return;
+        if (tables[0].used * 8 < tables[0].buckets.size())
+            resize(tables[0].used);
+    }
+};
@@ -0,0 +1,164 @@
+#include "HashObject.hpp"
+#include "Listpack.hpp"
+#include "Memory.hpp"
+
+static const size_t npos = std::string::npos;
+
+std::optional<std::string> HashObject::get(const std::string &field) const
+{
+    if (encoding == HashEncoding::HASHTABLE)
+    {
+        auto it = table.find(field);
+        if (it == table.end())
+            return std::nullopt;
+        return it->second;
+    }
+
+    size_t offset = listpack_find(field);
+    if (offset == npos)
+        return std::nullopt;
+
+    // Skip over the field to reach its value
+    size_t length;
+    size_t data = listpack_read_entry(listpack, offset, length);
+    data = listpack_read_entry(listpack, data + length, length);
+    return std::string(listpack.begin() + data, listpack.begin() + data + length);
+}
+
+bool HashObject::set(const std::string &field, const std::string &value)
+{
+    if (encoding == HashEncoding::LISTPACK)
+    {
+        bool too_long = field.size() > HASH_MAX_LISTPACK_VALUE || value.size() > HASH_MAX_LISTPACK_VALUE;
+        size_t offset = listpack_find(field);
+
+        if (!too_long && offset != npos)
+        {
+            // Overwrite in place: splice the new value entry over the old one
+            size_t length;
+            size_t value_offset = listpack_read_entry(listpack, offset, length) + length;
+            size_t value_data = listpack_read_entry(listpack, value_offset, length);
+
+            std::vector<unsigned char> encoded;
+            listpack_write_entry(encoded, value);
+            listpack.erase(listpack.begin() + value_offset, listpack.begin() + value_data + length);
+            listpack.insert(listpack.begin() + value_offset, encoded.begin(), encoded.end());
+            return false;
+        }
+
+        if (!too_long && listpack_entries < HASH_MAX_LISTPACK_ENTRIES)
+        {
+            listpack_write_entry(listpack, field);
+            listpack_write_entry(listpack, value);
+            listpack_entries++;
+            return true;
+        }
+
+        // The hash has outgrown the compact encoding
+        convert_to_hashtable();
+    }
+
+    auto [it, inserted] = table.insert_or_assign(field, value);
+    return inserted;
+}
+
+bool HashObject::remove(const std::string &field)
+{
+    if (encoding == HashEncoding::HASHTABLE)
+    {
+        return table.erase(field) > 0;
+    }
+
+    size_t offset = listpack_find(field);
+    if (offset == npos)
+        return false;
+
+    size_t length;
+    size_t end = listpack_read_entry(listpack, offset, length) + length;
+    end = listpack_read_entry(listpack, end, length) + length;
+    listpack.erase(listpack.begin() + offset, listpack.begin() + end);
+    listpack_entries--;
+    return true;
+}
+
+size_t HashObject::size() const
+{
+    if (encoding == HashEncoding::HASHTABLE)
+        return table.size();
+    return listpack_entries;
+}
+
+void HashObject::for_each(const std::function<void(const std::string &, const std::string &)> &fn) const
+{
+    if (encoding == HashEncoding::HASHTABLE)
+    {
+        for (const auto &[field, value] : table)
+        {
+            fn(field, value);
+        }
+        return;
+    }
+
+    size_t offset = 0;
+    while (offset < listpack.size())
+    {
+        size_t length;
+        size_t data = listpack_read_entry(listpack, offset, length);
+        std::string field(listpack.begin() + data, listpack.begin() + data + length);
+
+        data = listpack_read_entry(listpack, data + length, length);
+        std::string value(listpack.begin() + data, listpack.begin() + data + length);
+
+        fn(field, value);
+        offset = data + length;
+    }
+}
+
+size_t HashObject::memory_usage(size_t samples) const
+{
+    size_t bytes = allocation_size(sizeof(HashObject) + SHARED_CONTROL_BLOCK_SIZE);
+    if (encoding == HashEncoding::LISTPACK)
+        return bytes + allocation_size(listpack.capacity());
+
+    // unordered_map: the bucket array, then one node per field holding the next pointer,
+    // the field/value pair and the cached hash. The string contents are sampled.
+    typedef std::pair<const std::string, std::string> Pair;
+    bytes += table.bucket_count() * sizeof(void *);
+    bytes += table.size() * allocation_size(sizeof(void *) + sizeof(Pair) + sizeof(size_t));
+    size_t sampled = 0, sampled_bytes = 0;
+    for (auto it = table.begin(); it != table.end() && (samples == 0 || sampled < samples); ++it, ++sampled)
+    {
+        sampled_bytes += string_heap_size(it->first) + string_heap_size(it->second);
+    }
+    return bytes + extrapolate(sampled_bytes, sampled, table.size());
+}
+
+size_t HashObject::listpack_find(const std::string &field) const
+{
+    size_t offset = 0;
+    while (offset < listpack.size())
+    {
+        size_t length;
+        size_t data = listpack_read_entry(listpack, offset, length);
+
+        if (listpack_view(listpack, data, length) == field)
+            return offset;
+
+        // Skip the value belonging to this field
+        data = listpack_read_entry(listpack, data + length, length);
+        offset = data + length;
+    }
+    return npos;
+}
+
+void HashObject::convert_to_hashtable()
+{
+    table.reserve(listpack_entries * 2);
+    for_each([this](const std::string &field, const std::string &value)
+             { table.emplace(field, value); });
+
+    listpack.clear();
+    listpack.shrink_to_fit();
+    listpack_entries = 0;
+    encoding = HashEncoding::HASHTABLE;
+}
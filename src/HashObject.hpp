@@ -0,0 +1,55 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <optional>
+#include <functional>
+#include <unordered_map>
+#include "RedisObject.hpp"
+
+//======================  HASH ENCODING LIMITS START  ======================
+
+// A hash stays in the compact LISTPACK encoding while it has at most this many fields...
+const size_t HASH_MAX_LISTPACK_ENTRIES = 128;
+
+// ...and every field and value is at most this many bytes long.
+const size_t HASH_MAX_LISTPACK_VALUE = 64;
+
+//======================   HASH ENCODING LIMITS END   ======================
+
+enum class HashEncoding
+{
+    LISTPACK,  // One contiguous byte array, scanned linearly
+    HASHTABLE, // A real hash table, used once the hash grows past the limits above
+};
+
+class HashObject : public RedisObject
+{
+public:
+    HashEncoding encoding = HashEncoding::LISTPACK;
+
+    std::optional<std::string> get(const std::string &field) const;
+
+    // Returns true if the field is new, false if an existing field was overwritten
+    bool set(const std::string &field, const std::string &value);
+
+    // Returns true if the field existed and was removed
+    bool remove(const std::string &field);
+
+    size_t size() const;
+
+    // Calls fn(field, value) for every field in the hash
+    void for_each(const std::function<void(const std::string &, const std::string &)> &fn) const;
+
+    size_t memory_usage(size_t samples) const override;
+
+private:
+    // LISTPACK layout: [field entry][value entry][field entry][value entry]... (see Listpack.hpp)
+    std::vector<unsigned char> listpack;
+    size_t listpack_entries = 0;
+
+    std::unordered_map<std::string, std::string> table;
+
+    // Returns the offset of the field's entry in the listpack, or npos if absent
+    size_t listpack_find(const std::string &field) const;
+    void convert_to_hashtable();
+};
@@ -0,0 +1,151 @@
+#include "HotKeys.hpp"
+#include "RESPHandler.hpp"
+#include <algorithm>
+#include <functional>
+
+HotKeys::HotKeys(const ServerConfig &config)
+{
+    set_enabled(config.hotkeys);
+}
+
+void HotKeys::set_enabled(bool enabled)
+{
+    if (enabled == this->enabled())
+        return;
+    reset();
+    if (enabled)
+        sketch.assign(DEPTH * WIDTH, 0);
+    else
+        std::vector<uint32_t>().swap(sketch);
+    last_decay = std::chrono::steady_clock::now();
+}
+
+void HotKeys::record(std::string_view key)
+{
+    // The rows are indexed by h1 + row * h2, two halves of a single 64 bit hash, which is
+    // as good as independent hash functions for a sketch (Kirsch and Mitzenmacher)
+    uint64_t hash = std::hash<std::string_view>()(key);
+    uint32_t h1 = (uint32_t)hash;
+    uint32_t h2 = (uint32_t)(hash >> 32) | 1;
+    uint32_t *counters[DEPTH];
+    uint32_t estimate = UINT32_MAX;
+    for (size_t row = 0; row < DEPTH; row++)
+    {
+        counters[row] = &sketch[row * WIDTH + ((h1 + row * h2) & (WIDTH - 1))];
+        estimate = std::min(estimate, *counters[row]);
+    }
+    if (estimate == UINT32_MAX)
+        return;
+    estimate++;
+    for (uint32_t *counter : counters)
+        *counter = std::max(*counter, estimate);
+
+    // Cold keys stop here: a key already in the heap always passes, its estimate only grows
+    if (heap.size() == TOP_K && estimate <= heap.front().count)
+        return;
+
+    auto found = positions.find(key);
+    if (found != positions.end())
+    {
+        Candidate &candidate = heap[found->second];
+        candidate.count = estimate;
+        candidate.window_hits++;
+        sift_down(found->second);
+        return;
+    }
+    if (heap.size() == TOP_K)
+    {
+        // The coldest key makes room
+        positions.erase(heap.front().key);
+        heap.front() = {std::string(key), estimate, 1, 0};
+        positions.emplace(key, 0);
+        sift_down(0);
+        return;
+    }
+    heap.push_back({std::string(key), estimate, 1, 0});
+    positions.emplace(key, heap.size() - 1);
+    sift_up(heap.size() - 1);
+}
+
+void HotKeys::swap_candidates(size_t a, size_t b)
+{
+    std::swap(heap[a], heap[b]);
+    positions.find(heap[a].key)->second = a;
+    positions.find(heap[b].key)->second = b;
+}
+
+void HotKeys::sift_up(size_t index)
+{
+    while (index > 0)
+    {
+        size_t parent = (index - 1) / 2;
+        if (heap[parent].count <= heap[index].count)
+            return;
+        swap_candidates(parent, index);
+        index = parent;
+    }
+}
+
+void HotKeys::sift_down(size_t index)
+{
+    while (true)
+    {
+        size_t coldest = index;
+        for (size_t child = 2 * index + 1; child <= 2 * index + 2 && child < heap.size(); child++)
+        {
+            if (heap[child].count < heap[coldest].count)
+                coldest = child;
+        }
+        if (coldest == index)
+            return;
+        swap_candidates(index, coldest);
+        index = coldest;
+    }
+}
+
+void HotKeys::cron(std::chrono::steady_clock::time_point now)
+{
+    if (!enabled() || now - last_decay < std::chrono::seconds(1))
+        return;
+
+    double seconds = std::chrono::duration<double>(now - last_decay).count();
+    last_decay = now;
+    for (uint32_t &counter : sketch)
+        counter >>= 1;
+    // Halving keeps the heap order
+    for (Candidate &candidate : heap)
+    {
+        candidate.count >>= 1;
+        candidate.qps = (uint32_t)(candidate.window_hits / seconds);
+        candidate.window_hits = 0;
+    }
+}
+
+std::string HotKeys::top(size_t count) const
+{
+    std::vector<const Candidate *> sorted;
+    for (const Candidate &candidate : heap)
+        sorted.push_back(&candidate);
+    std::sort(sorted.begin(), sorted.end(), [](const Candidate *a, const Candidate *b)
+              { return a->count > b->count; });
+    sorted.resize(std::min(sorted.size(), count));
+
+    std::string reply = RESPHandler::serialize_array_header(sorted.size());
+    for (const Candidate *candidate : sorted)
+    {
+        // A key that entered the heap during this second has no full second yet
+        uint32_t qps = std::max(candidate->qps, candidate->window_hits);
+        reply += RESPHandler::serialize_array_header(3);
+        reply += RESPHandler::serialize_bulk_string(candidate->key);
+        reply += RESPHandler::serialize_integer(candidate->count);
+        reply += RESPHandler::serialize_integer(qps);
+    }
+    return reply;
+}
+
+void HotKeys::reset()
+{
+    std::fill(sketch.begin(), sketch.end(), 0);
+    heap.clear();
+    positions.clear();
+}
@@ -0,0 +1,75 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <chrono>
+#include <cstdint>
+#include "Config.hpp"
+
+// Hot key detection (HOTKEYS), on with hotkeys yes.
+//
+// Every key lookup and write in the KeyValueStore is counted in a count-min sketch: a
+// few rows of counters, each indexed by a different hash of the key, where a key's
+// estimate is the smallest of its counters. It never undercounts, and with conservative
+// updates (only the smallest counters are raised) collisions overcount very little. The
+// keys with the highest estimates are kept in a small min-heap next to it, so reporting
+// them needs no scan of the keyspace. A map from key to heap position finds a key that is
+// already in the heap, and only that entry is moved when its count grows.
+//
+// The common case, a key that is not hot, costs one hash and a handful of counter
+// updates. Once per second every count is halved, so keys that cool down leave the top
+// and the counts follow the current traffic; the accesses the top keys got during the
+// last second are their QPS.
+class HotKeys
+{
+public:
+    explicit HotKeys(const ServerConfig &config);
+
+    bool enabled() const { return !sketch.empty(); }
+
+    // Turning tracking off frees the sketch and forgets the top keys
+    void set_enabled(bool enabled);
+
+    // Counts one access to key
+    void record(std::string_view key);
+
+    // Halves the counts once per second
+    void cron(std::chrono::steady_clock::time_point now);
+    int cron_interval_ms() const { return enabled() ? 1000 : -1; }
+
+    // The HOTKEYS reply: up to 'count' [key, estimated accesses, QPS] triples, hottest first
+    std::string top(size_t count) const;
+    void reset();
+
+private:
+    static constexpr size_t DEPTH = 4;
+    static constexpr size_t WIDTH = 4096; // Counters per row, a power of two
+    static constexpr size_t TOP_K = 32;
+
+    struct Candidate
+    {
+        std::string key;
+        uint32_t count;       // Sketch estimate when last seen
+        uint32_t window_hits; // Accesses since the last decay
+        uint32_t qps;         // Accesses during the last full second
+    };
+
+    // Lets the positions map be searched with a string_view, without copying the key
+    struct KeyHash
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view key) const { return std::hash<std::string_view>()(key); }
+    };
+
+    std::vector<uint32_t> sketch; // DEPTH rows of WIDTH counters, empty when disabled
+    std::vector<Candidate> heap;  // Min-heap on count
+    std::unordered_map<std::string, size_t, KeyHash, std::equal_to<>> positions; // Key -> index in heap
+    std::chrono::steady_clock::time_point last_decay;
+
+    // Heap moves that keep positions up to date
+    void swap_candidates(size_t a, size_t b);
+    void sift_up(size_t index);
+    void sift_down(size_t index);
+};
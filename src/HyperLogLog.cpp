@@ -0,0 +1,506 @@
+#include "HyperLogLog.hpp"
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// Sparse opcodes:
+//   ZERO   00xxxxxx            run of 1..64 zero registers
+//   XZERO  01xxxxxx yyyyyyyy   run of 1..16384 zero registers
+//   VAL    1vvvvvxx            run of 1..4 registers set to 1..32
+const uint8_t HLL_SPARSE_XZERO_BIT = 0x40;
+const uint8_t HLL_SPARSE_VAL_BIT = 0x80;
+const int HLL_SPARSE_VAL_MAX_VALUE = 32;
+const int HLL_SPARSE_VAL_MAX_LENGTH = 4;
+const int HLL_SPARSE_ZERO_MAX_LENGTH = 64;
+const int HLL_SPARSE_XZERO_MAX_LENGTH = 16384;
+
+const double HLL_ALPHA_INF = 0.721347520444481703680;
+
+//======================  HEADER  ======================
+
+static HLLEncoding encoding_of(const std::string &hll)
+{
+    return (HLLEncoding)hll[4];
+}
+
+static void invalidate_cache(std::string &hll)
+{
+    hll[15] = (char)((uint8_t)hll[15] | 0x80);
+}
+
+static bool cache_valid(const std::string &hll)
+{
+    return ((uint8_t)hll[15] & 0x80) == 0;
+}
+
+static uint64_t read_cache(const std::string &hll)
+{
+    uint64_t cardinality = 0;
+    for (int i = 0; i < 8; i++)
+        cardinality |= (uint64_t)(uint8_t)hll[8 + i] << (8 * i);
+    return cardinality;
+}
+
+static void write_cache(std::string &hll, uint64_t cardinality)
+{
+    for (int i = 0; i < 8; i++)
+        hll[8 + i] = (char)(cardinality >> (8 * i));
+}
+
+static std::string make_header(HLLEncoding encoding)
+{
+    std::string hll(HLL_HEADER_SIZE, '\0');
+    memcpy(hll.data(), "HYLL", 4);
+    hll[4] = (char)encoding;
+    return hll;
+}
+
+std::string hll_create()
+{
+    // One XZERO covering every register
+    std::string hll = make_header(HLLEncoding::SPARSE);
+    hll.push_back((char)(HLL_SPARSE_XZERO_BIT | ((HLL_REGISTERS - 1) >> 8)));
+    hll.push_back((char)((HLL_REGISTERS - 1) & 0xFF));
+    return hll;
+}
+
+bool hll_is_valid(const std::string &hll)
+{
+    if (hll.size() < HLL_HEADER_SIZE || memcmp(hll.data(), "HYLL", 4) != 0)
+        return false;
+    if (encoding_of(hll) == HLLEncoding::DENSE)
+        return hll.size() == HLL_DENSE_SIZE;
+    return encoding_of(hll) == HLLEncoding::SPARSE;
+}
+
+//======================  HASHING  ======================
+
+// MurmurHash2, 64-bit version, with the same seed as Redis so registers match
+static uint64_t murmurhash64a(const void *key, size_t length, uint64_t seed)
+{
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = seed ^ (length * m);
+    const uint8_t *data = (const uint8_t *)key;
+    const uint8_t *end = data + (length - (length & 7));
+
+    while (data != end)
+    {
+        uint64_t k;
+        memcpy(&k, data, sizeof(k));
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+        data += 8;
+    }
+
+    switch (length & 7)
+    {
+    case 7:
+        h ^= (uint64_t)data[6] << 48;
+        [[fallthrough]];
+    case 6:
+        h ^= (uint64_t)data[5] << 40;
+        [[fallthrough]];
+    case 5:
+        h ^= (uint64_t)data[4] << 32;
+        [[fallthrough]];
+    case 4:
+        h ^= (uint64_t)data[3] << 24;
+        [[fallthrough]];
+    case 3:
+        h ^= (uint64_t)data[2] << 16;
+        [[fallthrough]];
+    case 2:
+        h ^= (uint64_t)data[1] << 8;
+        [[fallthrough]];
+    case 1:
+        h ^= (uint64_t)data[0];
+        h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+// Register index from the low HLL_P bits, register value = position of the first
+// set bit in the rest (1-based). The sentinel bit caps the value at HLL_Q + 1.
+static int hash_element(std::string_view element, size_t &index)
+{
+    uint64_t hash = murmurhash64a(element.data(), element.size(), 0xadc83b19ULL);
+    index = hash & (HLL_REGISTERS - 1);
+    hash >>= HLL_P;
+    hash |= 1ULL << HLL_Q;
+    return __builtin_ctzll(hash) + 1;
+}
+
+//======================  DENSE ENCODING  ======================
+
+// Registers are packed LSB first: register i starts at bit 6 * i
+
+static uint8_t dense_get(const uint8_t *registers, size_t index)
+{
+    size_t byte = index * HLL_BITS / 8;
+    size_t shift = index * HLL_BITS & 7;
+    unsigned int value = registers[byte] >> shift;
+    if (shift > 8 - HLL_BITS)
+        value |= (unsigned int)registers[byte + 1] << (8 - shift);
+    return value & 63;
+}
+
+static void dense_set(uint8_t *registers, size_t index, uint8_t value)
+{
+    size_t byte = index * HLL_BITS / 8;
+    size_t shift = index * HLL_BITS & 7;
+    registers[byte] &= ~(63 << shift);
+    registers[byte] |= value << shift;
+    if (shift > 8 - HLL_BITS)
+    {
+        registers[byte + 1] &= ~(63 >> (8 - shift));
+        registers[byte + 1] |= value >> (8 - shift);
+    }
+}
+
+// Every 3 bytes hold exactly 4 registers, so unpacking goes a group at a time
+static void dense_unpack(const uint8_t *packed, uint8_t *registers)
+{
+    for (size_t i = 0; i < HLL_REGISTERS / 4; i++)
+    {
+        uint8_t x = packed[3 * i], y = packed[3 * i + 1], z = packed[3 * i + 2];
+        registers[4 * i] = x & 63;
+        registers[4 * i + 1] = ((x >> 6) | (y << 2)) & 63;
+        registers[4 * i + 2] = ((y >> 4) | (z << 4)) & 63;
+        registers[4 * i + 3] = z >> 2;
+    }
+}
+
+static void dense_pack(const uint8_t *registers, uint8_t *packed)
+{
+    for (size_t i = 0; i < HLL_REGISTERS / 4; i++)
+    {
+        uint8_t a = registers[4 * i], b = registers[4 * i + 1], c = registers[4 * i + 2], d = registers[4 * i + 3];
+        packed[3 * i] = (uint8_t)(a | (b << 6));
+        packed[3 * i + 1] = (uint8_t)((b >> 2) | (c << 4));
+        packed[3 * i + 2] = (uint8_t)((c >> 4) | (d << 2));
+    }
+}
+
+std::string hll_from_registers(const uint8_t *registers)
+{
+    std::string hll = make_header(HLLEncoding::DENSE);
+    hll.resize(HLL_DENSE_SIZE, '\0');
+    dense_pack(registers, (uint8_t *)hll.data() + HLL_HEADER_SIZE);
+    invalidate_cache(hll);
+    return hll;
+}
+
+//======================  SPARSE ENCODING  ======================
+
+struct SparseRun
+{
+    uint8_t value;
+    uint32_t length;
+};
+
+static std::vector<SparseRun> sparse_decode(const std::string &hll)
+{
+    std::vector<SparseRun> runs;
+    const uint8_t *p = (const uint8_t *)hll.data() + HLL_HEADER_SIZE;
+    const uint8_t *end = (const uint8_t *)hll.data() + hll.size();
+    while (p < end)
+    {
+        if (*p & HLL_SPARSE_VAL_BIT)
+        {
+            runs.push_back({(uint8_t)(((*p >> 2) & 31) + 1), (uint32_t)(*p & 3) + 1});
+            p++;
+        }
+        else if (*p & HLL_SPARSE_XZERO_BIT)
+        {
+            runs.push_back({0, (((uint32_t)(*p & 63) << 8) | p[1]) + 1});
+            p += 2;
+        }
+        else
+        {
+            runs.push_back({0, (uint32_t)(*p & 63) + 1});
+            p++;
+        }
+    }
+    return runs;
+}
+
+static void sparse_encode(const std::vector<SparseRun> &runs, std::string &out)
+{
+    for (const SparseRun &run : runs)
+    {
+        uint32_t left = run.length;
+        while (left > 0)
+        {
+            if (run.value != 0)
+            {
+                uint32_t length = std::min<uint32_t>(left, HLL_SPARSE_VAL_MAX_LENGTH);
+                out.push_back((char)(HLL_SPARSE_VAL_BIT | ((run.value - 1) << 2) | (length - 1)));
+                left -= length;
+            }
+            else if (left > HLL_SPARSE_ZERO_MAX_LENGTH)
+            {
+                uint32_t length = std::min<uint32_t>(left, HLL_SPARSE_XZERO_MAX_LENGTH);
+                out.push_back((char)(HLL_SPARSE_XZERO_BIT | ((length - 1) >> 8)));
+                out.push_back((char)((length - 1) & 0xFF));
+                left -= length;
+            }
+            else
+            {
+                out.push_back((char)(left - 1));
+                left = 0;
+            }
+        }
+    }
+}
+
+static void sparse_to_registers(const std::string &hll, uint8_t *registers)
+{
+    size_t index = 0;
+    for (const SparseRun &run : sparse_decode(hll))
+    {
+        memset(registers + index, run.value, std::min<size_t>(run.length, HLL_REGISTERS - index));
+        index += run.length;
+        if (index >= HLL_REGISTERS)
+            break;
+    }
+}
+
+static void promote_to_dense(std::string &hll)
+{
+    std::vector<uint8_t> registers(HLL_REGISTERS, 0);
+    sparse_to_registers(hll, registers.data());
+    hll = hll_from_registers(registers.data());
+}
+
+// Raises register 'index' to 'count' in a sparse HLL. The run holding the register is
+// split in up to three, neighbours with equal values are joined back and the opcodes
+// are re-encoded. Sparse HLLs stay small (HLL_SPARSE_MAX_BYTES), so this is cheap.
+static bool sparse_add(std::string &hll, size_t index, uint8_t count)
+{
+    std::vector<SparseRun> runs = sparse_decode(hll);
+
+    size_t start = 0;
+    size_t position = 0;
+    while (position < runs.size() && start + runs[position].length <= index)
+    {
+        start += runs[position].length;
+        position++;
+    }
+    if (position == runs.size() || runs[position].value >= count)
+        return false;
+
+    SparseRun run = runs[position];
+    SparseRun pieces[3] = {{run.value, (uint32_t)(index - start)},
+                           {count, 1},
+                           {run.value, (uint32_t)(start + run.length - index - 1)}};
+
+    std::vector<SparseRun> updated(runs.begin(), runs.begin() + position);
+    updated.reserve(runs.size() + 2);
+    auto push = [&](SparseRun piece)
+    {
+        if (piece.length == 0)
+            return;
+        if (!updated.empty() && updated.back().value == piece.value)
+            updated.back().length += piece.length;
+        else
+            updated.push_back(piece);
+    };
+    for (const SparseRun &piece : pieces)
+        push(piece);
+    for (size_t i = position + 1; i < runs.size(); i++)
+        push(runs[i]);
+
+    std::string encoded = hll.substr(0, HLL_HEADER_SIZE);
+    sparse_encode(updated, encoded);
+    hll = std::move(encoded);
+
+    if (hll.size() > HLL_SPARSE_MAX_BYTES)
+        promote_to_dense(hll);
+    return true;
+}
+
+//======================  ADD AND COUNT  ======================
+
+bool hll_add(std::string &hll, std::string_view element)
+{
+    size_t index;
+    int count = hash_element(element, index);
+
+    bool changed;
+    if (encoding_of(hll) == HLLEncoding::SPARSE && count > HLL_SPARSE_VAL_MAX_VALUE)
+        promote_to_dense(hll);
+
+    if (encoding_of(hll) == HLLEncoding::SPARSE)
+    {
+        changed = sparse_add(hll, index, count);
+    }
+    else
+    {
+        uint8_t *registers = (uint8_t *)hll.data() + HLL_HEADER_SIZE;
+        changed = dense_get(registers, index) < count;
+        if (changed)
+            dense_set(registers, index, count);
+    }
+
+    if (changed)
+        invalidate_cache(hll);
+    return changed;
+}
+
+static double hll_tau(double x)
+{
+    if (x == 0.0 || x == 1.0)
+        return 0.0;
+    double previous;
+    double y = 1.0;
+    double z = 1 - x;
+    do
+    {
+        x = std::sqrt(x);
+        previous = z;
+        y *= 0.5;
+        z -= std::pow(1 - x, 2) * y;
+    } while (previous != z);
+    return z / 3;
+}
+
+static double hll_sigma(double x)
+{
+    if (x == 1.0)
+        return INFINITY;
+    double previous;
+    double y = 1;
+    double z = x;
+    do
+    {
+        x *= x;
+        previous = z;
+        z += x * y;
+        y += y;
+    } while (previous != z);
+    return z;
+}
+
+// Ertl's improved estimator: works off the histogram of register values only, and
+// needs neither the small range correction nor bias tables of the original paper
+static uint64_t estimate(const uint32_t *histogram)
+{
+    double m = HLL_REGISTERS;
+    double z = m * hll_tau((m - histogram[HLL_Q + 1]) / m);
+    for (int j = HLL_Q; j >= 1; j--)
+    {
+        z += histogram[j];
+        z *= 0.5;
+    }
+    z += m * hll_sigma(histogram[0] / m);
+    return (uint64_t)std::llround(HLL_ALPHA_INF * m * m / z);
+}
+
+uint64_t hll_count_registers(const uint8_t *registers)
+{
+    uint32_t histogram[64] = {0};
+    for (size_t i = 0; i < HLL_REGISTERS; i++)
+        histogram[registers[i]]++;
+    return estimate(histogram);
+}
+
+uint64_t hll_count(std::string &hll)
+{
+    if (cache_valid(hll))
+        return read_cache(hll);
+
+    uint32_t histogram[64] = {0};
+    if (encoding_of(hll) == HLLEncoding::SPARSE)
+    {
+        for (const SparseRun &run : sparse_decode(hll))
+            histogram[run.value] += run.length;
+    }
+    else
+    {
+        std::vector<uint8_t> registers(HLL_REGISTERS);
+        dense_unpack((const uint8_t *)hll.data() + HLL_HEADER_SIZE, registers.data());
+        for (uint8_t value : registers)
+            histogram[value]++;
+    }
+
+    uint64_t cardinality = estimate(histogram);
+    write_cache(hll, cardinality); // Also clears the stale bit
+    return cardinality;
+}
+
+//======================  MERGE  ======================
+
+static void max_bytes_scalar(uint8_t *dest, const uint8_t *source, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+        dest[i] = std::max(dest[i], source[i]);
+}
+
+#if defined(__x86_64__)
+
+__attribute__((target("avx2"))) static void max_bytes_avx2(uint8_t *dest, const uint8_t *source, size_t length)
+{
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(dest + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(source + i));
+        _mm256_storeu_si256((__m256i *)(dest + i), _mm256_max_epu8(a, b));
+    }
+    max_bytes_scalar(dest + i, source + i, length - i);
+}
+
+static void max_bytes(uint8_t *dest, const uint8_t *source, size_t length)
+{
+    static const bool use_avx2 = __builtin_cpu_supports("avx2");
+    if (use_avx2)
+        max_bytes_avx2(dest, source, length);
+    else
+        max_bytes_scalar(dest, source, length);
+}
+
+#else
+
+static void max_bytes(uint8_t *dest, const uint8_t *source, size_t length)
+{
+    max_bytes_scalar(dest, source, length);
+}
+
+#endif
+
+void hll_merge_into(uint8_t *registers, const std::string &hll)
+{
+    if (encoding_of(hll) == HLLEncoding::SPARSE)
+    {
+        // Only non-zero runs can raise anything, so walk the runs directly
+        size_t index = 0;
+        for (const SparseRun &run : sparse_decode(hll))
+        {
+            if (run.value != 0)
+            {
+                for (size_t i = index; i < index + run.length && i < HLL_REGISTERS; i++)
+                    registers[i] = std::max(registers[i], run.value);
+            }
+            index += run.length;
+        }
+        return;
+    }
+
+    // Dense: unpack to one byte per register, then a byte-wise max over all 16384
+    uint8_t unpacked[HLL_REGISTERS];
+    dense_unpack((const uint8_t *)hll.data() + HLL_HEADER_SIZE, unpacked);
+    max_bytes(registers, unpacked, HLL_REGISTERS);
+}
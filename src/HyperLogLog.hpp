@@ -0,0 +1,55 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstdint>
+
+// HyperLogLog cardinality estimator stored as an ordinary string value, using the same
+// byte layout as Redis so PF* values survive a DUMP/RDB round trip:
+//
+//   "HYLL" | encoding (1 byte) | 3 unused bytes | cached cardinality (8 bytes, LE) | registers
+//
+// The top bit of the last cache byte marks the cache as stale. Registers are either
+// dense (16384 6-bit counters packed into 12KB) or sparse, a run-length encoding that
+// is only a few bytes for small sets and is promoted to dense once it stops paying off.
+
+//======================  HYPERLOGLOG LIMITS START  ======================
+
+const int HLL_P = 14;                                      // Index bits taken from the hash
+const int HLL_Q = 64 - HLL_P;                              // Bits left to count zeros in
+const size_t HLL_REGISTERS = 1 << HLL_P;                   // 16384
+const size_t HLL_BITS = 6;                                 // Bits per dense register
+const size_t HLL_HEADER_SIZE = 16;
+const size_t HLL_DENSE_SIZE = HLL_HEADER_SIZE + (HLL_REGISTERS * HLL_BITS + 7) / 8;
+
+// A sparse HLL growing past this many bytes is converted to the dense encoding
+const size_t HLL_SPARSE_MAX_BYTES = 3000;
+
+//======================   HYPERLOGLOG LIMITS END   ======================
+
+enum class HLLEncoding : uint8_t
+{
+    DENSE = 0,
+    SPARSE = 1,
+};
+
+// An empty HLL (sparse encoding)
+std::string hll_create();
+
+// Checks the header and size, so PF* commands can refuse ordinary strings
+bool hll_is_valid(const std::string &hll);
+
+// Adds an element. Returns true if any register changed (and the cache was invalidated).
+bool hll_add(std::string &hll, std::string_view element);
+
+// Estimated cardinality. Served from the header cache when it is valid, otherwise
+// computed and written back to the cache.
+uint64_t hll_count(std::string &hll);
+
+// Max-merges the registers of hll into registers[HLL_REGISTERS] (one byte per register)
+void hll_merge_into(uint8_t *registers, const std::string &hll);
+
+// Estimated cardinality of an unpacked register array
+uint64_t hll_count_registers(const uint8_t *registers);
+
+// A dense HLL holding the given unpacked registers
+std::string hll_from_registers(const uint8_t *registers);
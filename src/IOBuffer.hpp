@@ -0,0 +1,35 @@
+#pragma once
+#include <vector>
+#include <memory>
+#include <utility>
+
+// Allocator that default-initializes instead of value-initializing: for bytes that
+// means leaving them as they are. A vector using it grows on resize() without writing
+// the new elements, so room made for a read() is not zero-filled first only to be
+// overwritten by the kernel.
+template <typename T>
+struct DefaultInitAllocator : std::allocator<T>
+{
+    template <typename U>
+    struct rebind
+    {
+        typedef DefaultInitAllocator<U> other;
+    };
+
+    using std::allocator<T>::allocator;
+
+    template <typename U>
+    void construct(U *p) noexcept(noexcept(::new ((void *)p) U))
+    {
+        ::new ((void *)p) U;
+    }
+
+    template <typename U, typename... Args>
+    void construct(U *p, Args &&...args)
+    {
+        ::new ((void *)p) U(std::forward<Args>(args)...);
+    }
+};
+
+// The connection I/O buffers: incoming requests and outgoing replies
+typedef std::vector<unsigned char, DefaultInitAllocator<unsigned char>> IOBuffer;
@@ -1,9 +1,17 @@
 #pragma once
 #include <string>
-#include <unordered_map>
+#include <functional>
 #include <optional>
 #include <mutex>
 #include <chrono>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include "RedisObject.hpp"
+#include "Dict.hpp"
+#include "Memory.hpp"
+#include "HotKeys.hpp"
 
 typedef struct ValueEntry Entry;
 
@@ -16,29 +24,172 @@ public:
     {
         std::string value;
         std::optional<std::chrono::steady_clock::time_point> expires_at;
+
+        // STRING values live in 'value'. Every other type lives in 'object'.
+        ValueType type = ValueType::STRING;
+        std::shared_ptr<RedisObject> object;
     };
 
     void set(const std::string &key, const ValueEntry &value)
     {
         std::lock_guard<std::mutex> lock(store_mutex);
+        track(key);
         data[key] = value;
     }
 
+    // Same, moving the value in: for large computed values (BITOP results)
+    void set(const std::string &key, ValueEntry &&value)
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        track(key);
+        data[key] = std::move(value);
+    }
+
     std::optional<ValueEntry> get(const std::string &key)
     {
         std::lock_guard<std::mutex> lock(store_mutex);
-        auto it = data.find(key);
-        if (it != data.end())
+        track(key);
+        ValueEntry *entry = data.find(key);
+        if (entry != nullptr)
         {
-            return it->second;
+            return *entry;
         }
         return std::nullopt;
     }
 
+    // Returns the live entry for key so it can be modified in place, or nullptr.
+    // Expired entries are deleted on access.
+    ValueEntry *find(const std::string &key)
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        track(key);
+        ValueEntry *entry = data.find(key);
+        if (entry == nullptr)
+        {
+            return nullptr;
+        }
+        if (is_expired(*entry))
+        {
+            data.erase(key);
+            expired_keys++;
+            return nullptr;
+        }
+        return entry;
+    }
+
+    // Creates a new key holding an empty object of type T and returns the object
+    template <typename T>
+    T &create(const std::string &key, ValueType type)
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        track(key);
+        ValueEntry &entry = data[key];
+        entry = ValueEntry{};
+        entry.type = type;
+        entry.object = std::make_shared<T>();
+        return static_cast<T &>(*entry.object);
+    }
+
+    bool erase(const std::string &key)
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        track(key);
+        return data.erase(key);
+    }
+
+    size_t size()
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        return data.size();
+    }
+
+    // Drops every key (a replica replacing its dataset with the primary's)
+    void clear()
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        data.clear();
+    }
+
+    // Pre-sizes the table, so a bulk load of 'count' keys never triggers a rehash
+    void reserve(size_t count)
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        data.reserve(count);
+    }
+
+    // Moves a batch of new keys in (snapshot loading). The keys must not exist yet.
+    void insert_loaded(std::vector<std::pair<std::string, ValueEntry>> &entries)
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        for (auto &[key, entry] : entries)
+        {
+            data.insert_unique(std::move(key), std::move(entry));
+        }
+        entries.clear();
+    }
+
+    // One SCAN step: visits the keys of one bucket (expired ones included, callers
+    // filter with is_expired) and returns the next cursor, 0 once the scan is complete
+    unsigned long scan(unsigned long cursor, const std::function<void(const std::string &, ValueEntry &)> &fn)
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        return data.scan(cursor, fn);
+    }
+
+    // Visits every key (expired ones included). fn must not add or remove keys.
+    void for_each(const std::function<void(const std::string &, ValueEntry &)> &fn)
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        data.for_each(fn);
+    }
+
+    // Bytes of the keyspace structure itself: the bucket arrays and one entry allocation
+    // per key (the key and value objects, not their contents)
+    size_t overhead_bytes()
+    {
+        std::lock_guard<std::mutex> lock(store_mutex);
+        return data.table_bytes() + data.size() * allocation_size(Dict<ValueEntry>::entry_size());
+    }
+
+    // Estimated footprint of one key (MEMORY USAGE): its entry, the key and string
+    // value contents and the value object, collections sampled (see RedisObject)
+    static size_t memory_usage(const std::string &key, const ValueEntry &entry, size_t samples)
+    {
+        size_t bytes = allocation_size(Dict<ValueEntry>::entry_size()) + string_heap_size(key) + string_heap_size(entry.value);
+        if (entry.object)
+        {
+            bytes += entry.object->memory_usage(samples);
+        }
+        return bytes;
+    }
+
+    // Every key lookup and write is reported to tracker (nullptr stops the counting)
+    void set_access_tracker(HotKeys *tracker) { access_tracker = tracker; }
+
+    // Keys deleted because they were found expired
+    uint64_t expired_count() const { return expired_keys; }
+
+    static bool is_expired(const ValueEntry &entry)
+    {
+        return entry.expires_at.has_value() && entry.expires_at <= std::chrono::steady_clock::now();
+    }
+
 private:
     // The actual "Town Square" where data lives
-    std::unordered_map<std::string, ValueEntry> data;
+    Dict<ValueEntry> data;
 
     // Mutex to ensure thread safety
     std::mutex store_mutex;
-};
\ No newline at end of file
+
+    uint64_t expired_keys = 0;
+
+    HotKeys *access_tracker = nullptr;
+
+    void track(const std::string &key)
+    {
+        if (access_tracker != nullptr)
+        {
+            access_tracker->record(key);
+        }
+    }
+};
@@ -0,0 +1,209 @@
+#include "LatencyMonitor.hpp"
+#include "RESPHandler.hpp"
+#include <algorithm>
+#include <cstdio>
+
+static const char *PHASE_NAMES[LatencyMonitor::PHASES] = {"poll", "accept", "read", "parse", "command", "write", "flush", "cron"};
+
+static uint64_t busy_ns(uint64_t total_ns, uint64_t poll_ns)
+{
+    return total_ns > poll_ns ? total_ns - poll_ns : 0;
+}
+
+LatencyMonitor::LatencyMonitor(const ServerConfig &config)
+{
+    threshold_ms = config.latency_monitor_threshold;
+}
+
+LatencyMonitor::Timer::Timer(LatencyMonitor &monitor, Phase phase) : monitor(monitor), phase(phase)
+{
+    if (monitor.enabled())
+        started = std::chrono::steady_clock::now();
+}
+
+LatencyMonitor::Timer::~Timer()
+{
+    if (started != std::chrono::steady_clock::time_point{})
+        monitor.add(phase, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - started).count());
+}
+
+void LatencyMonitor::add_command(const std::string &name, uint64_t nanoseconds)
+{
+    iteration.phase_ns[COMMAND] += nanoseconds;
+    if (nanoseconds > iteration.slowest_command_ns)
+    {
+        iteration.slowest_command = name;
+        iteration.slowest_command_ns = nanoseconds;
+    }
+}
+
+void LatencyMonitor::next_iteration()
+{
+    if (!enabled())
+    {
+        iteration_start = {};
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (iteration_start != std::chrono::steady_clock::time_point{})
+    {
+        iteration.total_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(now - iteration_start).count();
+        uint64_t busy = busy_ns(iteration.total_ns, iteration.phase_ns[POLL]);
+        const uint64_t threshold_ns = threshold_ms * 1000000ULL;
+        if (busy >= threshold_ns)
+        {
+            iteration.time = time(nullptr);
+            record_event("event-loop", busy / 1000000, iteration.time);
+            for (int phase = ACCEPT; phase < PHASES; phase++)
+            {
+                if (iteration.phase_ns[phase] >= threshold_ns)
+                    record_event(PHASE_NAMES[phase], iteration.phase_ns[phase] / 1000000, iteration.time);
+            }
+            if (busy >= busy_ns(worst_slow.total_ns, worst_slow.phase_ns[POLL]))
+                worst_slow = iteration;
+            latest_slow = std::move(iteration);
+        }
+    }
+    iteration = Iteration{};
+    iteration_start = now;
+}
+
+void LatencyMonitor::record_event(const std::string &event, uint32_t ms, time_t now)
+{
+    Series &series = events[event];
+    series.max_ms = std::max(series.max_ms, ms);
+    series.total_ms += ms;
+    series.recorded++;
+
+    // Several spikes within the same second are one sample, the worst of them
+    Sample &last = series.samples[(series.next + HISTORY_LENGTH - 1) % HISTORY_LENGTH];
+    if (series.count > 0 && last.time == now)
+    {
+        last.ms = std::max(last.ms, ms);
+        return;
+    }
+    series.samples[series.next] = {now, ms};
+    series.next = (series.next + 1) % HISTORY_LENGTH;
+    series.count = std::min(series.count + 1, HISTORY_LENGTH);
+}
+
+std::string LatencyMonitor::latest() const
+{
+    // event, time of the latest sample, its latency, the highest latency seen
+    std::string reply = RESPHandler::serialize_array_header(events.size());
+    for (const auto &[name, series] : events)
+    {
+        const Sample &last = series.samples[(series.next + HISTORY_LENGTH - 1) % HISTORY_LENGTH];
+        reply += RESPHandler::serialize_array_header(4);
+        reply += RESPHandler::serialize_bulk_string(name);
+        reply += RESPHandler::serialize_integer(last.time);
+        reply += RESPHandler::serialize_integer(last.ms);
+        reply += RESPHandler::serialize_integer(series.max_ms);
+    }
+    return reply;
+}
+
+std::string LatencyMonitor::history(const std::string &event) const
+{
+    auto found = events.find(event);
+    if (found == events.end())
+        return RESPHandler::serialize_array_header(0);
+
+    // Oldest first
+    const Series &series = found->second;
+    std::string reply = RESPHandler::serialize_array_header(series.count);
+    for (size_t i = 0; i < series.count; i++)
+    {
+        const Sample &sample = series.samples[(series.next + HISTORY_LENGTH - series.count + i) % HISTORY_LENGTH];
+        reply += RESPHandler::serialize_array_header(2);
+        reply += RESPHandler::serialize_integer(sample.time);
+        reply += RESPHandler::serialize_integer(sample.ms);
+    }
+    return reply;
+}
+
+size_t LatencyMonitor::reset(const std::vector<std::string> &names)
+{
+    if (names.empty())
+    {
+        size_t count = events.size();
+        events.clear();
+        latest_slow = Iteration{};
+        worst_slow = Iteration{};
+        return count;
+    }
+    size_t count = 0;
+    for (const std::string &name : names)
+        count += events.erase(name);
+    return count;
+}
+
+std::string LatencyMonitor::describe(const Iteration &slow)
+{
+    // "12.3 ms busy at 1700000000: command 11.9 ms (slowest HSET 11.8 ms), read 0.2 ms, ..."
+    char number[64];
+    auto ms = [&](uint64_t ns)
+    {
+        snprintf(number, sizeof(number), "%.3f ms", ns / 1e6);
+        return std::string(number);
+    };
+
+    uint64_t busy = busy_ns(slow.total_ns, slow.phase_ns[POLL]);
+    uint64_t accounted = 0;
+    std::string text = ms(busy) + " busy at unix time " + std::to_string(slow.time) + ":";
+    for (int phase = ACCEPT; phase < PHASES; phase++)
+    {
+        accounted += slow.phase_ns[phase];
+        if (slow.phase_ns[phase] == 0)
+            continue;
+        text += std::string(" ") + PHASE_NAMES[phase] + " " + ms(slow.phase_ns[phase]);
+        if (phase == COMMAND && !slow.slowest_command.empty())
+            text += " (slowest " + slow.slowest_command + " " + ms(slow.slowest_command_ns) + ")";
+        text += ",";
+    }
+    text += " other " + ms(busy > accounted ? busy - accounted : 0) + "; it followed a poll wait of " + ms(slow.phase_ns[POLL]) + ".\n";
+    return text;
+}
+
+std::string LatencyMonitor::doctor() const
+{
+    std::string text;
+    if (!enabled())
+        text += "The latency monitor is disabled: set latency-monitor-threshold to a number of milliseconds to enable it.\n";
+    if (events.empty())
+        return text + "No latency spike above the threshold was observed.\n";
+
+    text += "Latency spikes of " + std::to_string(threshold_ms) + " ms or more, by event:\n\n";
+    for (const auto &[name, series] : events)
+    {
+        text += "* " + name + ": " + std::to_string(series.recorded) + " spikes, average " +
+                std::to_string(series.total_ms / series.recorded) + " ms, worst " + std::to_string(series.max_ms) + " ms.\n";
+    }
+
+    if (latest_slow.total_ns > 0)
+    {
+        text += "\nWorst iteration: " + describe(worst_slow);
+        text += "Latest slow iteration: " + describe(latest_slow);
+
+        // Point at the phase that took most of the worst iteration
+        int dominant = ACCEPT;
+        for (int phase = ACCEPT; phase < PHASES; phase++)
+        {
+            if (worst_slow.phase_ns[phase] > worst_slow.phase_ns[dominant])
+                dominant = phase;
+        }
+        static const char *ADVICE[PHASES] = {
+            "",
+            "A burst of new connections: consider connection pooling on the client side.",
+            "Reading from sockets: very large requests or a lot of clients sending at once.",
+            "Parsing requests: very large or very many pipelined requests.",
+            "Executing commands: look at SLOWLOG GET for the culprits (big values, O(N) commands on large keys).",
+            "Writing replies: very large replies, e.g. KEYS or LRANGE over big ranges.",
+            "Flushing the AOF / replication stream: with appendfsync always every iteration waits for the disk.",
+            "The crons: forking for BGSAVE / BGREWRITEAOF (see latest_fork_usec in INFO persistence) or cluster and replication upkeep.",
+        };
+        text += "\n" + std::string(ADVICE[dominant]) + "\n";
+    }
+    return text;
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <cstdint>
+#include <ctime>
+#include "Config.hpp"
+
+// Event loop latency monitor (LATENCY LATEST / HISTORY / RESET / DOCTOR).
+//
+// Every iteration of the event loop is timed phase by phase: the poll wait, accepting
+// connections, socket reads, request parsing, command execution, socket writes, the
+// AOF / replication flush and the crons. An iteration whose busy time (everything but
+// the poll wait) reaches latency-monitor-threshold milliseconds is recorded as an
+// "event-loop" sample, and each phase that alone reached the threshold as a sample of
+// its own event, so a spike can be told apart: one giant command, a burst of accepts,
+// a slow fsync or a fork.
+//
+// With the threshold at 0 (the default) the monitor is off and no clock is read for it.
+class LatencyMonitor
+{
+public:
+    enum Phase
+    {
+        POLL,
+        ACCEPT,
+        READ,
+        PARSE,
+        COMMAND,
+        WRITE,
+        FLUSH,
+        CRON,
+        PHASES,
+    };
+
+    explicit LatencyMonitor(const ServerConfig &config);
+
+    bool enabled() const { return threshold_ms > 0; }
+    long long threshold() const { return threshold_ms; }
+    void set_threshold(long long ms) { threshold_ms = ms; }
+
+    // Called at the top of every event loop iteration: closes the previous iteration,
+    // recording it if it was slow, and starts timing the next one
+    void next_iteration();
+
+    void add(Phase phase, uint64_t nanoseconds) { iteration.phase_ns[phase] += nanoseconds; }
+    void add_command(const std::string &name, uint64_t nanoseconds);
+
+    // Times a phase for as long as it is in scope
+    class Timer
+    {
+    public:
+        Timer(LatencyMonitor &monitor, Phase phase);
+        ~Timer();
+
+    private:
+        LatencyMonitor &monitor;
+        Phase phase;
+        std::chrono::steady_clock::time_point started;
+    };
+
+    // Command replies
+    std::string latest() const;
+    std::string history(const std::string &event) const;
+    size_t reset(const std::vector<std::string> &events);
+    std::string doctor() const;
+
+private:
+    // Same size as Redis: 160 samples, one per second at most per event
+    static constexpr size_t HISTORY_LENGTH = 160;
+
+    struct Sample
+    {
+        time_t time = 0;
+        uint32_t ms = 0;
+    };
+    struct Series
+    {
+        Sample samples[HISTORY_LENGTH];
+        size_t next = 0;
+        size_t count = 0;
+        uint32_t max_ms = 0;
+        uint64_t total_ms = 0;
+        uint64_t recorded = 0;
+    };
+
+    struct Iteration
+    {
+        time_t time = 0;
+        uint64_t total_ns = 0;
+        uint64_t phase_ns[PHASES] = {};
+        std::string slowest_command;
+        uint64_t slowest_command_ns = 0;
+    };
+
+    long long threshold_ms;
+    std::map<std::string, Series> events;
+    std::chrono::steady_clock::time_point iteration_start;
+    Iteration iteration;
+    Iteration latest_slow;
+    Iteration worst_slow;
+
+    void record_event(const std::string &event, uint32_t ms, time_t now);
+    static std::string describe(const Iteration &slow);
+};
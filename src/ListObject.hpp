@@ -0,0 +1,24 @@
+#pragma once
+#include <string>
+#include <deque>
+#include "RedisObject.hpp"
+#include "Memory.hpp"
+
+// Lists are double ended queues: O(1) push and pop at both ends
+class ListObject : public RedisObject
+{
+public:
+    std::deque<std::string> items;
+
+    size_t memory_usage(size_t samples) const override
+    {
+        // The deque keeps the string objects in fixed blocks; their contents are sampled
+        size_t bytes = allocation_size(sizeof(ListObject) + SHARED_CONTROL_BLOCK_SIZE) + items.size() * sizeof(std::string);
+        size_t sampled = 0, sampled_bytes = 0;
+        for (auto it = items.begin(); it != items.end() && (samples == 0 || sampled < samples); ++it, ++sampled)
+        {
+            sampled_bytes += string_heap_size(*it);
+        }
+        return bytes + extrapolate(sampled_bytes, sampled, items.size());
+    }
+};
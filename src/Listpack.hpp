@@ -0,0 +1,54 @@
+#pragma once
+#include <vector>
+#include <string>
+#include <string_view>
+
+// Helpers for the compact "listpack" encodings used by small hashes, sorted sets and
+// stream blocks.
+// An entry is a varint length (7 bits per byte, high bit set on all but the last
+// byte) followed by that many raw bytes.
+
+inline void listpack_write_varint(std::vector<unsigned char> &buffer, unsigned long long value)
+{
+    while (value >= 0x80)
+    {
+        buffer.push_back((unsigned char)(value & 0x7F) | 0x80);
+        value >>= 7;
+    }
+    buffer.push_back((unsigned char)value);
+}
+
+// Decodes the varint at offset into value. Returns the offset just past it.
+inline size_t listpack_read_varint(const std::vector<unsigned char> &buffer, size_t offset, unsigned long long &value)
+{
+    value = 0;
+    int shift = 0;
+    while (buffer[offset] & 0x80)
+    {
+        value |= (unsigned long long)(buffer[offset] & 0x7F) << shift;
+        shift += 7;
+        offset++;
+    }
+    value |= (unsigned long long)buffer[offset] << shift;
+    return offset + 1;
+}
+
+inline void listpack_write_entry(std::vector<unsigned char> &buffer, std::string_view s)
+{
+    listpack_write_varint(buffer, s.size());
+    buffer.insert(buffer.end(), s.begin(), s.end());
+}
+
+// Decodes the length header at offset. Returns the offset of the entry's first data byte.
+inline size_t listpack_read_entry(const std::vector<unsigned char> &buffer, size_t offset, size_t &length)
+{
+    unsigned long long value;
+    offset = listpack_read_varint(buffer, offset, value);
+    length = (size_t)value;
+    return offset;
+}
+
+inline std::string_view listpack_view(const std::vector<unsigned char> &buffer, size_t data, size_t length)
+{
+    return std::string_view((const char *)buffer.data() + data, length);
+}
@@ -0,0 +1,303 @@
+#include "Log.hpp"
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <algorithm>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+#include <pthread.h>
+
+static const char *LEVEL_NAMES[] = {"debug", "verbose", "notice", "warning"};
+static const char LEVEL_SYMBOLS[] = {'.', '-', '*', '#'};
+
+// The ring: a bounded multi-producer queue (Vyukov's). Each slot carries a sequence
+// number telling whose turn it is: slot == position means free for the producer that
+// claimed position, position + 1 means filled and ready for the writer. Producers
+// claim positions with one compare-and-swap and never wait for each other or for the
+// writer; a full ring makes them drop the line.
+static constexpr size_t RING_SLOTS = 1024;
+static constexpr size_t LINE_SIZE = 512; // Longer messages are truncated
+
+struct LogSlot
+{
+    std::atomic<uint64_t> sequence;
+    LogLevel level;
+    std::chrono::system_clock::time_point time;
+    uint32_t length;
+    char text[LINE_SIZE];
+};
+
+static LogSlot ring[RING_SLOTS];
+static std::atomic<uint64_t> enqueue_position{0};
+static uint64_t dequeue_position = 0; // Writer thread only
+static std::atomic<uint64_t> dropped_lines{0};
+
+static std::thread writer;
+static std::atomic<bool> writer_sleeping{false};
+static std::atomic<bool> stopping{false};
+
+// False until start_logging() and in forked children: lines are written directly
+static bool asynchronous = false;
+
+// Forked children (BGSAVE, AOF rewrite) can't call localtime_r: it takes glibc's timezone
+// lock, which the writer thread may have held at the moment of the fork, and then the
+// child waits for it forever. The UTC offset is taken in the parent right before each
+// fork, and the child works out the date from it with plain arithmetic.
+static bool forked_child = false;
+static long utc_offset_seconds = 0;
+
+static const char *MONTH_NAMES[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+
+static std::string format_line(LogLevel level, std::chrono::system_clock::time_point time, const char *text, size_t length)
+{
+    int millis = (int)(std::chrono::duration_cast<std::chrono::milliseconds>(time.time_since_epoch()).count() % 1000);
+    int year, month, day, hours, minutes, seconds;
+    if (forked_child)
+    {
+        auto local = std::chrono::floor<std::chrono::seconds>(time) + std::chrono::seconds(utc_offset_seconds);
+        auto midnight = std::chrono::floor<std::chrono::days>(local);
+        std::chrono::year_month_day date(midnight);
+        std::chrono::hh_mm_ss clock(local - midnight);
+        year = (int)date.year();
+        month = (int)(unsigned)date.month() - 1;
+        day = (int)(unsigned)date.day();
+        hours = (int)clock.hours().count();
+        minutes = (int)clock.minutes().count();
+        seconds = (int)clock.seconds().count();
+    }
+    else
+    {
+        time_t since_epoch = std::chrono::system_clock::to_time_t(time);
+        struct tm local;
+        localtime_r(&since_epoch, &local);
+        year = local.tm_year + 1900;
+        month = local.tm_mon;
+        day = local.tm_mday;
+        hours = local.tm_hour;
+        minutes = local.tm_min;
+        seconds = local.tm_sec;
+    }
+
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), "%d %02d %s %d %02d:%02d:%02d.%03d %c ", (int)getpid(), day, MONTH_NAMES[month], year,
+             hours, minutes, seconds, millis, LEVEL_SYMBOLS[(int)level]);
+
+    std::string line = prefix;
+    line.append(text, length);
+    line += '\n';
+    return line;
+}
+
+static void write_all(int fd, const std::string &data)
+{
+    size_t written = 0;
+    while (written < data.size())
+    {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        written += n;
+    }
+}
+
+static void enqueue(LogLevel level, std::chrono::system_clock::time_point time, const std::string &message)
+{
+    uint64_t position = enqueue_position.load(std::memory_order_relaxed);
+    LogSlot *slot;
+    while (true)
+    {
+        slot = &ring[position & (RING_SLOTS - 1)];
+        int64_t turn = (int64_t)(slot->sequence.load(std::memory_order_acquire) - position);
+        if (turn == 0)
+        {
+            if (enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (turn < 0)
+        {
+            // The writer is a whole ring behind
+            dropped_lines.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        else
+        {
+            position = enqueue_position.load(std::memory_order_relaxed);
+        }
+    }
+
+    slot->level = level;
+    slot->time = time;
+    slot->length = (uint32_t)std::min(message.size(), LINE_SIZE);
+    memcpy(slot->text, message.data(), slot->length);
+    if (message.size() > LINE_SIZE)
+        memcpy(slot->text + LINE_SIZE - 3, "...", 3);
+    slot->sequence.store(position + 1, std::memory_order_release);
+
+    // Only wake the writer when it went to sleep: a busy writer finds the line on its
+    // own. Pairs with the fence in writer_loop so that one of the two always sees the
+    // other (either the writer sees the line, or we see it sleeping).
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (writer_sleeping.load(std::memory_order_relaxed))
+    {
+        writer_sleeping.store(false, std::memory_order_relaxed);
+        writer_sleeping.notify_one();
+    }
+}
+
+static bool ring_empty()
+{
+    LogSlot &slot = ring[dequeue_position & (RING_SLOTS - 1)];
+    return slot.sequence.load(std::memory_order_acquire) != dequeue_position + 1;
+}
+
+// Writes out everything queued so far, one write() per stream for a batch of lines
+static void drain()
+{
+    std::string out, err;
+    while (!ring_empty())
+    {
+        LogSlot &slot = ring[dequeue_position & (RING_SLOTS - 1)];
+        std::string line = format_line(slot.level, slot.time, slot.text, slot.length);
+        (slot.level == LogLevel::WARNING ? err : out) += line;
+        slot.sequence.store(dequeue_position + RING_SLOTS, std::memory_order_release);
+        dequeue_position++;
+
+        if (out.size() + err.size() >= 64 * 1024)
+            break;
+    }
+
+    uint64_t dropped = dropped_lines.exchange(0, std::memory_order_relaxed);
+    if (dropped > 0)
+    {
+        std::string message = std::to_string(dropped) + " log lines dropped, the log buffer was full";
+        err += format_line(LogLevel::WARNING, std::chrono::system_clock::now(), message.data(), message.size());
+    }
+
+    if (!out.empty())
+        write_all(STDOUT_FILENO, out);
+    if (!err.empty())
+        write_all(STDERR_FILENO, err);
+}
+
+static void writer_loop()
+{
+    while (true)
+    {
+        drain();
+        if (!ring_empty())
+            continue;
+        if (stopping.load(std::memory_order_acquire))
+            return;
+
+        writer_sleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!ring_empty() || stopping.load(std::memory_order_acquire))
+        {
+            writer_sleeping.store(false, std::memory_order_relaxed);
+            continue;
+        }
+        writer_sleeping.wait(true, std::memory_order_relaxed);
+    }
+}
+
+static void stop_logging()
+{
+    // A forked child never had the writer thread
+    if (!asynchronous)
+        return;
+    stopping.store(true, std::memory_order_release);
+    writer_sleeping.store(false, std::memory_order_relaxed);
+    writer_sleeping.notify_one();
+    writer.join();
+    asynchronous = false;
+}
+
+void start_logging()
+{
+    if (asynchronous)
+        return;
+    for (size_t i = 0; i < RING_SLOTS; i++)
+        ring[i].sequence.store(i, std::memory_order_relaxed);
+
+    writer = std::thread(writer_loop);
+    asynchronous = true;
+
+    // Children (BGSAVE, AOF rewrite) only have the thread that forked: they write
+    // directly. Lines queued in the parent at fork time are the parent's to write.
+    pthread_atfork([]()
+                   {
+                       time_t now = time(nullptr);
+                       struct tm local;
+                       localtime_r(&now, &local);
+                       utc_offset_seconds = local.tm_gmtoff; },
+                   nullptr, []()
+                   {
+                       asynchronous = false;
+                       forked_child = true; });
+    atexit(stop_logging);
+}
+
+void server_log(LogLevel level, const std::string &message)
+{
+    if (!log_enabled(level))
+        return;
+    std::chrono::system_clock::time_point now = std::chrono::system_clock::now();
+    if (asynchronous)
+    {
+        enqueue(level, now, message);
+        return;
+    }
+    write_all(level == LogLevel::WARNING ? STDERR_FILENO : STDOUT_FILENO, format_line(level, now, message.data(), message.size()));
+}
+
+void LogRateLimit::log(LogLevel level, const std::string &message)
+{
+    if (!log_enabled(level))
+        return;
+
+    int64_t second = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    if (second != window)
+    {
+        window = second;
+        count = 0;
+    }
+    if (count >= per_second)
+    {
+        suppressed++;
+        return;
+    }
+    count++;
+
+    if (suppressed > 0)
+    {
+        server_log(level, message + " (" + std::to_string(suppressed) + " similar lines suppressed)");
+        suppressed = 0;
+    }
+    else
+    {
+        server_log(level, message);
+    }
+}
+
+bool parse_log_level(const std::string &name, LogLevel &level)
+{
+    for (int i = 0; i < 4; i++)
+    {
+        if (name == LEVEL_NAMES[i])
+        {
+            level = (LogLevel)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *log_level_name(LogLevel level)
+{
+    return LEVEL_NAMES[(int)level];
+}
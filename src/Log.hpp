@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <cstdint>
+
+// Server log. Lines go through a fixed size lock-free ring buffer and are written to
+// stdout/stderr by a background thread, so logging never makes the event loop wait on
+// a slow terminal or pipe. When the ring is full lines are dropped (and counted)
+// rather than blocking. Before start_logging() and in forked children (BGSAVE, AOF
+// rewrite), where there is no writer thread, lines are written directly.
+//
+// Lines look like Redis': "<pid> 19 Oct 2026 10:00:00.123 * message"
+
+// Log levels, as in Redis. Events that happen once per connection (connects, closes,
+// refusals, protocol errors) are VERBOSE, so at the default NOTICE level connection
+// churn stays quiet.
+enum class LogLevel
+{
+    DEBUG,
+    VERBOSE,
+    NOTICE,
+    WARNING,
+};
+
+// Set from --loglevel / CONFIG SET loglevel
+inline LogLevel log_level = LogLevel::NOTICE;
+
+// Callers check this before building an expensive message
+inline bool log_enabled(LogLevel level) { return level >= log_level; }
+
+// Queues one line if level is enabled: warnings go to stderr, the rest to stdout
+void server_log(LogLevel level, const std::string &message);
+
+// Starts the writer thread. Lines still queued at exit() are written out.
+void start_logging();
+
+// "debug", "verbose", "notice" or "warning"
+bool parse_log_level(const std::string &name, LogLevel &level);
+const char *log_level_name(LogLevel level);
+
+// Rate limit for one place in the code that clients can trigger at will (protocol
+// errors, unknown commands): at most per_second lines a second, the rest are counted
+// and the count is appended to the next line that gets through. Declare it static
+// next to the call site. Not thread safe, meant for the event loop thread.
+class LogRateLimit
+{
+public:
+    explicit LogRateLimit(uint32_t per_second = 10) : per_second(per_second) {}
+
+    void log(LogLevel level, const std::string &message);
+
+private:
+    uint32_t per_second;
+    int64_t window = -1; // Second the current count belongs to
+    uint32_t count = 0;
+    uint64_t suppressed = 0;
+};
@@ -0,0 +1,96 @@
+#include "Memory.hpp"
+#include <atomic>
+#include <new>
+#include <fstream>
+#include <cstdio>
+#include <cstdlib>
+#include <malloc.h>
+#include <unistd.h>
+
+// Relaxed is enough: these are statistics, and the fsync / loader threads only need the
+// totals to come out right, not ordered with anything else
+static std::atomic<size_t> allocated_bytes{0};
+static std::atomic<size_t> allocated_peak{0};
+
+static void *counted_allocate(size_t size)
+{
+    void *block = malloc(size == 0 ? 1 : size);
+    if (block == nullptr)
+        return nullptr;
+    size_t usable = malloc_usable_size(block);
+    size_t now = allocated_bytes.fetch_add(usable, std::memory_order_relaxed) + usable;
+    // The peak may miss a concurrent increment, which only matters for a few bytes
+    if (now > allocated_peak.load(std::memory_order_relaxed))
+        allocated_peak.store(now, std::memory_order_relaxed);
+    return block;
+}
+
+static void counted_free(void *block)
+{
+    if (block == nullptr)
+        return;
+    allocated_bytes.fetch_sub(malloc_usable_size(block), std::memory_order_relaxed);
+    free(block);
+}
+
+void *operator new(size_t size)
+{
+    void *block = counted_allocate(size);
+    if (block == nullptr)
+        throw std::bad_alloc();
+    return block;
+}
+
+void *operator new[](size_t size)
+{
+    void *block = counted_allocate(size);
+    if (block == nullptr)
+        throw std::bad_alloc();
+    return block;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept { return counted_allocate(size); }
+void *operator new[](size_t size, const std::nothrow_t &) noexcept { return counted_allocate(size); }
+void operator delete(void *block) noexcept { counted_free(block); }
+void operator delete[](void *block) noexcept { counted_free(block); }
+void operator delete(void *block, size_t) noexcept { counted_free(block); }
+void operator delete[](void *block, size_t) noexcept { counted_free(block); }
+void operator delete(void *block, const std::nothrow_t &) noexcept { counted_free(block); }
+void operator delete[](void *block, const std::nothrow_t &) noexcept { counted_free(block); }
+
+size_t used_memory()
+{
+    return allocated_bytes.load(std::memory_order_relaxed);
+}
+
+size_t peak_memory()
+{
+    return allocated_peak.load(std::memory_order_relaxed);
+}
+
+size_t resident_set_bytes()
+{
+    // statm: size resident shared ..., in pages
+    std::ifstream statm("/proc/self/statm");
+    size_t size = 0, resident = 0;
+    statm >> size >> resident;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+std::string bytes_to_human(uint64_t bytes)
+{
+    static const char *UNITS[] = {"B", "K", "M", "G", "T"};
+    double value = bytes;
+    int unit = 0;
+    while (value >= 1024 && unit < 4)
+    {
+        value /= 1024;
+        unit++;
+    }
+    char text[32];
+    if (unit == 0)
+        snprintf(text, sizeof(text), "%lluB", (unsigned long long)bytes);
+    else
+        snprintf(text, sizeof(text), "%.2f%s", value, UNITS[unit]);
+    return text;
+}
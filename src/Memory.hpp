@@ -0,0 +1,46 @@
+#pragma once
+#include <string>
+#include <cstddef>
+#include <cstdint>
+
+// Memory accounting (INFO memory, MEMORY USAGE).
+//
+// The global operator new / delete are replaced (Memory.cpp) by versions that add and
+// subtract the usable size of every block, so used_memory() is the heap owned by C++
+// objects: the keyspace, connection buffers, the AOF and replication buffers, every
+// std::string and container. It costs two relaxed atomic operations per allocation.
+// Memory taken with malloc directly (by libc itself, for instance) is not counted.
+
+// Bytes currently allocated through operator new
+size_t used_memory();
+
+// Highest used_memory() seen since the start
+size_t peak_memory();
+
+// Resident set size of the process, from /proc/self/statm
+size_t resident_set_bytes();
+
+// What malloc really hands out for a request of 'size' bytes (glibc: 16 byte granularity,
+// 8 byte header, 24 bytes minimum). Used to estimate structures without walking them.
+inline size_t allocation_size(size_t size)
+{
+    if (size == 0)
+        return 0;
+    size_t chunk = (size + 8 + 15) & ~(size_t)15;
+    return (chunk < 32 ? 32 : chunk) - 8;
+}
+
+// Heap bytes behind a std::string: none while it fits in the small string buffer
+inline size_t string_heap_size(const std::string &s)
+{
+    return s.capacity() > 15 ? allocation_size(s.capacity() + 1) : 0;
+}
+
+// Total for 'total' elements when 'sampled' of them took 'sampled_bytes'
+inline size_t extrapolate(size_t sampled_bytes, size_t sampled, size_t total)
+{
+    return sampled == 0 ? 0 : (size_t)((double)sampled_bytes / sampled * total);
+}
+
+// "1.50M" style, as in used_memory_human
+std::string bytes_to_human(uint64_t bytes);
@@ -0,0 +1,236 @@
+#include "MetricsServer.hpp"
+#include "Server.hpp"
+#include "Utils.hpp"
+#include "Memory.hpp"
+#include "Log.hpp"
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+MetricsServer::MetricsServer(const ServerConfig &config)
+{
+    if (config.metrics_port == 0)
+        return;
+
+    struct sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(config.metrics_port);
+    if (inet_pton(AF_INET, config.metrics_bind.c_str(), &address.sin_addr) != 1)
+    {
+        server_log(LogLevel::WARNING, "Invalid metrics-bind address " + config.metrics_bind);
+        exit(1);
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 || set_fd_nonblocking(fd) != 0 ||
+        bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0 || listen(fd, SOMAXCONN) != 0)
+    {
+        server_log(LogLevel::WARNING, "Can't listen for metrics on " + config.metrics_bind + ":" + std::to_string(config.metrics_port) + ": " + std::string(strerror(errno)));
+        exit(1);
+    }
+    listen_fd = fd;
+    server_log(LogLevel::NOTICE, "Serving Prometheus metrics on http://" + config.metrics_bind + ":" + std::to_string(config.metrics_port) + "/metrics");
+}
+
+MetricsServer::~MetricsServer()
+{
+    for (HttpClient &client : clients)
+        close(client.fd);
+    if (listen_fd != -1)
+        close(listen_fd);
+}
+
+void MetricsServer::add_poll_fds(std::vector<struct pollfd> &poll_fds) const
+{
+    if (listen_fd == -1)
+        return;
+    // A full house stops accepting until a scrape finishes
+    poll_fds.push_back({listen_fd, (short)(clients.size() < MAX_CLIENTS ? POLLIN : 0), 0});
+    for (const HttpClient &client : clients)
+        poll_fds.push_back({client.fd, (short)(client.response.empty() ? POLLIN : POLLOUT), 0});
+}
+
+int MetricsServer::cron_interval_ms() const
+{
+    // Only to drop clients that never finish their request
+    return clients.empty() ? -1 : 1000;
+}
+
+void MetricsServer::handle_events(const struct pollfd *poll_fds, size_t count, Server &server)
+{
+    if (listen_fd == -1 || count == 0)
+        return;
+
+    const auto REQUEST_TIMEOUT = std::chrono::seconds(5);
+    auto now = std::chrono::steady_clock::now();
+
+    // poll_fds[1 + i] is clients[i]: nothing is added or removed until the loop is done
+    for (size_t i = 0; i < clients.size() && 1 + i < count; i++)
+    {
+        HttpClient &client = clients[i];
+        short ready = poll_fds[1 + i].revents;
+        bool done = (ready & (POLLERR | POLLNVAL)) != 0;
+
+        if (!done && (ready & (POLLIN | POLLHUP)) && client.response.empty())
+        {
+            char chunk[4096];
+            ssize_t n;
+            while ((n = recv(client.fd, chunk, sizeof(chunk), 0)) > 0 && client.request.size() <= MAX_REQUEST_BYTES)
+                client.request.append(chunk, n);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) || client.request.size() > MAX_REQUEST_BYTES)
+                done = true;
+            else if (client.request.find("\r\n\r\n") != std::string::npos)
+                respond(client, server);
+        }
+
+        if (!done && !client.response.empty())
+        {
+            ssize_t n = send(client.fd, client.response.data() + client.sent, client.response.size() - client.sent, MSG_NOSIGNAL);
+            if (n > 0)
+                client.sent += n;
+            else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+                done = true;
+            if (client.sent == client.response.size())
+                done = true;
+        }
+
+        if (done || now - client.accepted > REQUEST_TIMEOUT)
+        {
+            close(client.fd);
+            client.fd = -1;
+        }
+    }
+    clients.erase(std::remove_if(clients.begin(), clients.end(), [](const HttpClient &client)
+                                 { return client.fd == -1; }),
+                  clients.end());
+
+    if (poll_fds[0].revents & POLLIN)
+        accept_clients();
+}
+
+void MetricsServer::accept_clients()
+{
+    while (clients.size() < MAX_CLIENTS)
+    {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;
+        clients.push_back({fd, "", "", 0, std::chrono::steady_clock::now()});
+    }
+}
+
+void MetricsServer::respond(HttpClient &client, Server &server)
+{
+    // "GET /metrics HTTP/1.1". Headers are not needed for anything.
+    std::string line = client.request.substr(0, client.request.find("\r\n"));
+    std::string method = line.substr(0, line.find(' '));
+    size_t path_start = line.find(' ') + 1;
+    std::string path = line.substr(path_start, line.find_first_of(" ?", path_start) - path_start);
+
+    std::string status = "200 OK";
+    std::string body;
+    if (method != "GET" && method != "HEAD")
+        status = "405 Method Not Allowed";
+    else if (path != "/metrics")
+        status = "404 Not Found";
+    else
+        body = render(server);
+    if (status != "200 OK")
+        body = status + "\n";
+
+    client.response = "HTTP/1.1 " + status + "\r\n";
+    client.response += "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n";
+    client.response += "Content-Length: " + std::to_string(body.size()) + "\r\n";
+    client.response += "Connection: close\r\n\r\n";
+    if (method != "HEAD")
+        client.response += body;
+}
+
+// Label values as the exposition format wants them: backslash, double quote and line
+// feed escaped, so a value can't end the label or the line
+static std::string escape_label_value(const std::string &value)
+{
+    std::string escaped;
+    escaped.reserve(value.size());
+    for (char c : value)
+    {
+        if (c == '\\')
+            escaped += "\\\\";
+        else if (c == '"')
+            escaped += "\\\"";
+        else if (c == '\n')
+            escaped += "\\n";
+        else
+            escaped += c;
+    }
+    return escaped;
+}
+
+std::string MetricsServer::render(Server &server)
+{
+    std::string text;
+    auto header = [&](const std::string &name, const char *type, const char *help)
+    {
+        text += "# HELP " + name + " " + help + "\n# TYPE " + name + " " + type + "\n";
+    };
+    auto metric = [&](const std::string &name, const char *type, const char *help, uint64_t value)
+    {
+        header(name, type, help);
+        text += name + " " + std::to_string(value) + "\n";
+    };
+
+    const Stats &stats = server.stats;
+    auto uptime = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - server.start_time);
+    metric("redis_uptime_in_seconds", "gauge", "Seconds since the server started.", uptime.count());
+    metric("redis_connected_clients", "gauge", "Client connections currently open.", server.connected_clients());
+    metric("redis_connections_received_total", "counter", "Connections accepted.", stats.connections_received);
+    metric("redis_commands_processed_total", "counter", "Commands processed.", stats.commands_processed());
+    metric("redis_instantaneous_ops_per_sec", "gauge", "Commands per second over the last 1.6 seconds.", stats.ops_per_sec());
+    metric("redis_net_input_bytes_total", "counter", "Bytes read from clients.", stats.net_input_bytes);
+    metric("redis_net_output_bytes_total", "counter", "Bytes written to clients.", stats.net_output_bytes);
+    metric("redis_error_replies_total", "counter", "Error replies sent.", stats.error_replies());
+    metric("redis_expired_keys_total", "counter", "Keys deleted because they had expired.", server.kv_store.expired_count());
+    metric("redis_evicted_keys_total", "counter", "Keys evicted to stay under a memory limit (there is no limit yet).", 0);
+    metric("redis_memory_used_bytes", "gauge", "Bytes allocated by the server.", used_memory());
+    metric("redis_memory_max_used_bytes", "gauge", "Highest redis_memory_used_bytes seen.", peak_memory());
+    metric("redis_memory_rss_bytes", "gauge", "Resident set size of the process.", resident_set_bytes());
+    header("redis_db_keys", "gauge", "Keys in the database, expired keys not yet deleted included.");
+    text += "redis_db_keys{db=\"db0\"} " + std::to_string(server.kv_store.size()) + "\n";
+
+    // Per command counters, and the latency histograms folded into Prometheus buckets
+    static const double BUCKET_BOUNDS[] = {1e-6, 5e-6, 1e-5, 2.5e-5, 5e-5, 1e-4, 2.5e-4, 5e-4, 1e-3, 2.5e-3,
+                                           5e-3, 1e-2, 2.5e-2, 5e-2, 0.1, 0.25, 0.5, 1, 2.5, 5, 10};
+    std::string calls, failed, rejected, histograms;
+    char number[64];
+    stats.for_each_command([&](const std::string &name, const CommandStat &stat)
+                           {
+                               std::string label = name;
+                               std::transform(label.begin(), label.end(), label.begin(), ::tolower);
+                               label = "{cmd=\"" + escape_label_value(label) + "\"";
+                               calls += "redis_commands_total" + label + "} " + std::to_string(stat.calls) + "\n";
+                               failed += "redis_commands_failed_calls_total" + label + "} " + std::to_string(stat.failed_calls) + "\n";
+                               rejected += "redis_commands_rejected_calls_total" + label + "} " + std::to_string(stat.rejected_calls) + "\n";
+                               for (double bound : BUCKET_BOUNDS)
+                               {
+                                   snprintf(number, sizeof(number), "%g", bound);
+                                   histograms += "redis_command_duration_seconds_bucket" + label + ",le=\"" + number + "\"} " +
+                                                 std::to_string(stat.latency.count_at_most((uint64_t)(bound * 1e9))) + "\n";
+                               }
+                               histograms += "redis_command_duration_seconds_bucket" + label + ",le=\"+Inf\"} " + std::to_string(stat.calls) + "\n";
+                               snprintf(number, sizeof(number), "%.9f", stat.nanoseconds / 1e9);
+                               histograms += "redis_command_duration_seconds_sum" + label + "} " + number + "\n";
+                               histograms += "redis_command_duration_seconds_count" + label + "} " + std::to_string(stat.calls) + "\n"; });
+
+    header("redis_commands_total", "counter", "Calls per command.");
+    text += calls;
+    header("redis_commands_failed_calls_total", "counter", "Calls per command that replied with an error.");
+    text += failed;
+    header("redis_commands_rejected_calls_total", "counter", "Calls per command refused before running.");
+    text += rejected;
+    header("redis_command_duration_seconds", "histogram", "Execution time per command.");
+    text += histograms;
+    return text;
+}
@@ -0,0 +1,53 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <chrono>
+#include <poll.h>
+#include "Config.hpp"
+
+class Server;
+
+// Prometheus metrics over HTTP: GET /metrics on metrics-port (off when 0), bound to
+// metrics-bind (loopback by default).
+//
+// The listener and its HTTP clients are polled by the server's own event loop, with
+// non-blocking sockets, so a scrape never stalls it. Each response is rendered in one go
+// from the live counters and the connection is closed after it (HTTP/1.0 style).
+class MetricsServer
+{
+public:
+    explicit MetricsServer(const ServerConfig &config);
+    ~MetricsServer();
+
+    bool enabled() const { return listen_fd != -1; }
+
+    // Appends the sockets to watch to the poll set
+    void add_poll_fds(std::vector<struct pollfd> &poll_fds) const;
+
+    // Handles the poll results of the sockets added by add_poll_fds, in the same order
+    void handle_events(const struct pollfd *poll_fds, size_t count, Server &server);
+
+    int cron_interval_ms() const;
+
+    // The /metrics document
+    static std::string render(Server &server);
+
+private:
+    struct HttpClient
+    {
+        int fd;
+        std::string request;
+        std::string response;
+        size_t sent = 0;
+        std::chrono::steady_clock::time_point accepted;
+    };
+
+    static const size_t MAX_CLIENTS = 16;
+    static const size_t MAX_REQUEST_BYTES = 8192;
+
+    int listen_fd = -1;
+    std::vector<HttpClient> clients;
+
+    void accept_clients();
+    void respond(HttpClient &client, Server &server);
+};
@@ -0,0 +1,246 @@
+#include "Persistence.hpp"
+#include "Rdb.hpp"
+#include "RESPHandler.hpp"
+#include "Log.hpp"
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+Persistence::Persistence(const ServerConfig &config)
+{
+    rdb_path = config.dir + "/" + config.dbfilename;
+    save_rules = config.save_rules;
+    last_save = time(nullptr);
+}
+
+uint64_t private_dirty_bytes()
+{
+    // smaps_rollup sums every mapping in one line, which is far cheaper than smaps
+    std::ifstream file("/proc/self/smaps_rollup");
+    std::string line;
+    while (std::getline(file, line))
+    {
+        if (line.rfind("Private_Dirty:", 0) == 0)
+        {
+            std::istringstream fields(line.substr(strlen("Private_Dirty:")));
+            uint64_t kilobytes = 0;
+            fields >> kilobytes;
+            return kilobytes * 1024;
+        }
+    }
+    return 0;
+}
+
+void Persistence::load(KeyValueStore &store)
+{
+    if (access(rdb_path.c_str(), F_OK) != 0)
+    {
+        server_log(LogLevel::NOTICE, "No snapshot at " + rdb_path + ", starting empty");
+        return;
+    }
+
+    std::string error;
+    if (!rdb_load(store, rdb_path, load_stats, error))
+    {
+        server_log(LogLevel::WARNING, error);
+        server_log(LogLevel::WARNING, "Failed loading " + rdb_path + ". Unrecoverable error, aborting now.");
+        exit(1);
+    }
+    loaded = true;
+
+    uint64_t total_usec = load_stats.read_usec + load_stats.decode_usec + load_stats.insert_usec;
+    server_log(LogLevel::NOTICE, "DB loaded from disk: " + std::to_string(load_stats.keys) + " keys, " + std::to_string(load_stats.bytes) + " bytes in " + std::to_string(total_usec / 1000) + " ms (read " + std::to_string(load_stats.read_usec / 1000) + " ms, decode " + std::to_string(load_stats.decode_usec / 1000) + " ms on " + std::to_string(load_stats.threads) + " threads, insert " + std::to_string(load_stats.insert_usec / 1000) + " ms)");
+    if (load_stats.expired > 0)
+        server_log(LogLevel::NOTICE, "Skipped " + std::to_string(load_stats.expired) + " expired keys");
+}
+
+void Persistence::record_save(uint64_t bytes, uint64_t usec)
+{
+    last_rdb_bytes = bytes;
+    last_save_usec = usec;
+    saves_completed++;
+
+    double seconds = usec / 1e6;
+    double megabytes = bytes / (1024.0 * 1024.0);
+    char rate[32];
+    snprintf(rate, sizeof(rate), "%.1f", seconds > 0 ? megabytes / seconds : 0);
+    server_log(LogLevel::NOTICE, "DB saved on disk: " + std::to_string(bytes) + " bytes in " + std::to_string(usec / 1000) + " ms (" + rate + " MB/s)");
+}
+
+std::string Persistence::save(KeyValueStore &store)
+{
+    if (child_active())
+        return RESPHandler::serialize_error("ERR Background save already in progress");
+
+    auto started = std::chrono::steady_clock::now();
+    size_t bytes = 0;
+    std::string error;
+    if (!rdb_save(store, rdb_path, bytes, error))
+    {
+        server_log(LogLevel::WARNING, error);
+        return RESPHandler::serialize_error("ERR " + error);
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started);
+    record_save(bytes, elapsed.count());
+    dirty = 0;
+    last_save = time(nullptr);
+    return RESPHandler::serialize_simple_string("OK");
+}
+
+std::string Persistence::background_save(KeyValueStore &store)
+{
+    if (child_active())
+        return RESPHandler::serialize_error("ERR Background save already in progress");
+
+    int pipe_fds[2];
+    if (pipe2(pipe_fds, O_CLOEXEC) != 0)
+        return RESPHandler::serialize_error(std::string("ERR Can't create pipe: ") + strerror(errno));
+
+    last_bgsave_try = time(nullptr);
+    auto fork_started = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        // Child: serialize the snapshot we got at fork time and report back. _exit skips
+        // destructors, which would otherwise close the parent's client sockets.
+        close(pipe_fds[0]);
+        auto started = std::chrono::steady_clock::now();
+        ChildReport report;
+        size_t bytes = 0;
+        std::string error;
+        bool ok = rdb_save(store, rdb_path, bytes, error);
+        if (!ok)
+            server_log(LogLevel::WARNING, error);
+
+        report.bytes = bytes;
+        report.usec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+        report.cow_bytes = private_dirty_bytes();
+        ssize_t ignored = write(pipe_fds[1], &report, sizeof(report));
+        (void)ignored;
+        _exit(ok ? 0 : 1);
+    }
+
+    close(pipe_fds[1]);
+    if (pid < 0)
+    {
+        close(pipe_fds[0]);
+        last_bgsave_ok = false;
+        server_log(LogLevel::WARNING, "Can't save in background: fork: " + std::string(strerror(errno)));
+        return RESPHandler::serialize_error(std::string("ERR Can't fork: ") + strerror(errno));
+    }
+
+    // Fork time grows with the page tables of the parent, i.e. with the dataset size.
+    // The parent is stalled for all of it, so it is worth watching.
+    last_fork_usec = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - fork_started).count();
+    child_pid = pid;
+    child_pipe = pipe_fds[0];
+    child_started = fork_started;
+    child_started_unix = time(nullptr);
+    dirty_at_fork = dirty;
+
+    server_log(LogLevel::NOTICE, "Background saving started by pid " + std::to_string(pid) + " (fork took " + std::to_string(last_fork_usec) + " usec)");
+    return RESPHandler::serialize_simple_string("Background saving started");
+}
+
+void Persistence::finish_background_save(int status)
+{
+    ChildReport report;
+    bool have_report = read(child_pipe, &report, sizeof(report)) == (ssize_t)sizeof(report);
+    close(child_pipe);
+    child_pipe = -1;
+    child_pid = -1;
+
+    if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+    {
+        if (have_report)
+        {
+            last_cow_bytes = report.cow_bytes;
+            record_save(report.bytes, report.usec);
+            server_log(LogLevel::NOTICE, "Background saving copy-on-write: " + std::to_string(report.cow_bytes / (1024 * 1024)) + " MB");
+        }
+        // Writes that came in while the child was busy are not in the snapshot
+        dirty -= dirty_at_fork;
+        last_save = child_started_unix;
+        last_bgsave_ok = true;
+        server_log(LogLevel::NOTICE, "Background saving terminated with success");
+    }
+    else
+    {
+        last_bgsave_ok = false;
+        server_log(LogLevel::WARNING, "Background saving " + std::string(WIFSIGNALED(status) ? "terminated by signal" : "error"));
+    }
+}
+
+void Persistence::cron(KeyValueStore &store, bool can_fork)
+{
+    if (child_active())
+    {
+        int status;
+        if (waitpid(child_pid, &status, WNOHANG) == child_pid)
+            finish_background_save(status);
+        return;
+    }
+    if (!can_fork)
+        return;
+
+    // Same policy as Redis: after a failed BGSAVE only retry every few seconds
+    time_t now = time(nullptr);
+    const time_t RETRY_DELAY = 5;
+    for (const SaveRule &rule : save_rules)
+    {
+        if (dirty >= rule.changes && now - last_save >= rule.seconds &&
+            (last_bgsave_ok || now - last_bgsave_try > RETRY_DELAY))
+        {
+            server_log(LogLevel::NOTICE, std::to_string(rule.changes) + " changes in " + std::to_string(rule.seconds) + " seconds. Saving...");
+            background_save(store);
+            break;
+        }
+    }
+}
+
+int Persistence::cron_interval_ms() const
+{
+    if (child_active())
+        return 100;
+    if (!save_rules.empty())
+        return 1000;
+    return -1;
+}
+
+std::string Persistence::info() const
+{
+    auto now = std::chrono::steady_clock::now();
+    long long current_save_seconds = child_active() ? std::chrono::duration_cast<std::chrono::seconds>(now - child_started).count() : -1;
+    double throughput = last_save_usec > 0 ? (last_rdb_bytes / (1024.0 * 1024.0)) / (last_save_usec / 1e6) : 0;
+
+    std::string text = "# Persistence\r\n";
+    text += "rdb_changes_since_last_save:" + std::to_string(dirty) + "\r\n";
+    text += "rdb_bgsave_in_progress:" + std::to_string(child_active() ? 1 : 0) + "\r\n";
+    text += "rdb_last_save_time:" + std::to_string(last_save) + "\r\n";
+    text += "rdb_last_bgsave_status:" + std::string(last_bgsave_ok ? "ok" : "err") + "\r\n";
+    text += "rdb_current_bgsave_time_sec:" + std::to_string(current_save_seconds) + "\r\n";
+    text += "rdb_saves:" + std::to_string(saves_completed) + "\r\n";
+    text += "rdb_last_save_bytes:" + std::to_string(last_rdb_bytes) + "\r\n";
+    text += "rdb_last_save_usec:" + std::to_string(last_save_usec) + "\r\n";
+    text += "rdb_last_save_throughput_mb_per_sec:" + std::to_string(throughput) + "\r\n";
+    text += "rdb_last_cow_size:" + std::to_string(last_cow_bytes) + "\r\n";
+    text += "latest_fork_usec:" + std::to_string(last_fork_usec) + "\r\n";
+    text += "rdb_loaded:" + std::to_string(loaded ? 1 : 0) + "\r\n";
+    if (loaded)
+    {
+        text += "rdb_load_keys:" + std::to_string(load_stats.keys) + "\r\n";
+        text += "rdb_load_expired_keys:" + std::to_string(load_stats.expired) + "\r\n";
+        text += "rdb_load_bytes:" + std::to_string(load_stats.bytes) + "\r\n";
+        text += "rdb_load_threads:" + std::to_string(load_stats.threads) + "\r\n";
+        text += "rdb_load_chunks:" + std::to_string(load_stats.chunks) + "\r\n";
+        text += "rdb_load_read_usec:" + std::to_string(load_stats.read_usec) + "\r\n";
+        text += "rdb_load_decode_usec:" + std::to_string(load_stats.decode_usec) + "\r\n";
+        text += "rdb_load_insert_usec:" + std::to_string(load_stats.insert_usec) + "\r\n";
+    }
+    return text;
+}
@@ -0,0 +1,86 @@
+#pragma once
+#include <string>
+#include <chrono>
+#include <ctime>
+#include <sys/types.h>
+#include "Config.hpp"
+#include "KeyValueStore.hpp"
+#include "Rdb.hpp"
+
+// Owns RDB snapshotting: SAVE in the foreground, BGSAVE in a forked child, and the
+// save rules that trigger BGSAVE automatically.
+//
+// BGSAVE relies on fork() copy-on-write: the child serializes the keyspace exactly as
+// it was at the fork while the parent keeps serving. Pages the parent modifies during
+// the save get copied by the kernel, which is the memory headroom a snapshot costs, so
+// the child measures it and reports it back together with its throughput.
+class Persistence
+{
+public:
+    explicit Persistence(const ServerConfig &config);
+
+    // Writes since the last successful snapshot. Bumped by every write command.
+    long long dirty = 0;
+
+    // Loads the snapshot at startup, if there is one. Exits on a corrupt file rather than
+    // starting empty and overwriting it with the next save.
+    void load(KeyValueStore &store);
+
+    // Both return the RESP reply for the command
+    std::string save(KeyValueStore &store);
+    std::string background_save(KeyValueStore &store);
+
+    // Called every event loop iteration: reaps a finished child and applies the save rules.
+    // can_fork is false while another child (an AOF rewrite) is running.
+    void cron(KeyValueStore &store, bool can_fork);
+
+    // How long the event loop may sleep before cron needs to run again, -1 for no limit
+    int cron_interval_ms() const;
+
+    bool child_active() const { return child_pid != -1; }
+    time_t last_save_time() const { return last_save; }
+    bool last_bgsave_succeeded() const { return last_bgsave_ok; }
+
+    // The "# Persistence" section of INFO
+    std::string info() const;
+
+private:
+    // What the child sends back through a pipe right before exiting
+    struct ChildReport
+    {
+        uint64_t bytes = 0;
+        uint64_t usec = 0;
+        uint64_t cow_bytes = 0;
+    };
+
+    std::string rdb_path;
+    std::vector<SaveRule> save_rules;
+
+    pid_t child_pid = -1;
+    int child_pipe = -1; // Read end of the report pipe
+    long long dirty_at_fork = 0;
+    std::chrono::steady_clock::time_point child_started;
+    time_t child_started_unix = 0;
+
+    time_t last_save;
+    time_t last_bgsave_try = 0;
+    bool last_bgsave_ok = true;
+
+    // Stats of the most recent snapshot
+    long long last_fork_usec = 0;
+    uint64_t last_cow_bytes = 0;
+    uint64_t last_rdb_bytes = 0;
+    uint64_t last_save_usec = 0;
+    long long saves_completed = 0;
+
+    // Timing breakdown of the startup load
+    bool loaded = false;
+    RdbLoadStats load_stats;
+
+    void finish_background_save(int status);
+    void record_save(uint64_t bytes, uint64_t usec);
+};
+
+// Private dirty memory of the calling process in bytes, from /proc (0 if unavailable).
+// Called in a snapshot child it is the memory duplicated by copy-on-write.
+uint64_t private_dirty_bytes();
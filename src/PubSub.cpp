@@ -0,0 +1,161 @@
+#include "PubSub.hpp"
+#include "Connection.hpp"
+#include "RESPHandler.hpp"
+#include "Utils.hpp"
+
+PubSub::PubSub() : pattern_root(std::make_unique<PatternNode>()) {}
+
+PubSub::~PubSub() = default;
+
+PubSub::PatternNode *PubSub::PatternNode::child(char c) const
+{
+    for (const auto &[key, node] : children)
+    {
+        if (key == c)
+            return node.get();
+    }
+    return nullptr;
+}
+
+std::string PubSub::literal_prefix(const std::string &pattern)
+{
+    size_t end = pattern.find_first_of("*?[\\");
+    return pattern.substr(0, end);
+}
+
+bool PubSub::subscribe(Connection *client, const std::string &channel)
+{
+    if (!client->subscribed_channels.insert(channel).second)
+        return false;
+    channels[channel].insert(client);
+    return true;
+}
+
+bool PubSub::unsubscribe(Connection *client, const std::string &channel)
+{
+    if (client->subscribed_channels.erase(channel) == 0)
+        return false;
+
+    auto it = channels.find(channel);
+    it->second.erase(client);
+    if (it->second.empty())
+        channels.erase(it);
+    return true;
+}
+
+bool PubSub::psubscribe(Connection *client, const std::string &pattern)
+{
+    if (!client->subscribed_patterns.insert(pattern).second)
+        return false;
+
+    PatternNode *node = pattern_root.get();
+    for (char c : literal_prefix(pattern))
+    {
+        PatternNode *next = node->child(c);
+        if (next == nullptr)
+        {
+            node->children.emplace_back(c, std::make_unique<PatternNode>());
+            next = node->children.back().second.get();
+        }
+        node = next;
+    }
+    node->patterns[pattern].insert(client);
+    return true;
+}
+
+bool PubSub::punsubscribe(Connection *client, const std::string &pattern)
+{
+    if (client->subscribed_patterns.erase(pattern) == 0)
+        return false;
+
+    std::vector<PatternNode *> path = {pattern_root.get()};
+    for (char c : literal_prefix(pattern))
+    {
+        path.push_back(path.back()->child(c));
+    }
+
+    PatternNode *node = path.back();
+    auto it = node->patterns.find(pattern);
+    it->second.erase(client);
+    if (it->second.empty())
+        node->patterns.erase(it);
+
+    // Prune trie nodes that no longer lead to any pattern
+    for (size_t i = path.size() - 1; i > 0; i--)
+    {
+        PatternNode *current = path[i];
+        if (!current->patterns.empty() || !current->children.empty())
+            break;
+
+        auto &siblings = path[i - 1]->children;
+        for (auto child = siblings.begin(); child != siblings.end(); ++child)
+        {
+            if (child->second.get() == current)
+            {
+                siblings.erase(child);
+                break;
+            }
+        }
+    }
+    return true;
+}
+
+void PubSub::remove_client(Connection *client)
+{
+    // Copy first, unsubscribe() edits the sets we would be iterating
+    std::vector<std::string> subscribed(client->subscribed_channels.begin(), client->subscribed_channels.end());
+    for (const std::string &channel : subscribed)
+    {
+        unsubscribe(client, channel);
+    }
+
+    subscribed.assign(client->subscribed_patterns.begin(), client->subscribed_patterns.end());
+    for (const std::string &pattern : subscribed)
+    {
+        punsubscribe(client, pattern);
+    }
+}
+
+size_t PubSub::publish(const std::string &channel, const std::string &message)
+{
+    size_t receivers = 0;
+
+    auto it = channels.find(channel);
+    if (it != channels.end())
+    {
+        // Serialized once, shared by every subscriber's output queue
+        auto payload = std::make_shared<const std::string>(
+            RESPHandler::serialize_array({"message", channel, message}));
+        for (Connection *client : it->second)
+        {
+            client->enqueue_shared(payload);
+            receivers++;
+        }
+    }
+
+    // Walk the trie along the channel name; only patterns hanging off this path can match
+    PatternNode *node = pattern_root.get();
+    size_t depth = 0;
+    while (node != nullptr)
+    {
+        for (const auto &[pattern, subscribers] : node->patterns)
+        {
+            if (!glob_match(pattern, channel))
+                continue;
+
+            auto payload = std::make_shared<const std::string>(
+                RESPHandler::serialize_array({"pmessage", pattern, channel, message}));
+            for (Connection *client : subscribers)
+            {
+                client->enqueue_shared(payload);
+                receivers++;
+            }
+        }
+
+        if (depth == channel.size())
+            break;
+        node = node->child(channel[depth++]);
+    }
+
+    return receivers;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
+class Connection;
+
+// Channel and pattern subscriptions. PUBLISH serializes each message once into a
+// shared buffer that is queued on every receiving connection as is.
+class PubSub
+{
+public:
+    PubSub();
+    ~PubSub();
+
+    // Each returns true if the subscription state actually changed
+    bool subscribe(Connection *client, const std::string &channel);
+    bool unsubscribe(Connection *client, const std::string &channel);
+    bool psubscribe(Connection *client, const std::string &pattern);
+    bool punsubscribe(Connection *client, const std::string &pattern);
+
+    // Drops every subscription of a closing connection
+    void remove_client(Connection *client);
+
+    // Returns the number of connections the message was delivered to
+    size_t publish(const std::string &channel, const std::string &message);
+
+private:
+    typedef std::unordered_set<Connection *> Subscribers;
+
+    std::unordered_map<std::string, Subscribers> channels;
+
+    // Patterns are indexed in a trie on their literal prefix (everything before the first
+    // glob character), so PUBLISH only runs the glob matcher on patterns whose prefix is
+    // a prefix of the channel instead of scanning every pattern.
+    struct PatternNode
+    {
+        std::vector<std::pair<char, std::unique_ptr<PatternNode>>> children;
+        std::unordered_map<std::string, Subscribers> patterns;
+
+        PatternNode *child(char c) const;
+    };
+    std::unique_ptr<PatternNode> pattern_root;
+
+    static std::string literal_prefix(const std::string &pattern);
+};
@@ -1,15 +1,18 @@
 #include "RESPHandler.hpp"
 #include "Utils.hpp"
 #include <algorithm>
-#include <iostream>
+#include "Log.hpp"
 
-RESPRequest RESPHandler::parse_request(const std::vector<unsigned char> &buffer)
+// Clients can send garbage as fast as they like: log it, but not at that pace
+static LogRateLimit protocol_errors;
+
+RESPRequest RESPHandler::parse_request(const IOBuffer &buffer, size_t start)
 {
 
-    size_t cursor = 0;
+    size_t cursor = start;
     RESPRequest resp_req;
     // No incoming message. return. read = true
-    if (buffer.size() == 0)
+    if (buffer.size() <= start)
     {
         resp_req.status = ParseStatus::PARTIAL;
         return resp_req;
@@ -17,7 +20,7 @@ RESPRequest RESPHandler::parse_request(const std::vector<unsigned char> &buffer)
     // Message does not start with *. Does not follow RESP protocol. close = true
     if (buffer[cursor] != '*')
     {
-        std::cerr << "Protocol Error: Message must start with *\n";
+        protocol_errors.log(LogLevel::VERBOSE, "Protocol Error: Message must start with *");
         resp_req.status = ParseStatus::ERROR;
         return resp_req;
     }
@@ -26,7 +29,7 @@ RESPRequest RESPHandler::parse_request(const std::vector<unsigned char> &buffer)
 
     // Find the first carriage return(\r\n) after *. Then we can get the message length between * and \r\n.
     auto request_header_end_iterator = std::search(
-        buffer.begin(),
+        buffer.begin() + start,
         buffer.end(),
         target,
         target + 2);
@@ -39,12 +42,12 @@ RESPRequest RESPHandler::parse_request(const std::vector<unsigned char> &buffer)
     }
 
     long long array_length = parse_header_value(
-        buffer.begin() + 1,
+        buffer.begin() + start + 1,
         request_header_end_iterator);
 
     if (array_length < 0)
     {
-        std::cerr << "Protocol Error: Invalid Array Length\n";
+        protocol_errors.log(LogLevel::VERBOSE, "Protocol Error: Invalid Array Length");
         resp_req.status = ParseStatus::ERROR;
         return resp_req;
     }
@@ -52,7 +55,7 @@ RESPRequest RESPHandler::parse_request(const std::vector<unsigned char> &buffer)
     // We use static_cast<size_t> to tell the compiler: "I know this int is positive now, so treat it as unsigned."
     if (static_cast<size_t>(array_length) > MAX_ARGS_COUNT)
     {
-        std::cerr << "Security: Array too large\n";
+        protocol_errors.log(LogLevel::VERBOSE, "Security: Array too large");
         resp_req.status = ParseStatus::ERROR;
         return resp_req;
     }
@@ -72,7 +75,7 @@ RESPRequest RESPHandler::parse_request(const std::vector<unsigned char> &buffer)
 
         if (buffer[cursor] != '$')
         {
-            std::cerr << "Protocol Error: Expected character $\n";
+            protocol_errors.log(LogLevel::VERBOSE, "Protocol Error: Expected character $");
             resp_req.status = ParseStatus::ERROR;
             return resp_req;
         }
@@ -95,7 +98,7 @@ RESPRequest RESPHandler::parse_request(const std::vector<unsigned char> &buffer)
 
         if (string_length < 0)
         {
-            std::cerr << "Protocol Error: Invalid String Length\n";
+            protocol_errors.log(LogLevel::VERBOSE, "Protocol Error: Invalid String Length");
             resp_req.status = ParseStatus::ERROR;
             return resp_req;
         }
@@ -104,7 +107,7 @@ RESPRequest RESPHandler::parse_request(const std::vector<unsigned char> &buffer)
         // We use static_cast<size_t> to tell the compiler: "I know this int is positive now, so treat it as unsigned."
         if (static_cast<size_t>(string_length) > MAX_MSG_SIZE)
         {
-            std::cerr << "Security: String too large\n"; // Distinct error message!
+            protocol_errors.log(LogLevel::VERBOSE, "Security: String too large"); // Distinct error message!
             resp_req.status = ParseStatus::ERROR;
             return resp_req;
         }
@@ -138,7 +141,7 @@ RESPRequest RESPHandler::parse_request(const std::vector<unsigned char> &buffer)
 
     resp_req.status = ParseStatus::SUCCESS;
     resp_req.args = std::move(request_arguments);
-    resp_req.parsed_bytes = cursor;
+    resp_req.parsed_bytes = cursor - start;
     return resp_req;
 }
 
@@ -171,4 +174,25 @@ std::string RESPHandler::serialize_null_bulk()
 }
 std::string RESPHandler::serialize_integer(long long val)
 {
+    return ":" + std::to_string(val) + "\r\n";
+}
+
+std::string RESPHandler::serialize_array_header(size_t count)
+{
+    return "*" + std::to_string(count) + "\r\n";
+}
+
+std::string RESPHandler::serialize_array(const std::vector<std::string> &items)
+{
+    std::string result = serialize_array_header(items.size());
+    for (const std::string &item : items)
+    {
+        result += serialize_bulk_string(item);
+    }
+    return result;
+}
+
+std::string RESPHandler::serialize_null_array()
+{
+    return "*-1\r\n";
 }
\ No newline at end of file
@@ -2,6 +2,7 @@
 #include <vector>
 #include <string>
 #include <optional>
+#include "IOBuffer.hpp"
 
 //======================  SECURITY LIMITS START  ======================
 
@@ -35,13 +36,19 @@ struct RESPRequest
 class RESPHandler
 {
 public:
-    // Parses the buffer and returns arguments + number of bytes consumed
-    static RESPRequest parse_request(const std::vector<unsigned char> &buffer);
+    // Parses the request that starts at offset start of buffer and returns its
+    // arguments + the number of bytes it takes up (counted from start)
+    static RESPRequest parse_request(const IOBuffer &buffer, size_t start = 0);
 
     // Serialization helpers to wrap responses back into RESP
     static std::string serialize_simple_string(const std::string &s);
     static std::string serialize_error(const std::string &e);
     static std::string serialize_bulk_string(const std::string &s);
     static std::string serialize_null_bulk();
-    static std::string serialize_integer(long long val); 
+    static std::string serialize_integer(long long val);
+
+    // Array helpers. The header form lets callers stream elements straight into a reply.
+    static std::string serialize_array_header(size_t count);
+    static std::string serialize_array(const std::vector<std::string> &items);
+    static std::string serialize_null_array();
 };
\ No newline at end of file
@@ -0,0 +1,309 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <optional>
+#include <algorithm>
+
+// Compact (path compressed) radix tree over byte string keys, kept in byte order.
+// Used to index stream blocks by the big-endian bytes of their first entry ID, so
+// neighbouring IDs share almost all of their path.
+template <typename V>
+class RadixTree
+{
+public:
+    // Result of an ordered lookup. 'value' points into the tree and stays valid until
+    // the key is erased.
+    struct Match
+    {
+        std::string key;
+        V *value;
+    };
+
+    RadixTree() : root(std::make_unique<Node>()) {}
+
+    size_t size() const { return count; }
+
+    // Bytes of one node allocation, for memory estimates
+    static constexpr size_t node_size() { return sizeof(Node); }
+
+    // Inserts or replaces the value stored under key
+    void insert(std::string_view key, V value)
+    {
+        Node *node = root.get();
+        size_t pos = 0;
+        while (true)
+        {
+            if (pos == key.size())
+            {
+                if (!node->has_value)
+                    count++;
+                node->has_value = true;
+                node->value = std::move(value);
+                return;
+            }
+
+            Node *child = node->child(key[pos]);
+            if (child == nullptr)
+            {
+                auto leaf = std::make_unique<Node>();
+                leaf->label = std::string(key.substr(pos));
+                leaf->has_value = true;
+                leaf->value = std::move(value);
+                node->add_child(std::move(leaf));
+                count++;
+                return;
+            }
+
+            // Walk as far as the child's label agrees with the key
+            size_t common = 0;
+            while (common < child->label.size() && pos + common < key.size() &&
+                   child->label[common] == key[pos + common])
+                common++;
+
+            if (common < child->label.size())
+            {
+                // Split the edge: a new node takes the shared part of the label
+                std::unique_ptr<Node> old_child = node->take_child(key[pos]);
+                auto middle = std::make_unique<Node>();
+                middle->label = old_child->label.substr(0, common);
+                old_child->label.erase(0, common);
+                middle->add_child(std::move(old_child));
+                node->add_child(std::move(middle));
+                child = node->child(key[pos]);
+            }
+
+            node = child;
+            pos += common;
+        }
+    }
+
+    V *find(std::string_view key)
+    {
+        Node *node = root.get();
+        size_t pos = 0;
+        while (pos < key.size())
+        {
+            Node *child = node->child(key[pos]);
+            if (child == nullptr || key.substr(pos, child->label.size()) != child->label)
+                return nullptr;
+            pos += child->label.size();
+            node = child;
+        }
+        return node->has_value ? &node->value : nullptr;
+    }
+
+    bool erase(std::string_view key)
+    {
+        // Remember the path so empty nodes can be pruned and single children merged on the way back
+        std::vector<Node *> path = {root.get()};
+        size_t pos = 0;
+        while (pos < key.size())
+        {
+            Node *child = path.back()->child(key[pos]);
+            if (child == nullptr || key.substr(pos, child->label.size()) != child->label)
+                return false;
+            pos += child->label.size();
+            path.push_back(child);
+        }
+
+        Node *node = path.back();
+        if (!node->has_value)
+            return false;
+        node->has_value = false;
+        node->value = V();
+        count--;
+
+        for (size_t i = path.size() - 1; i > 0; i--)
+        {
+            Node *current = path[i];
+            Node *parent = path[i - 1];
+            if (current->has_value)
+                break;
+            if (current->children.empty())
+            {
+                parent->take_child(current->label[0]);
+                continue;
+            }
+            if (current->children.size() == 1)
+            {
+                // Fold the only child into this node's edge
+                std::unique_ptr<Node> only = std::move(current->children[0]);
+                std::unique_ptr<Node> self = parent->take_child(current->label[0]);
+                only->label = self->label + only->label;
+                parent->add_child(std::move(only));
+            }
+            break;
+        }
+        return true;
+    }
+
+    // Largest key <= key (or < key when strict)
+    std::optional<Match> floor(std::string_view key, bool strict = false)
+    {
+        std::string path;
+        return floor_from(root.get(), path, key, strict);
+    }
+
+    // Smallest key >= key (or > key when strict)
+    std::optional<Match> ceiling(std::string_view key, bool strict = false) const
+    {
+        if (strict)
+        {
+            // The smallest byte string greater than key is key followed by a zero byte
+            std::string next(key);
+            next.push_back('\0');
+            return ceiling(next, false);
+        }
+        std::string path;
+        return ceiling_from(root.get(), path, key);
+    }
+
+    std::optional<Match> first() const
+    {
+        if (count == 0)
+            return std::nullopt;
+        std::string path;
+        return min_from(root.get(), path);
+    }
+
+    std::optional<Match> last()
+    {
+        if (count == 0)
+            return std::nullopt;
+        std::string path;
+        return max_from(root.get(), path);
+    }
+
+private:
+    struct Node
+    {
+        std::string label; // Edge label from the parent (empty for the root)
+        bool has_value = false;
+        V value = V();
+        std::vector<std::unique_ptr<Node>> children; // Sorted by the first byte of their labels
+
+        Node *child(char c)
+        {
+            auto it = lower(c);
+            if (it != children.end() && (*it)->label[0] == c)
+                return it->get();
+            return nullptr;
+        }
+
+        void add_child(std::unique_ptr<Node> node)
+        {
+            auto it = lower(node->label[0]);
+            children.insert(it, std::move(node));
+        }
+
+        std::unique_ptr<Node> take_child(char c)
+        {
+            auto it = lower(c);
+            std::unique_ptr<Node> node = std::move(*it);
+            children.erase(it);
+            return node;
+        }
+
+        typename std::vector<std::unique_ptr<Node>>::iterator lower(char c)
+        {
+            return std::lower_bound(children.begin(), children.end(), (unsigned char)c,
+                                    [](const std::unique_ptr<Node> &n, unsigned char b)
+                                    { return (unsigned char)n->label[0] < b; });
+        }
+    };
+
+    std::unique_ptr<Node> root;
+    size_t count = 0;
+
+    static std::optional<Match> min_from(Node *node, std::string &path)
+    {
+        while (!node->has_value)
+        {
+            node = node->children.front().get();
+            path += node->label;
+        }
+        return Match{path, &node->value};
+    }
+
+    static std::optional<Match> max_from(Node *node, std::string &path)
+    {
+        while (!node->children.empty())
+        {
+            node = node->children.back().get();
+            path += node->label;
+        }
+        return Match{path, &node->value};
+    }
+
+    // 'path' holds the key of 'node', which is a prefix of key
+    static std::optional<Match> floor_from(Node *node, std::string &path, std::string_view key, bool strict)
+    {
+        if (path.size() == key.size())
+        {
+            // Every descendant is longer, hence greater
+            if (node->has_value && !strict)
+                return Match{path, &node->value};
+            return std::nullopt;
+        }
+
+        unsigned char next = key[path.size()];
+        for (auto it = node->children.rbegin(); it != node->children.rend(); ++it)
+        {
+            Node *child = it->get();
+            unsigned char first = child->label[0];
+            if (first > next)
+                continue;
+
+            size_t base = path.size();
+            path += child->label;
+            std::optional<Match> result;
+            std::string_view key_part = key.substr(base, child->label.size());
+            if (first < next || std::string_view(child->label) < key_part)
+                result = max_from(child, path); // Whole subtree sorts before key
+            else if (std::string_view(child->label) == key_part)
+                result = floor_from(child, path, key, strict);
+            // Otherwise the label runs past key (or above it) and the subtree sorts after key
+
+            if (result)
+                return result;
+            path.resize(base);
+        }
+
+        // This node's own key is a proper prefix of key, so it sorts before it
+        if (node->has_value)
+            return Match{path, &node->value};
+        return std::nullopt;
+    }
+
+    static std::optional<Match> ceiling_from(Node *node, std::string &path, std::string_view key)
+    {
+        if (path.size() == key.size())
+            return node->has_value || !node->children.empty() ? min_from(node, path) : std::nullopt;
+
+        unsigned char next = key[path.size()];
+        for (auto &owned : node->children)
+        {
+            Node *child = owned.get();
+            unsigned char first = child->label[0];
+            if (first < next)
+                continue;
+
+            size_t base = path.size();
+            path += child->label;
+            std::optional<Match> result;
+            std::string_view key_part = key.substr(base, child->label.size());
+            std::string_view label(child->label);
+            if (label == key_part)
+                result = ceiling_from(child, path, key);
+            else if (label > key_part)
+                result = min_from(child, path); // Whole subtree sorts after key
+
+            if (result)
+                return result;
+            path.resize(base);
+        }
+        return std::nullopt;
+    }
+};
@@ -0,0 +1,975 @@
+#include "Rdb.hpp"
+#include "ListObject.hpp"
+#include "HashObject.hpp"
+#include "SortedSet.hpp"
+#include "Stream.hpp"
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <optional>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//======================  CRC64  ======================
+
+static const uint64_t CRC64_POLY_REFLECTED = 0x95ac9329ac4bc9b5ULL;
+
+struct Crc64Table
+{
+    uint64_t entries[8][256];
+
+    // Slicing-by-8 tables: entries[k][b] is the CRC of byte b followed by k zero bytes
+    Crc64Table()
+    {
+        for (int b = 0; b < 256; b++)
+        {
+            uint64_t crc = b;
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc & 1) ? (crc >> 1) ^ CRC64_POLY_REFLECTED : crc >> 1;
+            entries[0][b] = crc;
+        }
+        for (int b = 0; b < 256; b++)
+        {
+            for (int k = 1; k < 8; k++)
+                entries[k][b] = (entries[k - 1][b] >> 8) ^ entries[0][entries[k - 1][b] & 0xFF];
+        }
+    }
+};
+
+uint64_t crc64(uint64_t crc, const unsigned char *data, size_t length)
+{
+    static const Crc64Table table;
+    const auto &t = table.entries;
+
+    // Eight bytes per step; the file is checksummed as it is written, so this is hot
+    while (length >= 8)
+    {
+        uint64_t word;
+        memcpy(&word, data, sizeof(word));
+        crc ^= word;
+        crc = t[7][crc & 0xFF] ^ t[6][(crc >> 8) & 0xFF] ^ t[5][(crc >> 16) & 0xFF] ^ t[4][(crc >> 24) & 0xFF] ^
+              t[3][(crc >> 32) & 0xFF] ^ t[2][(crc >> 40) & 0xFF] ^ t[1][(crc >> 48) & 0xFF] ^ t[0][crc >> 56];
+        data += 8;
+        length -= 8;
+    }
+    while (length-- > 0)
+        crc = t[0][(crc ^ *data++) & 0xFF] ^ (crc >> 8);
+    return crc;
+}
+
+//======================  WRITER  ======================
+
+// Buffers output in large chunks and keeps the running checksum. Without a file
+// descriptor (-1) everything stays in memory, for DUMP payloads.
+class RdbWriter
+{
+public:
+    explicit RdbWriter(int fd) : fd(fd)
+    {
+        if (fd >= 0)
+            buffer.reserve(BUFFER_SIZE);
+    }
+
+    bool failed = false;
+    size_t written = 0;
+    uint64_t checksum = 0;
+
+    void write_bytes(const void *data, size_t length)
+    {
+        checksum = crc64(checksum, (const unsigned char *)data, length);
+        buffer.append((const char *)data, length);
+        if (fd >= 0 && buffer.size() >= BUFFER_SIZE)
+            flush();
+    }
+
+    void write_byte(uint8_t byte) { write_bytes(&byte, 1); }
+
+    void write_length(uint64_t length)
+    {
+        unsigned char bytes[9];
+        if (length < (1 << 6))
+        {
+            bytes[0] = (unsigned char)((RDB_6BIT_LENGTH << 6) | length);
+            write_bytes(bytes, 1);
+        }
+        else if (length < (1 << 14))
+        {
+            bytes[0] = (unsigned char)((RDB_14BIT_LENGTH << 6) | (length >> 8));
+            bytes[1] = (unsigned char)(length & 0xFF);
+            write_bytes(bytes, 2);
+        }
+        else if (length <= UINT32_MAX)
+        {
+            bytes[0] = RDB_32BIT_LENGTH;
+            for (int i = 0; i < 4; i++)
+                bytes[1 + i] = (unsigned char)(length >> (24 - 8 * i));
+            write_bytes(bytes, 5);
+        }
+        else
+        {
+            bytes[0] = RDB_64BIT_LENGTH;
+            for (int i = 0; i < 8; i++)
+                bytes[1 + i] = (unsigned char)(length >> (56 - 8 * i));
+            write_bytes(bytes, 9);
+        }
+    }
+
+    void write_string(std::string_view value)
+    {
+        write_length(value.size());
+        write_bytes(value.data(), value.size());
+    }
+
+    void write_double(double value)
+    {
+        // Little endian IEEE 754, which is the in-memory layout on every platform we build for
+        unsigned char bytes[8];
+        memcpy(bytes, &value, sizeof(bytes));
+        write_bytes(bytes, sizeof(bytes));
+    }
+
+    void write_u64_le(uint64_t value)
+    {
+        unsigned char bytes[8];
+        for (int i = 0; i < 8; i++)
+            bytes[i] = (unsigned char)(value >> (8 * i));
+        write_bytes(bytes, sizeof(bytes));
+    }
+
+    void write_aux(const std::string &key, const std::string &value)
+    {
+        write_byte(RDB_OPCODE_AUX);
+        write_string(key);
+        write_string(value);
+    }
+
+    void flush()
+    {
+        size_t offset = 0;
+        while (!failed && offset < buffer.size())
+        {
+            ssize_t n = ::write(fd, buffer.data() + offset, buffer.size() - offset);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                    continue;
+                failed = true;
+                break;
+            }
+            offset += n;
+        }
+        written += offset;
+        buffer.clear();
+    }
+
+    // In-memory mode: what was written so far
+    std::string &contents() { return buffer; }
+
+private:
+    static const size_t BUFFER_SIZE = 1024 * 1024;
+    int fd;
+    std::string buffer;
+};
+
+static void write_value(RdbWriter &writer, const KeyValueStore::ValueEntry &entry)
+{
+    switch (entry.type)
+    {
+    case ValueType::STRING:
+        writer.write_string(entry.value);
+        break;
+    case ValueType::LIST:
+    {
+        const ListObject &list = static_cast<const ListObject &>(*entry.object);
+        writer.write_length(list.items.size());
+        for (const std::string &item : list.items)
+            writer.write_string(item);
+        break;
+    }
+    case ValueType::HASH:
+    {
+        const HashObject &hash = static_cast<const HashObject &>(*entry.object);
+        writer.write_length(hash.size());
+        hash.for_each([&](const std::string &field, const std::string &value)
+                      {
+                          writer.write_string(field);
+                          writer.write_string(value);
+                      });
+        break;
+    }
+    case ValueType::ZSET:
+    {
+        const SortedSet &zset = static_cast<const SortedSet &>(*entry.object);
+        writer.write_length(zset.size());
+        if (zset.size() > 0)
+        {
+            zset.range_by_rank(0, zset.size() - 1, false, [&](std::string_view member, double score)
+                               {
+                                   writer.write_string(member);
+                                   writer.write_double(score);
+                               });
+        }
+        break;
+    }
+    case ValueType::STREAM:
+    {
+        Stream &stream = static_cast<Stream &>(*entry.object);
+        writer.write_length(stream.last_id.ms);
+        writer.write_length(stream.last_id.seq);
+        writer.write_length(stream.size());
+        StreamID first{0, 0};
+        StreamID last{UINT64_MAX, UINT64_MAX};
+        stream.range(first, last, -1, false, [&](const StreamID &id, const std::vector<std::string_view> &fields)
+                     {
+                         writer.write_length(id.ms);
+                         writer.write_length(id.seq);
+                         writer.write_length(fields.size());
+                         for (std::string_view field : fields)
+                             writer.write_string(field);
+                     });
+        break;
+    }
+    }
+}
+
+static uint8_t rdb_type(ValueType type)
+{
+    switch (type)
+    {
+    case ValueType::STRING:
+        return RDB_TYPE_STRING;
+    case ValueType::LIST:
+        return RDB_TYPE_LIST;
+    case ValueType::HASH:
+        return RDB_TYPE_HASH;
+    case ValueType::ZSET:
+        return RDB_TYPE_ZSET_2;
+    case ValueType::STREAM:
+        return RDB_TYPE_STREAM_ENTRIES;
+    }
+    return RDB_TYPE_STRING;
+}
+
+bool rdb_save(KeyValueStore &store, const std::string &path, size_t &bytes_written, std::string &error)
+{
+    std::string temp_path = path + ".temp-" + std::to_string(getpid());
+    int fd = open(temp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        error = "Failed opening " + temp_path + ": " + strerror(errno);
+        return false;
+    }
+
+    RdbWriter writer(fd);
+
+    char magic[16];
+    snprintf(magic, sizeof(magic), "%s%04d", RDB_MAGIC, RDB_VERSION);
+    writer.write_bytes(magic, strlen(magic));
+    writer.write_aux("redis-ver", "7.0.0");
+    writer.write_aux("redis-bits", std::to_string(sizeof(void *) * 8));
+    writer.write_aux("ctime", std::to_string(time(nullptr)));
+
+    // Expiry times are kept on the monotonic clock, the file needs unix milliseconds
+    auto steady_now = std::chrono::steady_clock::now();
+    long long unix_now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                std::chrono::system_clock::now().time_since_epoch())
+                                .count();
+
+    size_t keys = 0;
+    size_t expires = 0;
+    store.for_each([&](const std::string &, KeyValueStore::ValueEntry &entry)
+                   {
+                       keys++;
+                       if (entry.expires_at.has_value())
+                           expires++;
+                   });
+
+    writer.write_byte(RDB_OPCODE_SELECTDB);
+    writer.write_length(0);
+    writer.write_byte(RDB_OPCODE_RESIZEDB);
+    writer.write_length(keys);
+    writer.write_length(expires);
+
+    store.for_each([&](const std::string &key, KeyValueStore::ValueEntry &entry)
+                   {
+                       if (KeyValueStore::is_expired(entry))
+                           return;
+                       if (entry.expires_at.has_value())
+                       {
+                           long long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(*entry.expires_at - steady_now).count();
+                           writer.write_byte(RDB_OPCODE_EXPIRETIME_MS);
+                           writer.write_u64_le(unix_now_ms + remaining);
+                       }
+                       writer.write_byte(rdb_type(entry.type));
+                       writer.write_string(key);
+                       write_value(writer, entry);
+                   });
+
+    writer.write_byte(RDB_OPCODE_EOF);
+    writer.write_u64_le(writer.checksum);
+    writer.flush();
+
+    if (writer.failed || fsync(fd) != 0)
+    {
+        error = "Failed writing " + temp_path + ": " + strerror(errno);
+        close(fd);
+        unlink(temp_path.c_str());
+        return false;
+    }
+    close(fd);
+
+    if (rename(temp_path.c_str(), path.c_str()) != 0)
+    {
+        error = "Failed renaming " + temp_path + " to " + path + ": " + strerror(errno);
+        unlink(temp_path.c_str());
+        return false;
+    }
+
+    bytes_written = writer.written;
+    return true;
+}
+
+//======================  READER  ======================
+
+// Bounds checked cursor over the mapped file. Running past the end (or into anything
+// malformed) clears 'ok' and makes every further read return zeros, so callers check
+// once per record instead of after every field.
+class RdbReader
+{
+public:
+    RdbReader(const uint8_t *data, size_t size, size_t position) : data(data), size(size), position(position) {}
+
+    const uint8_t *data;
+    size_t size;
+    size_t position;
+    bool ok = true;
+    std::string error;
+
+    void fail(const std::string &reason)
+    {
+        if (ok)
+            error = reason;
+        ok = false;
+        position = size;
+    }
+
+    bool need(size_t length)
+    {
+        if (size - position < length)
+        {
+            fail("Unexpected end of file");
+            return false;
+        }
+        return true;
+    }
+
+    void skip(size_t length)
+    {
+        if (need(length))
+            position += length;
+    }
+
+    uint8_t read_byte()
+    {
+        if (!need(1))
+            return 0;
+        return data[position++];
+    }
+
+    uint64_t read_le(size_t length)
+    {
+        if (!need(length))
+            return 0;
+        uint64_t value = 0;
+        for (size_t i = 0; i < length; i++)
+            value |= (uint64_t)data[position + i] << (8 * i);
+        position += length;
+        return value;
+    }
+
+    double read_double()
+    {
+        uint64_t bits = read_le(8);
+        double value;
+        memcpy(&value, &bits, sizeof(value));
+        return value;
+    }
+
+    // Reads a length prefix. For special encodings 'encoded' is set and the returned
+    // value is the encoding type instead of a length.
+    uint64_t read_length(bool *encoded = nullptr)
+    {
+        if (encoded)
+            *encoded = false;
+        uint8_t first = read_byte();
+        uint8_t kind = first >> 6;
+        if (kind == RDB_6BIT_LENGTH)
+            return first & 0x3F;
+        if (kind == RDB_14BIT_LENGTH)
+            return ((uint64_t)(first & 0x3F) << 8) | read_byte();
+        if (kind == RDB_ENCODED_VALUE)
+        {
+            if (encoded == nullptr)
+                fail("Unexpected encoded value");
+            else
+                *encoded = true;
+            return first & 0x3F;
+        }
+
+        size_t bytes = first == RDB_32BIT_LENGTH ? 4 : first == RDB_64BIT_LENGTH ? 8
+                                                                                  : 0;
+        if (bytes == 0 || !need(bytes))
+        {
+            fail("Invalid length encoding");
+            return 0;
+        }
+        uint64_t value = 0;
+        for (size_t i = 0; i < bytes; i++)
+            value = (value << 8) | data[position + i];
+        position += bytes;
+        return value;
+    }
+
+    std::string read_string()
+    {
+        bool encoded;
+        uint64_t length = read_length(&encoded);
+        if (encoded)
+            return read_encoded_string(length);
+        if (!need(length))
+            return std::string();
+        std::string value((const char *)data + position, length);
+        position += length;
+        return value;
+    }
+
+    void skip_string()
+    {
+        bool encoded;
+        uint64_t length = read_length(&encoded);
+        if (!encoded)
+        {
+            skip(length);
+            return;
+        }
+        switch (length)
+        {
+        case RDB_ENC_INT8:
+            skip(1);
+            break;
+        case RDB_ENC_INT16:
+            skip(2);
+            break;
+        case RDB_ENC_INT32:
+            skip(4);
+            break;
+        case RDB_ENC_LZF:
+        {
+            uint64_t compressed = read_length();
+            read_length(); // Uncompressed length
+            skip(compressed);
+            break;
+        }
+        default:
+            fail("Unknown string encoding");
+        }
+    }
+
+private:
+    std::string read_encoded_string(uint64_t encoding)
+    {
+        switch (encoding)
+        {
+        case RDB_ENC_INT8:
+            return std::to_string((int8_t)read_le(1));
+        case RDB_ENC_INT16:
+            return std::to_string((int16_t)read_le(2));
+        case RDB_ENC_INT32:
+            return std::to_string((int32_t)read_le(4));
+        case RDB_ENC_LZF:
+        {
+            uint64_t compressed = read_length();
+            uint64_t length = read_length();
+            if (!need(compressed))
+                return std::string();
+            std::string value(length, '\0');
+            if (!lzf_decompress(data + position, compressed, (uint8_t *)value.data(), length))
+                fail("Invalid LZF compressed string");
+            position += compressed;
+            return value;
+        }
+        }
+        fail("Unknown string encoding");
+        return std::string();
+    }
+
+    // LZF as written by Redis: literal runs (ctrl < 32) and back references
+    static bool lzf_decompress(const uint8_t *in, size_t in_length, uint8_t *out, size_t out_length)
+    {
+        const uint8_t *in_end = in + in_length;
+        size_t produced = 0;
+        while (in < in_end)
+        {
+            unsigned int ctrl = *in++;
+            if (ctrl < 32)
+            {
+                size_t length = ctrl + 1;
+                if (produced + length > out_length || in + length > in_end)
+                    return false;
+                memcpy(out + produced, in, length);
+                in += length;
+                produced += length;
+                continue;
+            }
+
+            size_t length = ctrl >> 5;
+            size_t back = (ctrl & 0x1F) << 8;
+            if (length == 7)
+            {
+                if (in >= in_end)
+                    return false;
+                length += *in++;
+            }
+            if (in >= in_end)
+                return false;
+            back += *in++ + 1;
+            length += 2;
+            if (back > produced || produced + length > out_length)
+                return false;
+
+            // Byte by byte: the reference may overlap what is being written
+            for (size_t i = 0; i < length; i++, produced++)
+                out[produced] = out[produced - back];
+        }
+        return produced == out_length;
+    }
+};
+
+// Skips over one value without materializing it (used to find chunk boundaries)
+static void skip_value(RdbReader &reader, uint8_t type)
+{
+    switch (type)
+    {
+    case RDB_TYPE_STRING:
+        reader.skip_string();
+        break;
+    case RDB_TYPE_LIST:
+    {
+        uint64_t count = reader.read_length();
+        for (uint64_t i = 0; i < count && reader.ok; i++)
+            reader.skip_string();
+        break;
+    }
+    case RDB_TYPE_HASH:
+    {
+        uint64_t count = reader.read_length();
+        for (uint64_t i = 0; i < count * 2 && reader.ok; i++)
+            reader.skip_string();
+        break;
+    }
+    case RDB_TYPE_ZSET_2:
+    {
+        uint64_t count = reader.read_length();
+        for (uint64_t i = 0; i < count && reader.ok; i++)
+        {
+            reader.skip_string();
+            reader.skip(8);
+        }
+        break;
+    }
+    case RDB_TYPE_STREAM_ENTRIES:
+    {
+        reader.read_length();
+        reader.read_length();
+        uint64_t count = reader.read_length();
+        for (uint64_t i = 0; i < count && reader.ok; i++)
+        {
+            reader.read_length();
+            reader.read_length();
+            uint64_t fields = reader.read_length();
+            for (uint64_t f = 0; f < fields && reader.ok; f++)
+                reader.skip_string();
+        }
+        break;
+    }
+    default:
+        reader.fail("Unsupported value type " + std::to_string(type));
+    }
+}
+
+static void read_value(RdbReader &reader, uint8_t type, KeyValueStore::ValueEntry &entry)
+{
+    switch (type)
+    {
+    case RDB_TYPE_STRING:
+        entry.value = reader.read_string();
+        break;
+    case RDB_TYPE_LIST:
+    {
+        auto list = std::make_shared<ListObject>();
+        uint64_t count = reader.read_length();
+        for (uint64_t i = 0; i < count && reader.ok; i++)
+            list->items.push_back(reader.read_string());
+        entry.type = ValueType::LIST;
+        entry.object = list;
+        break;
+    }
+    case RDB_TYPE_HASH:
+    {
+        auto hash = std::make_shared<HashObject>();
+        uint64_t count = reader.read_length();
+        for (uint64_t i = 0; i < count && reader.ok; i++)
+        {
+            std::string field = reader.read_string();
+            std::string value = reader.read_string();
+            hash->set(field, value);
+        }
+        entry.type = ValueType::HASH;
+        entry.object = hash;
+        break;
+    }
+    case RDB_TYPE_ZSET_2:
+    {
+        auto zset = std::make_shared<SortedSet>();
+        uint64_t count = reader.read_length();
+        for (uint64_t i = 0; i < count && reader.ok; i++)
+        {
+            std::string member = reader.read_string();
+            double score = reader.read_double();
+            zset->insert(member, score);
+        }
+        entry.type = ValueType::ZSET;
+        entry.object = zset;
+        break;
+    }
+    case RDB_TYPE_STREAM_ENTRIES:
+    {
+        auto stream = std::make_shared<Stream>();
+        StreamID last_id;
+        last_id.ms = reader.read_length();
+        last_id.seq = reader.read_length();
+        uint64_t count = reader.read_length();
+        std::vector<std::string> fields;
+        for (uint64_t i = 0; i < count && reader.ok; i++)
+        {
+            StreamID id;
+            id.ms = reader.read_length();
+            id.seq = reader.read_length();
+            uint64_t field_count = reader.read_length();
+            fields.clear();
+            for (uint64_t f = 0; f < field_count && reader.ok; f++)
+                fields.push_back(reader.read_string());
+            if (reader.ok)
+                stream->append(id, fields);
+        }
+        stream->last_id = last_id;
+        entry.type = ValueType::STREAM;
+        entry.object = stream;
+        break;
+    }
+    default:
+        reader.fail("Unsupported value type " + std::to_string(type));
+    }
+}
+
+//======================  LOADER  ======================
+
+struct RdbChunk
+{
+    size_t begin;
+    size_t end;
+    std::vector<std::pair<std::string, KeyValueStore::ValueEntry>> entries;
+    size_t expired = 0;
+    std::string error;
+};
+
+// Decodes every record in [chunk.begin, chunk.end). Chunks start at record boundaries,
+// so each can be decoded without knowing anything about the ones before it.
+static void decode_chunk(const uint8_t *data, RdbChunk &chunk)
+{
+    RdbReader reader(data, chunk.end, chunk.begin);
+    auto steady_now = std::chrono::steady_clock::now();
+    long long unix_now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                                std::chrono::system_clock::now().time_since_epoch())
+                                .count();
+
+    // Expiry opcode seen for the next key
+    bool has_expire = false;
+    long long expire_ms = 0;
+    while (reader.ok && reader.position < chunk.end)
+    {
+        uint8_t opcode = reader.read_byte();
+        switch (opcode)
+        {
+        case RDB_OPCODE_EXPIRETIME_MS:
+            expire_ms = (long long)reader.read_le(8);
+            has_expire = true;
+            continue;
+        case RDB_OPCODE_EXPIRETIME:
+            expire_ms = (long long)reader.read_le(4) * 1000;
+            has_expire = true;
+            continue;
+        case RDB_OPCODE_SELECTDB:
+            reader.read_length();
+            continue;
+        case RDB_OPCODE_RESIZEDB:
+            reader.read_length();
+            reader.read_length();
+            continue;
+        case RDB_OPCODE_AUX:
+            reader.skip_string();
+            reader.skip_string();
+            continue;
+        }
+
+        std::string key = reader.read_string();
+        KeyValueStore::ValueEntry entry;
+        read_value(reader, opcode, entry);
+
+        if (has_expire)
+        {
+            long long remaining = expire_ms - unix_now_ms;
+            has_expire = false;
+            if (remaining <= 0)
+            {
+                chunk.expired++;
+                continue;
+            }
+            entry.expires_at = steady_now + std::chrono::milliseconds(remaining);
+        }
+        if (reader.ok)
+            chunk.entries.emplace_back(std::move(key), std::move(entry));
+    }
+    if (!reader.ok)
+        chunk.error = reader.error + " at offset " + std::to_string(reader.position);
+}
+
+static uint64_t elapsed_usec(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+bool rdb_load(KeyValueStore &store, const std::string &path, RdbLoadStats &stats, std::string &error)
+{
+    auto phase_started = std::chrono::steady_clock::now();
+
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        error = "Failed opening " + path + ": " + strerror(errno);
+        return false;
+    }
+    struct stat file_stat;
+    if (fstat(fd, &file_stat) != 0 || file_stat.st_size < 9)
+    {
+        error = "Failed reading " + path + ": file too short";
+        close(fd);
+        return false;
+    }
+    size_t size = file_stat.st_size;
+    void *mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapping == MAP_FAILED)
+    {
+        error = "Failed mapping " + path + ": " + strerror(errno);
+        return false;
+    }
+
+    // The whole file is read front to back: ask for aggressive readahead, and for huge
+    // pages where the filesystem supports them, so the scan below is not a long
+    // series of 4KB page faults
+    madvise(mapping, size, MADV_SEQUENTIAL);
+    madvise(mapping, size, MADV_WILLNEED);
+#ifdef MADV_HUGEPAGE
+    madvise(mapping, size, MADV_HUGEPAGE);
+#endif
+
+    const uint8_t *data = (const uint8_t *)mapping;
+    stats.bytes = size;
+
+    auto fail = [&](const std::string &reason)
+    {
+        error = reason;
+        munmap(mapping, size);
+        return false;
+    };
+
+    if (memcmp(data, RDB_MAGIC, 5) != 0)
+        return fail("Wrong signature trying to load DB from file");
+    int version = atoi(std::string((const char *)data + 5, 4).c_str());
+    if (version < 1 || version > 11)
+        return fail("Can't handle RDB format version " + std::to_string(version));
+
+    // Pass 1 (sequential): skip over the records to find chunk boundaries and the EOF.
+    // Skipping only parses lengths, so it runs at close to memory bandwidth.
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    size_t target_chunk = std::max<size_t>(size / (threads * 8), 1024 * 1024);
+
+    std::vector<RdbChunk> chunks;
+    RdbReader scanner(data, size, 9);
+    size_t chunk_begin = 9;
+    size_t expected_keys = 0;
+    size_t eof_position = 0;
+    while (scanner.ok)
+    {
+        size_t record_begin = scanner.position;
+        uint8_t opcode = scanner.read_byte();
+        if (opcode == RDB_OPCODE_EOF)
+        {
+            eof_position = record_begin;
+            break;
+        }
+        switch (opcode)
+        {
+        case RDB_OPCODE_AUX:
+            scanner.skip_string();
+            scanner.skip_string();
+            continue;
+        case RDB_OPCODE_SELECTDB:
+            scanner.read_length();
+            continue;
+        case RDB_OPCODE_RESIZEDB:
+            expected_keys += scanner.read_length();
+            scanner.read_length();
+            continue;
+        case RDB_OPCODE_EXPIRETIME_MS:
+            scanner.skip(8);
+            opcode = scanner.read_byte();
+            break;
+        case RDB_OPCODE_EXPIRETIME:
+            scanner.skip(4);
+            opcode = scanner.read_byte();
+            break;
+        }
+        scanner.skip_string();
+        skip_value(scanner, opcode);
+
+        if (scanner.position - chunk_begin >= target_chunk)
+        {
+            chunks.push_back({chunk_begin, scanner.position, {}, 0, {}});
+            chunk_begin = scanner.position;
+        }
+    }
+    if (!scanner.ok)
+        return fail("Corrupt RDB file: " + scanner.error + " at offset " + std::to_string(scanner.position));
+    if (eof_position > chunk_begin)
+        chunks.push_back({chunk_begin, eof_position, {}, 0, {}});
+    stats.read_usec = elapsed_usec(phase_started);
+
+    // Pass 2 (parallel): decode the chunks, while one more thread checks the checksum
+    phase_started = std::chrono::steady_clock::now();
+    uint64_t expected_checksum = 0;
+    if (version >= 5 && size - eof_position - 1 >= 8)
+    {
+        for (int i = 0; i < 8; i++)
+            expected_checksum |= (uint64_t)data[eof_position + 1 + i] << (8 * i);
+    }
+    uint64_t actual_checksum = 0;
+    std::thread checksum_thread;
+    if (expected_checksum != 0)
+    {
+        checksum_thread = std::thread([&]()
+                                      { actual_checksum = crc64(0, data, eof_position + 1); });
+    }
+
+    std::atomic<size_t> next_chunk{0};
+    auto worker = [&]()
+    {
+        for (size_t i = next_chunk++; i < chunks.size(); i = next_chunk++)
+            decode_chunk(data, chunks[i]);
+    };
+    stats.threads = std::min<size_t>(threads, std::max<size_t>(chunks.size(), 1));
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < stats.threads; i++)
+        pool.emplace_back(worker);
+    worker();
+    for (std::thread &thread : pool)
+        thread.join();
+    if (checksum_thread.joinable())
+        checksum_thread.join();
+    stats.decode_usec = elapsed_usec(phase_started);
+    stats.chunks = chunks.size();
+
+    for (const RdbChunk &chunk : chunks)
+    {
+        if (!chunk.error.empty())
+            return fail("Corrupt RDB file: " + chunk.error);
+    }
+    if (expected_checksum != 0 && actual_checksum != expected_checksum)
+        return fail("Wrong RDB checksum");
+
+    // Pass 3: insert into a table that already has its final size, so there is no
+    // incremental rehash running while millions of keys go in
+    phase_started = std::chrono::steady_clock::now();
+    size_t decoded = 0;
+    for (const RdbChunk &chunk : chunks)
+        decoded += chunk.entries.size();
+    store.reserve(std::max(expected_keys, decoded));
+    for (RdbChunk &chunk : chunks)
+    {
+        stats.keys += chunk.entries.size();
+        stats.expired += chunk.expired;
+        store.insert_loaded(chunk.entries);
+    }
+    stats.insert_usec = elapsed_usec(phase_started);
+
+    munmap(mapping, size);
+    return true;
+}
+
+//======================  DUMP / RESTORE  ======================
+
+std::string rdb_dump_value(const KeyValueStore::ValueEntry &entry)
+{
+    RdbWriter writer(-1);
+    writer.write_byte(rdb_type(entry.type));
+    write_value(writer, entry);
+
+    // Trailer: RDB version (2 bytes) and the CRC64 of everything before it, little endian
+    unsigned char version[2] = {(unsigned char)(RDB_VERSION & 0xFF), (unsigned char)(RDB_VERSION >> 8)};
+    writer.write_bytes(version, sizeof(version));
+    uint64_t checksum = writer.checksum;
+    unsigned char trailer[8];
+    for (int i = 0; i < 8; i++)
+        trailer[i] = (unsigned char)(checksum >> (8 * i));
+    std::string payload = std::move(writer.contents());
+    payload.append((const char *)trailer, sizeof(trailer));
+    return payload;
+}
+
+bool rdb_restore_value(std::string_view payload, KeyValueStore::ValueEntry &entry, std::string &error)
+{
+    const size_t TRAILER = 10;
+    if (payload.size() < TRAILER + 1)
+    {
+        error = "DUMP payload version or checksum are wrong";
+        return false;
+    }
+
+    const uint8_t *data = (const uint8_t *)payload.data();
+    size_t body = payload.size() - 8;
+    int version = data[body - 2] | (data[body - 1] << 8);
+    uint64_t expected = 0;
+    for (int i = 0; i < 8; i++)
+        expected |= (uint64_t)data[body + i] << (8 * i);
+    if (version > RDB_VERSION || crc64(0, data, body) != expected)
+    {
+        error = "DUMP payload version or checksum are wrong";
+        return false;
+    }
+
+    RdbReader reader(data, body - 2, 0);
+    uint8_t type = reader.read_byte();
+    entry = KeyValueStore::ValueEntry{};
+    read_value(reader, type, entry);
+    if (!reader.ok || reader.position != reader.size)
+    {
+        error = "Bad data format";
+        return false;
+    }
+    return true;
+}
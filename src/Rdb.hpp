@@ -0,0 +1,75 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <string_view>
+#include "KeyValueStore.hpp"
+
+// RDB snapshot format (version 9). Strings, lists, hashes and sorted sets use the
+// standard Redis value types, so the file loads into a stock Redis as well. Streams
+// are stored with a private type, since our block layout has nothing in common with
+// the Redis stream listpacks.
+
+//======================  RDB FORMAT START  ======================
+
+const char RDB_MAGIC[] = "REDIS";
+const int RDB_VERSION = 9;
+
+// Value types
+const uint8_t RDB_TYPE_STRING = 0;
+const uint8_t RDB_TYPE_LIST = 1;
+const uint8_t RDB_TYPE_HASH = 4;
+const uint8_t RDB_TYPE_ZSET_2 = 5;       // Scores as binary doubles
+const uint8_t RDB_TYPE_STREAM_ENTRIES = 100; // Private: [last id][count] then [id][field count][fields...]
+
+// Opcodes
+const uint8_t RDB_OPCODE_AUX = 0xFA;
+const uint8_t RDB_OPCODE_RESIZEDB = 0xFB;
+const uint8_t RDB_OPCODE_EXPIRETIME_MS = 0xFC;
+const uint8_t RDB_OPCODE_EXPIRETIME = 0xFD;
+const uint8_t RDB_OPCODE_SELECTDB = 0xFE;
+const uint8_t RDB_OPCODE_EOF = 0xFF;
+
+// Length prefixes: the top two bits of the first byte select the format
+const uint8_t RDB_6BIT_LENGTH = 0;
+const uint8_t RDB_14BIT_LENGTH = 1;
+const uint8_t RDB_32BIT_LENGTH = 0x80;
+const uint8_t RDB_64BIT_LENGTH = 0x81;
+const uint8_t RDB_ENCODED_VALUE = 3; // Special string encodings (integers, LZF)
+const uint8_t RDB_ENC_INT8 = 0;
+const uint8_t RDB_ENC_INT16 = 1;
+const uint8_t RDB_ENC_INT32 = 2;
+const uint8_t RDB_ENC_LZF = 3;
+
+//======================   RDB FORMAT END   ======================
+
+// CRC-64/Jones as used for the RDB trailer (reflected, polynomial 0xad93d23594c935a9)
+uint64_t crc64(uint64_t crc, const unsigned char *data, size_t length);
+
+// Writes the whole keyspace to path, through a temporary file that is renamed into
+// place once it is complete and synced, so a crash never leaves a truncated snapshot.
+// Returns false and sets error on failure. bytes_written is the final file size.
+bool rdb_save(KeyValueStore &store, const std::string &path, size_t &bytes_written, std::string &error);
+
+// Where the time of a snapshot load went
+struct RdbLoadStats
+{
+    size_t bytes = 0;
+    size_t keys = 0;
+    size_t expired = 0; // Keys skipped because they expired while the server was down
+    size_t chunks = 0;
+    unsigned threads = 0;
+    uint64_t read_usec = 0;   // mmap + the sequential pass that splits the file into chunks
+    uint64_t decode_usec = 0; // Parallel decoding of the chunks (and the checksum)
+    uint64_t insert_usec = 0; // Moving the decoded keys into the keyspace
+};
+
+// Loads a snapshot into an empty store. The file is mapped, split into chunks at record
+// boundaries, decoded by a pool of threads and bulk inserted into a keyspace pre-sized
+// from the RESIZEDB hint. Returns false and sets error if the file is unreadable or corrupt.
+bool rdb_load(KeyValueStore &store, const std::string &path, RdbLoadStats &stats, std::string &error);
+
+// DUMP / RESTORE payload of a single value: its RDB type and encoding, followed by the
+// RDB version (2 bytes) and a CRC64 of all of it (8 bytes), like Redis. Used by MIGRATE.
+std::string rdb_dump_value(const KeyValueStore::ValueEntry &entry);
+bool rdb_restore_value(std::string_view payload, KeyValueStore::ValueEntry &entry, std::string &error);
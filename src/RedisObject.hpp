@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+
+// Every value in the KeyValueStore is tagged with its type so commands can
+// reject keys holding the wrong kind of value (WRONGTYPE).
+enum class ValueType
+{
+    STRING,
+    LIST,
+    HASH,
+    ZSET,
+    STREAM,
+};
+
+// Name of a type as accepted by SCAN ... TYPE
+inline const char *type_name(ValueType type)
+{
+    switch (type)
+    {
+    case ValueType::STRING:
+        return "string";
+    case ValueType::LIST:
+        return "list";
+    case ValueType::HASH:
+        return "hash";
+    case ValueType::ZSET:
+        return "zset";
+    case ValueType::STREAM:
+        return "stream";
+    }
+    return "none";
+}
+
+// Base class for the non-string value types. Strings stay inline in the
+// ValueEntry; everything else lives behind a pointer to one of these.
+class RedisObject
+{
+public:
+    virtual ~RedisObject() = default;
+
+    // Estimated bytes of the object and everything it owns (MEMORY USAGE). Collections
+    // look at 'samples' elements and extrapolate; 0 looks at all of them.
+    virtual size_t memory_usage(size_t samples) const = 0;
+};
+
+// make_shared allocates the object together with its reference counts
+const size_t SHARED_CONTROL_BLOCK_SIZE = 16;
@@ -0,0 +1,756 @@
+#include "Replication.hpp"
+#include "Server.hpp"
+#include "Connection.hpp"
+#include "RESPHandler.hpp"
+#include "Rdb.hpp"
+#include "Utils.hpp"
+#include "Log.hpp"
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+//======================  BACKLOG  ======================
+
+ReplicationBacklog::ReplicationBacklog(size_t capacity) : ring(capacity)
+{
+}
+
+void ReplicationBacklog::append(std::string_view data)
+{
+    end += data.size();
+
+    // Only the newest 'capacity' bytes can survive anyway
+    if (data.size() >= ring.size())
+    {
+        std::memcpy(ring.data(), data.data() + data.size() - ring.size(), ring.size());
+        head = 0;
+        length = ring.size();
+        return;
+    }
+
+    // At most two copies: up to the end of the ring, then from its start
+    size_t first = std::min(data.size(), ring.size() - head);
+    std::memcpy(ring.data() + head, data.data(), first);
+    std::memcpy(ring.data(), data.data() + first, data.size() - first);
+    head = (head + data.size()) % ring.size();
+    length = std::min(length + data.size(), ring.size());
+}
+
+void ReplicationBacklog::reset(long long offset)
+{
+    head = 0;
+    length = 0;
+    end = offset;
+}
+
+std::string ReplicationBacklog::copy_from(long long offset) const
+{
+    size_t count = end - offset + 1;
+    size_t start = (head + ring.size() - count) % ring.size();
+    std::string out;
+    out.reserve(count);
+    size_t first = std::min(count, ring.size() - start);
+    out.append(ring.data() + start, first);
+    out.append(ring.data(), count - first);
+    return out;
+}
+
+//======================  PRIMARY SIDE  ======================
+
+Replication::Replication(const ServerConfig &config) : backlog(config.repl_backlog_size)
+{
+    replid = random_hex_id();
+    my_port = config.port;
+    rdb_path = config.dir + "/" + config.dbfilename;
+    if (!config.replicaof_host.empty())
+    {
+        master_host = config.replicaof_host;
+        master_port = config.replicaof_port;
+        link_state = LinkState::CONNECT;
+    }
+}
+
+Replication::~Replication()
+{
+    if (link_fd != -1)
+        close(link_fd);
+    if (transfer_fd != -1)
+        close(transfer_fd);
+}
+
+void Replication::feed(std::string_view command)
+{
+    backlog.append(command);
+
+    bool any_online = false;
+    for (Connection *replica : replicas)
+    {
+        if (replica->replica_state.stage == ReplicaState::WAIT_BGSAVE_END)
+            replica->replica_state.pending.append(command);
+        else if (replica->replica_state.stage == ReplicaState::ONLINE)
+            any_online = true;
+    }
+    if (any_online)
+        stream_buffer.append(command);
+}
+
+void Replication::flush()
+{
+    if (stream_buffer.empty())
+        return;
+
+    // One buffer for every replica, like a published message
+    auto payload = std::make_shared<const std::string>(std::move(stream_buffer));
+    stream_buffer.clear();
+    for (Connection *replica : replicas)
+    {
+        if (replica->replica_state.stage == ReplicaState::ONLINE)
+            replica->enqueue_shared(payload);
+    }
+}
+
+std::string Replication::handle_psync(Server &server, Connection &client, const std::string &requested_id, long long offset)
+{
+    if (client.is_master || client.replica_state.stage != ReplicaState::NONE)
+        return RESPHandler::serialize_error("ERR Replica already attached");
+    if (is_replica() && link_state != LinkState::CONNECTED)
+        return RESPHandler::serialize_error("NOMASTERLINK Can't SYNC while not connected with my master");
+
+    // Whatever this iteration produced so far goes to the current replicas first. The
+    // newcomer gets it from the backlog (or the snapshot) instead.
+    flush();
+
+    bool known_history = requested_id == replid || (requested_id == replid2 && offset <= second_replid_offset);
+    if (known_history && backlog.can_serve_from(offset))
+    {
+        client.replica_state.stage = ReplicaState::ONLINE;
+        client.replica_state.ack_offset = offset - 1;
+        client.replica_state.ack_time = std::chrono::steady_clock::now();
+        replicas.push_back(&client);
+        sync_partial_ok++;
+
+        std::string missing = backlog.copy_from(offset);
+        server_log(LogLevel::NOTICE, "Partial resynchronization accepted, sending " + std::to_string(missing.size()) + " bytes of backlog");
+        return "+CONTINUE " + replid + "\r\n" + missing;
+    }
+
+    if (requested_id != "?")
+    {
+        sync_partial_err++;
+        server_log(LogLevel::NOTICE, "Partial resynchronization not possible (" + std::string(known_history ? "offset out of the backlog" : "unknown replication ID") + ")");
+    }
+    sync_full++;
+    client.replica_state.stage = ReplicaState::WAIT_BGSAVE_START;
+    replicas.push_back(&client);
+    start_full_sync(server);
+    return "";
+}
+
+std::string Replication::handle_replconf(Connection &client, const std::vector<std::string> &args)
+{
+    for (size_t i = 1; i + 1 < args.size(); i += 2)
+    {
+        std::string option = args[i];
+        std::transform(option.begin(), option.end(), option.begin(), ::tolower);
+        long long number = 0;
+
+        if (option == "listening-port")
+        {
+            if (!parse_integer(args[i + 1], number) || number <= 0 || number > 65535)
+                return RESPHandler::serialize_error("ERR value is not an integer or out of range");
+            client.replica_state.listening_port = (int)number;
+        }
+        else if (option == "capa")
+        {
+            // We only speak the PSYNC protocol there is, nothing to negotiate
+        }
+        else if (option == "ack")
+        {
+            // Acknowledgements are never answered
+            if (parse_integer(args[i + 1], number))
+            {
+                client.replica_state.ack_offset = number;
+                client.replica_state.ack_time = std::chrono::steady_clock::now();
+            }
+            return "";
+        }
+        else if (option == "getack")
+        {
+            if (!client.is_master)
+                return "";
+            return RESPHandler::serialize_array({"REPLCONF", "ACK", std::to_string(backlog.end_offset())});
+        }
+        else
+        {
+            return RESPHandler::serialize_error("ERR Unrecognized REPLCONF option: " + args[i]);
+        }
+    }
+    return RESPHandler::serialize_simple_string("OK");
+}
+
+void Replication::start_full_sync(Server &server)
+{
+    bool waiting = std::any_of(replicas.begin(), replicas.end(), [](Connection *replica)
+                               { return replica->replica_state.stage == ReplicaState::WAIT_BGSAVE_START; });
+
+    // Replicas arriving while a sync snapshot is written cannot use it: their stream
+    // would start at the wrong offset. They take the next one.
+    if (!waiting || sync_save_running || server.persistence.child_active() || server.aof.rewrite_in_progress())
+        return;
+
+    flush();
+    server.persistence.background_save(server.kv_store);
+    if (!server.persistence.child_active())
+    {
+        for (Connection *replica : std::vector<Connection *>(replicas))
+        {
+            if (replica->replica_state.stage == ReplicaState::WAIT_BGSAVE_START)
+                drop_replica(replica, "-ERR BGSAVE for replication failed\r\n");
+        }
+        return;
+    }
+    sync_save_running = true;
+
+    // Everything up to this offset is in the snapshot, the stream picks up right after it
+    std::string line = "+FULLRESYNC " + replid + " " + std::to_string(backlog.end_offset()) + "\r\n";
+    for (Connection *replica : replicas)
+    {
+        if (replica->replica_state.stage == ReplicaState::WAIT_BGSAVE_START)
+        {
+            replica->send_reply(line);
+            replica->replica_state.stage = ReplicaState::WAIT_BGSAVE_END;
+            replica->replica_state.pending.clear();
+        }
+    }
+}
+
+void Replication::finish_full_sync(Server &server)
+{
+    sync_save_running = false;
+    flush();
+
+    std::vector<Connection *> syncing;
+    for (Connection *replica : replicas)
+    {
+        if (replica->replica_state.stage == ReplicaState::WAIT_BGSAVE_END)
+            syncing.push_back(replica);
+    }
+    if (syncing.empty())
+        return;
+
+    std::ifstream file(rdb_path, std::ios::binary);
+    std::stringstream contents;
+    contents << file.rdbuf();
+    if (!server.persistence.last_bgsave_succeeded() || !file)
+    {
+        for (Connection *replica : syncing)
+            drop_replica(replica, "-ERR BGSAVE for replication failed\r\n");
+        return;
+    }
+
+    // The snapshot goes out as a bulk string without the trailing CRLF, then the stream
+    // that was produced while it was being written
+    std::string data = contents.str();
+    auto payload = std::make_shared<const std::string>("$" + std::to_string(data.size()) + "\r\n" + data);
+    for (Connection *replica : syncing)
+    {
+        ReplicaState &state = replica->replica_state;
+        replica->enqueue_shared(payload);
+        if (!state.pending.empty())
+            replica->enqueue_shared(std::make_shared<const std::string>(std::move(state.pending)));
+        state.pending.clear();
+        state.stage = ReplicaState::ONLINE;
+        state.ack_time = std::chrono::steady_clock::now();
+    }
+    server_log(LogLevel::NOTICE, "Synchronization with " + std::to_string(syncing.size()) + " replica(s) succeeded, " + std::to_string(data.size()) + " bytes of snapshot sent");
+}
+
+void Replication::drop_replica(Connection *client, const std::string &error)
+{
+    replicas.erase(std::remove(replicas.begin(), replicas.end(), client), replicas.end());
+    client->replica_state = ReplicaState{};
+    if (!error.empty())
+        client->send_reply(error);
+    client->schedule_close();
+}
+
+void Replication::disconnect_replicas()
+{
+    for (Connection *replica : std::vector<Connection *>(replicas))
+        drop_replica(replica, "");
+}
+
+void Replication::remove_client(Connection *client)
+{
+    if (client == master_link)
+    {
+        master_link = nullptr;
+        if (is_replica())
+        {
+            server_log(LogLevel::NOTICE, "Connection with master lost");
+            link_state = LinkState::CONNECT;
+            link_down_since = std::chrono::steady_clock::now();
+        }
+        return;
+    }
+    replicas.erase(std::remove(replicas.begin(), replicas.end(), client), replicas.end());
+}
+
+void Replication::shift_replid()
+{
+    replid2 = replid;
+    second_replid_offset = backlog.end_offset() + 1;
+    replid = random_hex_id();
+}
+
+//======================  REPLICA SIDE  ======================
+
+void Replication::follow(const std::string &host, int port)
+{
+    close_link();
+
+    // Our own replicas have to resync against the history of the new primary
+    disconnect_replicas();
+
+    master_host = host;
+    master_port = port;
+    link_state = LinkState::CONNECT;
+    last_connect_attempt = {};
+    link_down_since = std::chrono::steady_clock::now();
+    server_log(LogLevel::NOTICE, "Connecting to MASTER " + host + ":" + std::to_string(port));
+}
+
+void Replication::promote()
+{
+    if (!is_replica())
+        return;
+
+    close_link();
+    master_host.clear();
+    master_port = 0;
+    link_state = LinkState::NONE;
+
+    // A new history starts here. Replicas of our old primary share the old one up to this
+    // point, so they can still continue from us.
+    shift_replid();
+    server_log(LogLevel::NOTICE, "MASTER MODE enabled");
+}
+
+void Replication::close_link()
+{
+    if (link_fd != -1)
+    {
+        close(link_fd);
+        link_fd = -1;
+    }
+    if (transfer_fd != -1)
+    {
+        close(transfer_fd);
+        transfer_fd = -1;
+        unlink(transfer_path.c_str());
+    }
+    link_buffer.clear();
+    if (master_link != nullptr)
+    {
+        Connection *link = master_link;
+        master_link = nullptr;
+        link->is_master = false;
+        link->schedule_close();
+    }
+}
+
+void Replication::abort_handshake(const std::string &reason)
+{
+    server_log(LogLevel::WARNING, "Replication with " + master_host + ":" + std::to_string(master_port) + " failed: " + reason);
+    close_link();
+    link_state = LinkState::CONNECT;
+}
+
+void Replication::connect_to_master()
+{
+    last_connect_attempt = std::chrono::steady_clock::now();
+    last_master_io = last_connect_attempt;
+
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    struct addrinfo *addresses = nullptr;
+    std::string port = std::to_string(master_port);
+    if (getaddrinfo(master_host.c_str(), port.c_str(), &hints, &addresses) != 0 || addresses == nullptr)
+    {
+        server_log(LogLevel::WARNING, "Can't resolve master host " + master_host);
+        return;
+    }
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd >= 0 && set_fd_nonblocking(fd) == 0 &&
+        (connect(fd, addresses->ai_addr, addresses->ai_addrlen) == 0 || errno == EINPROGRESS))
+    {
+        link_fd = fd;
+        link_state = LinkState::CONNECTING;
+    }
+    else
+    {
+        server_log(LogLevel::WARNING, "Error connecting to master: " + std::string(strerror(errno)));
+        if (fd >= 0)
+            close(fd);
+    }
+    freeaddrinfo(addresses);
+}
+
+short Replication::handshake_events() const
+{
+    return link_state == LinkState::CONNECTING ? POLLOUT : POLLIN;
+}
+
+bool Replication::send_handshake(const std::string &command)
+{
+    // A few bytes on a fresh socket: they always fit in the send buffer
+    if (send(link_fd, command.data(), command.size(), MSG_NOSIGNAL) != (ssize_t)command.size())
+    {
+        abort_handshake(std::string("write error: ") + strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+bool Replication::take_line(std::string &line)
+{
+    size_t end = link_buffer.find('\n');
+    if (end == std::string::npos)
+        return false;
+    line = link_buffer.substr(0, end);
+    if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+    link_buffer.erase(0, end + 1);
+    return true;
+}
+
+void Replication::handle_handshake(Server &server)
+{
+    last_master_io = std::chrono::steady_clock::now();
+
+    if (link_state == LinkState::CONNECTING)
+    {
+        int error = 0;
+        socklen_t length = sizeof(error);
+        getsockopt(link_fd, SOL_SOCKET, SO_ERROR, &error, &length);
+        if (error != 0)
+        {
+            abort_handshake(strerror(error));
+            return;
+        }
+        server_log(LogLevel::NOTICE, "MASTER <-> REPLICA sync started");
+        if (send_handshake(RESPHandler::serialize_array({"PING"})))
+            link_state = LinkState::RECEIVE_PONG;
+        return;
+    }
+
+    char buffer[1024 * 64];
+    ssize_t bytes_read = read(link_fd, buffer, sizeof(buffer));
+    if (bytes_read < 0)
+    {
+        if (errno != EAGAIN && errno != EWOULDBLOCK)
+            abort_handshake(std::string("read error: ") + strerror(errno));
+        return;
+    }
+    if (bytes_read == 0)
+    {
+        abort_handshake("connection closed by master");
+        return;
+    }
+    link_buffer.append(buffer, bytes_read);
+
+    std::string line;
+    while (link_state != LinkState::TRANSFER)
+    {
+        if (!take_line(line))
+            return;
+
+        if (link_state == LinkState::RECEIVE_PONG)
+        {
+            if (line.empty() || line[0] == '-')
+            {
+                abort_handshake("unexpected reply to PING: " + line);
+                return;
+            }
+            std::string replconf = RESPHandler::serialize_array({"REPLCONF", "listening-port", std::to_string(my_port)}) +
+                                   RESPHandler::serialize_array({"REPLCONF", "capa", "psync2"});
+            if (!send_handshake(replconf))
+                return;
+            replconf_replies = 2;
+            link_state = LinkState::RECEIVE_REPLCONF;
+        }
+        else if (link_state == LinkState::RECEIVE_REPLCONF)
+        {
+            // Like Redis, a primary that does not know an option is not a reason to give up
+            if (!line.empty() && line[0] == '-')
+                server_log(LogLevel::WARNING, "Master does not understand REPLCONF: " + line);
+            if (--replconf_replies > 0)
+                continue;
+
+            // Ask to continue our history. Without one (nothing applied yet) ask for a full sync.
+            long long offset = backlog.end_offset();
+            std::vector<std::string> psync = {"PSYNC", "?", "-1"};
+            if (offset > 0)
+                psync = {"PSYNC", replid, std::to_string(offset + 1)};
+            if (!send_handshake(RESPHandler::serialize_array(psync)))
+                return;
+            link_state = LinkState::RECEIVE_PSYNC;
+        }
+        else if (link_state == LinkState::RECEIVE_PSYNC)
+        {
+            if (line.empty())
+                continue; // Keepalive newline
+
+            std::istringstream words(line);
+            std::string reply, id;
+            words >> reply >> id;
+            if (reply == "+FULLRESYNC")
+            {
+                if (!(words >> sync_offset) || id.size() != 40)
+                {
+                    abort_handshake("bad FULLRESYNC reply: " + line);
+                    return;
+                }
+                sync_replid = id;
+                transfer_size = -1;
+                transfer_read = 0;
+                link_state = LinkState::TRANSFER;
+                server_log(LogLevel::NOTICE, "Full resync from master: " + id + ":" + std::to_string(sync_offset));
+            }
+            else if (reply == "+CONTINUE")
+            {
+                // The primary may have switched IDs (it was promoted). Our history up to
+                // here is shared with it, so the new ID simply continues ours.
+                if (!id.empty() && id != replid)
+                {
+                    replid2 = replid;
+                    second_replid_offset = backlog.end_offset() + 1;
+                    replid = id;
+                }
+                server_log(LogLevel::NOTICE, "Successful partial resynchronization with master");
+                attach_master(server);
+                return;
+            }
+            else
+            {
+                abort_handshake("PSYNC refused: " + line);
+                return;
+            }
+        }
+    }
+
+    receive_transfer(server);
+}
+
+void Replication::receive_transfer(Server &server)
+{
+    // "$<length>\r\n", possibly after newlines the primary sends to keep the link alive
+    std::string line;
+    while (transfer_size < 0)
+    {
+        if (!take_line(line))
+            return;
+        if (line.empty())
+            continue;
+        if (line[0] != '$' || !parse_integer(line.substr(1), transfer_size) || transfer_size < 0)
+        {
+            abort_handshake("bad snapshot header: " + line);
+            return;
+        }
+        transfer_path = rdb_path + ".temp-repl-" + std::to_string(getpid());
+        transfer_fd = open(transfer_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (transfer_fd < 0)
+        {
+            abort_handshake("can't open " + transfer_path + ": " + strerror(errno));
+            return;
+        }
+    }
+
+    size_t take = (size_t)std::min<long long>(transfer_size - transfer_read, link_buffer.size());
+    size_t written = 0;
+    while (written < take)
+    {
+        ssize_t n = write(transfer_fd, link_buffer.data() + written, take - written);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            abort_handshake("write error on " + transfer_path + ": " + strerror(errno));
+            return;
+        }
+        written += n;
+    }
+    link_buffer.erase(0, take);
+    transfer_read += take;
+
+    if (transfer_read == transfer_size)
+        load_transfer(server);
+}
+
+void Replication::load_transfer(Server &server)
+{
+    bool synced = fsync(transfer_fd) == 0;
+    close(transfer_fd);
+    transfer_fd = -1;
+    if (!synced || rename(transfer_path.c_str(), rdb_path.c_str()) != 0)
+    {
+        std::string error = strerror(errno);
+        unlink(transfer_path.c_str());
+        abort_handshake("can't install the snapshot: " + error);
+        return;
+    }
+
+    // The old dataset goes, the primary's replaces it
+    server.kv_store.clear();
+    RdbLoadStats stats;
+    std::string error;
+    if (!rdb_load(server.kv_store, rdb_path, stats, error))
+    {
+        abort_handshake("failed loading the snapshot: " + error);
+        return;
+    }
+    server_log(LogLevel::NOTICE, "MASTER <-> REPLICA sync: loaded " + std::to_string(stats.keys) + " keys (" + std::to_string(stats.bytes) + " bytes)");
+
+    replid = sync_replid;
+    replid2.clear();
+    second_replid_offset = -1;
+    backlog.reset(sync_offset);
+
+    // Sub-replicas hold the dataset that was just thrown away
+    disconnect_replicas();
+
+    // The AOF describes the old dataset. A rewrite replaces it, and the stream applied
+    // meanwhile is appended to the new file.
+    if (server.aof.enabled())
+    {
+        if (!server.persistence.child_active())
+            server.aof.background_rewrite(server.kv_store);
+        else
+            server_log(LogLevel::WARNING, "Can't rewrite the AOF after the full sync while a BGSAVE runs, it is stale until the next BGREWRITEAOF");
+    }
+
+    attach_master(server);
+}
+
+void Replication::attach_master(Server &server)
+{
+    int fd = link_fd;
+    link_fd = -1;
+    link_state = LinkState::CONNECTED;
+    last_ack = {};
+
+    // From now on the primary is a regular connection whose commands are applied. Bytes
+    // that arrived right behind the handshake are its first commands.
+    master_link = server.add_connection(fd);
+    master_link->is_master = true;
+    std::string leftover = std::move(link_buffer);
+    link_buffer.clear();
+    if (!leftover.empty())
+        master_link->receive((const unsigned char *)leftover.data(), leftover.size());
+}
+
+void Replication::applied_from_master(std::string_view command)
+{
+    last_master_io = std::chrono::steady_clock::now();
+
+    // The stream goes on to our own replicas byte for byte, and our offset follows the primary's
+    feed(command);
+}
+
+void Replication::cron(Server &server)
+{
+    auto now = std::chrono::steady_clock::now();
+
+    if (sync_save_running && !server.persistence.child_active())
+        finish_full_sync(server);
+    start_full_sync(server);
+
+    if (link_state == LinkState::CONNECT && now - last_connect_attempt >= std::chrono::seconds(1))
+    {
+        connect_to_master();
+    }
+    else if (link_fd != -1 && now - last_master_io > std::chrono::seconds(60))
+    {
+        abort_handshake("timeout");
+    }
+
+    // Tell the primary how far we got, once a second
+    if (master_link != nullptr && now - last_ack >= std::chrono::seconds(1))
+    {
+        master_link->send_reply(RESPHandler::serialize_array({"REPLCONF", "ACK", std::to_string(backlog.end_offset())}));
+        last_ack = now;
+    }
+}
+
+int Replication::cron_interval_ms() const
+{
+    if (sync_save_running || link_state == LinkState::CONNECT)
+        return 100;
+    if (link_state != LinkState::NONE || !replicas.empty())
+        return 1000;
+    return -1;
+}
+
+std::string Replication::info() const
+{
+    auto now = std::chrono::steady_clock::now();
+    auto seconds_since = [&](std::chrono::steady_clock::time_point then)
+    { return std::to_string(std::chrono::duration_cast<std::chrono::seconds>(now - then).count()); };
+
+    std::string text = "# Replication\r\n";
+    text += std::string("role:") + (is_replica() ? "slave" : "master") + "\r\n";
+    if (is_replica())
+    {
+        bool up = link_state == LinkState::CONNECTED;
+        text += "master_host:" + master_host + "\r\n";
+        text += "master_port:" + std::to_string(master_port) + "\r\n";
+        text += std::string("master_link_status:") + (up ? "up" : "down") + "\r\n";
+        text += "master_last_io_seconds_ago:" + (up ? seconds_since(last_master_io) : std::string("-1")) + "\r\n";
+        text += "master_sync_in_progress:" + std::to_string(link_state == LinkState::TRANSFER ? 1 : 0) + "\r\n";
+        if (link_state == LinkState::TRANSFER)
+        {
+            text += "master_sync_total_bytes:" + std::to_string(transfer_size) + "\r\n";
+            text += "master_sync_read_bytes:" + std::to_string(transfer_read) + "\r\n";
+        }
+        if (!up)
+            text += "master_link_down_since_seconds:" + seconds_since(link_down_since) + "\r\n";
+        text += "slave_repl_offset:" + std::to_string(backlog.end_offset()) + "\r\n";
+        text += "slave_read_only:1\r\n";
+    }
+
+    text += "connected_slaves:" + std::to_string(replicas.size()) + "\r\n";
+    for (size_t i = 0; i < replicas.size(); i++)
+    {
+        const ReplicaState &state = replicas[i]->replica_state;
+        struct sockaddr_in address = {};
+        socklen_t length = sizeof(address);
+        std::string ip = "?";
+        if (getpeername(replicas[i]->fd, (struct sockaddr *)&address, &length) == 0)
+            ip = inet_ntoa(address.sin_addr);
+        const char *stage = state.stage == ReplicaState::ONLINE ? "online" : state.stage == ReplicaState::WAIT_BGSAVE_END ? "send_bulk" : "wait_bgsave";
+        text += "slave" + std::to_string(i) + ":ip=" + ip + ",port=" + std::to_string(state.listening_port) + ",state=" + stage +
+                ",offset=" + std::to_string(state.ack_offset) + ",lag=" + seconds_since(state.ack_time) + "\r\n";
+    }
+
+    text += "master_replid:" + replid + "\r\n";
+    text += "master_replid2:" + (replid2.empty() ? std::string(40, '0') : replid2) + "\r\n";
+    text += "master_repl_offset:" + std::to_string(backlog.end_offset()) + "\r\n";
+    text += "second_repl_offset:" + std::to_string(second_replid_offset) + "\r\n";
+    text += "repl_backlog_active:1\r\n";
+    text += "repl_backlog_size:" + std::to_string(backlog.capacity()) + "\r\n";
+    text += "repl_backlog_first_byte_offset:" + std::to_string(backlog.first_offset()) + "\r\n";
+    text += "repl_backlog_histlen:" + std::to_string(backlog.size()) + "\r\n";
+    text += "sync_full:" + std::to_string(sync_full) + "\r\n";
+    text += "sync_partial_ok:" + std::to_string(sync_partial_ok) + "\r\n";
+    text += "sync_partial_err:" + std::to_string(sync_partial_err) + "\r\n";
+    return text;
+}
@@ -0,0 +1,193 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include "Config.hpp"
+
+class Server;
+class Connection;
+
+// The most recent bytes of the replication stream, in a fixed size ring.
+//
+// Offsets count stream bytes since the replication ID was created, the first byte being
+// offset 1 (like Redis). A replica that lost its link asks for the stream starting right
+// after the last byte it applied (PSYNC), and while those bytes are still in the ring it
+// gets just the missing tail instead of a whole new snapshot.
+class ReplicationBacklog
+{
+public:
+    explicit ReplicationBacklog(size_t capacity);
+
+    void append(std::string_view data);
+
+    // Empties the ring. The next byte appended gets offset + 1.
+    void reset(long long offset);
+
+    // Offset of the last byte appended
+    long long end_offset() const { return end; }
+    long long first_offset() const { return end - (long long)length + 1; }
+
+    // True if the stream from offset on can be served: offset is in the ring, or is the
+    // next byte to come
+    bool can_serve_from(long long offset) const { return offset >= first_offset() && offset <= end + 1; }
+    std::string copy_from(long long offset) const;
+
+    size_t capacity() const { return ring.size(); }
+    size_t size() const { return length; }
+
+private:
+    std::vector<char> ring;
+    size_t head = 0;   // Where the next byte goes
+    size_t length = 0; // Valid bytes, ending right before head
+    long long end = 0;
+};
+
+// Leader-follower replication.
+//
+// Primary side: every write command that executes is appended to the stream in the
+// exact bytes the client sent it (Server::propagate_raw), so nothing is re-encoded. The
+// stream goes into the backlog right away and to the online replicas once per event loop
+// iteration, as a single buffer shared by all of them. A new replica gets a snapshot
+// first (BGSAVE), and the stream produced while the child ran is kept on the side and
+// sent right after it.
+//
+// Replica side: REPLICAOF connects to the primary without blocking the event loop,
+// performs the PING / REPLCONF / PSYNC handshake, loads the snapshot if a full sync is
+// needed, and then applies the stream through a regular Connection flagged is_master.
+// Replicas are read only and reconnect with PSYNC when the link drops.
+class Replication
+{
+public:
+    // Kept on the Connection of a replica attached to us
+    struct ReplicaState
+    {
+        enum Stage
+        {
+            NONE,
+            WAIT_BGSAVE_START, // Waiting for another child to finish before we can fork
+            WAIT_BGSAVE_END,   // Snapshot being written, stream collects in 'pending'
+            ONLINE,
+        };
+        Stage stage = NONE;
+        int listening_port = 0;
+        long long ack_offset = 0;
+        std::chrono::steady_clock::time_point ack_time;
+        std::string pending;
+    };
+
+    explicit Replication(const ServerConfig &config);
+    ~Replication();
+
+    //======  PRIMARY SIDE  ======
+
+    // Appends bytes to the replication stream
+    void feed(std::string_view command);
+
+    // Sends the stream of this iteration to the online replicas. Called before the event
+    // loop sleeps.
+    void flush();
+
+    // PSYNC: returns the reply, or "" when the FULLRESYNC line is sent later (once the
+    // snapshot child is forked)
+    std::string handle_psync(Server &server, Connection &client, const std::string &requested_id, long long offset);
+    std::string handle_replconf(Connection &client, const std::vector<std::string> &args);
+
+    // Forgets a closing connection, replica or primary link
+    void remove_client(Connection *client);
+
+    //======  REPLICA SIDE  ======
+
+    bool is_replica() const { return !master_host.empty(); }
+
+    // REPLICAOF host port: drops the current link and starts following host:port
+    void follow(const std::string &host, int port);
+    // REPLICAOF NO ONE: keeps the data and starts accepting writes
+    void promote();
+
+    // Socket of the handshake / snapshot transfer in progress, -1 if none. Polled by the
+    // server loop, which calls handle_handshake when it is ready.
+    int handshake_fd() const { return link_fd; }
+    short handshake_events() const;
+    void handle_handshake(Server &server);
+
+    // Bytes of the primary's stream that were applied, one command at a time
+    void applied_from_master(std::string_view command);
+
+    // Reconnects, acknowledges the applied offset, and finishes full syncs whose snapshot
+    // is ready. Called every event loop iteration.
+    void cron(Server &server);
+    int cron_interval_ms() const;
+
+    // The "# Replication" section of INFO
+    std::string info() const;
+
+    // Bytes of the backlog ring
+    size_t backlog_memory() const { return backlog.capacity(); }
+
+private:
+    enum class LinkState
+    {
+        NONE,           // Not a replica
+        CONNECT,        // Must (re)connect
+        CONNECTING,     // Non-blocking connect in flight
+        RECEIVE_PONG,
+        RECEIVE_REPLCONF,
+        RECEIVE_PSYNC,
+        TRANSFER,       // Receiving the snapshot
+        CONNECTED,      // Stream flowing through master_link
+    };
+
+    // Replication ID and history. replid2 is the ID we had before the last switch, valid
+    // up to second_replid_offset, so replicas of an old primary can still continue.
+    std::string replid;
+    std::string replid2;
+    long long second_replid_offset = -1;
+    ReplicationBacklog backlog;
+
+    // Primary side
+    std::vector<Connection *> replicas;
+    std::string stream_buffer; // Stream of this iteration, not sent to online replicas yet
+    bool sync_save_running = false;
+    long long sync_full = 0;
+    long long sync_partial_ok = 0;
+    long long sync_partial_err = 0;
+
+    // Replica side
+    std::string master_host;
+    int master_port = 0;
+    int my_port;
+    std::string rdb_path;
+    LinkState link_state = LinkState::NONE;
+    int link_fd = -1;
+    std::string link_buffer;
+    int replconf_replies = 0;
+    std::string sync_replid; // From FULLRESYNC, adopted once the snapshot is loaded
+    long long sync_offset = 0;
+    long long transfer_size = -1;
+    long long transfer_read = 0;
+    int transfer_fd = -1;
+    std::string transfer_path;
+    std::chrono::steady_clock::time_point last_connect_attempt;
+    std::chrono::steady_clock::time_point last_master_io;
+    std::chrono::steady_clock::time_point last_ack;
+    std::chrono::steady_clock::time_point link_down_since;
+    Connection *master_link = nullptr;
+
+    void start_full_sync(Server &server);
+    void finish_full_sync(Server &server);
+    void shift_replid();
+    void disconnect_replicas();
+
+    void drop_replica(Connection *client, const std::string &error);
+    void close_link();
+
+    void connect_to_master();
+    void abort_handshake(const std::string &reason);
+    bool send_handshake(const std::string &command);
+    bool take_line(std::string &line);
+    void receive_transfer(Server &server);
+    void load_transfer(Server &server);
+    void attach_master(Server &server);
+};
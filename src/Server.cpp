@@ -1,21 +1,60 @@
 #include "Server.hpp"
 #include "Utils.hpp"
-#include <iostream>
+#include "Memory.hpp"
+#include "Log.hpp"
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <sys/resource.h>
 
 // Constructor
-Server::Server(int port)
+Server::Server(const ServerConfig &config) : config(config), persistence(config), aof(config), replication(config), cluster(config), slowlog(config), latency(config), hotkeys(config), metrics(config)
 {
-    this->port = port;
+    this->port = config.port;
+    this->start_time = std::chrono::steady_clock::now();
+    this->startup_memory = used_memory();
+
+    // Every client is a file descriptor: make sure maxclients of them can be open, plus
+    // some for the listeners, the AOF, snapshots and replication
+    struct rlimit files;
+    rlim_t wanted = (rlim_t)config.maxclients + 32;
+    if (getrlimit(RLIMIT_NOFILE, &files) == 0 && files.rlim_cur < wanted)
+    {
+        files.rlim_cur = files.rlim_max == RLIM_INFINITY ? wanted : std::min(wanted, files.rlim_max);
+        if (setrlimit(RLIMIT_NOFILE, &files) != 0 || files.rlim_cur < wanted)
+        {
+            server_log(LogLevel::WARNING, "Open file limit of " + std::to_string(files.rlim_cur) + " is too low for maxclients " +
+                                              std::to_string(config.maxclients) + ", raise it with ulimit -n");
+        }
+    }
+    // Restore the data before accepting any clients. The AOF is the more complete
+    // record of the two, so it wins when it is enabled.
+    if (aof.enabled() && aof.exists())
+    {
+        aof.load(*this);
+    }
+    else
+    {
+        persistence.load(kv_store);
+    }
+    aof.open(kv_store);
+
+    // Only count client traffic: the keys touched while loading say nothing about which
+    // are hot
+    if (hotkeys.enabled())
+    {
+        kv_store.set_access_tracker(&hotkeys);
+    }
+
     // Create the server socket
     int server_fd = socket(AF_INET, SOCK_STREAM, 0);
 
     if (server_fd < 0)
     {
-        std::cerr << "Failed to create socket server\n";
+        server_log(LogLevel::WARNING, "Failed to create socket server");
         exit(1);
     }
 
@@ -25,14 +64,14 @@ Server::Server(int port)
     // Set socket option to reuse address to avoid 'Address already in use' errors
     if (setsockopt(server_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) < 0)
     {
-        std::cerr << "Set socket option to Reuse address failed\n";
+        server_log(LogLevel::WARNING, "Set socket option to Reuse address failed");
         exit(1);
     }
 
     // Set the server socket to non-blocking mode
     if (set_fd_nonblocking(server_fd) == -1)
     {
-        std::cerr << "Failed to set server socket Non-Blocking\n";
+        server_log(LogLevel::WARNING, "Failed to set server socket Non-Blocking");
         exit(1);
     }
 
@@ -44,7 +83,7 @@ Server::Server(int port)
     // Bind the socket to the IP and Port
     if (bind(server_fd, (SocketAddress *)&server_address, sizeof(server_address)) != 0)
     {
-        std::cerr << "Socket binding failed\n";
+        server_log(LogLevel::WARNING, "Socket binding failed");
         exit(1);
     }
 
@@ -52,7 +91,7 @@ Server::Server(int port)
     // Start listening for incoming connections
     if (listen(server_fd, request_queue_size) != 0)
     {
-        std::cerr << "Listen failed\n";
+        server_log(LogLevel::WARNING, "Listen failed");
         exit(1);
     }
 }
@@ -64,6 +103,16 @@ void Server::run()
     // Event Loop
     while (true)
     {
+        latency.next_iteration();
+
+        // Write out the commands of the last iteration with one write (and one fsync for
+        // appendfsync always). Replies held back for it go out in the poll below.
+        {
+            LatencyMonitor::Timer timer(latency, LatencyMonitor::FLUSH);
+            aof.flush();
+            replication.flush();
+        }
+
         poll_arguments.clear();
 
         PollFD server_poll_fd;
@@ -94,12 +143,62 @@ void Server::run()
             {
                 client_poll_fd.events = client_poll_fd.events | POLLOUT;
             }
+            if (connection->blocked)
+            {
+                // Parked connections are not read from, but we still want to hear about the peer leaving
+                client_poll_fd.events = client_poll_fd.events | POLLRDHUP;
+            }
             // Add client socket to poll arguments
             poll_arguments.push_back(client_poll_fd);
         }
 
+        // A replica's handshake with its primary runs on a socket of its own until the
+        // stream starts flowing
+        int handshake_index = -1;
+        if (replication.handshake_fd() != -1)
+        {
+            handshake_index = (int)poll_arguments.size();
+            poll_arguments.push_back({replication.handshake_fd(), replication.handshake_events(), 0});
+        }
+
+        // The metrics listener and its HTTP clients come last
+        size_t metrics_index = poll_arguments.size();
+        metrics.add_poll_fds(poll_arguments);
+
+        // Sleep until the nearest BLPOP/BRPOP deadline, or indefinitely if nobody is waiting
+        int timeout_ms = -1;
+        std::optional<BlockingManager::TimePoint> deadline = blocking.next_deadline();
+        if (deadline.has_value())
+        {
+            auto wait = std::chrono::ceil<std::chrono::milliseconds>(*deadline - std::chrono::steady_clock::now());
+            timeout_ms = (int)std::max<long long>(wait.count(), 0);
+        }
+
+        // The next idle timeout check counts as a deadline too
+        std::optional<std::chrono::steady_clock::time_point> idle_deadline = idle_timers.next_deadline();
+        if (idle_deadline.has_value())
+        {
+            auto wait = std::chrono::ceil<std::chrono::milliseconds>(*idle_deadline - std::chrono::steady_clock::now());
+            int idle_ms = (int)std::max<long long>(wait.count(), 0);
+            timeout_ms = timeout_ms < 0 ? idle_ms : std::min(timeout_ms, idle_ms);
+        }
+
+        // Wake up regularly while a snapshot child runs or save rules need checking
+        for (int cron_ms : {persistence.cron_interval_ms(), aof.cron_interval_ms(), replication.cron_interval_ms(), cluster.cron_interval_ms(),
+                            hotkeys.cron_interval_ms(), metrics.cron_interval_ms(), clients_cron_interval_ms()})
+        {
+            if (cron_ms >= 0 && (timeout_ms < 0 || cron_ms < timeout_ms))
+            {
+                timeout_ms = cron_ms;
+            }
+        }
+
         // Wait for events on any of the sockets
-        int return_value = poll(poll_arguments.data(), (nfds_t)poll_arguments.size(), -1);
+        int return_value;
+        {
+            LatencyMonitor::Timer timer(latency, LatencyMonitor::POLL);
+            return_value = poll(poll_arguments.data(), (nfds_t)poll_arguments.size(), timeout_ms);
+        }
         if (return_value < 0)
         {
             if (errno == EINTR)
@@ -108,20 +207,47 @@ void Server::run()
             }
             else
             {
-                std::cerr << "Poll failed\n";
+                server_log(LogLevel::WARNING, "Poll failed");
                 exit(1);
             }
         }
 
+        // Answer blocked clients whose timeout has passed
+        blocking.expire_timeouts(std::chrono::steady_clock::now());
+
+        {
+            LatencyMonitor::Timer timer(latency, LatencyMonitor::CRON);
+            if (handshake_index != -1 && poll_arguments[handshake_index].revents != 0)
+            {
+                replication.handle_handshake(*this);
+            }
+
+            // Reap a finished BGSAVE child, start one if a save rule fired
+            persistence.cron(kv_store, !aof.rewrite_in_progress());
+            aof.cron();
+            replication.cron(*this);
+            cluster.cron(*this);
+            hotkeys.cron(std::chrono::steady_clock::now());
+            expire_idle_clients(std::chrono::steady_clock::now());
+            clients_cron(std::chrono::steady_clock::now());
+        }
+
         // Check if there is a new connection request on the server socket
         if (poll_arguments[0].revents & POLLIN)
         {
+            LatencyMonitor::Timer timer(latency, LatencyMonitor::ACCEPT);
             accept_new_connection();
         }
 
+        metrics.handle_events(poll_arguments.data() + metrics_index, poll_arguments.size() - metrics_index, *this);
+
         // Iterate through client sockets to handle events
-        for (size_t i = 1; i < poll_arguments.size(); ++i)
+        for (size_t i = 1; i < metrics_index; ++i)
         {
+            if ((int)i == handshake_index)
+            {
+                continue;
+            }
 
             uint32_t ready = poll_arguments[i].revents;
             if (ready == 0)
@@ -147,50 +273,195 @@ void Server::run()
                 connection->handle_write();
             }
 
-            // Handle errors or close request
-            if ((ready & POLLERR) || connection->want_close)
+            // Handle errors or close request. A hang-up without readable data happens to
+            // parked connections, which are not polled for reads.
+            bool hung_up = (ready & (POLLHUP | POLLRDHUP)) && !(ready & POLLIN);
+            if ((ready & POLLERR) || hung_up || connection->want_close)
             {
                 // Clear the connection from the map and free memory
                 fd_to_connection[connection->fd] = NULL;
-                delete connection;
+                connection_count--;
+                connection_pool.release(connection);
             }
         }
     }
 }
 
-void Server::accept_new_connection()
+void Server::propagate(const std::vector<std::string> &args)
 {
-    SocketAddressIPV4 client_address;
-    SocketAddressSize client_address_length = sizeof(client_address);
-
-    // Accept the new incoming connection
-    int client_fd = accept(server_fd, (SocketAddress *)&client_address, &client_address_length);
+    std::string command;
+    aof_append_command(command, std::vector<std::string_view>(args.begin(), args.end()));
+    propagate_raw(command);
+}
 
-    if (client_fd < 0)
+void Server::propagate_raw(std::string_view command)
+{
+    if (aof.loading)
     {
-        std::cerr<<"Failed to accept the client\n";
         return;
     }
+    persistence.dirty++;
+    aof.feed(command);
+
+    // A replica's stream is the one it receives, forwarded as is (applied_from_master)
+    if (!replication.is_replica())
+    {
+        replication.feed(command);
+    }
+}
+
+size_t Server::connected_clients() const
+{
+    return connection_count;
+}
+
+std::vector<Connection *> Server::clients() const
+{
+    std::vector<Connection *> connections;
+    for (Connection *connection : fd_to_connection)
+    {
+        if (connection != NULL)
+        {
+            connections.push_back(connection);
+        }
+    }
+    return connections;
+}
 
-    char *ip_string = inet_ntoa(client_address.sin_addr);
-    uint16_t port = ntohs(client_address.sin_port);
+void Server::accept_new_connection()
+{
+    // During a reconnect storm the whole backlog is taken in one go, up to a budget per
+    // event loop iteration so the clients already connected keep being served
+    for (int accepted = 0; accepted < MAX_ACCEPTS_PER_ITERATION; accepted++)
+    {
+        SocketAddressIPV4 client_address;
+        SocketAddressSize client_address_length = sizeof(client_address);
+
+        // The socket comes back non-blocking and close-on-exec (not inherited by the
+        // BGSAVE / rewrite children), no fcntl calls needed
+        int client_fd = accept4(server_fd, (SocketAddress *)&client_address, &client_address_length, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (client_fd < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                server_log(LogLevel::WARNING, std::string("Accepting a client failed: ") + strerror(errno));
+            }
+            return;
+        }
 
-    std::cout << "Client connected\n";
-    std::cout << "IP:" << ip_string << "\n";
-    std::cout << "PORT:" << port << "\n";
+        char ip[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &client_address.sin_addr, ip, sizeof(ip));
+        std::string address = std::string(ip) + ":" + std::to_string(ntohs(client_address.sin_port));
 
-    // Set the new client socket to non-blocking mode
-    set_fd_nonblocking(client_fd);
+        // Over the limit the client gets the error right away, without a Connection
+        // being built for it: one non-blocking send and the socket is closed
+        if (connection_count >= (size_t)config.maxclients)
+        {
+            static const char FULL[] = "-ERR max number of clients reached\r\n";
+            send(client_fd, FULL, sizeof(FULL) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+            close(client_fd);
+            stats.rejected_connections++;
+            if (log_enabled(LogLevel::VERBOSE))
+            {
+                server_log(LogLevel::VERBOSE, "Refused client " + address + ": max number of clients reached");
+            }
+            continue;
+        }
 
-    Connection *connection = new Connection(client_fd, kv_store);
+        // Peers that vanished without a FIN (crashed host, dropped NAT entry) are found by
+        // keepalive probes, idle ones by the timeout
+        if (config.tcp_keepalive > 0)
+        {
+            set_tcp_keepalive(client_fd, (int)config.tcp_keepalive);
+        }
 
-    if (connection)
+        Connection *connection = add_connection(client_fd, address);
+        stats.connections_received++;
+        if (config.timeout > 0)
+        {
+            idle_timers.schedule(connection->created + std::chrono::seconds(config.timeout), {client_fd, connection->id, idle_timer_generation});
+        }
+        if (log_enabled(LogLevel::VERBOSE))
+        {
+            server_log(LogLevel::VERBOSE, "Accepted " + address);
+        }
+    }
+}
+
+void Server::set_idle_timeout(long long seconds)
+{
+    config.timeout = seconds;
+    idle_timer_generation++;
+    if (seconds <= 0)
+    {
+        return;
+    }
+    for (Connection *connection : clients())
     {
-        if (fd_to_connection.size() <= (size_t)connection->fd)
+        idle_timers.schedule(connection->last_interaction + std::chrono::seconds(seconds), {connection->fd, connection->id, idle_timer_generation});
+    }
+}
+
+void Server::expire_idle_clients(std::chrono::steady_clock::time_point now)
+{
+    idle_timers.advance(now, [&](const IdleTimer &timer)
+                        {
+                            Connection *connection = (size_t)timer.fd < fd_to_connection.size() ? fd_to_connection[timer.fd] : NULL;
+                            if (connection == NULL || connection->id != timer.client_id || timer.generation != idle_timer_generation)
+                                return;
+
+                            // Like in Redis, links to the primary and to replicas, parked clients and
+                            // subscribers are waiting for a reason, not abandoned
+                            auto limit = std::chrono::seconds(config.timeout);
+                            bool exempt = connection->is_master || connection->replica_state.stage != Replication::ReplicaState::NONE ||
+                                          connection->blocked || connection->subscription_count() > 0;
+                            if (!exempt && now - connection->last_interaction >= limit)
+                            {
+                                if (log_enabled(LogLevel::VERBOSE))
+                                {
+                                    server_log(LogLevel::VERBOSE, "Closing idle client " + connection->address);
+                                }
+                                connection->schedule_close();
+                                return;
+                            }
+                            idle_timers.schedule((exempt ? now : connection->last_interaction) + limit, timer); });
+}
+
+void Server::clients_cron(std::chrono::steady_clock::time_point now)
+{
+    if (now - last_clients_cron < std::chrono::milliseconds(100) || connection_count == 0)
+    {
+        return;
+    }
+    last_clients_cron = now;
+
+    size_t slice = fd_to_connection.size() / 10 + 1;
+    for (size_t i = 0; i < slice; i++)
+    {
+        clients_cron_cursor = (clients_cron_cursor + 1) % fd_to_connection.size();
+        Connection *connection = fd_to_connection[clients_cron_cursor];
+        if (connection != NULL && !connection->want_close)
         {
-            fd_to_connection.resize(connection->fd + 1);
+            connection->reclaim_buffers(now);
         }
-        // Map the file descriptor to the connection object
-        fd_to_connection[connection->fd] = connection;
     }
+}
+
+Connection *Server::add_connection(int fd, const std::string &address)
+{
+    Connection *connection = connection_pool.acquire(fd, *this);
+    connection->address = address.empty() ? connection->peer_address() : address;
+    connection_count++;
+
+    if (fd_to_connection.size() <= (size_t)connection->fd)
+    {
+        fd_to_connection.resize(connection->fd + 1);
+    }
+    // Map the file descriptor to the connection object
+    fd_to_connection[connection->fd] = connection;
+    return connection;
 }
\ No newline at end of file
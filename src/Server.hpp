@@ -5,6 +5,19 @@
 #include <netinet/in.h> 
 #include "Connection.hpp"
 #include "KeyValueStore.hpp"
+#include "BlockingManager.hpp"
+#include "PubSub.hpp"
+#include "Persistence.hpp"
+#include "AppendOnlyFile.hpp"
+#include "Replication.hpp"
+#include "Cluster.hpp"
+#include "Stats.hpp"
+#include "SlowLog.hpp"
+#include "LatencyMonitor.hpp"
+#include "MetricsServer.hpp"
+#include "TimingWheel.hpp"
+#include "ConnectionPool.hpp"
+#include "Config.hpp"
 
 // Typedefs
 typedef struct sockaddr_in SocketAddressIPV4;
@@ -15,14 +28,81 @@ typedef struct pollfd PollFD;
 
 class Server {
 public:
-    Server(int port);
+    Server(const ServerConfig &config);
     void run(); // Starts the infinite loop
+    size_t connected_clients() const;
+
+    // Open connections in fd order (CLIENT LIST / KILL)
+    std::vector<Connection *> clients() const;
+    uint64_t next_client_id = 1;
+
+    ServerConfig config;
+    std::chrono::steady_clock::time_point start_time;
+    size_t startup_memory = 0; // used_memory once the members are built, before any data is loaded
+
+    // Recycled connection objects and I/O buffers. Declared before everything that can
+    // hold a connection, so it is destroyed after all of them.
+    ConnectionPool connection_pool;
+
+    // Shared state that commands running on a Connection reach through the server
+    KeyValueStore kv_store;
+    BlockingManager blocking;
+    PubSub pubsub;
+    Persistence persistence;
+    AppendOnlyFile aof;
+    Replication replication;
+    Cluster cluster;
+    Stats stats;
+    SlowLog slowlog;
+    LatencyMonitor latency;
+    HotKeys hotkeys;
+    MetricsServer metrics;
+
+    // Records a write command that was executed: counts it towards the save rules and
+    // appends it to the AOF and the replication stream. propagate_raw takes the command
+    // already RESP encoded.
+    void propagate(const std::vector<std::string> &args);
+    void propagate_raw(std::string_view command);
+
+    // Registers a connected socket with the event loop. The peer address is looked up
+    // when not given.
+    Connection *add_connection(int fd, const std::string &address = "");
+
+    // Applies the timeout setting (CONFIG SET goes through here): every client gets a
+    // fresh idle timer for the new value
+    void set_idle_timeout(long long seconds);
 
 private:
     int server_fd;
     int port;
-    KeyValueStore kv_store;
     std::vector<Connection*> fd_to_connection;
+    size_t connection_count = 0;
+
+    static const int MAX_ACCEPTS_PER_ITERATION = 1000;
 
     void accept_new_connection();
+
+    // Idle timeouts. A client's timer is not moved on activity: when it fires, a client
+    // that was active since is given a new one from its last interaction, so a busy
+    // client costs one timer per timeout period. Timers of closed connections (or of an
+    // older timeout setting) are recognized by the client id and generation and dropped.
+    struct IdleTimer
+    {
+        int fd;
+        uint64_t client_id;
+        uint64_t generation;
+    };
+    TimingWheel<IdleTimer> idle_timers{std::chrono::milliseconds(100)};
+    uint64_t idle_timer_generation = 0;
+
+    void expire_idle_clients(std::chrono::steady_clock::time_point now);
+
+    // Visits a slice of the connections every 100ms, each one about once a second, to
+    // release the buffer capacity they are not using. Off while nobody is connected, so an
+    // idle server does not wake up for it (fd_to_connection is indexed by fd and keeps its
+    // size once connections are gone).
+    size_t clients_cron_cursor = 0;
+    std::chrono::steady_clock::time_point last_clients_cron;
+    void clients_cron(std::chrono::steady_clock::time_point now);
+    int clients_cron_interval_ms() const { return connection_count > 0 ? 100 : -1; }
 };
\ No newline at end of file
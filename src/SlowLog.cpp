@@ -0,0 +1,84 @@
+#include "SlowLog.hpp"
+#include "RESPHandler.hpp"
+#include <algorithm>
+
+SlowLog::SlowLog(const ServerConfig &config)
+{
+    threshold_usec = config.slowlog_log_slower_than;
+    ring.resize(config.slowlog_max_len);
+}
+
+void SlowLog::record(const std::vector<std::string> &args, uint64_t usec, const std::string &client_address, const std::string &client_name)
+{
+    if (ring.empty())
+        return;
+
+    // Entries are reused in place, so their argument vectors keep their capacity
+    Entry &entry = ring[head];
+    entry.id = next_id++;
+    entry.time = time(nullptr);
+    entry.usec = usec;
+    entry.client_address = client_address;
+    entry.client_name = client_name;
+    entry.args.clear();
+
+    size_t kept = std::min(args.size(), MAX_ARGS);
+    for (size_t i = 0; i < kept; i++)
+    {
+        if (kept < args.size() && i == kept - 1)
+        {
+            entry.args.push_back("... (" + std::to_string(args.size() - kept + 1) + " more arguments)");
+            break;
+        }
+        if (args[i].size() > MAX_ARG_LENGTH)
+            entry.args.push_back(args[i].substr(0, MAX_ARG_LENGTH) + "... (" + std::to_string(args[i].size() - MAX_ARG_LENGTH) + " more bytes)");
+        else
+            entry.args.push_back(args[i]);
+    }
+
+    head = (head + 1) % ring.size();
+    count = std::min(count + 1, ring.size());
+}
+
+void SlowLog::configure(long long threshold, size_t max_len)
+{
+    threshold_usec = threshold;
+    if (max_len == ring.size())
+        return;
+
+    // Rebuilt oldest first, so the newest entries are the ones that survive a shrink
+    std::vector<Entry> resized(max_len);
+    size_t kept = std::min(count, max_len);
+    for (size_t i = 0; i < kept; i++)
+        resized[i] = std::move(ring[(head + ring.size() - kept + i) % ring.size()]);
+    ring = std::move(resized);
+    count = kept;
+    head = max_len > 0 ? kept % max_len : 0;
+}
+
+std::string SlowLog::get(long long wanted) const
+{
+    size_t entries = wanted < 0 ? count : std::min(count, (size_t)wanted);
+    std::string reply = RESPHandler::serialize_array_header(entries);
+    for (size_t i = 0; i < entries; i++)
+    {
+        // Newest first
+        const Entry &entry = ring[(head + ring.size() - 1 - i) % ring.size()];
+        reply += RESPHandler::serialize_array_header(6);
+        reply += RESPHandler::serialize_integer(entry.id);
+        reply += RESPHandler::serialize_integer(entry.time);
+        reply += RESPHandler::serialize_integer(entry.usec);
+        reply += RESPHandler::serialize_array(entry.args);
+        reply += RESPHandler::serialize_bulk_string(entry.client_address);
+        reply += RESPHandler::serialize_bulk_string(entry.client_name);
+    }
+    return reply;
+}
+
+void SlowLog::reset()
+{
+    for (Entry &entry : ring)
+        entry.args.clear();
+    head = 0;
+    count = 0;
+}
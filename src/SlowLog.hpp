@@ -0,0 +1,51 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <ctime>
+#include "Config.hpp"
+
+// Commands that took longer than slowlog-log-slower-than microseconds, newest kept.
+//
+// The entries live in a ring of slowlog-max-len slots, so a burst of slow commands
+// overwrites the oldest entries instead of growing memory. Arguments are copied truncated
+// (a few dozen, each cut to a bounded length): a slow SET of a 100MB value must not
+// keep the value alive a second time in here.
+class SlowLog
+{
+public:
+    struct Entry
+    {
+        uint64_t id = 0;
+        time_t time = 0;
+        uint64_t usec = 0;
+        std::vector<std::string> args;
+        std::string client_address;
+        std::string client_name;
+    };
+
+    explicit SlowLog(const ServerConfig &config);
+
+    // Cheap check done after every command: false unless the command must be logged
+    bool is_slow(uint64_t usec) const { return threshold_usec >= 0 && (long long)usec >= threshold_usec; }
+
+    void record(const std::vector<std::string> &args, uint64_t usec, const std::string &client_address, const std::string &client_name);
+
+    // Applies CONFIG SET slowlog-log-slower-than / slowlog-max-len. Shrinking keeps the newest.
+    void configure(long long threshold_usec, size_t max_len);
+
+    // The SLOWLOG GET reply for the newest 'count' entries (-1 for all)
+    std::string get(long long count) const;
+    size_t length() const { return count; }
+    void reset();
+
+private:
+    static constexpr size_t MAX_ARGS = 32;
+    static constexpr size_t MAX_ARG_LENGTH = 128;
+
+    long long threshold_usec;
+    std::vector<Entry> ring;
+    size_t head = 0;  // Slot of the next entry
+    size_t count = 0; // Valid entries, ending right before head
+    uint64_t next_id = 0;
+};
@@ -0,0 +1,540 @@
+#include "SortedSet.hpp"
+#include "Listpack.hpp"
+#include "Memory.hpp"
+#include <cstring>
+#include <random>
+#include <new>
+
+static const size_t npos = std::string::npos;
+
+//======================  SKIPLIST  ======================
+
+Skiplist::Skiplist()
+{
+    header = create_node(MAX_LEVEL, 0, "");
+    for (int i = 0; i < MAX_LEVEL; i++)
+    {
+        header->levels()[i] = {nullptr, 0};
+    }
+    header->backward = nullptr;
+}
+
+Skiplist::~Skiplist()
+{
+    Node *node = header->next();
+    while (node)
+    {
+        Node *next = node->next();
+        free_node(node);
+        node = next;
+    }
+    free_node(header);
+}
+
+Skiplist::Node *Skiplist::create_node(int height, double score, const std::string &member)
+{
+    void *memory = ::operator new(sizeof(Node) + height * sizeof(Level));
+    Node *node = new (memory) Node{member, score, nullptr, height};
+    return node;
+}
+
+void Skiplist::free_node(Node *node)
+{
+    node->~Node();
+    ::operator delete(node);
+}
+
+int Skiplist::random_level()
+{
+    // Each extra level is taken with probability 1/4
+    static thread_local std::minstd_rand generator(std::random_device{}());
+    int height = 1;
+    while (height < MAX_LEVEL && (generator() & 0xFFFF) < 0xFFFF / 4)
+        height++;
+    return height;
+}
+
+// Orders elements by score, then by member
+static bool node_before(const Skiplist::Node *node, double score, const std::string &member)
+{
+    return node->score < score || (node->score == score && node->member < member);
+}
+
+Skiplist::Node *Skiplist::insert(double score, const std::string &member)
+{
+    Node *update[MAX_LEVEL];
+    size_t rank[MAX_LEVEL];
+
+    // Find the insert position on every level, remembering how many nodes we passed
+    Node *x = header;
+    for (int i = level - 1; i >= 0; i--)
+    {
+        rank[i] = (i == level - 1) ? 0 : rank[i + 1];
+        while (x->levels()[i].forward && node_before(x->levels()[i].forward, score, member))
+        {
+            rank[i] += x->levels()[i].span;
+            x = x->levels()[i].forward;
+        }
+        update[i] = x;
+    }
+
+    int height = random_level();
+    if (height > level)
+    {
+        for (int i = level; i < height; i++)
+        {
+            rank[i] = 0;
+            update[i] = header;
+            header->levels()[i].span = length;
+        }
+        level = height;
+    }
+
+    x = create_node(height, score, member);
+    for (int i = 0; i < height; i++)
+    {
+        x->levels()[i].forward = update[i]->levels()[i].forward;
+        update[i]->levels()[i].forward = x;
+
+        // Split the span of the link we cut in two
+        x->levels()[i].span = update[i]->levels()[i].span - (rank[0] - rank[i]);
+        update[i]->levels()[i].span = (rank[0] - rank[i]) + 1;
+    }
+
+    // Links above the new node now jump over one more node
+    for (int i = height; i < level; i++)
+    {
+        update[i]->levels()[i].span++;
+    }
+
+    x->backward = (update[0] == header) ? nullptr : update[0];
+    if (x->next())
+        x->next()->backward = x;
+    else
+        tail = x;
+
+    length++;
+    return x;
+}
+
+void Skiplist::delete_node(Node *node, Node **update)
+{
+    for (int i = 0; i < level; i++)
+    {
+        if (update[i]->levels()[i].forward == node)
+        {
+            update[i]->levels()[i].span += node->levels()[i].span - 1;
+            update[i]->levels()[i].forward = node->levels()[i].forward;
+        }
+        else
+        {
+            update[i]->levels()[i].span -= 1;
+        }
+    }
+
+    if (node->next())
+        node->next()->backward = node->backward;
+    else
+        tail = node->backward;
+
+    while (level > 1 && header->levels()[level - 1].forward == nullptr)
+        level--;
+    length--;
+}
+
+bool Skiplist::remove(double score, const std::string &member)
+{
+    Node *update[MAX_LEVEL];
+    Node *x = header;
+    for (int i = level - 1; i >= 0; i--)
+    {
+        while (x->levels()[i].forward && node_before(x->levels()[i].forward, score, member))
+            x = x->levels()[i].forward;
+        update[i] = x;
+    }
+
+    x = x->next();
+    if (x && x->score == score && x->member == member)
+    {
+        delete_node(x, update);
+        free_node(x);
+        return true;
+    }
+    return false;
+}
+
+Skiplist::Node *Skiplist::update_score(double current_score, const std::string &member, double new_score)
+{
+    Node *update[MAX_LEVEL];
+    Node *x = header;
+    for (int i = level - 1; i >= 0; i--)
+    {
+        while (x->levels()[i].forward && node_before(x->levels()[i].forward, current_score, member))
+            x = x->levels()[i].forward;
+        update[i] = x;
+    }
+    x = x->next();
+
+    // If the node keeps its position we can just rewrite the score
+    bool after_previous = x->backward == nullptr || x->backward->score < new_score ||
+                          (x->backward->score == new_score && x->backward->member < member);
+    bool before_next = x->next() == nullptr || new_score < x->next()->score ||
+                       (x->next()->score == new_score && member < x->next()->member);
+    if (after_previous && before_next)
+    {
+        x->score = new_score;
+        return x;
+    }
+
+    delete_node(x, update);
+    free_node(x);
+    return insert(new_score, member);
+}
+
+size_t Skiplist::rank(double score, const std::string &member) const
+{
+    size_t traversed = 0;
+    Node *x = header;
+    for (int i = level - 1; i >= 0; i--)
+    {
+        while (x->levels()[i].forward &&
+               (node_before(x->levels()[i].forward, score, member) ||
+                (x->levels()[i].forward->score == score && x->levels()[i].forward->member == member)))
+        {
+            traversed += x->levels()[i].span;
+            x = x->levels()[i].forward;
+        }
+        if (x != header && x->member == member)
+            return traversed;
+    }
+    return 0;
+}
+
+Skiplist::Node *Skiplist::by_rank(size_t rank) const
+{
+    size_t traversed = 0;
+    Node *x = header;
+    for (int i = level - 1; i >= 0; i--)
+    {
+        while (x->levels()[i].forward && traversed + x->levels()[i].span <= rank)
+        {
+            traversed += x->levels()[i].span;
+            x = x->levels()[i].forward;
+        }
+        if (traversed == rank)
+            return x == header ? nullptr : x;
+    }
+    return nullptr;
+}
+
+Skiplist::Node *Skiplist::first_in_range(const ScoreRange &range) const
+{
+    Node *x = header;
+    for (int i = level - 1; i >= 0; i--)
+    {
+        while (x->levels()[i].forward && !range.above_min(x->levels()[i].forward->score))
+            x = x->levels()[i].forward;
+    }
+    x = x->next();
+    if (x == nullptr || !range.below_max(x->score))
+        return nullptr;
+    return x;
+}
+
+//======================  SORTED SET  ======================
+
+// LISTPACK layout: [member entry][8 byte score]... kept sorted by (score, member)
+static double listpack_score_at(const std::vector<unsigned char> &listpack, size_t offset)
+{
+    double score;
+    memcpy(&score, listpack.data() + offset, sizeof(score));
+    return score;
+}
+
+std::optional<double> SortedSet::score(const std::string &member) const
+{
+    if (encoding == ZSetEncoding::SKIPLIST)
+    {
+        auto it = dict.find(member);
+        if (it == dict.end())
+            return std::nullopt;
+        return it->second->score;
+    }
+
+    double score;
+    if (listpack_find(member, &score) == npos)
+        return std::nullopt;
+    return score;
+}
+
+bool SortedSet::insert(const std::string &member, double score)
+{
+    if (encoding == ZSetEncoding::LISTPACK)
+    {
+        size_t offset = listpack_find(member, nullptr);
+        if (offset != npos)
+        {
+            listpack_remove_at(offset);
+            listpack_insert(member, score);
+            return false;
+        }
+
+        if (member.size() <= ZSET_MAX_LISTPACK_VALUE && listpack_entries < ZSET_MAX_LISTPACK_ENTRIES)
+        {
+            listpack_insert(member, score);
+            return true;
+        }
+
+        // The set has outgrown the compact encoding
+        convert_to_skiplist();
+    }
+
+    auto it = dict.find(member);
+    if (it != dict.end())
+    {
+        Skiplist::Node *node = it->second;
+        if (node->score != score)
+        {
+            // The node may be reallocated, and the index is keyed on its member string,
+            // so drop the index entry first and re-add it afterwards
+            dict.erase(it);
+            node = skiplist.update_score(node->score, member, score);
+            dict.emplace(node->member, node);
+        }
+        return false;
+    }
+
+    Skiplist::Node *node = skiplist.insert(score, member);
+    dict.emplace(node->member, node);
+    return true;
+}
+
+bool SortedSet::remove(const std::string &member)
+{
+    if (encoding == ZSetEncoding::LISTPACK)
+    {
+        size_t offset = listpack_find(member, nullptr);
+        if (offset == npos)
+            return false;
+        listpack_remove_at(offset);
+        return true;
+    }
+
+    auto it = dict.find(member);
+    if (it == dict.end())
+        return false;
+
+    double score = it->second->score;
+    dict.erase(it);
+    skiplist.remove(score, member);
+    return true;
+}
+
+std::optional<size_t> SortedSet::rank(const std::string &member, bool reverse) const
+{
+    size_t length = size();
+
+    if (encoding == ZSetEncoding::SKIPLIST)
+    {
+        auto it = dict.find(member);
+        if (it == dict.end())
+            return std::nullopt;
+        size_t rank = skiplist.rank(it->second->score, member);
+        return reverse ? length - rank : rank - 1;
+    }
+
+    size_t offset = 0;
+    size_t index = 0;
+    while (offset < listpack.size())
+    {
+        size_t member_length;
+        size_t data = listpack_read_entry(listpack, offset, member_length);
+        if (listpack_view(listpack, data, member_length) == member)
+            return reverse ? length - 1 - index : index;
+        offset = data + member_length + sizeof(double);
+        index++;
+    }
+    return std::nullopt;
+}
+
+size_t SortedSet::size() const
+{
+    if (encoding == ZSetEncoding::SKIPLIST)
+        return skiplist.size();
+    return listpack_entries;
+}
+
+void SortedSet::range_by_rank(size_t start, size_t stop, bool reverse, const Visitor &fn) const
+{
+    size_t count = stop - start + 1;
+
+    if (encoding == ZSetEncoding::SKIPLIST)
+    {
+        // Jump straight to the first node with a rank lookup, then walk the bottom level
+        size_t length = skiplist.size();
+        Skiplist::Node *node = reverse ? skiplist.by_rank(length - start) : skiplist.by_rank(start + 1);
+        while (node && count--)
+        {
+            fn(node->member, node->score);
+            node = reverse ? node->backward : node->next();
+        }
+        return;
+    }
+
+    // Small sets: collect the entry offsets once so reverse walks are cheap too
+    std::vector<size_t> offsets;
+    offsets.reserve(listpack_entries);
+    size_t offset = 0;
+    while (offset < listpack.size())
+    {
+        offsets.push_back(offset);
+        size_t member_length;
+        offset = listpack_read_entry(listpack, offset, member_length) + member_length + sizeof(double);
+    }
+
+    for (size_t i = start; i <= stop && i < offsets.size(); i++)
+    {
+        size_t entry = reverse ? offsets[offsets.size() - 1 - i] : offsets[i];
+        size_t member_length;
+        size_t data = listpack_read_entry(listpack, entry, member_length);
+        fn(listpack_view(listpack, data, member_length), listpack_score_at(listpack, data + member_length));
+    }
+}
+
+void SortedSet::range_by_score(const ScoreRange &range, size_t offset, long long count, const Visitor &fn) const
+{
+    if (encoding == ZSetEncoding::SKIPLIST)
+    {
+        Skiplist::Node *node = skiplist.first_in_range(range);
+        while (node && offset > 0)
+        {
+            node = node->next();
+            offset--;
+        }
+        while (node && count != 0 && range.below_max(node->score))
+        {
+            fn(node->member, node->score);
+            node = node->next();
+            if (count > 0)
+                count--;
+        }
+        return;
+    }
+
+    size_t position = 0;
+    while (position < listpack.size() && count != 0)
+    {
+        size_t member_length;
+        size_t data = listpack_read_entry(listpack, position, member_length);
+        double score = listpack_score_at(listpack, data + member_length);
+        position = data + member_length + sizeof(double);
+
+        if (!range.above_min(score))
+            continue;
+        if (!range.below_max(score))
+            break;
+        if (offset > 0)
+        {
+            offset--;
+            continue;
+        }
+
+        fn(listpack_view(listpack, data, member_length), score);
+        if (count > 0)
+            count--;
+    }
+}
+
+size_t SortedSet::memory_usage(size_t samples) const
+{
+    size_t bytes = allocation_size(sizeof(SortedSet) + SHARED_CONTROL_BLOCK_SIZE);
+    // The skiplist header node exists in both encodings
+    bytes += allocation_size(sizeof(Skiplist::Node) + Skiplist::MAX_LEVEL * sizeof(Skiplist::Level));
+    if (encoding == ZSetEncoding::LISTPACK)
+        return bytes + allocation_size(listpack.capacity());
+
+    // The member -> node index: buckets plus one node per member (next, pair, cached hash)
+    typedef std::pair<const std::string_view, Skiplist::Node *> Pair;
+    bytes += dict.bucket_count() * sizeof(void *);
+    bytes += dict.size() * allocation_size(sizeof(void *) + sizeof(Pair) + sizeof(size_t));
+
+    // Skiplist nodes vary with their height and member, so both are sampled
+    size_t sampled = 0, sampled_bytes = 0;
+    for (Skiplist::Node *node = skiplist.by_rank(1); node != nullptr && (samples == 0 || sampled < samples); node = node->next(), sampled++)
+    {
+        sampled_bytes += allocation_size(sizeof(Skiplist::Node) + node->height * sizeof(Skiplist::Level)) + string_heap_size(node->member);
+    }
+    return bytes + extrapolate(sampled_bytes, sampled, skiplist.size());
+}
+
+size_t SortedSet::listpack_find(const std::string &member, double *score_out) const
+{
+    size_t offset = 0;
+    while (offset < listpack.size())
+    {
+        size_t member_length;
+        size_t data = listpack_read_entry(listpack, offset, member_length);
+        if (listpack_view(listpack, data, member_length) == member)
+        {
+            if (score_out)
+                *score_out = listpack_score_at(listpack, data + member_length);
+            return offset;
+        }
+        offset = data + member_length + sizeof(double);
+    }
+    return npos;
+}
+
+void SortedSet::listpack_insert(const std::string &member, double score)
+{
+    // Find the first entry that sorts after (score, member)
+    size_t offset = 0;
+    while (offset < listpack.size())
+    {
+        size_t member_length;
+        size_t data = listpack_read_entry(listpack, offset, member_length);
+        double entry_score = listpack_score_at(listpack, data + member_length);
+        if (entry_score > score || (entry_score == score && listpack_view(listpack, data, member_length) > member))
+            break;
+        offset = data + member_length + sizeof(double);
+    }
+
+    std::vector<unsigned char> encoded;
+    listpack_write_entry(encoded, member);
+    const unsigned char *score_bytes = reinterpret_cast<const unsigned char *>(&score);
+    encoded.insert(encoded.end(), score_bytes, score_bytes + sizeof(score));
+
+    listpack.insert(listpack.begin() + offset, encoded.begin(), encoded.end());
+    listpack_entries++;
+}
+
+void SortedSet::listpack_remove_at(size_t offset)
+{
+    size_t member_length;
+    size_t end = listpack_read_entry(listpack, offset, member_length) + member_length + sizeof(double);
+    listpack.erase(listpack.begin() + offset, listpack.begin() + end);
+    listpack_entries--;
+}
+
+void SortedSet::convert_to_skiplist()
+{
+    dict.reserve(listpack_entries * 2);
+
+    size_t offset = 0;
+    while (offset < listpack.size())
+    {
+        size_t member_length;
+        size_t data = listpack_read_entry(listpack, offset, member_length);
+        std::string member(listpack_view(listpack, data, member_length));
+        double score = listpack_score_at(listpack, data + member_length);
+
+        Skiplist::Node *node = skiplist.insert(score, member);
+        dict.emplace(node->member, node);
+        offset = data + member_length + sizeof(double);
+    }
+
+    listpack.clear();
+    listpack.shrink_to_fit();
+    listpack_entries = 0;
+    encoding = ZSetEncoding::SKIPLIST;
+}
@@ -0,0 +1,142 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <optional>
+#include <functional>
+#include <unordered_map>
+#include "RedisObject.hpp"
+
+//======================  ZSET ENCODING LIMITS START  ======================
+
+// A sorted set stays in the compact LISTPACK encoding while it has at most this many members...
+const size_t ZSET_MAX_LISTPACK_ENTRIES = 128;
+
+// ...and every member is at most this many bytes long.
+const size_t ZSET_MAX_LISTPACK_VALUE = 64;
+
+//======================   ZSET ENCODING LIMITS END   ======================
+
+// Inclusive/exclusive score interval, as used by ZRANGEBYSCORE ("(1.5" means exclusive)
+struct ScoreRange
+{
+    double min;
+    double max;
+    bool min_exclusive = false;
+    bool max_exclusive = false;
+
+    bool above_min(double score) const { return min_exclusive ? score > min : score >= min; }
+    bool below_max(double score) const { return max_exclusive ? score < max : score <= max; }
+};
+
+// Skiplist ordered by (score, member). Every level link also stores its span, the number
+// of bottom level nodes it jumps over, so the rank of a node falls out of the search path.
+class Skiplist
+{
+public:
+    static const int MAX_LEVEL = 32;
+
+    struct Node;
+    struct Level
+    {
+        Node *forward;
+        size_t span;
+    };
+
+    struct Node
+    {
+        std::string member;
+        double score;
+        Node *backward;
+        int height;
+
+        // The level array is allocated inline right after the node
+        Level *levels() { return reinterpret_cast<Level *>(this + 1); }
+        Node *next() { return levels()[0].forward; }
+    };
+
+    Skiplist();
+    ~Skiplist();
+    Skiplist(const Skiplist &) = delete;
+    Skiplist &operator=(const Skiplist &) = delete;
+
+    Node *insert(double score, const std::string &member);
+    bool remove(double score, const std::string &member);
+
+    // Moves an existing element to a new score. Returns the (possibly reallocated) node.
+    Node *update_score(double current_score, const std::string &member, double new_score);
+
+    // 1-based rank of the element, 0 if it is not in the list
+    size_t rank(double score, const std::string &member) const;
+
+    // Node at the 1-based rank, or nullptr
+    Node *by_rank(size_t rank) const;
+
+    Node *first_in_range(const ScoreRange &range) const;
+    Node *last() const { return tail; }
+    size_t size() const { return length; }
+
+private:
+    Node *header;
+    Node *tail = nullptr;
+    size_t length = 0;
+    int level = 1;
+
+    static Node *create_node(int height, double score, const std::string &member);
+    static void free_node(Node *node);
+    static int random_level();
+    void delete_node(Node *node, Node **update);
+};
+
+enum class ZSetEncoding
+{
+    LISTPACK, // Sorted [member entry][8 byte score] pairs in one byte array
+    SKIPLIST, // Skiplist for ordering plus a member -> node index
+};
+
+class SortedSet : public RedisObject
+{
+public:
+    typedef std::function<void(std::string_view member, double score)> Visitor;
+
+    ZSetEncoding encoding = ZSetEncoding::LISTPACK;
+
+    SortedSet() = default;
+    SortedSet(const SortedSet &) = delete;
+    SortedSet &operator=(const SortedSet &) = delete;
+
+    std::optional<double> score(const std::string &member) const;
+
+    // Adds member or moves it to a new score. Returns true if the member is new.
+    bool insert(const std::string &member, double score);
+
+    // Returns true if the member existed and was removed
+    bool remove(const std::string &member);
+
+    // 0-based rank of member counted from the lowest score (or the highest if reverse)
+    std::optional<size_t> rank(const std::string &member, bool reverse) const;
+
+    size_t size() const;
+
+    // Visits members with 0-based ranks start..stop (both inclusive and already clamped)
+    void range_by_rank(size_t start, size_t stop, bool reverse, const Visitor &fn) const;
+
+    // Visits members whose score lies in range, skipping 'offset' of them and stopping after
+    // 'count' (a negative count means no limit)
+    void range_by_score(const ScoreRange &range, size_t offset, long long count, const Visitor &fn) const;
+
+    size_t memory_usage(size_t samples) const override;
+
+private:
+    std::vector<unsigned char> listpack;
+    size_t listpack_entries = 0;
+
+    Skiplist skiplist;
+    std::unordered_map<std::string_view, Skiplist::Node *> dict;
+
+    // Returns the offset of member's entry in the listpack, or npos
+    size_t listpack_find(const std::string &member, double *score_out) const;
+    void listpack_insert(const std::string &member, double score);
+    void listpack_remove_at(size_t offset);
+    void convert_to_skiplist();
+};
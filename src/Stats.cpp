@@ -0,0 +1,182 @@
+#include "Stats.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+//======================  LATENCY HISTOGRAM  ======================
+
+int LatencyHistogram::bucket_index(uint64_t value)
+{
+    if (value < (uint64_t)SUB_BUCKETS)
+        return (int)value;
+    value = std::min<uint64_t>(value, (1ULL << MAX_VALUE_BITS) - 1);
+
+    // The top SUB_BUCKET_BITS + 1 bits of the value pick the bucket, the rest is the
+    // precision given up in that range
+    int magnitude = 63 - __builtin_clzll(value);
+    int shift = magnitude - SUB_BUCKET_BITS;
+    return (shift + 1) * SUB_BUCKETS + (int)((value >> shift) - SUB_BUCKETS);
+}
+
+uint64_t LatencyHistogram::bucket_highest_value(int index)
+{
+    if (index < SUB_BUCKETS)
+        return index;
+    int shift = index / SUB_BUCKETS - 1;
+    uint64_t sub_bucket = index % SUB_BUCKETS;
+    return ((SUB_BUCKETS + sub_bucket + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t nanoseconds)
+{
+    if (buckets.empty())
+        buckets.assign(BUCKETS, 0);
+    buckets[bucket_index(nanoseconds)]++;
+    total++;
+}
+
+uint64_t LatencyHistogram::percentile(double p) const
+{
+    if (total == 0)
+        return 0;
+    uint64_t wanted = std::max<uint64_t>(1, (uint64_t)std::ceil(p / 100.0 * total));
+    uint64_t seen = 0;
+    for (int i = 0; i < BUCKETS; i++)
+    {
+        seen += buckets[i];
+        if (seen >= wanted)
+            return bucket_highest_value(i);
+    }
+    return bucket_highest_value(BUCKETS - 1);
+}
+
+uint64_t LatencyHistogram::count_at_most(uint64_t nanoseconds) const
+{
+    uint64_t count = 0;
+    for (int i = 0; i < (int)buckets.size() && bucket_highest_value(i) <= nanoseconds; i++)
+        count += buckets[i];
+    return count;
+}
+
+//======================  SERVER STATS  ======================
+
+void Stats::record_command(const std::string &name, uint64_t nanoseconds, Outcome outcome, std::chrono::steady_clock::time_point now)
+{
+    commands_total++;
+    roll_windows(std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() / OPS_WINDOW_MS);
+    ops_windows[current_window % OPS_WINDOWS]++;
+
+    if (outcome != Outcome::OK)
+        errors_total++;
+    // Unknown names are not kept: a client could otherwise grow the table at will, or
+    // put CR/LF in a name and forge INFO fields. The rest are all known command names.
+    if (outcome == Outcome::UNKNOWN)
+        return;
+    CommandStat &stat = commands[name];
+    if (outcome == Outcome::REJECTED)
+    {
+        stat.rejected_calls++;
+        return;
+    }
+    stat.calls++;
+    stat.nanoseconds += nanoseconds;
+    stat.latency.record(nanoseconds);
+    if (outcome == Outcome::FAILED)
+        stat.failed_calls++;
+}
+
+void Stats::roll_windows(long long window)
+{
+    if (window == current_window)
+        return;
+    // Windows nobody recorded into in between are cleared on the way
+    for (long long w = std::max(current_window + 1, window - OPS_WINDOWS + 1); w <= window; w++)
+        ops_windows[w % OPS_WINDOWS] = 0;
+    current_window = window;
+}
+
+void Stats::reset()
+{
+    commands.clear();
+    commands_total = 0;
+    errors_total = 0;
+    connections_received = 0;
+    rejected_connections = 0;
+    net_input_bytes = 0;
+    net_output_bytes = 0;
+    std::fill(std::begin(ops_windows), std::end(ops_windows), 0);
+}
+
+std::vector<std::string> Stats::sorted_names() const
+{
+    std::vector<std::string> names;
+    names.reserve(commands.size());
+    for (const auto &[name, stat] : commands)
+        names.push_back(name);
+    std::sort(names.begin(), names.end());
+    return names;
+}
+
+static std::string lowercase(std::string text)
+{
+    std::transform(text.begin(), text.end(), text.begin(), ::tolower);
+    return text;
+}
+
+uint64_t Stats::ops_per_sec() const
+{
+    // Average over the complete windows of the last 1.6s (the current one is still filling)
+    long long now_window = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count() / OPS_WINDOW_MS;
+    uint64_t recent = 0;
+    for (long long w = std::max(now_window - OPS_WINDOWS, current_window - OPS_WINDOWS + 1); w <= std::min(current_window, now_window - 1); w++)
+        recent += ops_windows[w % OPS_WINDOWS];
+    return recent * 1000 / (OPS_WINDOWS * OPS_WINDOW_MS);
+}
+
+std::string Stats::info_stats(uint64_t expired_keys) const
+{
+    std::string text = "# Stats\r\n";
+    text += "total_connections_received:" + std::to_string(connections_received) + "\r\n";
+    text += "total_commands_processed:" + std::to_string(commands_total) + "\r\n";
+    text += "instantaneous_ops_per_sec:" + std::to_string(ops_per_sec()) + "\r\n";
+    text += "total_net_input_bytes:" + std::to_string(net_input_bytes) + "\r\n";
+    text += "total_net_output_bytes:" + std::to_string(net_output_bytes) + "\r\n";
+    text += "rejected_connections:" + std::to_string(rejected_connections) + "\r\n";
+    text += "total_error_replies:" + std::to_string(errors_total) + "\r\n";
+    text += "expired_keys:" + std::to_string(expired_keys) + "\r\n";
+    text += "evicted_keys:0\r\n";
+    return text;
+}
+
+std::string Stats::info_commandstats() const
+{
+    std::string text = "# Commandstats\r\n";
+    char line[256];
+    for (const std::string &name : sorted_names())
+    {
+        const CommandStat &stat = commands.at(name);
+        uint64_t usec = stat.nanoseconds / 1000;
+        double usec_per_call = stat.calls > 0 ? stat.nanoseconds / 1000.0 / stat.calls : 0;
+        snprintf(line, sizeof(line), ":calls=%llu,usec=%llu,usec_per_call=%.2f,rejected_calls=%llu,failed_calls=%llu\r\n",
+                 (unsigned long long)stat.calls, (unsigned long long)usec, usec_per_call,
+                 (unsigned long long)stat.rejected_calls, (unsigned long long)stat.failed_calls);
+        text += "cmdstat_" + lowercase(name) + line;
+    }
+    return text;
+}
+
+std::string Stats::info_latencystats() const
+{
+    std::string text = "# Latencystats\r\n";
+    char line[256];
+    for (const std::string &name : sorted_names())
+    {
+        const LatencyHistogram &latency = commands.at(name).latency;
+        if (latency.count() == 0)
+            continue;
+        snprintf(line, sizeof(line), ":p50=%.3f,p99=%.3f,p99.9=%.3f\r\n",
+                 latency.percentile(50) / 1000.0, latency.percentile(99) / 1000.0, latency.percentile(99.9) / 1000.0);
+        text += "latency_percentiles_usec_" + lowercase(name) + line;
+    }
+    return text;
+}
@@ -0,0 +1,104 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <chrono>
+#include <cstdint>
+
+// Latency histogram with log-linear buckets, the HdrHistogram layout: every power of two
+// range is split into 32 equal sub-buckets, so any recorded value is known to within ~3%
+// whatever its magnitude, with a fixed 1024 counters covering 1ns up to ~68s.
+class LatencyHistogram
+{
+public:
+    void record(uint64_t nanoseconds);
+
+    uint64_t count() const { return total; }
+
+    // Highest value of the bucket holding the p-th percentile (0 < p <= 100), in ns
+    uint64_t percentile(double p) const;
+
+    // Number of values recorded in buckets that lie entirely at or below 'nanoseconds'
+    uint64_t count_at_most(uint64_t nanoseconds) const;
+
+private:
+    static const int SUB_BUCKET_BITS = 5;
+    static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+    static const int MAX_VALUE_BITS = 36;
+    static const int BUCKETS = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+    static int bucket_index(uint64_t value);
+    static uint64_t bucket_highest_value(int index);
+
+    std::vector<uint64_t> buckets; // Allocated on the first record
+    uint64_t total = 0;
+};
+
+// Counters of one command, reported by INFO commandstats / latencystats
+struct CommandStat
+{
+    uint64_t calls = 0;
+    uint64_t nanoseconds = 0;
+    uint64_t rejected_calls = 0; // Refused before running: READONLY, MOVED, ...
+    uint64_t failed_calls = 0;   // Ran and replied with an error
+    LatencyHistogram latency;
+};
+
+// Server wide statistics.
+//
+// All of it is updated from the event loop thread only, so the counters are plain
+// integers: recording a command is a hash lookup and a few increments.
+class Stats
+{
+public:
+    enum class Outcome
+    {
+        OK,
+        FAILED,
+        REJECTED,
+        UNKNOWN, // Not a command we know (CommandDispatcher::is_known_command): only counted as an error reply
+    };
+
+    // Records a command that took 'nanoseconds' and finished at 'now'
+    void record_command(const std::string &name, uint64_t nanoseconds, Outcome outcome, std::chrono::steady_clock::time_point now);
+
+    uint64_t connections_received = 0;
+    uint64_t rejected_connections = 0; // Refused because of maxclients
+    uint64_t net_input_bytes = 0;
+    uint64_t net_output_bytes = 0;
+
+    // CONFIG RESETSTAT
+    void reset();
+
+    uint64_t commands_processed() const { return commands_total; }
+    uint64_t error_replies() const { return errors_total; }
+    uint64_t ops_per_sec() const;
+
+    // Visits the commands in name order
+    template <typename Fn>
+    void for_each_command(Fn fn) const
+    {
+        for (const std::string &name : sorted_names())
+            fn(name, commands.at(name));
+    }
+
+    // INFO sections
+    std::string info_stats(uint64_t expired_keys) const;
+    std::string info_commandstats() const;
+    std::string info_latencystats() const;
+
+private:
+    std::unordered_map<std::string, CommandStat> commands;
+    uint64_t commands_total = 0;
+    uint64_t errors_total = 0;
+
+    // Commands per 100ms window over the last 1.6s, for instantaneous_ops_per_sec. The
+    // windows roll over as commands come in, so an idle server needs no timer for it.
+    static const int OPS_WINDOWS = 16;
+    static const int OPS_WINDOW_MS = 100;
+    uint64_t ops_windows[OPS_WINDOWS] = {};
+    long long current_window = 0;
+
+    void roll_windows(long long window);
+    std::vector<std::string> sorted_names() const;
+};
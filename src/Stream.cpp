@@ -0,0 +1,249 @@
+#include "Stream.hpp"
+#include "Listpack.hpp"
+#include "Memory.hpp"
+
+std::string StreamID::key() const
+{
+    std::string bytes(16, '\0');
+    for (int i = 0; i < 8; i++)
+    {
+        bytes[i] = (char)(ms >> (56 - 8 * i));
+        bytes[8 + i] = (char)(seq >> (56 - 8 * i));
+    }
+    return bytes;
+}
+
+// Entry layout: [ms delta][seq][field count][field entry][value entry]...
+// The seq is stored as a delta too when the entry shares the master entry's millisecond.
+void Stream::encode_entry(StreamBlock &block, const StreamID &id, const std::vector<std::string_view> &fields)
+{
+    uint64_t ms_delta = id.ms - block.master_id.ms;
+    listpack_write_varint(block.data, ms_delta);
+    listpack_write_varint(block.data, ms_delta == 0 ? id.seq - block.master_id.seq : id.seq);
+    listpack_write_varint(block.data, fields.size());
+    for (std::string_view field : fields)
+    {
+        listpack_write_entry(block.data, field);
+    }
+}
+
+size_t Stream::decode_entry(const StreamBlock &block, size_t offset, StreamID &id, std::vector<std::string_view> &fields)
+{
+    unsigned long long ms_delta, seq, field_count;
+    offset = listpack_read_varint(block.data, offset, ms_delta);
+    offset = listpack_read_varint(block.data, offset, seq);
+    offset = listpack_read_varint(block.data, offset, field_count);
+
+    id.ms = block.master_id.ms + ms_delta;
+    id.seq = ms_delta == 0 ? block.master_id.seq + seq : seq;
+
+    fields.clear();
+    for (unsigned long long i = 0; i < field_count; i++)
+    {
+        size_t length;
+        size_t data = listpack_read_entry(block.data, offset, length);
+        fields.push_back(listpack_view(block.data, data, length));
+        offset = data + length;
+    }
+    return offset;
+}
+
+void Stream::append(const StreamID &id, std::span<const std::string> fields_and_values)
+{
+    std::vector<std::string_view> fields(fields_and_values.begin(), fields_and_values.end());
+
+    auto tail = blocks.last();
+    StreamBlock *block = tail ? tail->value->get() : nullptr;
+    if (block == nullptr || block->entries >= STREAM_BLOCK_MAX_ENTRIES || block->data.size() >= STREAM_BLOCK_MAX_BYTES)
+    {
+        auto fresh = std::make_unique<StreamBlock>();
+        fresh->master_id = id;
+        block = fresh.get();
+        blocks.insert(id.key(), std::move(fresh));
+    }
+
+    encode_entry(*block, id, fields);
+    block->entries++;
+    block->last_id = id;
+    length++;
+    last_id = id;
+}
+
+void Stream::range(const StreamID &start, const StreamID &end, long long count, bool reverse, const Visitor &fn)
+{
+    StreamID id;
+    std::vector<std::string_view> fields;
+
+    if (!reverse)
+    {
+        // Start at the block that could contain 'start' and scan blocks in order
+        auto match = blocks.floor(start.key());
+        if (!match)
+            match = blocks.first();
+
+        while (match && count != 0)
+        {
+            const StreamBlock &block = **match->value;
+            if (block.master_id > end)
+                return;
+
+            if (block.last_id >= start)
+            {
+                size_t offset = 0;
+                for (size_t i = 0; i < block.entries && count != 0; i++)
+                {
+                    offset = decode_entry(block, offset, id, fields);
+                    if (id < start)
+                        continue;
+                    if (id > end)
+                        return;
+                    fn(id, fields);
+                    if (count > 0)
+                        count--;
+                }
+            }
+            match = blocks.ceiling(match->key, true);
+        }
+        return;
+    }
+
+    auto match = blocks.floor(end.key());
+    std::vector<size_t> offsets;
+    while (match && count != 0)
+    {
+        const StreamBlock &block = **match->value;
+        if (block.last_id < start)
+            return;
+
+        // Entries only decode forwards, so note where each one starts
+        offsets.clear();
+        size_t offset = 0;
+        for (size_t i = 0; i < block.entries; i++)
+        {
+            offsets.push_back(offset);
+            offset = decode_entry(block, offset, id, fields);
+        }
+
+        for (auto it = offsets.rbegin(); it != offsets.rend() && count != 0; ++it)
+        {
+            decode_entry(block, *it, id, fields);
+            if (id > end)
+                continue;
+            if (id < start)
+                return;
+            fn(id, fields);
+            if (count > 0)
+                count--;
+        }
+        match = blocks.floor(match->key, true);
+    }
+}
+
+size_t Stream::trim_by_length(size_t max_length, bool approximate)
+{
+    size_t removed = 0;
+    while (length > max_length)
+    {
+        auto head = blocks.first();
+        StreamBlock &block = **head->value;
+
+        // Whole blocks go first: this is the cheap path, no re-encoding needed
+        if (length - block.entries >= max_length)
+        {
+            length -= block.entries;
+            removed += block.entries;
+            blocks.erase(head->key);
+            continue;
+        }
+        if (approximate)
+            break;
+
+        size_t drop = length - max_length;
+        trim_head_block(block, drop);
+        length -= drop;
+        removed += drop;
+    }
+    return removed;
+}
+
+size_t Stream::trim_by_min_id(const StreamID &min_id, bool approximate)
+{
+    size_t removed = 0;
+    while (length > 0)
+    {
+        auto head = blocks.first();
+        StreamBlock &block = **head->value;
+
+        if (block.last_id < min_id)
+        {
+            length -= block.entries;
+            removed += block.entries;
+            blocks.erase(head->key);
+            continue;
+        }
+        if (approximate || block.master_id >= min_id)
+            break;
+
+        // Count the entries of the head block that fall below min_id
+        StreamID id;
+        std::vector<std::string_view> fields;
+        size_t drop = 0;
+        size_t offset = 0;
+        while (drop < block.entries)
+        {
+            offset = decode_entry(block, offset, id, fields);
+            if (id >= min_id)
+                break;
+            drop++;
+        }
+
+        trim_head_block(block, drop);
+        length -= drop;
+        removed += drop;
+        break;
+    }
+    return removed;
+}
+
+size_t Stream::memory_usage(size_t samples) const
+{
+    // Blocks are sampled from the oldest one; each one is a radix tree node, the block and
+    // its packed data. Inner nodes of the tree are few next to the blocks and not counted.
+    size_t bytes = allocation_size(sizeof(Stream) + SHARED_CONTROL_BLOCK_SIZE) + allocation_size(blocks.node_size());
+    size_t sampled = 0, sampled_bytes = 0;
+    for (auto match = blocks.first(); match && (samples == 0 || sampled < samples); match = blocks.ceiling(match->key, true), sampled++)
+    {
+        const StreamBlock &block = **match->value;
+        sampled_bytes += allocation_size(blocks.node_size()) + allocation_size(sizeof(StreamBlock)) + allocation_size(block.data.capacity());
+    }
+    return bytes + extrapolate(sampled_bytes, sampled, blocks.size());
+}
+
+void Stream::trim_head_block(StreamBlock &block, size_t drop)
+{
+    StreamID id;
+    std::vector<std::string_view> fields;
+    std::string old_key = block.master_id.key();
+
+    // Re-encode the surviving entries against the new first ID
+    auto fresh = std::make_unique<StreamBlock>();
+    size_t offset = 0;
+    for (size_t i = 0; i < block.entries; i++)
+    {
+        offset = decode_entry(block, offset, id, fields);
+        if (i < drop)
+            continue;
+        if (fresh->entries == 0)
+            fresh->master_id = id;
+        encode_entry(*fresh, id, fields);
+        fresh->entries++;
+        fresh->last_id = id;
+    }
+
+    blocks.erase(old_key);
+    if (fresh->entries > 0)
+    {
+        std::string new_key = fresh->master_id.key();
+        blocks.insert(new_key, std::move(fresh));
+    }
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <span>
+#include <memory>
+#include <functional>
+#include <compare>
+#include <cstdint>
+#include "RedisObject.hpp"
+#include "RadixTree.hpp"
+
+//======================  STREAM BLOCK LIMITS START  ======================
+
+// A block is closed and a new one started once it holds this many entries...
+const size_t STREAM_BLOCK_MAX_ENTRIES = 100;
+
+// ...or its packed data reaches this many bytes.
+const size_t STREAM_BLOCK_MAX_BYTES = 4096;
+
+//======================   STREAM BLOCK LIMITS END   ======================
+
+struct StreamID
+{
+    uint64_t ms = 0;
+    uint64_t seq = 0;
+
+    auto operator<=>(const StreamID &) const = default;
+
+    std::string to_string() const { return std::to_string(ms) + "-" + std::to_string(seq); }
+
+    // 16 big-endian bytes, so byte order in the radix tree matches ID order
+    std::string key() const;
+};
+
+// A run of consecutive entries packed into one byte array. IDs are stored as deltas
+// against the block's first ID, which is also the block's key in the radix tree.
+struct StreamBlock
+{
+    StreamID master_id;
+    StreamID last_id;
+    size_t entries = 0;
+    std::vector<unsigned char> data;
+};
+
+class Stream : public RedisObject
+{
+public:
+    typedef std::function<void(const StreamID &id, const std::vector<std::string_view> &fields)> Visitor;
+
+    // ID of the newest entry ever added. Trimming does not move it back.
+    StreamID last_id;
+
+    size_t size() const { return length; }
+
+    // Appends an entry. The caller guarantees id > last_id.
+    void append(const StreamID &id, std::span<const std::string> fields_and_values);
+
+    // Visits entries with start <= id <= end, oldest first (newest first if reverse),
+    // stopping after 'count' entries (a negative count means no limit)
+    void range(const StreamID &start, const StreamID &end, long long count, bool reverse, const Visitor &fn);
+
+    // Evicts the oldest entries. In approximate mode only whole blocks are freed, so
+    // slightly more than the threshold may be kept. Both return the number of entries removed.
+    size_t trim_by_length(size_t max_length, bool approximate);
+    size_t trim_by_min_id(const StreamID &min_id, bool approximate);
+
+    size_t memory_usage(size_t samples) const override;
+
+private:
+    RadixTree<std::unique_ptr<StreamBlock>> blocks;
+    size_t length = 0;
+
+    static size_t decode_entry(const StreamBlock &block, size_t offset, StreamID &id, std::vector<std::string_view> &fields);
+    static void encode_entry(StreamBlock &block, const StreamID &id, const std::vector<std::string_view> &fields);
+
+    // Drops the first 'drop' entries of the oldest block, re-keying it on its new first ID
+    void trim_head_block(StreamBlock &block, size_t drop);
+};
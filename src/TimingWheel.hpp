@@ -0,0 +1,116 @@
+#pragma once
+#include <vector>
+#include <chrono>
+#include <optional>
+#include <cstdint>
+#include <algorithm>
+
+// Hierarchical timing wheel: O(1) scheduling of a large number of timers that mostly
+// never fire on time, like idle timeouts that get pushed back by activity.
+//
+// Time is cut into ticks. Level 0 has one slot per tick for the next 64 ticks, level 1
+// one slot per 64 ticks for the next 64 * 64, and so on. A timer goes into the coarsest
+// level that can hold it and moves down a level each time the finer wheel below
+// completes a turn (cascading), so every timer is touched a handful of times at most
+// however far away its deadline is. Deadlines further than the last level reaches are
+// clamped to it.
+//
+// There is no cancel: owners check when a timer fires whether it still applies, which
+// keeps the items plain values.
+template <typename T>
+class TimingWheel
+{
+public:
+    typedef std::chrono::steady_clock Clock;
+
+    explicit TimingWheel(Clock::duration tick) : tick(tick), origin(Clock::now())
+    {
+        for (auto &level : levels)
+            level.resize(SLOTS);
+    }
+
+    size_t size() const { return count; }
+
+    void schedule(Clock::time_point deadline, T item)
+    {
+        // Rounded up: a timer never fires early
+        uint64_t at = deadline <= origin ? 0 : (uint64_t)((deadline - origin + tick - Clock::duration(1)) / tick);
+        at = std::clamp<uint64_t>(at, current + 1, current + MAX_TICKS - 1);
+        insert({at, std::move(item)});
+        count++;
+    }
+
+    // Moves the wheel up to now, calling fn(item) for every timer that expired
+    template <typename F>
+    void advance(Clock::time_point now, F &&fn)
+    {
+        uint64_t target = now <= origin ? 0 : (uint64_t)((now - origin) / tick);
+        while (current < target)
+        {
+            // Nothing left to fire or cascade: jump straight to now
+            if (count == 0)
+            {
+                current = target;
+                break;
+            }
+            current++;
+            // Each time a level finishes a turn the next slot of the level above moves down
+            for (int level = 1; level < LEVELS && (current & ((1ULL << (SLOT_BITS * level)) - 1)) == 0; level++)
+            {
+                std::vector<Entry> moving;
+                moving.swap(levels[level][(current >> (SLOT_BITS * level)) & (SLOTS - 1)]);
+                for (Entry &entry : moving)
+                    insert(std::move(entry));
+            }
+
+            std::vector<Entry> expired;
+            expired.swap(levels[0][current & (SLOTS - 1)]);
+            count -= expired.size();
+            for (Entry &entry : expired)
+                fn(entry.item);
+        }
+    }
+
+    // When advance() next has something to do: the next occupied slot of level 0, or the
+    // next cascade when level 0 is empty. nullopt without timers.
+    std::optional<Clock::time_point> next_deadline() const
+    {
+        if (count == 0)
+            return std::nullopt;
+        for (uint64_t at = current + 1; at <= current + SLOTS; at++)
+        {
+            if (!levels[0][at & (SLOTS - 1)].empty())
+                return origin + tick * at;
+            if ((at & (SLOTS - 1)) == 0)
+                return origin + tick * at;
+        }
+        return origin + tick * (current + SLOTS);
+    }
+
+private:
+    static constexpr int SLOT_BITS = 6;
+    static constexpr uint64_t SLOTS = 1 << SLOT_BITS;
+    static constexpr int LEVELS = 4;
+    static constexpr uint64_t MAX_TICKS = 1ULL << (SLOT_BITS * LEVELS);
+
+    struct Entry
+    {
+        uint64_t at; // Tick the timer expires on
+        T item;
+    };
+
+    Clock::duration tick;
+    Clock::time_point origin;
+    uint64_t current = 0; // Last tick processed
+    size_t count = 0;
+    std::vector<std::vector<Entry>> levels[LEVELS];
+
+    void insert(Entry entry)
+    {
+        uint64_t delta = entry.at > current ? entry.at - current : 0;
+        int level = 0;
+        while (level < LEVELS - 1 && delta >= (1ULL << (SLOT_BITS * (level + 1))))
+            level++;
+        levels[level][(entry.at >> (SLOT_BITS * level)) & (SLOTS - 1)].push_back(std::move(entry));
+    }
+};
@@ -1,6 +1,15 @@
 #pragma once
 #include <fcntl.h>
 #include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <charconv>
+#include <cmath>
+#include <string_view>
+#include <algorithm>
+#include <random>
 
 // Sets a file descriptor to non-blocking mode
 inline int set_fd_nonblocking(int fd) {
@@ -10,6 +19,18 @@ inline int set_fd_nonblocking(int fd) {
     return fcntl(fd, F_SETFL, flags);
 }
 
+// Turns on TCP keepalive: probes after 'seconds' of silence, then every third of that,
+// and the connection is reset after three unanswered ones
+inline int set_tcp_keepalive(int fd, int seconds) {
+    int yes = 1;
+    int interval = std::max(seconds / 3, 1);
+    int probes = 3;
+    if (setsockopt(fd, SOL_SOCKET, SO_KEEPALIVE, &yes, sizeof(yes)) != 0) return -1;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_KEEPIDLE, &seconds, sizeof(seconds)) != 0) return -1;
+    if (setsockopt(fd, IPPROTO_TCP, TCP_KEEPINTVL, &interval, sizeof(interval)) != 0) return -1;
+    return setsockopt(fd, IPPROTO_TCP, TCP_KEEPCNT, &probes, sizeof(probes));
+}
+
 // Universal parser for numeric headers
 template <typename T>
 inline long long parse_header_value(T start, T end)
@@ -39,4 +60,136 @@ inline long long parse_header_value(T start, T end)
     }
 
     return (is_negative) ? -value : value;
-}
\ No newline at end of file
+}
+
+// Strict signed integer parser for command arguments.
+// Unlike parse_header_value it reports failure separately from negative values.
+inline bool parse_integer(const std::string &s, long long &out)
+{
+    if (s.empty())
+        return false;
+    auto [ptr, ec] = std::from_chars(s.data(), s.data() + s.size(), out);
+    return ec == std::errc() && ptr == s.data() + s.size();
+}
+
+// Parses a floating point argument. Accepts "inf", "+inf" and "-inf", rejects NaN.
+inline bool parse_double(const std::string &s, double &out)
+{
+    if (s.empty())
+        return false;
+    const char *begin = s.data();
+    if (*begin == '+')
+        begin++;
+    auto [ptr, ec] = std::from_chars(begin, s.data() + s.size(), out);
+    return ec == std::errc() && ptr == s.data() + s.size() && !std::isnan(out);
+}
+
+// Formats a double the way replies expect it: shortest round-trip form, "inf"/"-inf" for infinities.
+inline std::string format_double(double value)
+{
+    char buffer[32];
+    auto [ptr, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    return std::string(buffer, ptr);
+}
+
+// Glob-style matcher used by PSUBSCRIBE and KEYS/SCAN MATCH. Supports *, ?, [abc], [^abc],
+// [a-z] and backslash escapes. A '*' only ever backtracks to its latest position, so the
+// match runs in O(pattern * text) in the worst case instead of exploding on "a*a*a*...".
+inline bool glob_match(std::string_view pattern, std::string_view text)
+{
+    size_t p = 0, t = 0;
+    size_t star_p = std::string_view::npos, star_t = 0;
+
+    while (t < text.size())
+    {
+        bool matched = false;
+        size_t next_p = p;
+
+        if (p < pattern.size())
+        {
+            char c = pattern[p];
+            if (c == '*')
+            {
+                // Remember where to resume if what follows fails to match
+                star_p = p++;
+                star_t = t;
+                continue;
+            }
+            else if (c == '?')
+            {
+                matched = true;
+                next_p = p + 1;
+            }
+            else if (c == '[')
+            {
+                size_t i = p + 1;
+                bool negate = i < pattern.size() && pattern[i] == '^';
+                if (negate)
+                    i++;
+                bool in_class = false;
+                while (i < pattern.size() && pattern[i] != ']')
+                {
+                    if (pattern[i] == '\\' && i + 1 < pattern.size())
+                    {
+                        i++;
+                        in_class |= pattern[i] == text[t];
+                    }
+                    else if (i + 2 < pattern.size() && pattern[i + 1] == '-' && pattern[i + 2] != ']')
+                    {
+                        char low = std::min(pattern[i], pattern[i + 2]);
+                        char high = std::max(pattern[i], pattern[i + 2]);
+                        in_class |= text[t] >= low && text[t] <= high;
+                        i += 2;
+                    }
+                    else
+                    {
+                        in_class |= pattern[i] == text[t];
+                    }
+                    i++;
+                }
+                matched = in_class != negate;
+                next_p = (i < pattern.size()) ? i + 1 : i;
+            }
+            else
+            {
+                if (c == '\\' && p + 1 < pattern.size())
+                    c = pattern[++p];
+                matched = c == text[t];
+                next_p = p + 1;
+            }
+        }
+
+        if (matched)
+        {
+            p = next_p;
+            t++;
+        }
+        else if (star_p != std::string_view::npos)
+        {
+            // Let the last '*' swallow one more character and retry
+            p = star_p + 1;
+            t = ++star_t;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    // Only trailing stars may remain
+    while (p < pattern.size() && pattern[p] == '*')
+        p++;
+    return p == pattern.size();
+}
+
+// A random 40 character hex ID, the form of replication IDs and cluster node IDs
+inline std::string random_hex_id()
+{
+    static const char *HEX = "0123456789abcdef";
+    std::random_device seed;
+    std::mt19937_64 generator(((uint64_t)seed() << 32) ^ seed());
+    std::string id(40, '0');
+    for (char &c : id)
+        c = HEX[generator() & 15];
+    return id;
+}
@@ -1,12 +1,20 @@
 #include "Server.hpp"
-#include <iostream>
+#include "Log.hpp"
 
 int main(int argc, char **argv) {
-    std::cout << std::unitbuf;
-    std::cerr << std::unitbuf;
+    ServerConfig config;
+    std::string error;
+    if (!parse_config_arguments(argc, argv, config, error))
+    {
+        server_log(LogLevel::WARNING, error);
+        return 1;
+    }
 
-    Server server(6379);
+    // From here on log lines are queued and written by a background thread
+    start_logging();
+
+    Server server(config);
     server.run();
 
     return 0;
-}
\ No newline at end of file
+}
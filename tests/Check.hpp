@@ -0,0 +1,15 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+
+// Stops the test at the first condition that does not hold. Unlike assert() it stays on
+// in release builds.
+#define CHECK(condition)                                                                  \
+    do                                                                                    \
+    {                                                                                     \
+        if (!(condition))                                                                 \
+        {                                                                                 \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            exit(1);                                                                      \
+        }                                                                                 \
+    } while (0)
@@ -0,0 +1,140 @@
+#include "Cluster.hpp"
+#include "Rdb.hpp"
+#include "ListObject.hpp"
+#include "HashObject.hpp"
+#include "SortedSet.hpp"
+#include "Check.hpp"
+
+// The two checksums against the values Redis gets for them, and DUMP / RESTORE payloads
+// of every value type going through a round trip.
+
+static void test_crc16()
+{
+    // The CRC16/XMODEM check value, and slots real Redis Cluster assigns
+    CHECK(crc16("123456789", 9) == 0x31C3);
+    CHECK(crc16("", 0) == 0);
+    CHECK(key_hash_slot("foo") == 12182);
+    CHECK(key_hash_slot("bar") == 5061);
+    CHECK(key_hash_slot("hello") == 866);
+
+    // Only a non-empty {hash tag} is hashed
+    CHECK(key_hash_slot("{user1000}.following") == key_hash_slot("user1000"));
+    CHECK(key_hash_slot("{user1000}.followers") == key_hash_slot("{user1000}.following"));
+    CHECK(key_hash_slot("foo{}{bar}") == crc16("foo{}{bar}", 10) % CLUSTER_SLOTS);
+    CHECK(key_hash_slot("foo{{bar}}zap") == key_hash_slot("{bar"));
+}
+
+static void test_crc64()
+{
+    // The check value of CRC-64/Jones, the one Redis' own crc64 test uses
+    const unsigned char *check = (const unsigned char *)"123456789";
+    CHECK(crc64(0, check, 9) == 0xe9c6d914c4b8d9caULL);
+    CHECK(crc64(0, check, 0) == 0);
+    // Feeding the data in pieces gives the same result
+    CHECK(crc64(crc64(0, check, 4), check + 4, 5) == 0xe9c6d914c4b8d9caULL);
+}
+
+static KeyValueStore::ValueEntry round_trip(const KeyValueStore::ValueEntry &entry)
+{
+    std::string payload = rdb_dump_value(entry);
+    KeyValueStore::ValueEntry restored;
+    std::string error;
+    CHECK(rdb_restore_value(payload, restored, error));
+    CHECK(restored.type == entry.type);
+    return restored;
+}
+
+static void test_strings()
+{
+    for (const std::string &value : {std::string(""), std::string("bar"), std::string("12345"), std::string("-7"),
+                                     std::string(1000, 'a'), std::string("bin\0ary\r\n", 9)})
+    {
+        KeyValueStore::ValueEntry entry;
+        entry.value = value;
+        CHECK(round_trip(entry).value == value);
+    }
+}
+
+static void test_list()
+{
+    auto list = std::make_shared<ListObject>();
+    list->items = {"a", "", "42", std::string(300, 'x')};
+    KeyValueStore::ValueEntry entry;
+    entry.type = ValueType::LIST;
+    entry.object = list;
+
+    KeyValueStore::ValueEntry restored = round_trip(entry);
+    CHECK(static_cast<ListObject *>(restored.object.get())->items == list->items);
+}
+
+static void test_hash()
+{
+    // Small enough for a listpack, then large enough for a hash table
+    for (size_t fields : {3, 500})
+    {
+        auto hash = std::make_shared<HashObject>();
+        for (size_t i = 0; i < fields; i++)
+            hash->set("field:" + std::to_string(i), "value:" + std::to_string(i * 7));
+        KeyValueStore::ValueEntry entry;
+        entry.type = ValueType::HASH;
+        entry.object = hash;
+
+        KeyValueStore::ValueEntry restored_entry = round_trip(entry);
+        HashObject *restored = static_cast<HashObject *>(restored_entry.object.get());
+        CHECK(restored->size() == fields);
+        hash->for_each([&](const std::string &field, const std::string &value)
+                       { CHECK(restored->get(field) == value); });
+    }
+}
+
+static void test_sorted_set()
+{
+    auto zset = std::make_shared<SortedSet>();
+    zset->insert("one", 1);
+    zset->insert("pi", 3.14159);
+    zset->insert("negative", -2.5);
+    zset->insert("big", 1e300);
+    KeyValueStore::ValueEntry entry;
+    entry.type = ValueType::ZSET;
+    entry.object = zset;
+
+    KeyValueStore::ValueEntry restored_entry = round_trip(entry);
+    SortedSet *restored = static_cast<SortedSet *>(restored_entry.object.get());
+    CHECK(restored->size() == 4);
+    CHECK(restored->score("one") == 1);
+    CHECK(restored->score("pi") == 3.14159);
+    CHECK(restored->score("negative") == -2.5);
+    CHECK(restored->score("big") == 1e300);
+}
+
+static void test_corrupt_payloads()
+{
+    KeyValueStore::ValueEntry entry;
+    entry.value = "some value";
+    std::string payload = rdb_dump_value(entry);
+    KeyValueStore::ValueEntry restored;
+    std::string error;
+
+    // Any flipped bit is caught by the checksum
+    for (size_t i = 0; i < payload.size(); i++)
+    {
+        std::string corrupt = payload;
+        corrupt[i] ^= 0x10;
+        CHECK(!rdb_restore_value(corrupt, restored, error));
+    }
+    CHECK(!rdb_restore_value(payload.substr(0, payload.size() - 1), restored, error));
+    CHECK(!rdb_restore_value("", restored, error));
+    CHECK(error == "DUMP payload version or checksum are wrong");
+}
+
+int main()
+{
+    test_crc16();
+    test_crc64();
+    test_strings();
+    test_list();
+    test_hash();
+    test_sorted_set();
+    test_corrupt_payloads();
+    return 0;
+}
@@ -0,0 +1,95 @@
+#include "RESPHandler.hpp"
+#include "Check.hpp"
+#include <cstring>
+
+// Pipelined requests are parsed in place: each one from where the previous one ended, in
+// the same buffer, without moving the bytes in front of it.
+
+static IOBuffer buffer_of(const std::string &text)
+{
+    return IOBuffer(text.begin(), text.end());
+}
+
+static std::string command(const std::vector<std::string> &args)
+{
+    std::string text = "*" + std::to_string(args.size()) + "\r\n";
+    for (const std::string &arg : args)
+        text += "$" + std::to_string(arg.size()) + "\r\n" + arg + "\r\n";
+    return text;
+}
+
+static void test_pipeline()
+{
+    const std::vector<std::vector<std::string>> commands = {
+        {"SET", "key", "value"}, {"GET", "key"}, {"PING"}, {"SET", "bin", std::string("a\r\n\0b", 5)}, {"ECHO", ""}};
+    std::string text;
+    for (const auto &args : commands)
+        text += command(args);
+    IOBuffer buffer = buffer_of(text);
+
+    size_t start = 0;
+    for (const auto &args : commands)
+    {
+        RESPRequest request = RESPHandler::parse_request(buffer, start);
+        CHECK(request.status == ParseStatus::SUCCESS);
+        CHECK(request.args == args);
+        CHECK(request.parsed_bytes == command(args).size());
+        start += request.parsed_bytes;
+    }
+    CHECK(start == buffer.size());
+    CHECK(RESPHandler::parse_request(buffer, start).status == ParseStatus::PARTIAL);
+}
+
+static void test_partial_tail()
+{
+    // The last request of a read is often cut short: every prefix of it is PARTIAL, and
+    // the requests before it parse the same either way
+    std::string first = command({"SET", "a", "1"});
+    std::string second = command({"SET", "somewhat longer key", "and a value"});
+    for (size_t cut = 0; cut < second.size(); cut++)
+    {
+        IOBuffer buffer = buffer_of(first + second.substr(0, cut));
+        RESPRequest request = RESPHandler::parse_request(buffer, 0);
+        CHECK(request.status == ParseStatus::SUCCESS);
+        CHECK(request.parsed_bytes == first.size());
+        CHECK(RESPHandler::parse_request(buffer, first.size()).status == ParseStatus::PARTIAL);
+    }
+    IOBuffer buffer = buffer_of(first + second);
+    RESPRequest request = RESPHandler::parse_request(buffer, first.size());
+    CHECK(request.status == ParseStatus::SUCCESS);
+    CHECK(request.parsed_bytes == second.size());
+    CHECK(request.args[1] == "somewhat longer key");
+}
+
+static void test_bytes_before_start()
+{
+    // Whatever lies before start has been consumed already and is never looked at
+    std::string junk = "not RESP at all \r\n$$$";
+    std::string text = junk + command({"GET", "k"});
+    IOBuffer buffer = buffer_of(text);
+    CHECK(RESPHandler::parse_request(buffer, 0).status == ParseStatus::ERROR);
+    RESPRequest request = RESPHandler::parse_request(buffer, junk.size());
+    CHECK(request.status == ParseStatus::SUCCESS);
+    CHECK(request.args == std::vector<std::string>({"GET", "k"}));
+    CHECK(request.parsed_bytes == text.size() - junk.size());
+}
+
+static void test_errors()
+{
+    // Malformed requests right behind a good one: inline, wrong type, bad lengths
+    for (const char *text : {"GET k\r\n", "*2\r\n+GET\r\n$1\r\nk\r\n", "*1\r\n$-5\r\n", "*1025\r\n", "*x\r\n"})
+    {
+        IOBuffer buffer = buffer_of(command({"PING"}) + text);
+        CHECK(RESPHandler::parse_request(buffer, 0).status == ParseStatus::SUCCESS);
+        CHECK(RESPHandler::parse_request(buffer, strlen("*1\r\n$4\r\nPING\r\n")).status == ParseStatus::ERROR);
+    }
+}
+
+int main()
+{
+    test_pipeline();
+    test_partial_tail();
+    test_bytes_before_start();
+    test_errors();
+    return 0;
+}
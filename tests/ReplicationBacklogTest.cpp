@@ -0,0 +1,114 @@
+#include "Replication.hpp"
+#include "Check.hpp"
+#include <random>
+
+// PSYNC offsets: the first byte of the stream is offset 1, a replica asks for the byte
+// right after the last one it applied, and only what is still in the ring can be served.
+
+static void test_empty()
+{
+    ReplicationBacklog backlog(16);
+    CHECK(backlog.end_offset() == 0);
+    CHECK(backlog.first_offset() == 1);
+    // Nothing is missing for a replica that is caught up
+    CHECK(backlog.can_serve_from(1));
+    CHECK(!backlog.can_serve_from(2));
+    CHECK(backlog.copy_from(1).empty());
+}
+
+static void test_offsets()
+{
+    ReplicationBacklog backlog(16);
+    backlog.append("hello");
+    CHECK(backlog.end_offset() == 5);
+    CHECK(backlog.first_offset() == 1);
+    CHECK(!backlog.can_serve_from(0));
+    CHECK(backlog.can_serve_from(1));
+    CHECK(backlog.can_serve_from(6));
+    CHECK(!backlog.can_serve_from(7));
+    CHECK(backlog.copy_from(1) == "hello");
+    CHECK(backlog.copy_from(3) == "llo");
+    CHECK(backlog.copy_from(6).empty());
+}
+
+static void test_wrap_around()
+{
+    ReplicationBacklog backlog(16);
+    backlog.append("0123456789");
+    backlog.append("abcdefghij");
+    // 20 bytes went through a ring of 16: offsets 1 to 4 are gone
+    CHECK(backlog.end_offset() == 20);
+    CHECK(backlog.size() == 16);
+    CHECK(backlog.first_offset() == 5);
+    CHECK(!backlog.can_serve_from(4));
+    CHECK(backlog.can_serve_from(5));
+    CHECK(backlog.copy_from(5) == "456789abcdefghij");
+    CHECK(backlog.copy_from(15) == "efghij");
+}
+
+static void test_append_larger_than_ring()
+{
+    ReplicationBacklog backlog(8);
+    backlog.append("xyz");
+    backlog.append("ABCDEFGHIJKLMNOPQRST");
+    CHECK(backlog.end_offset() == 23);
+    CHECK(backlog.first_offset() == 16);
+    CHECK(backlog.copy_from(16) == "MNOPQRST");
+    backlog.append("uv");
+    CHECK(backlog.copy_from(18) == "OPQRSTuv");
+}
+
+static void test_reset()
+{
+    // A new replication ID continues from the offset reached under the old one
+    ReplicationBacklog backlog(16);
+    backlog.append("old stream");
+    backlog.reset(100);
+    CHECK(backlog.end_offset() == 100);
+    CHECK(backlog.size() == 0);
+    CHECK(!backlog.can_serve_from(100));
+    CHECK(backlog.can_serve_from(101));
+    backlog.append("ab");
+    CHECK(backlog.first_offset() == 101);
+    CHECK(backlog.copy_from(101) == "ab");
+}
+
+static void test_random_appends()
+{
+    // Whatever the sizes of the appends, every servable offset gives the stream's tail
+    const size_t capacity = 100;
+    ReplicationBacklog backlog(capacity);
+    std::string stream;
+    std::mt19937 random(7);
+    for (int round = 0; round < 2000; round++)
+    {
+        std::string data(random() % 150, '\0');
+        for (char &c : data)
+            c = (char)('a' + random() % 26);
+        backlog.append(data);
+        stream += data;
+
+        long long end = (long long)stream.size();
+        CHECK(backlog.end_offset() == end);
+        CHECK(backlog.size() == std::min(stream.size(), capacity));
+        long long first = backlog.first_offset();
+        CHECK(!backlog.can_serve_from(first - 1));
+        CHECK(!backlog.can_serve_from(end + 2));
+        for (long long offset = first; offset <= end + 1; offset += 7)
+        {
+            CHECK(backlog.can_serve_from(offset));
+            CHECK(backlog.copy_from(offset) == stream.substr(offset - 1));
+        }
+    }
+}
+
+int main()
+{
+    test_empty();
+    test_offsets();
+    test_wrap_around();
+    test_append_larger_than_ring();
+    test_reset();
+    test_random_appends();
+    return 0;
+}
@@ -0,0 +1,107 @@
+#include "TimingWheel.hpp"
+#include "Check.hpp"
+#include <map>
+
+// Timers on every level of the wheel have to come down through the cascades and fire on
+// their tick: never early, and at most one tick late (deadlines are rounded up to a tick,
+// and the wheel's clock started a little before the test's).
+
+typedef TimingWheel<int>::Clock Clock;
+static const Clock::duration TICK = std::chrono::seconds(1);
+
+static void test_cascading()
+{
+    TimingWheel<int> wheel(TICK);
+    Clock::time_point start = Clock::now();
+
+    // Level 0 covers 64 ticks, level 1 64 * 64, level 2 64^3: deadlines on each side of
+    // every boundary
+    const int deadlines[] = {1, 2, 63, 64, 65, 127, 128, 4095, 4096, 4097, 8191, 8193,
+                             100000, 262143, 262144, 262145, 1000000};
+    std::map<int, int> fired_at;
+    for (int deadline : deadlines)
+        wheel.schedule(start + deadline * TICK, deadline);
+    CHECK(wheel.size() == sizeof(deadlines) / sizeof(deadlines[0]));
+
+    for (int now = 1; now <= 1000001; now++)
+    {
+        wheel.advance(start + now * TICK, [&](int deadline)
+                      { fired_at[deadline] = now; });
+    }
+    CHECK(wheel.size() == 0);
+    for (int deadline : deadlines)
+    {
+        CHECK(fired_at.count(deadline) == 1);
+        CHECK(fired_at[deadline] >= deadline);
+        CHECK(fired_at[deadline] <= deadline + 1);
+    }
+}
+
+static void test_jump()
+{
+    // One advance far into the future fires everything that is due, and nothing else
+    TimingWheel<int> wheel(TICK);
+    Clock::time_point start = Clock::now();
+    for (int deadline = 1; deadline <= 20000; deadline += 13)
+        wheel.schedule(start + deadline * TICK, deadline);
+
+    size_t scheduled = wheel.size();
+    size_t fired = 0;
+    wheel.advance(start + 10000 * TICK, [&](int deadline)
+                  {
+                      CHECK(deadline <= 10000);
+                      fired++; });
+    CHECK(fired > 0);
+    CHECK(wheel.size() == scheduled - fired);
+    wheel.advance(start + 20001 * TICK, [&](int deadline)
+                  {
+                      CHECK(deadline > 9999);
+                      fired++; });
+    CHECK(fired == scheduled);
+    CHECK(wheel.size() == 0);
+}
+
+static void test_past_and_far_deadlines()
+{
+    TimingWheel<int> wheel(TICK);
+    Clock::time_point start = Clock::now();
+
+    // A deadline already passed fires on the next tick
+    wheel.schedule(start - 10 * TICK, 1);
+    int fired = 0;
+    wheel.advance(start + TICK, [&](int item)
+                  { fired += item; });
+    CHECK(fired == 1);
+
+    // Beyond what the top level reaches (64^4 ticks) it is clamped, never dropped
+    wheel.schedule(start + 100000000 * TICK, 2);
+    wheel.advance(start + 16777216 * TICK, [&](int item)
+                  { fired += item; });
+    CHECK(fired == 3);
+}
+
+static void test_next_deadline()
+{
+    TimingWheel<int> wheel(TICK);
+    Clock::time_point start = Clock::now();
+    CHECK(!wheel.next_deadline());
+
+    // Never later than the timer, so a poll() timeout from it can't make it late
+    wheel.schedule(start + 10 * TICK, 1);
+    CHECK(wheel.next_deadline() && *wheel.next_deadline() <= start + 11 * TICK);
+    CHECK(*wheel.next_deadline() > start);
+
+    // A far timer: the wheel still wants to wake up for the cascade that brings it down
+    TimingWheel<int> far(TICK);
+    far.schedule(start + 5000 * TICK, 1);
+    CHECK(far.next_deadline() && *far.next_deadline() <= start + 65 * TICK);
+}
+
+int main()
+{
+    test_cascading();
+    test_jump();
+    test_past_and_far_deadlines();
+    test_next_deadline();
+    return 0;
+}